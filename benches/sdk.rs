@@ -0,0 +1,205 @@
+//! Benchmark of the sdk core, without the C ABI or the bindings
+//!
+//! Runs the workloads of the C++ and Python drivers on an sdk instance and
+//! prints their latency percentiles and throughput as json. The sdk config is
+//! read from `DATENLORD_BENCH_CONFIG`, the results are also written to the
+//! file named by `DATENLORD_BENCH_OUT` when set. `DATENLORD_BENCH_LARGE_MB`
+//! sets the size of the large file, 256 MiB by default.
+
+use std::sync::Arc;
+use std::time::{Duration, Instant};
+
+use datenlord::sdk::config::SdkConfig;
+use datenlord::sdk::ops::{self, SdkFs};
+use nix::fcntl::OFlag;
+use serde_json::{json, Value};
+use tokio::runtime::Runtime;
+
+/// Directory of the bench files, below the root of the backend
+const DIR: &str = "datenlord_bench";
+const SMALL_FILES: usize = 1000;
+const SMALL_SIZE: usize = 4096;
+const LARGE_CHUNK: usize = 4 * 1024 * 1024;
+const RANDOM_READS: usize = 20000;
+const SCALING_OPS: usize = 20000;
+const SCALING_THREADS: [usize; 5] = [1, 2, 4, 8, 16];
+
+/// Timings of one workload
+struct Sample {
+    name: &'static str,
+    threads: usize,
+    bytes: u64,
+    elapsed: Duration,
+    latencies: Vec<Duration>,
+}
+
+impl Sample {
+    fn to_json(&mut self) -> Value {
+        self.latencies.sort_unstable();
+        let percentile = |p: f64| {
+            let index = ((self.latencies.len() as f64 * p) as usize).min(self.latencies.len().saturating_sub(1));
+            self.latencies.get(index).map_or(0.0, |d| d.as_secs_f64() * 1e6)
+        };
+        let seconds = self.elapsed.as_secs_f64();
+        let ops = self.latencies.len();
+        json!({
+            "name": self.name,
+            "threads": self.threads,
+            "ops": ops,
+            "bytes": self.bytes,
+            "seconds": seconds,
+            "ops_per_sec": ops as f64 / seconds,
+            "gb_per_sec": self.bytes as f64 / seconds / 1e9,
+            "latency_us": {
+                "p50": percentile(0.5),
+                "p90": percentile(0.9),
+                "p99": percentile(0.99),
+                "p999": percentile(0.999),
+                "max": percentile(1.0),
+            },
+        })
+    }
+}
+
+/// Run `op` `count` times in a row and time every call
+fn run<F>(name: &'static str, count: usize, mut op: F) -> Sample
+where
+    F: FnMut(usize) -> usize,
+{
+    let mut latencies = Vec::with_capacity(count);
+    let mut bytes = 0;
+    let start = Instant::now();
+    for i in 0..count {
+        let call = Instant::now();
+        bytes += op(i) as u64;
+        latencies.push(call.elapsed());
+    }
+    Sample {
+        name,
+        threads: 1,
+        bytes,
+        elapsed: start.elapsed(),
+        latencies,
+    }
+}
+
+fn small_path(i: usize) -> String {
+    format!("{DIR}/small_{i}")
+}
+
+fn main() {
+    let config = SdkConfig::parse(&std::env::var("DATENLORD_BENCH_CONFIG").unwrap_or_else(|_| "{}".to_owned()));
+    let large_bytes = std::env::var("DATENLORD_BENCH_LARGE_MB")
+        .ok()
+        .and_then(|mb| mb.parse::<usize>().ok())
+        .unwrap_or(256)
+        * 1024
+        * 1024;
+    let runtime: Runtime = config.build_runtime().expect("failed to build the sdk runtime");
+    let backend = config.backend.build().expect("failed to build the sdk backend");
+    let fs = Arc::new(SdkFs::new(backend, &config));
+
+    // The bench files are left behind, so their directory may exist already
+    let _ = runtime.block_on(ops::mkdir(&fs, DIR));
+    let mut samples = Vec::new();
+
+    let content = vec![b'x'; SMALL_SIZE];
+    samples.push(run("small_write", SMALL_FILES, |i| {
+        let path = small_path(i);
+        let _ = runtime.block_on(ops::create_file(&fs, &path));
+        runtime.block_on(ops::write_file(&fs, &path, &content)).expect("small write failed");
+        SMALL_SIZE
+    }));
+    samples.push(run("small_stat", SMALL_FILES, |i| {
+        runtime.block_on(ops::stat(&fs, &small_path(i))).expect("small stat failed");
+        0
+    }));
+    let mut buffer = vec![0; SMALL_SIZE];
+    samples.push(run("small_read", SMALL_FILES, |i| {
+        runtime.block_on(ops::read_file(&fs, &small_path(i), &mut buffer)).expect("small read failed")
+    }));
+
+    let large = format!("{DIR}/large");
+    let chunks = large_bytes.div_ceil(LARGE_CHUNK);
+    let chunk = vec![b'y'; LARGE_CHUNK];
+    let _ = runtime.block_on(ops::create_file(&fs, &large));
+    let flags = (OFlag::O_WRONLY | OFlag::O_TRUNC).bits() as u32;
+    let handle = runtime.block_on(ops::open_file(&fs, &large, flags)).expect("failed to open the large file");
+    samples.push(run("large_write", chunks, |i| {
+        let offset = (i * LARGE_CHUNK) as u64;
+        runtime.block_on(ops::pwrite(&fs, &handle, offset, &chunk)).expect("large write failed");
+        LARGE_CHUNK
+    }));
+    runtime.block_on(ops::close_file(&fs, &handle)).expect("failed to close the large file");
+
+    let handle = runtime.block_on(ops::open_file(&fs, &large, OFlag::O_RDONLY.bits() as u32)).expect("open failed");
+    let mut buffer = vec![0; LARGE_CHUNK];
+    samples.push(run("large_read", chunks, |i| {
+        let offset = (i * LARGE_CHUNK) as u64;
+        runtime.block_on(ops::pread(&fs, &handle, offset, &mut buffer)).expect("large read failed")
+    }));
+    let mut buffer = vec![0; SMALL_SIZE];
+    let blocks = (chunks * LARGE_CHUNK / SMALL_SIZE) as u64;
+    // A fixed linear congruential sequence, the same offsets on every run
+    let mut state = 0x2545_f491_4f6c_dd1d_u64;
+    samples.push(run("random_pread", RANDOM_READS, |_| {
+        state = state.wrapping_mul(6_364_136_223_846_793_005).wrapping_add(1_442_695_040_888_963_407);
+        let offset = (state >> 33) % blocks * SMALL_SIZE as u64;
+        runtime.block_on(ops::pread(&fs, &handle, offset, &mut buffer)).expect("random pread failed")
+    }));
+    runtime.block_on(ops::close_file(&fs, &handle)).expect("failed to close the large file");
+
+    samples.push(run("readdir", 1, |_| {
+        let mut dir = runtime.block_on(ops::opendir(&fs, DIR)).expect("opendir failed");
+        loop {
+            let page = runtime.block_on(ops::readdir_page(&fs, &mut dir)).expect("readdir failed");
+            if page.is_empty() {
+                break;
+            }
+        }
+        runtime.block_on(ops::closedir(&fs, &dir)).expect("closedir failed");
+        0
+    }));
+
+    for threads in SCALING_THREADS {
+        let start = Instant::now();
+        let latencies: Vec<Duration> = std::thread::scope(|scope| {
+            let workers: Vec<_> = (0..threads)
+                .map(|t| {
+                    let fs = &fs;
+                    let handle = runtime.handle();
+                    scope.spawn(move || {
+                        let path = small_path(t);
+                        let mut buffer = vec![0; SMALL_SIZE];
+                        let count = SCALING_OPS / threads;
+                        let mut latencies = Vec::with_capacity(count);
+                        for _ in 0..count {
+                            let call = Instant::now();
+                            handle.block_on(ops::read_file(fs, &path, &mut buffer)).expect("scaling read failed");
+                            latencies.push(call.elapsed());
+                        }
+                        latencies
+                    })
+                })
+                .collect();
+            workers.into_iter().flat_map(|worker| worker.join().unwrap()).collect()
+        });
+        samples.push(Sample {
+            name: "scaling_read",
+            threads,
+            bytes: (latencies.len() * SMALL_SIZE) as u64,
+            elapsed: start.elapsed(),
+            latencies,
+        });
+    }
+
+    let results = json!({
+        "driver": "rust",
+        "results": samples.iter_mut().map(Sample::to_json).collect::<Vec<_>>(),
+    });
+    let output = serde_json::to_string_pretty(&results).unwrap();
+    println!("{output}");
+    if let Ok(path) = std::env::var("DATENLORD_BENCH_OUT") {
+        std::fs::write(&path, output).expect("failed to write the bench results");
+    }
+}
@@ -0,0 +1,213 @@
+#include <fcntl.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "datenlord.h"
+
+// Benchmark of the C ABI, prints the latency percentiles and throughput of
+// every workload as json. Usage: bench [config] [results.json], the size of
+// the large file is DATENLORD_BENCH_LARGE_MB, 256 MiB by default.
+#define BENCH_DIR "datenlord_bench"
+#define SMALL_FILES 1000
+#define SMALL_SIZE 4096
+#define LARGE_CHUNK (4 * 1024 * 1024)
+#define RANDOM_READS 20000
+#define SCALING_OPS 20000
+
+using bench_clock = std::chrono::steady_clock;
+
+// Timings of one workload
+struct sample {
+    std::string name;
+    int threads = 1;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    std::vector<double> latencies_us;
+};
+
+static std::string small_path(int i) {
+    return std::string(BENCH_DIR) + "/small_" + std::to_string(i);
+}
+
+static double elapsed_us(bench_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(bench_clock::now() - start).count();
+}
+
+static bool check(int err, const char *what) {
+    if (err != 0) {
+        const char *message = datenlord_last_error_message();
+        fprintf(stderr, "%s failed: %d, %s\n", what, err, message != NULL ? message : strerror(err));
+    }
+    return err == 0;
+}
+
+// Run `op` `count` times in a row and time every call, `op` returns the bytes moved
+template <typename Op>
+static sample run(const char *name, int count, Op op) {
+    sample s;
+    s.name = name;
+    s.latencies_us.reserve(count);
+    auto start = bench_clock::now();
+    for (int i = 0; i < count; i++) {
+        auto call = bench_clock::now();
+        s.bytes += op(i);
+        s.latencies_us.push_back(elapsed_us(call));
+    }
+    s.seconds = elapsed_us(start) / 1e6;
+    return s;
+}
+
+static std::string to_json(sample &s) {
+    std::sort(s.latencies_us.begin(), s.latencies_us.end());
+    auto percentile = [&](double p) {
+        if (s.latencies_us.empty()) {
+            return 0.0;
+        }
+        size_t index = std::min((size_t)(s.latencies_us.size() * p), s.latencies_us.size() - 1);
+        return s.latencies_us[index];
+    };
+    size_t ops = s.latencies_us.size();
+    char json[512];
+    snprintf(json, sizeof(json),
+             "{\"name\": \"%s\", \"threads\": %d, \"ops\": %zu, \"bytes\": %llu, \"seconds\": %.6f, "
+             "\"ops_per_sec\": %.1f, \"gb_per_sec\": %.6f, \"latency_us\": {\"p50\": %.2f, \"p90\": %.2f, "
+             "\"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f}}",
+             s.name.c_str(), s.threads, ops, (unsigned long long)s.bytes, s.seconds, ops / s.seconds,
+             s.bytes / s.seconds / 1e9, percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999),
+             percentile(1.0));
+    return json;
+}
+
+int main(int argc, char **argv) {
+    const char *config = argc > 1 ? argv[1] : "{}";
+    const char *out_path = argc > 2 ? argv[2] : NULL;
+    const char *large_mb = getenv("DATENLORD_BENCH_LARGE_MB");
+    size_t large_bytes = (large_mb != NULL ? strtoull(large_mb, NULL, 10) : 256) * 1024 * 1024;
+
+    datenlord_sdk *sdk = init(config);
+    if (sdk == NULL) {
+        printf("Failed to initialize SDK\n");
+        return 1;
+    }
+    // The bench files are left behind, so their directory may exist already
+    datenlord_mkdir(sdk, BENCH_DIR);
+    std::vector<sample> samples;
+
+    std::vector<uint8_t> content(SMALL_SIZE, 'x');
+    samples.push_back(run("small_write", SMALL_FILES, [&](int i) -> uint64_t {
+        std::string path = small_path(i);
+        create_file(sdk, path.c_str());
+        datenlord_bytes bytes = { content.data(), content.size() };
+        return check(write_file(sdk, path.c_str(), bytes), "small write") ? SMALL_SIZE : 0;
+    }));
+    samples.push_back(run("small_stat", SMALL_FILES, [&](int i) -> uint64_t {
+        datenlord_file_stat file_stat;
+        check(datenlord_stat(sdk, small_path(i).c_str(), &file_stat), "small stat");
+        return 0;
+    }));
+    std::vector<uint8_t> buffer(LARGE_CHUNK);
+    samples.push_back(run("small_read", SMALL_FILES, [&](int i) -> uint64_t {
+        datenlord_bytes out = { buffer.data(), SMALL_SIZE };
+        return check(read_file(sdk, small_path(i).c_str(), &out), "small read") ? out.len : 0;
+    }));
+
+    std::string large = std::string(BENCH_DIR) + "/large";
+    int chunks = (int)((large_bytes + LARGE_CHUNK - 1) / LARGE_CHUNK);
+    std::vector<uint8_t> chunk(LARGE_CHUNK, 'y');
+    create_file(sdk, large.c_str());
+    datenlord_file *file = NULL;
+    if (!check(datenlord_open(sdk, large.c_str(), O_WRONLY | O_TRUNC, &file), "open large file")) {
+        free_sdk(sdk);
+        return 1;
+    }
+    samples.push_back(run("large_write", chunks, [&](int i) -> uint64_t {
+        datenlord_bytes bytes = { chunk.data(), chunk.size() };
+        return check(datenlord_pwrite(sdk, file, (uint64_t)i * LARGE_CHUNK, bytes), "large write") ? LARGE_CHUNK : 0;
+    }));
+    check(datenlord_close(sdk, file), "close large file");
+
+    if (!check(datenlord_open(sdk, large.c_str(), O_RDONLY, &file), "open large file")) {
+        free_sdk(sdk);
+        return 1;
+    }
+    samples.push_back(run("large_read", chunks, [&](int i) -> uint64_t {
+        datenlord_bytes out = { buffer.data(), LARGE_CHUNK };
+        return check(datenlord_pread(sdk, file, (uint64_t)i * LARGE_CHUNK, &out), "large read") ? out.len : 0;
+    }));
+    // A fixed linear congruential sequence, the same offsets on every run
+    uint64_t blocks = (uint64_t)chunks * LARGE_CHUNK / SMALL_SIZE;
+    uint64_t state = 0x2545f4914f6cdd1dULL;
+    samples.push_back(run("random_pread", RANDOM_READS, [&](int) -> uint64_t {
+        state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+        datenlord_bytes out = { buffer.data(), SMALL_SIZE };
+        uint64_t offset = (state >> 33) % blocks * SMALL_SIZE;
+        return check(datenlord_pread(sdk, file, offset, &out), "random pread") ? out.len : 0;
+    }));
+    check(datenlord_close(sdk, file), "close large file");
+
+    samples.push_back(run("readdir", 1, [&](int) -> uint64_t {
+        datenlord_dir *dir = NULL;
+        if (!check(datenlord_opendir(sdk, BENCH_DIR, false, &dir), "opendir")) {
+            return 0;
+        }
+        datenlord_dirent entries[256];
+        uintptr_t count = 0;
+        while (check(datenlord_readdir_next(sdk, dir, entries, 256, &count), "readdir") && count > 0) {
+        }
+        check(datenlord_closedir(sdk, dir), "closedir");
+        return 0;
+    }));
+
+    // Multi-threaded scaling, every thread reads its own file
+    for (int threads : { 1, 2, 4, 8, 16 }) {
+        std::vector<std::vector<double>> latencies(threads);
+        auto start = bench_clock::now();
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                std::string path = small_path(t);
+                std::vector<uint8_t> buffer(SMALL_SIZE);
+                for (int i = 0; i < SCALING_OPS / threads; i++) {
+                    auto call = bench_clock::now();
+                    datenlord_bytes out = { buffer.data(), SMALL_SIZE };
+                    check(read_file(sdk, path.c_str(), &out), "scaling read");
+                    latencies[t].push_back(elapsed_us(call));
+                }
+            });
+        }
+        for (std::thread &worker : workers) {
+            worker.join();
+        }
+        sample s;
+        s.name = "scaling_read";
+        s.threads = threads;
+        s.seconds = elapsed_us(start) / 1e6;
+        for (const std::vector<double> &thread_latencies : latencies) {
+            s.latencies_us.insert(s.latencies_us.end(), thread_latencies.begin(), thread_latencies.end());
+        }
+        s.bytes = (uint64_t)s.latencies_us.size() * SMALL_SIZE;
+        samples.push_back(s);
+    }
+    free_sdk(sdk);
+
+    std::string results = "{\"driver\": \"c\", \"results\": [";
+    for (size_t i = 0; i < samples.size(); i++) {
+        results += (i == 0 ? "\n  " : ",\n  ") + to_json(samples[i]);
+    }
+    results += "\n]}\n";
+    fputs(results.c_str(), stdout);
+    if (out_path != NULL) {
+        FILE *fp = fopen(out_path, "w");
+        if (fp == NULL) {
+            fprintf(stderr, "Failed to write %s\n", out_path);
+            return 1;
+        }
+        fputs(results.c_str(), fp);
+        fclose(fp);
+    }
+    return 0;
+}
@@ -1,14 +1,15 @@
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "datenlord.h"
 
 
-// Utils functions to free current error
-void handle_error(datenlord_error *err) {
-    if (err != NULL) {
-        printf("Error code: %d, message: %.*s\n", err->code, (int)err->message.len, (const char*)err->message.data);
-        free(err);
+// Utils functions to print the last error
+void handle_error(int err) {
+    if (err != 0) {
+        const char *message = datenlord_last_error_message();
+        printf("Error code: %d, message: %s\n", err, message != NULL ? message : strerror(err));
     }
 }
 
@@ -26,8 +27,8 @@ int main() {
     printf("Directory exists: %d\n", dir_exists);
 
     // Mkdir /example_dir
-    datenlord_error* err = mkdir(sdk, "example_dir/");
-    if (err == NULL) {
+    int err = datenlord_mkdir(sdk, "example_dir/");
+    if (err == 0) {
         printf("Directory created successfully\n");
     } else {
         handle_error(err);
@@ -35,7 +36,7 @@ int main() {
 
     // Create file
     err = create_file(sdk, "/example_dir/example_file.txt");
-    if (err == NULL) {
+    if (err == 0) {
         printf("File created successfully\n");
     } else {
         handle_error(err);
@@ -46,7 +47,7 @@ int main() {
     const char* file_content = "Hello, Datenlord!";
     datenlord_bytes content = { (const uint8_t*)file_content, strlen(file_content) };
     err = write_file(sdk, file_path, content);
-    if (err == NULL) {
+    if (err == 0) {
         printf("File written successfully\n");
     } else {
         handle_error(err);
@@ -61,22 +62,60 @@ int main() {
     }
     datenlord_bytes out_content = { buffer, buffer_size };
     err = read_file(sdk, file_path, &out_content);
-    if (err == NULL) {
+    if (err == 0) {
         printf("File read successfully: %.*s\n", (int)out_content.len, (const char*)out_content.data);
     } else {
         handle_error(err);
     }
 
+    // Read file asynchronously, wait for the completion on the queue eventfd
+    datenlord_cq *cq = datenlord_cq_new();
+    datenlord_bytes async_content = { buffer, buffer_size };
+    datenlord_async_handler handler = { NULL, cq, (void *)file_path };
+    err = read_file_async(sdk, file_path, async_content, handler);
+    if (err == 0) {
+        struct pollfd pfd = { datenlord_cq_fd(cq), POLLIN, 0 };
+        datenlord_completion completion;
+        while (datenlord_cq_poll(cq, &completion, 1) == 0) {
+            poll(&pfd, 1, -1);
+        }
+        if (completion.code == 0) {
+            printf("File read asynchronously: %zu bytes\n", completion.size);
+        } else {
+            // The message stays on the runtime thread, only the code is posted
+            printf("Error code: %d, message: %s\n", completion.code, strerror(completion.code));
+        }
+    } else {
+        handle_error(err);
+    }
+    datenlord_cq_free(cq);
+
+    // Read into a registered buffer, repeated reads need no allocation
+    datenlord_bytes registered = { NULL, buffer_size };
+    err = datenlord_register_buffers(sdk, &registered, 1);
+    if (err == 0) {
+        size_t read = 0;
+        err = datenlord_read_file_fixed(sdk, file_path, 0, 0, &read);
+        if (err == 0) {
+            printf("File read into registered buffer: %.*s\n", (int)read, (const char*)registered.data);
+        } else {
+            handle_error(err);
+        }
+        datenlord_unregister_buffers(sdk);
+    } else {
+        handle_error(err);
+    }
+
     // Stat file
     datenlord_file_stat file_stat;
-    err = stat(sdk, "/example_dir/renamed_file.txt", &file_stat);
-    if (err == NULL) {
+    err = datenlord_stat(sdk, "/example_dir/renamed_file.txt", &file_stat);
+    if (err == 0) {
         printf("File stat: %ld %d %d %d %d %d %d %d %d %d %d\n", file_stat.blocks, file_stat.gid, file_stat.ino, file_stat.nlink, file_stat.perm, file_stat.rdev, file_stat.size, file_stat.uid);
     }
 
     // Rename file
     err = rename_path(sdk, "/example_dir/example_file.txt", "/example_dir/renamed_file.txt");
-    if (err == NULL) {
+    if (err == 0) {
         printf("File renamed successfully\n");
     } else {
         handle_error(err);
@@ -84,7 +123,7 @@ int main() {
 
     // Delete dir
     err = deldir(sdk, "/example_dir", 1);
-    if (err == NULL) {
+    if (err == 0) {
         printf("Directory deleted successfully\n");
     } else {
         handle_error(err);
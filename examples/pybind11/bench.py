@@ -0,0 +1,167 @@
+"""Benchmark of the pybind11 bindings
+
+Runs the workloads of the C++ driver through the bindings, with the GIL
+released during every sdk call, and prints the latency percentiles and
+throughput of each as json.
+
+    python3 bench.py [--config CONFIG] [--out results.json] [--large-mb 256]
+"""
+
+import argparse
+import json
+import os
+import threading
+import time
+
+import datenlord
+
+BENCH_DIR = "datenlord_bench"
+SMALL_FILES = 1000
+SMALL_SIZE = 4096
+LARGE_CHUNK = 4 * 1024 * 1024
+RANDOM_READS = 20000
+SCALING_OPS = 20000
+SCALING_THREADS = [1, 2, 4, 8, 16]
+
+
+def small_path(i):
+    return f"{BENCH_DIR}/small_{i}"
+
+
+def check(result, what):
+    if result != "Success":
+        raise RuntimeError(f"{what} failed: {result}")
+
+
+def sample(name, latencies, seconds, nbytes, threads=1):
+    latencies = sorted(latencies)
+
+    def percentile(p):
+        if not latencies:
+            return 0.0
+        return latencies[min(int(len(latencies) * p), len(latencies) - 1)] * 1e6
+
+    return {
+        "name": name,
+        "threads": threads,
+        "ops": len(latencies),
+        "bytes": nbytes,
+        "seconds": seconds,
+        "ops_per_sec": len(latencies) / seconds,
+        "gb_per_sec": nbytes / seconds / 1e9,
+        "latency_us": {
+            "p50": percentile(0.5),
+            "p90": percentile(0.9),
+            "p99": percentile(0.99),
+            "p999": percentile(0.999),
+            "max": percentile(1.0),
+        },
+    }
+
+
+def run(name, count, op):
+    """Run `op(i)` `count` times in a row and time every call, `op` returns the bytes moved"""
+    latencies = []
+    nbytes = 0
+    start = time.perf_counter()
+    for i in range(count):
+        call = time.perf_counter()
+        nbytes += op(i)
+        latencies.append(time.perf_counter() - call)
+    return sample(name, latencies, time.perf_counter() - start, nbytes)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--config", default="{}", help="sdk config passed to init")
+    parser.add_argument("--out", help="file to write the results to")
+    parser.add_argument("--large-mb", type=int, default=256, help="size of the large file in MiB")
+    args = parser.parse_args()
+
+    sdk = datenlord.init(args.config)
+    if sdk is None:
+        raise SystemExit("Failed to initialize SDK")
+    # The bench files are left behind, so their directory may exist already
+    datenlord.mkdir(sdk, BENCH_DIR)
+    results = []
+
+    content = memoryview(b"x" * SMALL_SIZE)
+
+    def small_write(i):
+        datenlord.create_file(sdk, small_path(i))
+        check(datenlord.write_file(sdk, small_path(i), content), "small write")
+        return SMALL_SIZE
+
+    results.append(run("small_write", SMALL_FILES, small_write))
+    results.append(run("small_stat", SMALL_FILES, lambda i: datenlord.stat(sdk, small_path(i)) and 0))
+    buffer = bytearray(LARGE_CHUNK)
+    small = memoryview(buffer)[:SMALL_SIZE]
+    results.append(run("small_read", SMALL_FILES, lambda i: datenlord.read_into(sdk, small_path(i), small)))
+
+    large = f"{BENCH_DIR}/large"
+    chunks = (args.large_mb * 1024 * 1024 + LARGE_CHUNK - 1) // LARGE_CHUNK
+    chunk = memoryview(b"y" * LARGE_CHUNK)
+    datenlord.create_file(sdk, large)
+    file = datenlord.open(sdk, large, os.O_WRONLY | os.O_TRUNC)
+
+    def large_write(i):
+        check(datenlord.pwrite(sdk, file, i * LARGE_CHUNK, chunk), "large write")
+        return LARGE_CHUNK
+
+    results.append(run("large_write", chunks, large_write))
+    check(datenlord.close(sdk, file), "close large file")
+
+    file = datenlord.open(sdk, large, os.O_RDONLY)
+    results.append(run("large_read", chunks, lambda i: datenlord.read_into(sdk, file, buffer, i * LARGE_CHUNK)))
+    # A fixed linear congruential sequence, the same offsets on every run
+    blocks = chunks * LARGE_CHUNK // SMALL_SIZE
+    state = 0x2545F4914F6CDD1D
+
+    def random_pread(_):
+        nonlocal state
+        state = (state * 6364136223846793005 + 1442695040888963407) % (1 << 64)
+        return datenlord.read_into(sdk, file, small, (state >> 33) % blocks * SMALL_SIZE)
+
+    results.append(run("random_pread", RANDOM_READS, random_pread))
+    check(datenlord.close(sdk, file), "close large file")
+
+    def readdir(_):
+        directory = datenlord.opendir(sdk, BENCH_DIR)
+        while datenlord.readdir_next(sdk, directory, 1024):
+            pass
+        check(datenlord.closedir(sdk, directory), "closedir")
+        return 0
+
+    results.append(run("readdir", 1, readdir))
+
+    # Multi-threaded scaling, every thread reads its own file
+    for threads in SCALING_THREADS:
+        latencies = [[] for _ in range(threads)]
+
+        def worker(t):
+            out = bytearray(SMALL_SIZE)
+            for _ in range(SCALING_OPS // threads):
+                call = time.perf_counter()
+                datenlord.read_into(sdk, small_path(t), out)
+                latencies[t].append(time.perf_counter() - call)
+
+        workers = [threading.Thread(target=worker, args=(t,)) for t in range(threads)]
+        start = time.perf_counter()
+        for thread in workers:
+            thread.start()
+        for thread in workers:
+            thread.join()
+        seconds = time.perf_counter() - start
+        merged = [latency for thread_latencies in latencies for latency in thread_latencies]
+        results.append(sample("scaling_read", merged, seconds, len(merged) * SMALL_SIZE, threads))
+    datenlord.free_sdk(sdk)
+
+    output = json.dumps({"driver": "python", "results": results}, indent=2)
+    print(output)
+    if args.out:
+        with open(args.out, "w") as f:
+            f.write(output)
+
+
+if __name__ == "__main__":
+    main()
@@ -13,25 +13,22 @@ constexpr static const uint64_t ROOT_ID = 1;
 /// TODO: add a feature flag to control this
 constexpr static const bool NEED_CHECK_PERM = false;
 
-template<typename T = void>
-struct Arc;
+/// Pollable completion queue backed by an eventfd
+struct datenlord_cq;
 
-struct LocalFS;
+/// An open directory, created by `datenlord_opendir` and released by `datenlord_closedir`
+struct datenlord_dir;
 
-struct datenlord_sdk {
-  Arc<Mutex<LocalFS>> localfs;
-};
+/// An open file, created by `datenlord_open` and released by `datenlord_close`
+struct datenlord_file;
+
+struct datenlord_sdk;
 
 struct datenlord_bytes {
   const uint8_t *data;
   uintptr_t len;
 };
 
-struct datenlord_error {
-  unsigned int code;
-  datenlord_bytes message;
-};
-
 /// The type of i-number
 using INum = uint64_t;
 
@@ -55,37 +52,317 @@ struct datenlord_file_stat {
   uint32_t rdev;
 };
 
+/// A directory entry returned by `datenlord_readdir_next`
+struct datenlord_dirent {
+  /// Inode number
+  INum ino;
+  /// File type, the `S_IFMT` bits of the mode
+  uint32_t kind;
+  /// Entry name, not nul terminated, valid until the next call on the directory
+  datenlord_bytes name;
+  /// Whether `stat` is filled, only for directories opened with `plus`
+  bool has_stat;
+  /// Attributes of the entry
+  datenlord_file_stat stat;
+};
+
+/// Counters of the block read cache
+struct datenlord_cache_stats {
+  /// Blocks served from the cache
+  uint64_t hits;
+  /// Blocks read from the filesystem
+  uint64_t misses;
+  /// Blocks evicted to stay within the budget
+  uint64_t evictions;
+  /// Bytes of the cached blocks
+  uint64_t bytes;
+  /// The byte budget, `block_cache_bytes` of the config
+  uint64_t capacity;
+};
+
+/// A segment of a vectored read or write
+struct datenlord_iovec {
+  /// Offset in the file
+  uint64_t offset;
+  /// The buffer of the segment
+  datenlord_bytes buf;
+};
+
+/// A read-only view of a file returned by `datenlord_mmap`
+struct datenlord_mapping {
+  /// Start of the range
+  const uint8_t *data;
+  /// Length of the range
+  uintptr_t len;
+  /// Owner of the view, released by `datenlord_munmap`
+  void *inner;
+};
+
+/// Allocate a buffer of `size` bytes for `read_file_alloc`, return null on failure
+using datenlord_alloc_fn = uint8_t*(*)(void *ctx, uintptr_t size);
+
+/// Completion callback, `code` is 0 on success and the errno of the failure otherwise
+using datenlord_callback = void(*)(void *ctx, int code, uintptr_t size);
+
+/// Where the completion of an async call is delivered
+struct datenlord_async_handler {
+  /// Invoked on a runtime worker thread when set
+  datenlord_callback callback;
+  /// Completion queue to post to when callback is not set
+  datenlord_cq *cq;
+  /// Passed back to the callback or stored in the completion
+  void *ctx;
+};
+
+/// A finished async call
+struct datenlord_completion {
+  /// The `ctx` of the handler the call was submitted with
+  void *ctx;
+  /// 0 on success, the errno of the failure otherwise
+  int code;
+  /// Bytes transferred, 0 for calls without a size
+  uintptr_t size;
+};
+
 extern "C" {
 
 datenlord_sdk *init(const char *config);
 
 void free_sdk(datenlord_sdk *sdk);
 
+/// Serve the sdk to the clients on this host through a unix socket, until
+/// `free_sdk`. Clients connect with a `daemon` backend naming the socket.
+int datenlord_serve(datenlord_sdk *sdk, const char *socket_path);
+
 bool exists(datenlord_sdk *sdk, const char *dir_path);
 
-datenlord_error *mkdir(datenlord_sdk *sdk, const char *dir_path);
+/// Create a directory
+int datenlord_mkdir(datenlord_sdk *sdk, const char *dir_path);
+
+/// Remove a directory, with everything below it when `recursive` is set
+int deldir(datenlord_sdk *sdk, const char *dir_path, bool recursive);
+
+int rename_path(datenlord_sdk *sdk, const char *src_path, const char *dest_path);
+
+int copy_from_local_file(datenlord_sdk *sdk,
+                         bool overwrite,
+                         const char *local_file_path,
+                         const char *dest_file_path);
+
+int copy_to_local_file(datenlord_sdk *sdk, const char *src_file_path, const char *local_file_path);
+
+/// Copy a regular file to `dest_path`, replacing it. The backend copies the
+/// file by itself when it can, without the data going through the sdk.
+int datenlord_copy(datenlord_sdk *sdk, const char *src_path, const char *dest_path);
+
+/// Copy a directory with everything below it to `dest_path`, which must not
+/// exist. Regular files and directories are copied, other entries skipped.
+int datenlord_copy_tree(datenlord_sdk *sdk, const char *src_path, const char *dest_path);
+
+int create_file(datenlord_sdk *sdk, const char *file_path);
+
+/// Get the attributes of a file
+int datenlord_stat(datenlord_sdk *sdk, const char *file_path, datenlord_file_stat *file_metadata);
+
+/// Stat `n` paths concurrently into `out`. When `errs` is set, `errs[i]` is
+/// 0 or the error code of `paths[i]`, otherwise any failure fails the call.
+/// Failed entries of `out` are zeroed.
+int datenlord_stat_batch(datenlord_sdk *sdk,
+                         const char *const *paths,
+                         uintptr_t n,
+                         datenlord_file_stat *out,
+                         int *errs);
+
+/// Check `n` paths concurrently, `out[i]` tells whether `paths[i]` exists
+int datenlord_exists_batch(datenlord_sdk *sdk, const char *const *paths, uintptr_t n, bool *out);
+
+int write_file(datenlord_sdk *sdk, const char *file_path, datenlord_bytes content);
+
+int read_file(datenlord_sdk *sdk, const char *file_path, datenlord_bytes *out_content);
+
+/// Read a file at offset into `out_content`, its len is set to the number of bytes read
+int read_file_at(datenlord_sdk *sdk,
+                 const char *file_path,
+                 uint64_t offset,
+                 datenlord_bytes *out_content);
+
+/// Read a whole file in one call, the buffer is taken from `alloc` once the
+/// file size is known and returned in `out_content`
+int read_file_alloc(datenlord_sdk *sdk,
+                    const char *file_path,
+                    datenlord_alloc_fn alloc,
+                    void *ctx,
+                    datenlord_bytes *out_content);
+
+/// Open a file, `flags` are the open(2) flags
+int datenlord_open(datenlord_sdk *sdk,
+                   const char *file_path,
+                   uint32_t flags,
+                   datenlord_file **out_file);
+
+/// Create a regular file with `mode` and open it, `flags` are the open(2)
+/// flags. An existing file is opened instead unless `O_EXCL` is set. When
+/// `out_stat` is set it gets the attributes of the file as it was opened.
+int datenlord_create_open(datenlord_sdk *sdk,
+                          const char *file_path,
+                          uint32_t mode,
+                          uint32_t flags,
+                          datenlord_file **out_file,
+                          datenlord_file_stat *out_stat);
+
+/// Create or replace a file with `content`, created, written and closed in one call
+int datenlord_put(datenlord_sdk *sdk, const char *file_path, datenlord_bytes content);
+
+/// Read at offset into `out_content`, its len is set to the number of bytes read
+int datenlord_pread(datenlord_sdk *sdk,
+                    datenlord_file *file,
+                    uint64_t offset,
+                    datenlord_bytes *out_content);
+
+/// Write the whole content at offset, with write-back the write is buffered
+/// and its errors are returned by the next flush, fsync or close
+int datenlord_pwrite(datenlord_sdk *sdk,
+                     datenlord_file *file,
+                     uint64_t offset,
+                     datenlord_bytes content);
+
+/// Read `n` segments at their offsets in one call, the `len` of each buffer
+/// is set to the number of bytes read into it. Nearby segments are merged
+/// into larger reads, which run concurrently.
+int datenlord_preadv(datenlord_sdk *sdk, datenlord_file *file, datenlord_iovec *iov, uintptr_t n);
+
+/// Write `n` segments at their offsets in one call, adjacent segments are
+/// merged into one write and overlapping segments are written in order
+int datenlord_pwritev(datenlord_sdk *sdk,
+                      datenlord_file *file,
+                      const datenlord_iovec *iov,
+                      uintptr_t n);
+
+/// Register `n` buffers of `buffers[i].len` bytes, `buffers[i].data` is set
+/// to each. The id of a buffer is its index. The buffers are carved out of
+/// one locked arena owned by the sdk, valid until `datenlord_unregister_buffers`.
+int datenlord_register_buffers(datenlord_sdk *sdk, datenlord_bytes *buffers, uintptr_t n);
+
+/// Unregister the buffers, the calls still using them keep them alive until they return
+int datenlord_unregister_buffers(datenlord_sdk *sdk);
+
+/// Read at offset into `len` bytes of registered buffer `index` from
+/// `buffer_offset`, 0 reads up to the end of the buffer
+int datenlord_pread_fixed(datenlord_sdk *sdk,
+                          datenlord_file *file,
+                          uint64_t offset,
+                          uint32_t index,
+                          uintptr_t buffer_offset,
+                          uintptr_t len,
+                          uintptr_t *out_read);
+
+/// Write `len` bytes of registered buffer `index` from `buffer_offset` at
+/// offset, 0 writes up to the end of the buffer
+int datenlord_pwrite_fixed(datenlord_sdk *sdk,
+                           datenlord_file *file,
+                           uint64_t offset,
+                           uint32_t index,
+                           uintptr_t buffer_offset,
+                           uintptr_t len);
+
+/// Read a file from offset into registered buffer `index`
+int datenlord_read_file_fixed(datenlord_sdk *sdk,
+                              const char *file_path,
+                              uint64_t offset,
+                              uint32_t index,
+                              uintptr_t *out_read);
+
+/// Write out the buffered writes of the file and flush it
+int datenlord_flush(datenlord_sdk *sdk, datenlord_file *file);
+
+/// Write out the buffered writes of the file and sync it to storage
+int datenlord_fsync(datenlord_sdk *sdk, datenlord_file *file);
+
+/// Flush and close the file, the handle is freed even if the flush fails
+int datenlord_close(datenlord_sdk *sdk, datenlord_file *file);
+
+/// Open a directory for `datenlord_readdir_next`, with `plus` set every
+/// entry comes with its attributes, which also warms the metadata cache
+int datenlord_opendir(datenlord_sdk *sdk, const char *dir_path, bool plus, datenlord_dir **out_dir);
+
+/// Read up to `max` entries into `out`, `count` is set to the number of
+/// entries read, 0 at the end of the directory. Entries are read from the
+/// filesystem one page at a time, so memory does not grow with the directory.
+int datenlord_readdir_next(datenlord_sdk *sdk,
+                           datenlord_dir *dir,
+                           datenlord_dirent *out,
+                           uintptr_t max,
+                           uintptr_t *count);
+
+/// Close the directory, the handle is freed even if the release fails
+int datenlord_closedir(datenlord_sdk *sdk, datenlord_dir *dir);
+
+/// Get the counters of the block read cache
+int datenlord_get_cache_stats(datenlord_sdk *sdk, datenlord_cache_stats *out);
+
+/// Write the metrics of the sdk as a json document into `buf`, its len is
+/// set to the size of the document. A null or too small buffer fails with
+/// `EINVAL` and its len set to the size needed, which grows with the counters.
+int datenlord_metrics_snapshot(datenlord_sdk *sdk, datenlord_bytes *buf);
+
+/// Map `len` bytes of a file from `offset` read-only, 0 maps up to the end of
+/// file. Files of a local backend are mapped and share the page cache, other
+/// backends get a copy of the range. Release it with `datenlord_munmap`.
+int datenlord_mmap(datenlord_sdk *sdk,
+                   const char *file_path,
+                   uint64_t offset,
+                   uintptr_t len,
+                   datenlord_mapping *out);
+
+/// Release a view returned by `datenlord_mmap`
+void datenlord_munmap(datenlord_mapping *mapping);
+
+datenlord_cq *datenlord_cq_new();
+
+/// Get the eventfd of the queue, it is readable while completions are pending
+int datenlord_cq_fd(const datenlord_cq *cq);
+
+/// Pop up to `max` completions into `out`, return the number popped
+uintptr_t datenlord_cq_poll(datenlord_cq *cq, datenlord_completion *out, uintptr_t max);
 
-datenlord_error *deldir(datenlord_sdk *sdk, const char *dir_path, bool recursive);
+/// Free the queue, all submitted calls must have completed
+void datenlord_cq_free(datenlord_cq *cq);
 
-datenlord_error *rename_path(datenlord_sdk *sdk, const char *src_path, const char *dest_path);
+int read_file_async(datenlord_sdk *sdk,
+                    const char *file_path,
+                    datenlord_bytes out_content,
+                    datenlord_async_handler handler);
 
-datenlord_error *copy_from_local_file(datenlord_sdk *sdk,
-                                      bool overwrite,
-                                      const char *local_file_path,
-                                      const char *dest_file_path);
+/// Read a file from offset into registered buffer `index`
+int read_file_fixed_async(datenlord_sdk *sdk,
+                          const char *file_path,
+                          uint64_t offset,
+                          uint32_t index,
+                          datenlord_async_handler handler);
 
-datenlord_error *copy_to_local_file(datenlord_sdk *sdk,
-                                    const char *src_file_path,
-                                    const char *local_file_path);
+int write_file_async(datenlord_sdk *sdk,
+                     const char *file_path,
+                     datenlord_bytes content,
+                     datenlord_async_handler handler);
 
-datenlord_error *create_file(datenlord_sdk *sdk, const char *file_path);
+int stat_async(datenlord_sdk *sdk,
+               const char *file_path,
+               datenlord_file_stat *file_metadata,
+               datenlord_async_handler handler);
 
-datenlord_error *stat(datenlord_sdk *sdk,
-                      const char *file_path,
-                      datenlord_file_stat *file_metadata);
+int copy_from_local_file_async(datenlord_sdk *sdk,
+                               bool overwrite,
+                               const char *local_file_path,
+                               const char *dest_file_path,
+                               datenlord_async_handler handler);
 
-datenlord_error *write_file(datenlord_sdk *sdk, const char *file_path, datenlord_bytes content);
+int copy_to_local_file_async(datenlord_sdk *sdk,
+                             const char *src_file_path,
+                             const char *local_file_path,
+                             datenlord_async_handler handler);
 
-datenlord_error *read_file(datenlord_sdk *sdk, const char *file_path, datenlord_bytes *out_content);
+/// Get the message of the last failed call of the calling thread, null when
+/// no call failed. The message is valid until the next failed call of the thread.
+const char *datenlord_last_error_message();
 
 } // extern "C"
@@ -0,0 +1,15 @@
+// The names `datenlord_mkdir` and `datenlord_stat` had before they were
+// prefixed. Exported under these names they replaced the libc `mkdir` and
+// `stat` in every process linking the sdk, here they are inline overloads
+// of the libc functions, so include this after datenlord.h only to build
+// code written against the old names.
+
+#include "datenlord.h"
+
+inline int mkdir(datenlord_sdk *sdk, const char *dir_path) {
+  return datenlord_mkdir(sdk, dir_path);
+}
+
+inline int stat(datenlord_sdk *sdk, const char *file_path, datenlord_file_stat *file_metadata) {
+  return datenlord_stat(sdk, file_path, file_metadata);
+}
@@ -8,6 +8,12 @@ pub enum DatenLordError {
     /// Unimplemented error
     #[error("Unimplemented: {context:?}")]
     Unimplemented { context: Vec<String> },
+    /// Not found error
+    #[error("Not found: {context:?}")]
+    NotFound { context: Vec<String> },
+    /// Already exists error
+    #[error("Already exists: {context:?}")]
+    AlreadyExists { context: Vec<String> },
     /// Invalid argument error
     #[error("Invalid argument: {context:?}")]
     InvalidArgument { context: Vec<String> },
@@ -20,4 +26,17 @@ pub enum DatenLordError {
     /// Other error
     #[error("Other error: {context:?}")]
     Other { context: Vec<String> },
-}
\ No newline at end of file
+}
+
+impl DatenLordError {
+    /// The errno closest to the error
+    pub fn errno(&self) -> i32 {
+        match self {
+            Self::Unimplemented { .. } => nix::libc::ENOSYS,
+            Self::NotFound { .. } => nix::libc::ENOENT,
+            Self::AlreadyExists { .. } => nix::libc::EEXIST,
+            Self::InvalidArgument { .. } => nix::libc::EINVAL,
+            Self::Internal { .. } | Self::Io { .. } | Self::Other { .. } => nix::libc::EIO,
+        }
+    }
+}
@@ -0,0 +1,388 @@
+//! Sharded dentry and attribute cache of the sdk
+//!
+//! Entries live for the `Duration` returned along with them by `VirtualFs`.
+//! Dentries map `(parent, name)` to an inode number and attributes are kept
+//! per inode, so invalidating an inode drops its attributes for every name
+//! pointing at it. Names found missing are remembered too, for their own
+//! TTL, so that probing a missing path again takes no call to the
+//! filesystem either. The content of small files can be kept inline with
+//! their attributes, so that reading them again takes no call to the filesystem.
+//! A full shard evicts with CLOCK, so that an insert costs O(1) amortized.
+
+use std::collections::hash_map::{DefaultHasher, HashMap};
+use std::collections::VecDeque;
+use std::hash::{Hash, Hasher};
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::RwLock;
+use std::time::{Duration, Instant};
+
+use bytes::Bytes;
+
+use crate::storage::fs_util::FileAttr;
+use crate::storage::virtualfs::INum;
+
+/// Number of shards of each map, a power of two
+const SHARDS: usize = 16;
+
+/// A cached value with its expiration time
+#[derive(Debug)]
+struct Entry<V> {
+    value: V,
+    expire: Instant,
+    /// Read since the clock hand last passed it
+    referenced: AtomicBool,
+}
+
+/// A shard evicting with CLOCK: keys are queued in insertion order and the
+/// hand gives referenced keys a second chance
+#[derive(Debug)]
+struct Shard<K, V> {
+    map: HashMap<K, Entry<V>>,
+    /// Keys in the order the hand visits them, including removed ones
+    clock: VecDeque<K>,
+}
+
+impl<K: Hash + Eq + Clone, V> Shard<K, V> {
+    /// Drop the first key the hand finds expired or not referenced
+    fn evict(&mut self, now: Instant) {
+        while let Some(key) = self.clock.pop_front() {
+            let Some(entry) = self.map.get(&key) else {
+                continue;
+            };
+            if entry.expire > now && entry.referenced.swap(false, Ordering::Relaxed) {
+                self.clock.push_back(key);
+            } else {
+                self.map.remove(&key);
+                return;
+            }
+        }
+    }
+}
+
+/// A hash map split into independently locked shards
+#[derive(Debug)]
+struct ShardedMap<K, V> {
+    shards: Vec<RwLock<Shard<K, V>>>,
+    /// Max entries per shard
+    shard_capacity: usize,
+}
+
+impl<K: Hash + Eq + Clone, V: Clone> ShardedMap<K, V> {
+    fn new(capacity: usize) -> Self {
+        Self {
+            shards: (0..SHARDS)
+                .map(|_| RwLock::new(Shard { map: HashMap::new(), clock: VecDeque::new() }))
+                .collect(),
+            shard_capacity: capacity.div_ceil(SHARDS),
+        }
+    }
+
+    fn shard(&self, key: &K) -> &RwLock<Shard<K, V>> {
+        let mut hasher = DefaultHasher::new();
+        key.hash(&mut hasher);
+        &self.shards[hasher.finish() as usize & (SHARDS - 1)]
+    }
+
+    fn get(&self, key: &K) -> Option<V> {
+        let shard = self.shard(key).read().unwrap();
+        shard
+            .map
+            .get(key)
+            .filter(|entry| entry.expire > Instant::now())
+            .map(|entry| {
+                entry.referenced.store(true, Ordering::Relaxed);
+                entry.value.clone()
+            })
+    }
+
+    fn insert(&self, key: K, value: V, ttl: Duration) {
+        let now = Instant::now();
+        let mut shard = self.shard(&key).write().unwrap();
+        let entry = Entry { value, expire: now + ttl, referenced: AtomicBool::new(false) };
+        if let Some(cached) = shard.map.get_mut(&key) {
+            *cached = entry;
+            return;
+        }
+        if shard.map.len() >= self.shard_capacity {
+            shard.evict(now);
+        }
+        // Removed keys stay queued until the hand passes them, sweep them
+        // once they outnumber the live ones
+        if shard.clock.len() >= self.shard_capacity.saturating_mul(2).max(1) {
+            let Shard { map, clock } = &mut *shard;
+            clock.retain(|key| map.contains_key(key));
+        }
+        shard.clock.push_back(key.clone());
+        shard.map.insert(key, entry);
+    }
+
+    /// Change a fresh value in place, keeping its expiration time
+    fn update<F: FnOnce(&mut V)>(&self, key: &K, f: F) {
+        let mut shard = self.shard(key).write().unwrap();
+        if let Some(entry) = shard.map.get_mut(key).filter(|entry| entry.expire > Instant::now()) {
+            f(&mut entry.value);
+        }
+    }
+
+    fn remove(&self, key: &K) {
+        self.shard(key).write().unwrap().map.remove(key);
+    }
+
+    fn clear(&self) {
+        for shard in &self.shards {
+            let mut shard = shard.write().unwrap();
+            shard.map.clear();
+            shard.clock.clear();
+        }
+    }
+}
+
+/// The attributes of an inode, with the whole content of a small file
+#[derive(Debug, Clone)]
+struct Inode {
+    attr: FileAttr,
+    data: Option<Bytes>,
+}
+
+/// Whether two attributes of a file are of the same content
+fn unchanged(cached: &FileAttr, attr: &FileAttr) -> bool {
+    cached.size == attr.size && cached.mtime == attr.mtime
+}
+
+/// Cache of `lookup` and `getattr` results
+#[derive(Debug)]
+pub struct AttrCache {
+    /// `(parent, name)` to inode number, none for a missing name
+    dentries: ShardedMap<(INum, String), Option<INum>>,
+    /// Inode number to attributes
+    attrs: ShardedMap<INum, Inode>,
+    /// Caching is disabled with a zero capacity
+    enabled: bool,
+    /// Max size of the files kept inline, 0 keeps none
+    inline_max_bytes: usize,
+    /// How long missing names are remembered, 0 remembers none
+    negative_ttl: Duration,
+}
+
+impl AttrCache {
+    /// Create a cache holding up to `capacity` dentries and as many
+    /// attributes, with the content of the files up to `inline_max_bytes`,
+    /// and the missing names for `negative_ttl`
+    pub fn new(capacity: usize, inline_max_bytes: usize, negative_ttl: Duration) -> Self {
+        Self {
+            dentries: ShardedMap::new(capacity),
+            attrs: ShardedMap::new(capacity),
+            enabled: capacity > 0,
+            inline_max_bytes: if capacity > 0 { inline_max_bytes } else { 0 },
+            negative_ttl,
+        }
+    }
+
+    /// Whether a file of this size would be kept inline
+    pub fn inlines(&self, size: u64) -> bool {
+        size <= self.inline_max_bytes as u64 && self.inline_max_bytes > 0
+    }
+
+    /// Get the attributes of `name` under `parent` if still fresh
+    pub fn lookup(&self, parent: INum, name: &str) -> Option<FileAttr> {
+        if !self.enabled {
+            return None;
+        }
+        let ino = self.dentries.get(&(parent, name.to_owned()))??;
+        self.getattr(ino)
+    }
+
+    /// Whether `name` under `parent` was found missing and is still known to be
+    pub fn missing(&self, parent: INum, name: &str) -> bool {
+        self.enabled && self.dentries.get(&(parent, name.to_owned())) == Some(None)
+    }
+
+    /// Get the attributes of an inode if still fresh
+    pub fn getattr(&self, ino: INum) -> Option<FileAttr> {
+        if !self.enabled {
+            return None;
+        }
+        self.attrs.get(&ino).map(|inode| inode.attr)
+    }
+
+    /// Get the content of a small file kept with its fresh attributes
+    pub fn inline_data(&self, ino: INum) -> Option<Bytes> {
+        if self.inline_max_bytes == 0 {
+            return None;
+        }
+        self.attrs.get(&ino)?.data
+    }
+
+    /// Keep the whole content of a file with its attributes, unless they
+    /// changed since `attr` was read or the file is too large
+    pub fn insert_data(&self, attr: &FileAttr, data: Bytes) {
+        if !self.inlines(attr.size) || data.len() as u64 != attr.size {
+            return;
+        }
+        self.attrs.update(&attr.ino, |inode| {
+            if unchanged(&inode.attr, attr) {
+                inode.data = Some(data);
+            }
+        });
+    }
+
+    /// Remember a lookup result for `ttl`
+    pub fn insert_entry(&self, parent: INum, name: &str, attr: FileAttr, ttl: Duration) {
+        if !self.enabled || ttl.is_zero() {
+            return;
+        }
+        self.dentries.insert((parent, name.to_owned()), Some(attr.ino), ttl);
+        self.insert_attr(attr, ttl);
+    }
+
+    /// Remember that a lookup found no `name` under `parent`, until a create
+    /// of this sdk instance replaces the entry or the negative TTL expires
+    pub fn insert_missing(&self, parent: INum, name: &str) {
+        if !self.enabled || self.negative_ttl.is_zero() {
+            return;
+        }
+        self.dentries.insert((parent, name.to_owned()), None, self.negative_ttl);
+    }
+
+    /// Remember a getattr result for `ttl`
+    pub fn insert_attr(&self, attr: FileAttr, ttl: Duration) {
+        if !self.enabled || ttl.is_zero() {
+            return;
+        }
+        // The content is kept as long as the file did not change
+        let data = if self.inline_max_bytes > 0 {
+            self.attrs
+                .get(&attr.ino)
+                .filter(|inode| unchanged(&inode.attr, &attr))
+                .and_then(|inode| inode.data)
+        } else {
+            None
+        };
+        self.attrs.insert(attr.ino, Inode { attr, data }, ttl);
+    }
+
+    /// Forget `name` under `parent`, after it was removed or renamed
+    pub fn invalidate_entry(&self, parent: INum, name: &str) {
+        self.dentries.remove(&(parent, name.to_owned()));
+    }
+
+    /// Forget the attributes of an inode, after its content or metadata changed
+    pub fn invalidate_attr(&self, ino: INum) {
+        self.attrs.remove(&ino);
+    }
+
+    /// Forget everything
+    pub fn clear(&self) {
+        self.dentries.clear();
+        self.attrs.clear();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn attr(ino: INum, size: u64) -> FileAttr {
+        FileAttr {
+            ino,
+            size,
+            ..FileAttr::default()
+        }
+    }
+
+    const TTL: Duration = Duration::from_secs(60);
+
+    #[test]
+    fn entries_expire_with_their_ttl() {
+        let cache = AttrCache::new(16, 0, TTL);
+        cache.insert_entry(1, "a", attr(2, 3), Duration::from_millis(10));
+        cache.insert_entry(1, "b", attr(3, 3), Duration::ZERO);
+        assert_eq!(cache.lookup(1, "a").map(|attr| attr.size), Some(3));
+        assert!(cache.lookup(1, "b").is_none());
+        std::thread::sleep(Duration::from_millis(20));
+        assert!(cache.lookup(1, "a").is_none());
+    }
+
+    #[test]
+    fn missing_names() {
+        let cache = AttrCache::new(16, 0, TTL);
+        cache.insert_missing(1, "a");
+        assert!(cache.missing(1, "a"));
+        assert!(cache.lookup(1, "a").is_none());
+        assert!(!cache.missing(1, "b"));
+        // Created since
+        cache.insert_entry(1, "a", attr(2, 3), TTL);
+        assert!(!cache.missing(1, "a"));
+        assert!(cache.lookup(1, "a").is_some());
+        // A zero negative TTL remembers none
+        let cache = AttrCache::new(16, 0, Duration::ZERO);
+        cache.insert_missing(1, "a");
+        assert!(!cache.missing(1, "a"));
+    }
+
+    #[test]
+    fn invalidation() {
+        let cache = AttrCache::new(16, 0, TTL);
+        cache.insert_entry(1, "a", attr(2, 3), TTL);
+        cache.insert_entry(1, "hardlink", attr(2, 3), TTL);
+        cache.invalidate_attr(2);
+        assert!(cache.lookup(1, "a").is_none());
+        assert!(cache.lookup(1, "hardlink").is_none());
+
+        cache.insert_entry(1, "a", attr(2, 3), TTL);
+        cache.invalidate_entry(1, "a");
+        assert!(cache.lookup(1, "a").is_none());
+        assert!(cache.getattr(2).is_some());
+    }
+
+    #[test]
+    fn capacity_bounds_the_entries() {
+        let cache = AttrCache::new(SHARDS, 0, TTL);
+        for ino in 0..1000 {
+            cache.insert_entry(1, &ino.to_string(), attr(ino + 2, 0), TTL);
+        }
+        let cached = (0..1000).filter(|ino| cache.lookup(1, &ino.to_string()).is_some()).count();
+        assert!(cached > 0 && cached <= SHARDS, "{cached} entries cached");
+        assert!(AttrCache::new(0, 0, TTL).lookup(1, "0").is_none());
+    }
+
+    #[test]
+    fn eviction_spares_the_entries_read() {
+        let map = ShardedMap::new(SHARDS * 2);
+        // Fill the shard of key 0 with it and another key, then read key 0
+        let shard = |key: &u64| map.shard(key) as *const _;
+        let other = (1..).find(|key| shard(key) == shard(&0)).unwrap();
+        let third = (other + 1..).find(|key| shard(key) == shard(&0)).unwrap();
+        map.insert(0, 0, TTL);
+        map.insert(other, other, TTL);
+        assert_eq!(map.get(&0), Some(0));
+        map.insert(third, third, TTL);
+        assert_eq!(map.get(&0), Some(0));
+        assert!(map.get(&other).is_none());
+        assert_eq!(map.get(&third), Some(third));
+        // Removed keys are swept from the clock rather than piling up
+        for key in 0..1000 {
+            map.insert(third, key, TTL);
+            map.remove(&third);
+        }
+        let shard = map.shard(&0).read().unwrap();
+        assert!(shard.clock.len() <= 4, "{} keys queued", shard.clock.len());
+    }
+
+    #[test]
+    fn inline_data_follows_the_attributes() {
+        let cache = AttrCache::new(16, 8, TTL);
+        cache.insert_attr(attr(2, 4), TTL);
+        cache.insert_data(&attr(2, 4), Bytes::from_static(b"abcd"));
+        assert_eq!(cache.inline_data(2).as_deref(), Some(&b"abcd"[..]));
+        // Refreshed attributes of the same content keep it, a new size drops it
+        cache.insert_attr(attr(2, 4), TTL);
+        assert!(cache.inline_data(2).is_some());
+        cache.insert_attr(attr(2, 5), TTL);
+        assert!(cache.inline_data(2).is_none());
+        // Too large to be kept
+        cache.insert_attr(attr(3, 9), TTL);
+        cache.insert_data(&attr(3, 9), Bytes::from_static(b"123456789"));
+        assert!(cache.inline_data(3).is_none());
+    }
+}
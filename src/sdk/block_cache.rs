@@ -0,0 +1,492 @@
+//! Block read cache of the sdk
+//!
+//! Files are cached in fixed size blocks aligned to the block size, between
+//! the sdk reads and `VirtualFs::read`. Every shard evicts with ARC, which
+//! keeps apart the blocks read once and the blocks read again, and adapts
+//! the split between them, so a single scan does not flush the blocks that
+//! are re-read on every epoch.
+//!
+//! A block is tagged with the mtime and size of its file when it was read,
+//! handles opened on another version of the file miss on it. Invalidating a
+//! file also bumps its epoch, a block read before is not inserted after, so
+//! a read racing with a write does not cache the data it overwrote.
+
+use std::collections::hash_map::DefaultHasher;
+use std::collections::{BTreeMap, HashMap, HashSet};
+use std::hash::{Hash, Hasher};
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Mutex;
+use std::time::SystemTime;
+
+use bytes::Bytes;
+
+use crate::storage::fs_util::FileAttr;
+use crate::storage::virtualfs::INum;
+
+/// Max number of shards
+const SHARDS: usize = 16;
+
+/// Min blocks per shard, smaller caches use fewer shards
+const MIN_SHARD_BLOCKS: usize = 4;
+
+/// Invalidation epochs, shared by the files with the same slot
+const EPOCHS: usize = 1024;
+
+/// A block is identified by its inode number and its index in the file
+type BlockKey = (INum, u64);
+
+/// The version of a file its blocks were read from
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct FileVersion {
+    pub mtime: SystemTime,
+    pub size: u64,
+}
+
+impl FileVersion {
+    /// Get the version of a file from its attributes
+    pub fn of(attr: &FileAttr) -> Self {
+        Self {
+            mtime: attr.mtime,
+            size: attr.size,
+        }
+    }
+}
+
+/// Keys ordered from the least to the most recently used
+#[derive(Debug, Default)]
+struct LruList {
+    ticks: HashMap<BlockKey, u64>,
+    order: BTreeMap<u64, BlockKey>,
+    next_tick: u64,
+}
+
+impl LruList {
+    fn len(&self) -> usize {
+        self.ticks.len()
+    }
+
+    /// Insert a key as the most recently used one
+    fn push(&mut self, key: BlockKey) {
+        self.remove(&key);
+        self.next_tick += 1;
+        self.ticks.insert(key, self.next_tick);
+        self.order.insert(self.next_tick, key);
+    }
+
+    fn remove(&mut self, key: &BlockKey) -> bool {
+        match self.ticks.remove(key) {
+            Some(tick) => {
+                self.order.remove(&tick);
+                true
+            }
+            None => false,
+        }
+    }
+
+    /// Remove the least recently used key
+    fn pop_lru(&mut self) -> Option<BlockKey> {
+        let (_, key) = self.order.pop_first()?;
+        self.ticks.remove(&key);
+        Some(key)
+    }
+}
+
+/// A cached block
+#[derive(Debug)]
+struct Block {
+    data: Bytes,
+    version: FileVersion,
+    /// Read ahead and not read by the caller yet, its first read is not a reuse
+    prefetched: bool,
+}
+
+/// One shard of the cache, with the lists of ARC
+#[derive(Debug)]
+struct ArcShard {
+    /// Max resident blocks
+    capacity: usize,
+    /// Target number of resident blocks read once, adapted on ghost hits
+    target_recent: usize,
+    /// Resident blocks read once
+    recent: LruList,
+    /// Resident blocks read more than once
+    frequent: LruList,
+    /// Keys recently evicted from `recent`
+    recent_ghost: LruList,
+    /// Keys recently evicted from `frequent`
+    frequent_ghost: LruList,
+    blocks: HashMap<BlockKey, Block>,
+    /// Indexes of the resident blocks by file, so a file is dropped without a scan
+    files: HashMap<INum, HashSet<u64>>,
+    /// Bytes of the resident blocks
+    bytes: usize,
+}
+
+impl ArcShard {
+    fn new(capacity: usize) -> Self {
+        Self {
+            capacity,
+            target_recent: 0,
+            recent: LruList::default(),
+            frequent: LruList::default(),
+            recent_ghost: LruList::default(),
+            frequent_ghost: LruList::default(),
+            blocks: HashMap::new(),
+            files: HashMap::new(),
+            bytes: 0,
+        }
+    }
+
+    fn get(&mut self, key: &BlockKey, version: FileVersion) -> Option<Bytes> {
+        let block = self.blocks.get_mut(key).filter(|block| block.version == version)?;
+        let data = block.data.clone();
+        if std::mem::take(&mut block.prefetched) {
+            self.recent.push(*key);
+        } else {
+            self.recent.remove(key);
+            self.frequent.push(*key);
+        }
+        Some(data)
+    }
+
+    fn contains(&self, key: &BlockKey, version: FileVersion) -> bool {
+        self.blocks.get(key).is_some_and(|block| block.version == version)
+    }
+
+    /// Insert a block, return the number of blocks evicted
+    fn insert(&mut self, key: BlockKey, block: Block) -> u64 {
+        if let Some(old) = self.blocks.insert(key, block) {
+            // A newer version of a resident block, it keeps its place
+            self.bytes -= old.data.len();
+            self.bytes += self.blocks[&key].data.len();
+            return 0;
+        }
+        self.bytes += self.blocks[&key].data.len();
+        self.files.entry(key.0).or_default().insert(key.1);
+
+        let mut evicted = 0;
+        if self.recent_ghost.remove(&key) {
+            // Evicted too early from the blocks read once, favor them
+            let delta = (self.frequent_ghost.len() / (self.recent_ghost.len() + 1)).max(1);
+            self.target_recent = (self.target_recent + delta).min(self.capacity);
+            evicted += self.replace(&key, false);
+            self.frequent.push(key);
+        } else if self.frequent_ghost.remove(&key) {
+            let delta = (self.recent_ghost.len() / (self.frequent_ghost.len() + 1)).max(1);
+            self.target_recent = self.target_recent.saturating_sub(delta);
+            evicted += self.replace(&key, true);
+            self.frequent.push(key);
+        } else {
+            let recent_total = self.recent.len() + self.recent_ghost.len();
+            let total = recent_total + self.frequent.len() + self.frequent_ghost.len();
+            if recent_total >= self.capacity {
+                if self.recent.len() < self.capacity {
+                    self.recent_ghost.pop_lru();
+                    evicted += self.replace(&key, false);
+                } else if let Some(victim) = self.recent.pop_lru() {
+                    self.drop_block(&victim);
+                    evicted += 1;
+                }
+            } else if total >= self.capacity {
+                if total >= 2 * self.capacity {
+                    self.frequent_ghost.pop_lru();
+                }
+                evicted += self.replace(&key, false);
+            }
+            self.recent.push(key);
+        }
+        evicted
+    }
+
+    /// Evict one block when the shard is full, into the ghost list of its list
+    fn replace(&mut self, key: &BlockKey, frequent_ghost_hit: bool) -> u64 {
+        if self.recent.len() + self.frequent.len() < self.capacity {
+            return 0;
+        }
+        let from_recent = self.frequent.len() == 0
+            || (self.recent.len() > 0
+                && (self.recent.len() > self.target_recent
+                    || (frequent_ghost_hit && self.recent.len() == self.target_recent)));
+        let victim = if from_recent {
+            self.recent.pop_lru().inspect(|victim| self.recent_ghost.push(*victim))
+        } else {
+            self.frequent.pop_lru().inspect(|victim| self.frequent_ghost.push(*victim))
+        };
+        match victim {
+            Some(victim) if victim != *key => {
+                self.drop_block(&victim);
+                1
+            }
+            _ => 0,
+        }
+    }
+
+    fn drop_block(&mut self, key: &BlockKey) {
+        if let Some(block) = self.blocks.remove(key) {
+            self.bytes -= block.data.len();
+            if let Some(indexes) = self.files.get_mut(&key.0) {
+                indexes.remove(&key.1);
+                if indexes.is_empty() {
+                    self.files.remove(&key.0);
+                }
+            }
+        }
+    }
+
+    /// Drop every block of a file
+    fn remove_ino(&mut self, ino: INum) {
+        let Some(indexes) = self.files.remove(&ino) else {
+            return;
+        };
+        for index in indexes {
+            let key = (ino, index);
+            self.recent.remove(&key);
+            self.frequent.remove(&key);
+            if let Some(block) = self.blocks.remove(&key) {
+                self.bytes -= block.data.len();
+            }
+        }
+    }
+}
+
+/// Counters of the block cache
+#[derive(Debug, Clone, Copy, Default)]
+pub struct BlockCacheStats {
+    pub hits: u64,
+    pub misses: u64,
+    pub evictions: u64,
+    /// Bytes of the resident blocks
+    pub bytes: u64,
+    /// The byte budget
+    pub capacity: u64,
+}
+
+/// Cache of file blocks, shared by all reads of an sdk instance
+#[derive(Debug)]
+pub struct BlockCache {
+    shards: Vec<Mutex<ArcShard>>,
+    /// Invalidations by slot of inode number
+    epochs: Vec<AtomicU64>,
+    block_size: usize,
+    capacity: u64,
+    hits: AtomicU64,
+    misses: AtomicU64,
+    evictions: AtomicU64,
+}
+
+impl BlockCache {
+    /// Create a cache of up to `capacity` bytes in blocks of `block_size` bytes,
+    /// a capacity smaller than one block disables the cache
+    pub fn new(capacity: u64, block_size: usize) -> Self {
+        let block_size = block_size.max(1);
+        let blocks = usize::try_from(capacity / block_size as u64).unwrap_or(usize::MAX);
+        let shard_count = (blocks / MIN_SHARD_BLOCKS).clamp(1, SHARDS);
+        let shards = if blocks == 0 {
+            Vec::new()
+        } else {
+            (0..shard_count)
+                .map(|index| {
+                    // Spread the remainder over the first shards
+                    let extra = usize::from(index < blocks % shard_count);
+                    Mutex::new(ArcShard::new(blocks / shard_count + extra))
+                })
+                .collect()
+        };
+        Self {
+            shards,
+            epochs: (0..EPOCHS).map(|_| AtomicU64::new(0)).collect(),
+            block_size,
+            capacity,
+            hits: AtomicU64::new(0),
+            misses: AtomicU64::new(0),
+            evictions: AtomicU64::new(0),
+        }
+    }
+
+    /// Whether reads go through the cache
+    pub fn enabled(&self) -> bool {
+        !self.shards.is_empty()
+    }
+
+    pub fn block_size(&self) -> usize {
+        self.block_size
+    }
+
+    fn shard(&self, key: &BlockKey) -> &Mutex<ArcShard> {
+        let mut hasher = DefaultHasher::new();
+        key.hash(&mut hasher);
+        &self.shards[hasher.finish() as usize % self.shards.len()]
+    }
+
+    fn epoch_slot(&self, ino: INum) -> &AtomicU64 {
+        &self.epochs[ino as usize % EPOCHS]
+    }
+
+    /// Get the invalidation epoch of a file, to be taken before a block is
+    /// read from the filesystem and passed to `insert`
+    pub fn epoch(&self, ino: INum) -> u64 {
+        self.epoch_slot(ino).load(Ordering::Acquire)
+    }
+
+    /// Get block `index` of a file read at `version`
+    pub fn get(&self, ino: INum, index: u64, version: FileVersion) -> Option<Bytes> {
+        if !self.enabled() {
+            return None;
+        }
+        let key = (ino, index);
+        let block = self.shard(&key).lock().unwrap().get(&key, version);
+        let counter = if block.is_some() { &self.hits } else { &self.misses };
+        counter.fetch_add(1, Ordering::Relaxed);
+        block
+    }
+
+    /// Whether block `index` of a file read at `version` is cached, without counting it as a read
+    pub fn contains(&self, ino: INum, index: u64, version: FileVersion) -> bool {
+        if !self.enabled() {
+            return false;
+        }
+        let key = (ino, index);
+        self.shard(&key).lock().unwrap().contains(&key, version)
+    }
+
+    /// Remember block `index` of a file read at `version` in `epoch`,
+    /// `prefetched` for blocks read ahead of the caller. The block is dropped
+    /// when the file was invalidated since.
+    pub fn insert(&self, ino: INum, index: u64, version: FileVersion, epoch: u64, data: Bytes, prefetched: bool) {
+        if !self.enabled() {
+            return;
+        }
+        let key = (ino, index);
+        let block = Block {
+            data,
+            version,
+            prefetched,
+        };
+        let mut shard = self.shard(&key).lock().unwrap();
+        // Checked under the lock, an invalidation either comes after and
+        // removes the block or came before and the block is dropped
+        if self.epoch(ino) != epoch {
+            return;
+        }
+        let evicted = shard.insert(key, block);
+        drop(shard);
+        if evicted > 0 {
+            self.evictions.fetch_add(evicted, Ordering::Relaxed);
+        }
+    }
+
+    /// Drop every block of a file, after it was written
+    pub fn invalidate(&self, ino: INum) {
+        if !self.enabled() {
+            return;
+        }
+        self.epoch_slot(ino).fetch_add(1, Ordering::AcqRel);
+        for shard in &self.shards {
+            shard.lock().unwrap().remove_ino(ino);
+        }
+    }
+
+    pub fn stats(&self) -> BlockCacheStats {
+        let bytes = self.shards.iter().map(|shard| shard.lock().unwrap().bytes as u64).sum();
+        BlockCacheStats {
+            hits: self.hits.load(Ordering::Relaxed),
+            misses: self.misses.load(Ordering::Relaxed),
+            evictions: self.evictions.load(Ordering::Relaxed),
+            bytes,
+            capacity: self.capacity,
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const VERSION: FileVersion = FileVersion {
+        mtime: SystemTime::UNIX_EPOCH,
+        size: 1,
+    };
+
+    fn block(len: usize) -> Block {
+        Block {
+            data: Bytes::from(vec![0; len]),
+            version: VERSION,
+            prefetched: false,
+        }
+    }
+
+    #[test]
+    fn ghost_hits_adapt_the_target() {
+        let mut shard = ArcShard::new(2);
+        let (a, b, c) = ((1, 0), (1, 1), (1, 2));
+        shard.insert(a, block(1));
+        assert!(shard.get(&a, VERSION).is_some());
+        shard.insert(b, block(1));
+        // The full shard evicts the block read once into its ghost list
+        shard.insert(c, block(1));
+        assert!(!shard.contains(&b, VERSION));
+        assert!(shard.recent_ghost.ticks.contains_key(&b));
+
+        // Read again after its eviction, the blocks read once get more room
+        assert_eq!(shard.insert(b, block(1)), 1);
+        assert_eq!(shard.target_recent, 1);
+        assert!(shard.frequent.ticks.contains_key(&b));
+        assert!(shard.frequent_ghost.ticks.contains_key(&a));
+        assert!(!shard.contains(&a, VERSION));
+
+        // And less once a block read more than once is evicted too early
+        assert_eq!(shard.insert(a, block(1)), 1);
+        assert_eq!(shard.target_recent, 0);
+        assert!(shard.recent_ghost.ticks.contains_key(&c));
+        assert_eq!(shard.frequent.len(), 2);
+        assert_eq!(shard.bytes, 2);
+    }
+
+    #[test]
+    fn a_scan_keeps_the_blocks_read_again() {
+        let cache = BlockCache::new(64 * 10, 10);
+        for _ in 0..3 {
+            for index in 0..20 {
+                if cache.get(2, index, VERSION).is_none() {
+                    cache.insert(2, index, VERSION, 0, Bytes::from(vec![0; 10]), false);
+                }
+            }
+        }
+        for index in 0..200 {
+            cache.insert(1, index, VERSION, 0, Bytes::from(vec![0; 10]), false);
+        }
+        let hot = (0..20).filter(|&index| cache.contains(2, index, VERSION)).count();
+        assert!(hot >= 16, "{hot} hot blocks left");
+        assert!(cache.stats().bytes <= 640);
+    }
+
+    #[test]
+    fn invalidate_drops_the_blocks_of_a_file() {
+        let cache = BlockCache::new(64 * 10, 10);
+        for index in 0..8 {
+            cache.insert(1, index, VERSION, 0, Bytes::from(vec![0; 10]), false);
+            cache.insert(2, index, VERSION, 0, Bytes::from(vec![0; 10]), false);
+        }
+        cache.invalidate(1);
+        assert!((0..8).all(|index| !cache.contains(1, index, VERSION)));
+        assert!((0..8).all(|index| cache.contains(2, index, VERSION)));
+        assert_eq!(cache.stats().bytes, 80);
+        for shard in &cache.shards {
+            assert!(!shard.lock().unwrap().files.contains_key(&1));
+        }
+        // Another version of the file misses
+        let version = FileVersion { size: 2, ..VERSION };
+        assert!(cache.get(2, 0, version).is_none());
+    }
+
+    #[test]
+    fn blocks_read_before_an_invalidation_are_dropped() {
+        let cache = BlockCache::new(64 * 10, 10);
+        let epoch = cache.epoch(1);
+        cache.invalidate(1);
+        cache.insert(1, 0, VERSION, epoch, Bytes::from(vec![0; 10]), false);
+        assert!(!cache.contains(1, 0, VERSION));
+        cache.insert(1, 0, VERSION, cache.epoch(1), Bytes::from(vec![0; 10]), false);
+        assert!(cache.contains(1, 0, VERSION));
+    }
+}
@@ -0,0 +1,289 @@
+//! Registered buffers
+//!
+//! A caller doing many large reads registers its buffers once and then reads
+//! into them by index. The buffers are carved out of one arena owned by the
+//! sdk, populated and locked when they are registered, so no call allocates
+//! or faults pages in. Buffers of 2 MiB and more are aligned to 2 MiB and the
+//! arena is advised for transparent huge pages.
+//!
+//! The arena is a memfd, backends in another process map it too: a daemon
+//! reads and writes the registered buffers of its clients in place.
+
+use std::ops::Range;
+use std::os::fd::{AsRawFd, FromRawFd, OwnedFd};
+use std::sync::{Arc, RwLock};
+use std::{io, ptr};
+
+use tracing::debug;
+
+use crate::common::{DatenLordError, DatenLordResult};
+use crate::sdk::ops::{self, FileHandle, SdkFs};
+
+/// Size of a transparent huge page
+const HUGE_PAGE: usize = 2 * 1024 * 1024;
+const PAGE: usize = 4096;
+
+/// A shared memory region backed by a memfd
+#[derive(Debug)]
+pub struct Arena {
+    fd: OwnedFd,
+    base: *mut u8,
+    len: usize,
+}
+
+// The arena is plain memory, its users split it between them
+unsafe impl Send for Arena {}
+unsafe impl Sync for Arena {}
+
+impl Arena {
+    /// Create an arena of `len` bytes, populated and locked when allowed
+    pub fn new(len: usize) -> io::Result<Self> {
+        let fd = unsafe { nix::libc::memfd_create(b"datenlord-buffers\0".as_ptr().cast(), nix::libc::MFD_CLOEXEC) };
+        if fd < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let fd = unsafe { OwnedFd::from_raw_fd(fd) };
+        if unsafe { nix::libc::ftruncate(fd.as_raw_fd(), len as nix::libc::off_t) } < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let arena = Self::map(fd, len, nix::libc::MAP_POPULATE)?;
+        unsafe {
+            // Only taken when shmem huge pages are enabled, a hint otherwise
+            nix::libc::madvise(arena.base.cast(), len, nix::libc::MADV_HUGEPAGE);
+            if nix::libc::mlock(arena.base.cast(), len) < 0 {
+                debug!("registered buffers not locked: {}", io::Error::last_os_error());
+            }
+        }
+        Ok(arena)
+    }
+
+    /// Map an arena created by another process
+    pub fn from_fd(fd: OwnedFd, len: usize) -> io::Result<Self> {
+        Self::map(fd, len, 0)
+    }
+
+    /// Map the memfd, at a huge page boundary when it spans huge pages
+    fn map(fd: OwnedFd, len: usize, flags: nix::libc::c_int) -> io::Result<Self> {
+        let align = if len >= HUGE_PAGE { HUGE_PAGE } else { PAGE };
+        // Reserve enough address space to place the mapping at the alignment
+        let reserved_len = len + align - PAGE;
+        let reserved = unsafe {
+            nix::libc::mmap(
+                ptr::null_mut(),
+                reserved_len,
+                nix::libc::PROT_NONE,
+                nix::libc::MAP_PRIVATE | nix::libc::MAP_ANONYMOUS | nix::libc::MAP_NORESERVE,
+                -1,
+                0,
+            )
+        };
+        if reserved == nix::libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+        let reserved = reserved as usize;
+        let start = reserved.div_ceil(align) * align;
+        let base = unsafe {
+            nix::libc::mmap(
+                start as *mut nix::libc::c_void,
+                len,
+                nix::libc::PROT_READ | nix::libc::PROT_WRITE,
+                nix::libc::MAP_SHARED | nix::libc::MAP_FIXED | flags,
+                fd.as_raw_fd(),
+                0,
+            )
+        };
+        let mapped = base != nix::libc::MAP_FAILED;
+        let error = io::Error::last_os_error();
+        unsafe {
+            if mapped {
+                // Give back the reservation around the mapping
+                nix::libc::munmap(reserved as *mut nix::libc::c_void, start - reserved);
+                nix::libc::munmap((start + len) as *mut nix::libc::c_void, reserved + reserved_len - start - len);
+            } else {
+                nix::libc::munmap(reserved as *mut nix::libc::c_void, reserved_len);
+            }
+        }
+        if !mapped {
+            return Err(error);
+        }
+        Ok(Self {
+            fd,
+            base: base.cast(),
+            len,
+        })
+    }
+
+    /// The memfd of the arena
+    pub fn fd(&self) -> &OwnedFd {
+        &self.fd
+    }
+
+    pub fn as_ptr(&self) -> *mut u8 {
+        self.base
+    }
+
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// A range of the arena, the caller makes sure no one else writes it meanwhile
+    #[allow(clippy::mut_from_ref)]
+    pub unsafe fn slice(&self, range: Range<usize>) -> &mut [u8] {
+        debug_assert!(range.start <= range.end && range.end <= self.len);
+        std::slice::from_raw_parts_mut(self.base.add(range.start), range.len())
+    }
+}
+
+impl Drop for Arena {
+    fn drop(&mut self) {
+        unsafe {
+            nix::libc::munmap(self.base.cast(), self.len);
+        }
+    }
+}
+
+/// The buffers registered at once
+#[derive(Debug)]
+pub struct Registration {
+    arena: Arena,
+    /// The range of each buffer in the arena, indexed by buffer id
+    buffers: Vec<Range<usize>>,
+}
+
+impl Registration {
+    /// Start of a buffer
+    pub fn buffer_ptr(&self, index: u32) -> Option<*mut u8> {
+        let range = self.buffers.get(index as usize)?;
+        Some(unsafe { self.arena.as_ptr().add(range.start) })
+    }
+
+    /// `len` bytes of a buffer from `offset`, 0 takes the rest of the buffer
+    #[allow(clippy::mut_from_ref)]
+    pub fn slice(&self, index: u32, offset: usize, len: usize) -> DatenLordResult<&mut [u8]> {
+        let invalid = || DatenLordError::InvalidArgument {
+            context: vec![format!("range {offset}+{len} out of registered buffer {index}")],
+        };
+        let buffer = self.buffers.get(index as usize).ok_or_else(invalid)?;
+        let available = buffer.len().checked_sub(offset).ok_or_else(invalid)?;
+        let len = if len == 0 { available } else { len };
+        if len > available {
+            return Err(invalid());
+        }
+        let start = buffer.start + offset;
+        // Calls on the same buffer are serialized by the caller, as with any buffer it passes
+        Ok(unsafe { self.arena.slice(start..start + len) })
+    }
+}
+
+/// The registered buffers of an sdk instance
+#[derive(Debug, Default)]
+pub struct BufferPool {
+    registration: RwLock<Option<Arc<Registration>>>,
+}
+
+impl BufferPool {
+    /// The registered buffers, kept alive by the calls using them
+    pub fn get(&self) -> DatenLordResult<Arc<Registration>> {
+        self.registration.read().unwrap().clone().ok_or_else(|| DatenLordError::InvalidArgument {
+            context: vec!["no buffers registered".to_owned()],
+        })
+    }
+}
+
+/// Place the buffers in an arena, return their ranges and the arena size
+fn layout(sizes: &[usize]) -> DatenLordResult<(Vec<Range<usize>>, usize)> {
+    let mut end = 0usize;
+    let mut buffers = Vec::with_capacity(sizes.len());
+    for &size in sizes {
+        if size == 0 {
+            return Err(DatenLordError::InvalidArgument {
+                context: vec!["registered buffers must not be empty".to_owned()],
+            });
+        }
+        let align = if size >= HUGE_PAGE { HUGE_PAGE } else { PAGE };
+        let start = end.div_ceil(align) * align;
+        end = start.checked_add(size).ok_or_else(|| DatenLordError::InvalidArgument {
+            context: vec!["registered buffers overflow the address space".to_owned()],
+        })?;
+        buffers.push(start..end);
+    }
+    let align = if end >= HUGE_PAGE { HUGE_PAGE } else { PAGE };
+    Ok((buffers, end.div_ceil(align) * align))
+}
+
+/// Register buffers of the given sizes, their ids are their indexes. The
+/// buffers of an earlier registration must be unregistered first.
+pub async fn register(fs: &SdkFs, sizes: &[usize]) -> DatenLordResult<Arc<Registration>> {
+    if sizes.is_empty() {
+        return Err(DatenLordError::InvalidArgument {
+            context: vec!["no buffers to register".to_owned()],
+        });
+    }
+    if fs.buffers.registration.read().unwrap().is_some() {
+        return Err(DatenLordError::AlreadyExists {
+            context: vec!["buffers are registered already, unregister them first".to_owned()],
+        });
+    }
+    let (buffers, len) = layout(sizes)?;
+    let arena = Arena::new(len).map_err(|e| DatenLordError::Io {
+        context: vec![format!("failed to allocate {len} bytes of registered buffers: {e}")],
+    })?;
+    fs.backend.register_buffers(arena.fd().as_raw_fd(), arena.as_ptr() as usize, len).await?;
+
+    let registration = Arc::new(Registration { arena, buffers });
+    let mut current = fs.buffers.registration.write().unwrap();
+    if current.is_some() {
+        return Err(DatenLordError::AlreadyExists {
+            context: vec!["buffers were registered concurrently".to_owned()],
+        });
+    }
+    *current = Some(Arc::clone(&registration));
+    Ok(registration)
+}
+
+/// Unregister the buffers, the arena is freed once the calls using it are done
+pub async fn unregister(fs: &SdkFs) -> DatenLordResult<()> {
+    let registration = fs.buffers.registration.write().unwrap().take();
+    if registration.is_none() {
+        return Err(DatenLordError::InvalidArgument {
+            context: vec!["no buffers registered".to_owned()],
+        });
+    }
+    fs.backend.unregister_buffers().await
+}
+
+/// Read from an open file at offset into `len` bytes of a registered buffer
+/// from `buffer_offset`, 0 reads up to the end of the buffer
+pub async fn pread_fixed(
+    fs: &Arc<SdkFs>,
+    handle: &FileHandle,
+    offset: u64,
+    index: u32,
+    buffer_offset: usize,
+    len: usize,
+) -> DatenLordResult<usize> {
+    let registration = fs.buffers.get()?;
+    let buffer = registration.slice(index, buffer_offset, len)?;
+    ops::pread(fs, handle, offset, buffer).await
+}
+
+/// Write `len` bytes of a registered buffer from `buffer_offset` at offset
+pub async fn pwrite_fixed(
+    fs: &Arc<SdkFs>,
+    handle: &FileHandle,
+    offset: u64,
+    index: u32,
+    buffer_offset: usize,
+    len: usize,
+) -> DatenLordResult<()> {
+    let registration = fs.buffers.get()?;
+    let buffer = registration.slice(index, buffer_offset, len)?;
+    ops::pwrite(fs, handle, offset, buffer).await
+}
+
+/// Read a file from offset into a whole registered buffer
+pub async fn read_file_fixed(fs: &Arc<SdkFs>, path: &str, offset: u64, index: u32) -> DatenLordResult<usize> {
+    let registration = fs.buffers.get()?;
+    let buffer = registration.slice(index, 0, 0)?;
+    ops::read_file_at(fs, path, offset, buffer).await
+}
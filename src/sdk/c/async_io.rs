@@ -0,0 +1,338 @@
+//! Non-blocking variants of the c sdk
+//!
+//! Every `*_async` function copies its path arguments, submits the operation
+//! to the sdk runtime and returns immediately. On completion the handler
+//! callback is invoked on a runtime worker thread, or when no callback is set
+//! the completion is posted to a `datenlord_cq`, whose eventfd becomes
+//! readable so it can be driven from an epoll loop.
+//!
+//! A failed call completes with its errno. Callbacks can get the message of
+//! the failure with `datenlord_last_error_message`, completions popped from a
+//! queue only carry the code.
+//!
+//! Buffers passed to an async call must stay valid until its completion.
+//! Callbacks must not call the blocking sdk functions, they run on the
+//! runtime and would dead lock it.
+
+use std::collections::VecDeque;
+use std::ffi::CStr;
+use std::os::fd::{AsFd, AsRawFd};
+use std::os::raw::{c_char, c_int, c_void};
+use std::ptr;
+use std::sync::Mutex;
+
+use nix::sys::eventfd::{EfdFlags, EventFd};
+
+use super::datenlord::{datenlord_bytes, datenlord_file_stat, datenlord_sdk};
+use super::error;
+use crate::sdk::buffers;
+use crate::sdk::ops;
+
+/// Completion callback, `code` is 0 on success and the errno of the failure otherwise
+#[allow(non_camel_case_types)]
+pub type datenlord_callback = extern "C" fn(ctx: *mut c_void, code: c_int, size: usize);
+
+/// Where the completion of an async call is delivered
+#[repr(C)]
+#[allow(non_camel_case_types)]
+pub struct datenlord_async_handler {
+    /// Invoked on a runtime worker thread when set
+    pub callback: Option<datenlord_callback>,
+    /// Completion queue to post to when callback is not set
+    pub cq: *mut datenlord_cq,
+    /// Passed back to the callback or stored in the completion
+    pub ctx: *mut c_void,
+}
+
+// The caller guarantees the handler targets outlive the async call
+unsafe impl Send for datenlord_async_handler {}
+
+/// A finished async call
+#[repr(C)]
+#[allow(non_camel_case_types)]
+pub struct datenlord_completion {
+    /// The `ctx` of the handler the call was submitted with
+    pub ctx: *mut c_void,
+    /// 0 on success, the errno of the failure otherwise
+    pub code: c_int,
+    /// Bytes transferred, 0 for calls without a size
+    pub size: usize,
+}
+
+/// Pollable completion queue backed by an eventfd
+#[allow(non_camel_case_types)]
+pub struct datenlord_cq {
+    /// Finished calls waiting to be polled
+    completions: Mutex<VecDeque<datenlord_completion>>,
+    /// Readable while there are completions in the queue
+    event: EventFd,
+}
+
+// Completions only carry pointers handed in by the caller
+unsafe impl Send for datenlord_completion {}
+
+impl datenlord_cq {
+    /// Queue a completion and wake up the poller
+    fn post(&self, completion: datenlord_completion) {
+        self.completions.lock().unwrap().push_back(completion);
+        let _ = self.event.write(1);
+    }
+}
+
+impl datenlord_async_handler {
+    /// Deliver the result of an async call
+    fn complete(self, code: c_int, size: usize) {
+        if let Some(callback) = self.callback {
+            callback(self.ctx, code, size);
+        } else if !self.cq.is_null() {
+            let cq = unsafe { &*self.cq };
+            cq.post(datenlord_completion { ctx: self.ctx, code, size });
+        }
+    }
+
+    fn is_valid(&self) -> bool {
+        self.callback.is_some() || !self.cq.is_null()
+    }
+}
+
+/// Raw pointer moved into an async task
+struct SendPtr<T>(*mut T);
+
+// The caller guarantees the pointee outlives the async call
+unsafe impl<T> Send for SendPtr<T> {}
+
+impl<T> SendPtr<T> {
+    fn get(&self) -> *mut T {
+        self.0
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn datenlord_cq_new() -> *mut datenlord_cq {
+    let event = match EventFd::from_value_and_flags(0, EfdFlags::EFD_CLOEXEC | EfdFlags::EFD_NONBLOCK) {
+        Ok(event) => event,
+        Err(_) => return ptr::null_mut(),
+    };
+    let cq = Box::new(datenlord_cq {
+        completions: Mutex::new(VecDeque::new()),
+        event,
+    });
+    Box::into_raw(cq)
+}
+
+/// Get the eventfd of the queue, it is readable while completions are pending
+#[no_mangle]
+pub extern "C" fn datenlord_cq_fd(cq: *const datenlord_cq) -> c_int {
+    if cq.is_null() {
+        return -1;
+    }
+    let cq = unsafe { &*cq };
+    cq.event.as_fd().as_raw_fd()
+}
+
+/// Pop up to `max` completions into `out`, return the number popped
+#[no_mangle]
+pub extern "C" fn datenlord_cq_poll(
+    cq: *mut datenlord_cq,
+    out: *mut datenlord_completion,
+    max: usize,
+) -> usize {
+    if cq.is_null() || out.is_null() {
+        return 0;
+    }
+    let cq = unsafe { &*cq };
+    let out = unsafe { std::slice::from_raw_parts_mut(out, max) };
+
+    let mut completions = cq.completions.lock().unwrap();
+    // Reset the counter under the lock, a later post will rearm it
+    let _ = cq.event.read();
+    let count = completions.len().min(max);
+    for (slot, completion) in out.iter_mut().zip(completions.drain(..count)) {
+        *slot = completion;
+    }
+    if !completions.is_empty() {
+        let _ = cq.event.write(1);
+    }
+    count
+}
+
+/// Free the queue, all submitted calls must have completed
+#[no_mangle]
+pub extern "C" fn datenlord_cq_free(cq: *mut datenlord_cq) {
+    if !cq.is_null() {
+        unsafe {
+            let _ = Box::from_raw(cq);
+        }
+    }
+}
+
+/// Copy a c string argument so it can be moved into an async task
+fn owned_path(path: *const c_char) -> String {
+    unsafe { CStr::from_ptr(path).to_str().unwrap_or_default().to_owned() }
+}
+
+#[no_mangle]
+pub extern "C" fn read_file_async(
+    sdk: *mut datenlord_sdk,
+    file_path: *const c_char,
+    out_content: datenlord_bytes,
+    handler: datenlord_async_handler,
+) -> c_int {
+    if sdk.is_null() || file_path.is_null() || !handler.is_valid() {
+        return error::invalid_arguments();
+    }
+
+    let path = owned_path(file_path);
+    let sdk_ref = unsafe { &*sdk };
+    let fs = sdk_ref.fs.clone();
+    let (data, len) = (SendPtr(out_content.data as *mut u8), out_content.len);
+
+    sdk_ref.runtime.spawn(async move {
+        let buffer = unsafe { std::slice::from_raw_parts_mut(data.get(), len) };
+        match ops::read_file(&fs, &path, buffer).await {
+            Ok(size) => handler.complete(0, size),
+            Err(e) => handler.complete(error::fail("Failed to read file", e), 0),
+        }
+    });
+
+    0
+}
+
+/// Read a file from offset into registered buffer `index`
+#[no_mangle]
+pub extern "C" fn read_file_fixed_async(
+    sdk: *mut datenlord_sdk,
+    file_path: *const c_char,
+    offset: u64,
+    index: u32,
+    handler: datenlord_async_handler,
+) -> c_int {
+    if sdk.is_null() || file_path.is_null() || !handler.is_valid() {
+        return error::invalid_arguments();
+    }
+
+    let path = owned_path(file_path);
+    let sdk_ref = unsafe { &*sdk };
+    let fs = sdk_ref.fs.clone();
+
+    sdk_ref.runtime.spawn(async move {
+        match buffers::read_file_fixed(&fs, &path, offset, index).await {
+            Ok(size) => handler.complete(0, size),
+            Err(e) => handler.complete(error::fail("Failed to read file", e), 0),
+        }
+    });
+
+    0
+}
+
+#[no_mangle]
+pub extern "C" fn write_file_async(
+    sdk: *mut datenlord_sdk,
+    file_path: *const c_char,
+    content: datenlord_bytes,
+    handler: datenlord_async_handler,
+) -> c_int {
+    if sdk.is_null() || file_path.is_null() || !handler.is_valid() {
+        return error::invalid_arguments();
+    }
+
+    let path = owned_path(file_path);
+    let sdk_ref = unsafe { &*sdk };
+    let fs = sdk_ref.fs.clone();
+    let (data, len) = (SendPtr(content.data as *mut u8), content.len);
+
+    sdk_ref.runtime.spawn(async move {
+        let data = unsafe { std::slice::from_raw_parts(data.get(), len) };
+        match ops::write_file(&fs, &path, data).await {
+            Ok(_) => handler.complete(0, len),
+            Err(e) => handler.complete(error::fail("Failed to write file", e), 0),
+        }
+    });
+
+    0
+}
+
+#[no_mangle]
+pub extern "C" fn stat_async(
+    sdk: *mut datenlord_sdk,
+    file_path: *const c_char,
+    file_metadata: *mut datenlord_file_stat,
+    handler: datenlord_async_handler,
+) -> c_int {
+    if sdk.is_null() || file_path.is_null() || file_metadata.is_null() || !handler.is_valid() {
+        return error::invalid_arguments();
+    }
+
+    let path = owned_path(file_path);
+    let sdk_ref = unsafe { &*sdk };
+    let fs = sdk_ref.fs.clone();
+    let file_metadata = SendPtr(file_metadata);
+
+    sdk_ref.runtime.spawn(async move {
+        match ops::stat(&fs, &path).await {
+            Ok(attr) => {
+                let file_metadata = unsafe { &mut *file_metadata.get() };
+                file_metadata.fill(&attr);
+                handler.complete(0, 0);
+            }
+            Err(e) => handler.complete(error::fail("Failed to get file metadata", e), 0),
+        }
+    });
+
+    0
+}
+
+#[no_mangle]
+pub extern "C" fn copy_from_local_file_async(
+    sdk: *mut datenlord_sdk,
+    overwrite: bool,
+    local_file_path: *const c_char,
+    dest_file_path: *const c_char,
+    handler: datenlord_async_handler,
+) -> c_int {
+    if sdk.is_null() || local_file_path.is_null() || dest_file_path.is_null() || !handler.is_valid() {
+        return error::invalid_arguments();
+    }
+
+    let local = owned_path(local_file_path);
+    let dest = owned_path(dest_file_path);
+    let sdk_ref = unsafe { &*sdk };
+    let fs = sdk_ref.fs.clone();
+    let options = sdk_ref.config.copy_options();
+
+    sdk_ref.runtime.spawn(async move {
+        match ops::copy_from_local_file(&fs, options, overwrite, &local, &dest).await {
+            Ok(_) => handler.complete(0, 0),
+            Err(e) => handler.complete(error::fail("Failed to copy file", e), 0),
+        }
+    });
+
+    0
+}
+
+#[no_mangle]
+pub extern "C" fn copy_to_local_file_async(
+    sdk: *mut datenlord_sdk,
+    src_file_path: *const c_char,
+    local_file_path: *const c_char,
+    handler: datenlord_async_handler,
+) -> c_int {
+    if sdk.is_null() || src_file_path.is_null() || local_file_path.is_null() || !handler.is_valid() {
+        return error::invalid_arguments();
+    }
+
+    let src = owned_path(src_file_path);
+    let local = owned_path(local_file_path);
+    let sdk_ref = unsafe { &*sdk };
+    let fs = sdk_ref.fs.clone();
+    let options = sdk_ref.config.copy_options();
+
+    sdk_ref.runtime.spawn(async move {
+        match ops::copy_to_local_file(&fs, options, &src, &local).await {
+            Ok(_) => handler.complete(0, 0),
+            Err(e) => handler.complete(error::fail("Failed to copy file to local", e), 0),
+        }
+    });
+
+    0
+}
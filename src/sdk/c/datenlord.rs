@@ -1,24 +1,28 @@
 use std::ffi::CStr;
-use std::os::raw::{c_char, c_uint};
+use std::os::raw::{c_char, c_int, c_void};
 use std::ptr;
 use std::time::SystemTime;
-use bytes::BytesMut;
 use tokio::runtime::Runtime;
-use std::sync::{Arc, Mutex};
-
-use crate::storage::fs_util::{CreateParam, RenameParam};
-use crate::storage::localfs::LocalFS;
-use crate::storage::virtualfs::{INum, VirtualFs};
-
-#[repr(C)]
-#[allow(non_camel_case_types)]
-pub struct datenlord_error {
-    pub code: c_uint,
-    pub message: datenlord_bytes,
-}
+use std::sync::Arc;
+use std::time::Duration;
+use tracing::warn;
+
+use super::error;
+use crate::common::DatenLordError;
+use crate::sdk::buffers;
+use crate::sdk::config::SdkConfig;
+use crate::sdk::daemon;
+use crate::sdk::metrics;
+use crate::sdk::mmap::{self, FileMapping};
+use crate::sdk::vectored;
+use crate::sdk::ops::{self, DirHandle, FileHandle, SdkFs};
+use crate::sdk::tree;
+use crate::storage::fs_util::FileAttr;
+use crate::storage::virtualfs::{DirEntry, INum};
 
 /// File attributes
 #[repr(C)]
+#[derive(Default)]
 #[allow(non_camel_case_types)]
 pub struct datenlord_file_stat {
     /// Inode number
@@ -46,25 +50,125 @@ pub struct datenlord_bytes {
     pub len: usize,
 }
 
-impl datenlord_error {
-    fn new(code: c_uint, message: String) -> *mut datenlord_error {
-        let message_bytes = message.into_bytes();
-        let error = Box::new(datenlord_error {
-            code,
-            message: datenlord_bytes {
-                data: message_bytes.as_ptr(),
-                len: message_bytes.len(),
-            },
-        });
-        Box::into_raw(error)
+impl datenlord_bytes {
+    /// Whether the bytes can be used, `data` may only be null when `len` is 0
+    fn is_valid(&self) -> bool {
+        !self.data.is_null() || self.len == 0
+    }
+
+    /// The bytes as a slice, empty when `len` is 0 whatever `data` is
+    ///
+    /// # Safety
+    /// `data` must point to `len` bytes that outlive the slice
+    unsafe fn as_slice<'a>(&self) -> &'a [u8] {
+        if self.len == 0 {
+            &[]
+        } else {
+            std::slice::from_raw_parts(self.data, self.len)
+        }
+    }
+
+    /// The bytes as a buffer to read into, empty when `len` is 0 whatever `data` is
+    ///
+    /// # Safety
+    /// `data` must point to `len` writable bytes that outlive the slice
+    unsafe fn as_mut_slice<'a>(&self) -> &'a mut [u8] {
+        if self.len == 0 {
+            &mut []
+        } else {
+            std::slice::from_raw_parts_mut(self.data as *mut u8, self.len)
+        }
     }
 }
 
-#[repr(C)]
+/// How long `free_sdk` waits for in-flight tasks on the shared runtime
+const RUNTIME_SHUTDOWN_TIMEOUT: Duration = Duration::from_secs(10);
+
 #[allow(non_camel_case_types)]
 pub struct datenlord_sdk {
     // Do not expose the internal structure
-    localfs: Arc<Mutex<LocalFS>>,
+    pub(crate) fs: Arc<SdkFs>,
+    /// Runtime shared by all calls, created in `init` and shut down in `free_sdk`
+    pub(crate) runtime: Runtime,
+    /// The config passed to `init`
+    pub(crate) config: SdkConfig,
+}
+
+/// An open file, created by `datenlord_open` and released by `datenlord_close`
+#[allow(non_camel_case_types)]
+pub struct datenlord_file {
+    // Do not expose the internal structure
+    pub(crate) handle: FileHandle,
+}
+
+/// An open directory, created by `datenlord_opendir` and released by `datenlord_closedir`
+#[allow(non_camel_case_types)]
+pub struct datenlord_dir {
+    // Do not expose the internal structure
+    pub(crate) handle: DirHandle,
+    /// Whether entries come with their attributes
+    pub(crate) plus: bool,
+    /// The page being returned, the names handed out point into it
+    pub(crate) page: Vec<DirEntry>,
+    /// Attributes of the page entries when `plus` is set
+    pub(crate) attrs: Vec<Option<FileAttr>>,
+    /// Index of the next entry of the page to return
+    pub(crate) next: usize,
+}
+
+/// A directory entry returned by `datenlord_readdir_next`
+#[repr(C)]
+#[allow(non_camel_case_types)]
+pub struct datenlord_dirent {
+    /// Inode number
+    pub ino: INum,
+    /// File type, the `S_IFMT` bits of the mode
+    pub kind: u32,
+    /// Entry name, not nul terminated, valid until the next call on the directory
+    pub name: datenlord_bytes,
+    /// Whether `stat` is filled, only for directories opened with `plus`
+    pub has_stat: bool,
+    /// Attributes of the entry
+    pub stat: datenlord_file_stat,
+}
+
+/// Counters of the block read cache
+#[repr(C)]
+#[allow(non_camel_case_types)]
+#[derive(Default)]
+pub struct datenlord_cache_stats {
+    /// Blocks served from the cache
+    pub hits: u64,
+    /// Blocks read from the filesystem
+    pub misses: u64,
+    /// Blocks evicted to stay within the budget
+    pub evictions: u64,
+    /// Bytes of the cached blocks
+    pub bytes: u64,
+    /// The byte budget, `block_cache_bytes` of the config
+    pub capacity: u64,
+}
+
+/// A segment of a vectored read or write
+#[repr(C)]
+#[allow(non_camel_case_types)]
+pub struct datenlord_iovec {
+    /// Offset in the file
+    pub offset: u64,
+    /// The buffer of the segment
+    pub buf: datenlord_bytes,
+}
+
+/// A read-only view of a file returned by `datenlord_mmap`
+#[repr(C)]
+#[allow(non_camel_case_types)]
+pub struct datenlord_mapping {
+    /// Start of the range
+    pub data: *const u8,
+    /// Length of the range
+    pub len: usize,
+    /// Owner of the view, released by `datenlord_munmap`
+    pub inner: *mut c_void,
 }
 
 #[no_mangle]
@@ -79,9 +183,24 @@ pub extern "C" fn init(config: *const c_char) -> *mut datenlord_sdk {
             .unwrap_or("default config")
     };
 
-    let localfs = LocalFS::new().unwrap();
+    let config = SdkConfig::parse(config_str);
+    config.init_logging();
+    let runtime = match config.build_runtime() {
+        Ok(runtime) => runtime,
+        Err(_) => return ptr::null_mut(),
+    };
+
+    let backend = match config.backend.build() {
+        Ok(backend) => backend,
+        Err(e) => {
+            warn!("failed to init sdk: {}", e);
+            return ptr::null_mut();
+        }
+    };
     let sdk = Box::new(datenlord_sdk {
-        localfs: Arc::new(Mutex::new(localfs)),
+        fs: Arc::new(SdkFs::new(backend, &config)),
+        runtime,
+        config,
     });
 
     Box::into_raw(sdk)
@@ -90,9 +209,39 @@ pub extern "C" fn init(config: *const c_char) -> *mut datenlord_sdk {
 #[no_mangle]
 pub extern "C" fn free_sdk(sdk: *mut datenlord_sdk) {
     if !sdk.is_null() {
-        unsafe {
-            let _ = Box::from_raw(sdk);
+        let sdk = unsafe { Box::from_raw(sdk) };
+        sdk.runtime.shutdown_timeout(RUNTIME_SHUTDOWN_TIMEOUT);
+    }
+}
+
+/// Serve the sdk to the clients on this host through a unix socket, until
+/// `free_sdk`. Clients connect with a `daemon` backend naming the socket.
+#[no_mangle]
+pub extern "C" fn datenlord_serve(sdk: *mut datenlord_sdk, socket_path: *const c_char) -> c_int {
+    if sdk.is_null() || socket_path.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let path = unsafe { CStr::from_ptr(socket_path).to_str().unwrap_or_default() };
+    let sdk_ref = unsafe { &*sdk };
+
+    // The listeners register with the reactor of the sdk runtime
+    let _runtime = sdk_ref.runtime.enter();
+    let metrics_addr = &sdk_ref.config.metrics_addr;
+    let listeners = daemon::server::bind(path).and_then(|listener| {
+        let scrape = if metrics_addr.is_empty() { None } else { Some(metrics::bind_prometheus(metrics_addr)?) };
+        Ok((listener, scrape))
+    });
+    match listeners {
+        Ok((listener, scrape)) => {
+            let serve = daemon::server::serve(Arc::clone(&sdk_ref.fs), listener, sdk_ref.config.ring_options());
+            sdk_ref.runtime.spawn(serve);
+            if let Some(scrape) = scrape {
+                sdk_ref.runtime.spawn(metrics::serve_prometheus(Arc::clone(&sdk_ref.fs), scrape));
+            }
+            0
         }
+        Err(e) => error::fail("Failed to serve sdk", e),
     }
 }
 
@@ -106,75 +255,51 @@ pub extern "C" fn exists(sdk: *mut datenlord_sdk, dir_path: *const c_char) -> bo
 
     let sdk_ref = unsafe { &*sdk };
 
-    let rt = Runtime::new().unwrap();
-    let result = rt.block_on(async {
-        let localfs = sdk_ref.localfs.lock().unwrap();
-        // demo inode info
-        localfs.lookup(1000, 1000, 1, path).await
-    });
-
-    result.is_ok()
+    sdk_ref.runtime.block_on(ops::exists(&sdk_ref.fs, path))
 }
 
+/// Create a directory
 #[no_mangle]
-pub extern "C" fn mkdir(sdk: *mut datenlord_sdk, dir_path: *const c_char) -> *mut datenlord_error {
+pub extern "C" fn datenlord_mkdir(sdk: *mut datenlord_sdk, dir_path: *const c_char) -> c_int {
     if sdk.is_null() || dir_path.is_null() {
-        return datenlord_error::new(1, "Invalid arguments".to_string());
+        return error::invalid_arguments();
     }
 
-    println!("mkdir path {:?}", dir_path);
-
     let path = unsafe { CStr::from_ptr(dir_path).to_str().unwrap_or_default() };
 
     let sdk_ref = unsafe { &*sdk };
 
-    let rt = Runtime::new().unwrap();
-    let result = rt.block_on(async {
-        let param = CreateParam {
-            parent: 34735213,// test inode
-            name: path.to_string(),
-            mode: 0o777,
-            rdev: 0,
-            uid: 1000,
-            gid: 1000,
-            node_type: nix::sys::stat::SFlag::S_IFDIR,
-            link: None,
-        };
-
-        let localfs = sdk_ref.localfs.lock().unwrap();
-        localfs.mkdir(param).await
-    });
+    let result = sdk_ref.runtime.block_on(ops::mkdir(&sdk_ref.fs, path));
 
     match result {
-        Ok(_) => std::ptr::null_mut(),
-        Err(_) => datenlord_error::new(1, "Failed to create directory".to_string()),
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to create directory", e),
     }
-
 }
 
+/// Remove a directory, with everything below it when `recursive` is set
 #[no_mangle]
 pub extern "C" fn deldir(
     sdk: *mut datenlord_sdk,
     dir_path: *const c_char,
     recursive: bool
-) -> *mut datenlord_error {
+) -> c_int {
     if sdk.is_null() || dir_path.is_null() {
-        return datenlord_error::new(1, "Invalid arguments".to_string());
+        return error::invalid_arguments();
     }
 
     let path = unsafe { CStr::from_ptr(dir_path).to_str().unwrap_or_default() };
     let sdk_ref = unsafe { &*sdk };
 
-    let rt = Runtime::new().unwrap();
-    // dimiss recursive now
-    let result = rt.block_on(async {
-        let localfs = sdk_ref.localfs.lock().unwrap();
-        localfs.rmdir(1000, 1000, 1, path).await
-    });
+    let result = if recursive {
+        sdk_ref.runtime.block_on(tree::remove_tree(&sdk_ref.fs, path))
+    } else {
+        sdk_ref.runtime.block_on(ops::deldir(&sdk_ref.fs, path))
+    };
 
     match result {
-        Ok(_) => std::ptr::null_mut(),
-        Err(_) => datenlord_error::new(1, "Failed to remove directory".to_string()),
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to remove directory", e),
     }
 }
 
@@ -183,31 +308,34 @@ pub extern "C" fn rename_path(
     sdk: *mut datenlord_sdk,
     src_path: *const c_char,
     dest_path: *const c_char
-) -> *mut datenlord_error {
+) -> c_int {
     if sdk.is_null() || src_path.is_null() || dest_path.is_null() {
-        return datenlord_error::new(1, "Invalid arguments".to_string());
+        return error::invalid_arguments();
     }
 
     let src = unsafe { CStr::from_ptr(src_path).to_str().unwrap_or_default() };
     let dest = unsafe { CStr::from_ptr(dest_path).to_str().unwrap_or_default() };
     let sdk_ref = unsafe { &*sdk };
 
-    let rt = Runtime::new().unwrap();
-    let result = rt.block_on(async {
-        let param = RenameParam {
-            old_parent: 1,
-            old_name: src.to_string(),
-            new_parent: 1,
-            new_name: dest.to_string(),
-            flags: 0,
-        };
-        let localfs = sdk_ref.localfs.lock().unwrap();
-        localfs.rename(1000, 1000, param).await
-    });
+    let result = sdk_ref.runtime.block_on(ops::rename(&sdk_ref.fs, src, dest));
 
     match result {
-        Ok(_) => std::ptr::null_mut(),
-        Err(_) => datenlord_error::new(1, "Failed to rename path".to_string()),
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to rename path", e),
+    }
+}
+
+impl datenlord_file_stat {
+    /// Fill the c file metadata from file attributes
+    pub(crate) fn fill(&mut self, attr: &FileAttr) {
+        self.ino = attr.ino;
+        self.size = attr.size;
+        self.blocks = attr.blocks;
+        self.perm = attr.perm;
+        self.uid = attr.uid;
+        self.gid = attr.gid;
+        self.nlink = attr.nlink;
+        self.rdev = attr.rdev;
     }
 }
 
@@ -217,37 +345,22 @@ pub extern "C" fn copy_from_local_file(
     overwrite: bool,
     local_file_path: *const c_char,
     dest_file_path: *const c_char
-) -> *mut datenlord_error {
+) -> c_int {
     if sdk.is_null() || local_file_path.is_null() || dest_file_path.is_null() {
-        return datenlord_error::new(1, "Invalid arguments".to_string());
+        return error::invalid_arguments();
     }
 
     let local = unsafe { CStr::from_ptr(local_file_path).to_str().unwrap_or_default() };
     let dest = unsafe { CStr::from_ptr(dest_file_path).to_str().unwrap_or_default() };
     let sdk_ref = unsafe { &*sdk };
 
-    let rt = Runtime::new().unwrap();
-    let result = rt.block_on(async {
-        let localfs = sdk_ref.localfs.lock().unwrap();
-
-        if !overwrite && localfs.lookup(1000, 1000, 1, dest).await.is_ok() {
-            return Err(());
-        }
-
-        match std::fs::read(local) {
-            Ok(content) => {
-                match localfs.write(1, 0, 0, &content, 0).await {
-                    Ok(_) => Ok(()),
-                    Err(_) => Err(()),
-                }
-            }
-            Err(_) => Err(()),
-        }
-    });
+    let result = sdk_ref.runtime.block_on(
+        ops::copy_from_local_file(&sdk_ref.fs, sdk_ref.config.copy_options(), overwrite, local, dest)
+    );
 
     match result {
-        Ok(_) => std::ptr::null_mut(),
-        Err(_) => datenlord_error::new(1, "Failed to copy file".to_string()),
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to copy file", e),
     }
 }
 
@@ -256,140 +369,236 @@ pub extern "C" fn copy_to_local_file(
     sdk: *mut datenlord_sdk,
     src_file_path: *const c_char,
     local_file_path: *const c_char
-) -> *mut datenlord_error {
+) -> c_int {
     if sdk.is_null() || src_file_path.is_null() || local_file_path.is_null() {
-        return datenlord_error::new(1, "Invalid arguments".to_string());
+        return error::invalid_arguments();
     }
 
     let src = unsafe { CStr::from_ptr(src_file_path).to_str().unwrap_or_default() };
     let local = unsafe { CStr::from_ptr(local_file_path).to_str().unwrap_or_default() };
     let sdk_ref = unsafe { &*sdk };
 
-    let rt = Runtime::new().unwrap();
-    let result = rt.block_on(async {
-        let mut buf = BytesMut::new();
-        let localfs = sdk_ref.localfs.lock().unwrap();
+    let result = sdk_ref.runtime.block_on(
+        ops::copy_to_local_file(&sdk_ref.fs, sdk_ref.config.copy_options(), src, local)
+    );
 
-        // for demo purpose, we need to get the hole file size
-        match localfs.read(1, 0, 0, 1024, &mut buf).await {
-            Ok(size) => {
-                match std::fs::write(local, &buf[..size]) {
-                    Ok(_) => Ok(()),
-                    Err(_) => Err(()),
-                }
-            }
-            Err(_) => Err(()),
-        }
-    });
+    match result {
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to copy file to local", e),
+    }
+}
+
+/// Copy a regular file to `dest_path`, replacing it. The backend copies the
+/// file by itself when it can, without the data going through the sdk.
+#[no_mangle]
+pub extern "C" fn datenlord_copy(
+    sdk: *mut datenlord_sdk,
+    src_path: *const c_char,
+    dest_path: *const c_char
+) -> c_int {
+    if sdk.is_null() || src_path.is_null() || dest_path.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let src = unsafe { CStr::from_ptr(src_path).to_str().unwrap_or_default() };
+    let dest = unsafe { CStr::from_ptr(dest_path).to_str().unwrap_or_default() };
+    let sdk_ref = unsafe { &*sdk };
+
+    let result = sdk_ref.runtime.block_on(
+        ops::copy(&sdk_ref.fs, sdk_ref.config.copy_options(), src, dest)
+    );
 
     match result {
-        Ok(_) => std::ptr::null_mut(),
-        Err(_) => datenlord_error::new(1, "Failed to copy file to local".to_string()),
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to copy file", e),
     }
 }
 
+/// Copy a directory with everything below it to `dest_path`, which must not
+/// exist. Regular files and directories are copied, other entries skipped.
+#[no_mangle]
+pub extern "C" fn datenlord_copy_tree(
+    sdk: *mut datenlord_sdk,
+    src_path: *const c_char,
+    dest_path: *const c_char
+) -> c_int {
+    if sdk.is_null() || src_path.is_null() || dest_path.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let src = unsafe { CStr::from_ptr(src_path).to_str().unwrap_or_default() };
+    let dest = unsafe { CStr::from_ptr(dest_path).to_str().unwrap_or_default() };
+    let sdk_ref = unsafe { &*sdk };
+
+    let result = sdk_ref.runtime.block_on(
+        tree::copy_tree(&sdk_ref.fs, sdk_ref.config.copy_options(), src, dest)
+    );
+
+    match result {
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to copy directory tree", e),
+    }
+}
 
 #[no_mangle]
 pub extern "C" fn create_file(
     sdk: *mut datenlord_sdk,
     file_path: *const c_char
-) -> *mut datenlord_error {
+) -> c_int {
     if sdk.is_null() || file_path.is_null() {
-        return datenlord_error::new(1, "Invalid arguments".to_string());
+        return error::invalid_arguments();
     }
 
     let path = unsafe { CStr::from_ptr(file_path).to_str().unwrap_or_default() };
     let sdk_ref = unsafe { &*sdk };
 
-    let rt = Runtime::new().unwrap();
-    let result = rt.block_on(async {
-        let param = CreateParam {
-            parent: 1,
-            name: path.to_string(),
-            mode: 0o644,
-            rdev: 0,
-            uid: 1000,
-            gid: 1000,
-            node_type: nix::sys::stat::SFlag::S_IFREG,
-            link: None,
-        };
-
-        let localfs = sdk_ref.localfs.lock().unwrap();
-        localfs.mknod(param).await
-    });
+    let result = sdk_ref.runtime.block_on(ops::create_file(&sdk_ref.fs, path));
 
     match result {
-        Ok(_) => std::ptr::null_mut(),
-        Err(_) => datenlord_error::new(1, "Failed to create file".to_string()),
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to create file", e),
     }
 }
 
+/// Get the attributes of a file
 #[no_mangle]
-pub extern "C" fn stat(
+pub extern "C" fn datenlord_stat(
     sdk: *mut datenlord_sdk,
     file_path: *const c_char,
     file_metadata: *mut datenlord_file_stat
-) -> *mut datenlord_error {
-    if sdk.is_null() || file_path.is_null() {
-        return datenlord_error::new(1, "Invalid arguments".to_string());
-    }
-    if file_metadata.is_null() {
-        return datenlord_error::new(1, "Invalid arguments".to_string());
+) -> c_int {
+    if sdk.is_null() || file_path.is_null() || file_metadata.is_null() {
+        return error::invalid_arguments();
     }
 
     let path = unsafe { CStr::from_ptr(file_path).to_str().unwrap_or_default() };
     let sdk_ref = unsafe { &*sdk };
     let file_metadata: &mut datenlord_file_stat = unsafe { &mut *file_metadata };
 
-    let rt = Runtime::new().unwrap();
-    let result = rt.block_on(async {
-        let localfs = sdk_ref.localfs.lock().unwrap();
-        localfs.getattr(1).await  // 示例 inode
-    });
+    let result = sdk_ref.runtime.block_on(ops::stat(&sdk_ref.fs, path));
 
     match result {
         Ok(attr) => {
-            println!("File duration: {:?}, attr: {:?}", attr.0, attr.1);
             // Convert to file metadata
-            file_metadata.size = attr.1.size;
-            file_metadata.uid = attr.1.uid;
-            file_metadata.gid = attr.1.gid;
-            file_metadata.nlink = attr.1.nlink;
-            file_metadata.rdev = attr.1.rdev;
+            file_metadata.fill(&attr);
+            0
+        }
+        Err(e) => error::fail("Failed to get file metadata", e),
+    }
+}
+
+/// Copy a c array of `n` c string paths
+fn owned_paths(paths: *const *const c_char, n: usize) -> Vec<String> {
+    let paths = unsafe { std::slice::from_raw_parts(paths, n) };
+    paths
+        .iter()
+        .map(|&path| {
+            if path.is_null() {
+                return String::new();
+            }
+            unsafe { CStr::from_ptr(path).to_str().unwrap_or_default().to_owned() }
+        })
+        .collect()
+}
+
+/// Stat `n` paths concurrently into `out`. When `errs` is set, `errs[i]` is
+/// 0 or the error code of `paths[i]`, otherwise any failure fails the call.
+/// Failed entries of `out` are zeroed.
+#[no_mangle]
+pub extern "C" fn datenlord_stat_batch(
+    sdk: *mut datenlord_sdk,
+    paths: *const *const c_char,
+    n: usize,
+    out: *mut datenlord_file_stat,
+    errs: *mut c_int,
+) -> c_int {
+    if sdk.is_null() || (n > 0 && (paths.is_null() || out.is_null())) {
+        return error::invalid_arguments();
+    }
+    if n == 0 {
+        return 0;
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let paths = owned_paths(paths, n);
+    let out = unsafe { std::slice::from_raw_parts_mut(out, n) };
+
+    let results = sdk_ref.runtime.block_on(ops::stat_batch(&sdk_ref.fs, paths));
 
-            std::ptr::null_mut()
+    let mut first_error = None;
+    for (index, (slot, result)) in out.iter_mut().zip(results).enumerate() {
+        let code = match result {
+            Ok(attr) => {
+                slot.fill(&attr);
+                0
+            }
+            Err(e) => {
+                *slot = datenlord_file_stat::default();
+                let code = e.errno();
+                first_error.get_or_insert(e);
+                code
+            }
+        };
+        if !errs.is_null() {
+            unsafe {
+                *errs.add(index) = code;
+            }
         }
-        Err(_) => datenlord_error::new(1, "Failed to get file metadata".to_string()),
+    }
+
+    match first_error {
+        Some(e) if errs.is_null() => error::fail("Failed to get file metadata", e),
+        _ => 0,
     }
 }
 
+/// Check `n` paths concurrently, `out[i]` tells whether `paths[i]` exists
+#[no_mangle]
+pub extern "C" fn datenlord_exists_batch(
+    sdk: *mut datenlord_sdk,
+    paths: *const *const c_char,
+    n: usize,
+    out: *mut bool,
+) -> c_int {
+    if sdk.is_null() || (n > 0 && (paths.is_null() || out.is_null())) {
+        return error::invalid_arguments();
+    }
+    if n == 0 {
+        return 0;
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let paths = owned_paths(paths, n);
+    let out = unsafe { std::slice::from_raw_parts_mut(out, n) };
+
+    let results = sdk_ref.runtime.block_on(ops::stat_batch(&sdk_ref.fs, paths));
+
+    for (slot, result) in out.iter_mut().zip(results) {
+        *slot = result.is_ok();
+    }
+    0
+}
+
 #[no_mangle]
 pub extern "C" fn write_file(
     sdk: *mut datenlord_sdk,
     file_path: *const c_char,
     content: datenlord_bytes,
-) -> *mut datenlord_error {
-    if sdk.is_null() || file_path.is_null() {
-        return datenlord_error::new(1, "Invalid arguments".to_string());
+) -> c_int {
+    if sdk.is_null() || file_path.is_null() || !content.is_valid() {
+        return error::invalid_arguments();
     }
 
     let path = unsafe { CStr::from_ptr(file_path).to_str().unwrap_or_default() };
-    let data = unsafe { std::slice::from_raw_parts(content.data, content.len) };
-
-    println!("Writing file: {} data size: {} data {}", path, data.len(), String::from_utf8_lossy(data));
+    let data = unsafe { content.as_slice() };
 
     let sdk_ref = unsafe { &*sdk };
 
-    let rt = Runtime::new().unwrap();
-    let result = rt.block_on(async {
-        let localfs = sdk_ref.localfs.lock().unwrap();
-        // demo params
-        localfs.write(34734588, 0, 0, data, 0).await
-    });
+    let result = sdk_ref.runtime.block_on(ops::write_file(&sdk_ref.fs, path, data));
 
     match result {
-        Ok(_) => std::ptr::null_mut(),
-        Err(_) => datenlord_error::new(1, "Failed to write file".to_string()),
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to write file", e),
     }
 }
 
@@ -398,35 +607,759 @@ pub extern "C" fn read_file(
     sdk: *mut datenlord_sdk,
     file_path: *const c_char,
     out_content: *mut datenlord_bytes,
-) -> *mut datenlord_error {
+) -> c_int {
+    if sdk.is_null() || file_path.is_null() || out_content.is_null() || !unsafe { (*out_content).is_valid() } {
+        return error::invalid_arguments();
+    }
+
+    let path = unsafe { CStr::from_ptr(file_path).to_str().unwrap_or_default() };
+
+    let sdk_ref = unsafe { &*sdk };
+
+    let buffer = unsafe { (*out_content).as_mut_slice() };
+
+    let result = sdk_ref.runtime.block_on(ops::read_file(&sdk_ref.fs, path, buffer));
+
+    match result {
+        Ok(size) => {
+            unsafe {
+                (*out_content).len = size;
+            }
+            0
+        }
+        Err(e) => error::fail("Failed to read file", e),
+    }
+}
+
+/// Allocate a buffer of `size` bytes for `read_file_alloc`, return null on failure
+#[allow(non_camel_case_types)]
+pub type datenlord_alloc_fn = extern "C" fn(ctx: *mut c_void, size: usize) -> *mut u8;
+
+/// Read a file at offset into `out_content`, its len is set to the number of bytes read
+#[no_mangle]
+pub extern "C" fn read_file_at(
+    sdk: *mut datenlord_sdk,
+    file_path: *const c_char,
+    offset: u64,
+    out_content: *mut datenlord_bytes,
+) -> c_int {
+    if sdk.is_null() || file_path.is_null() || out_content.is_null() || !unsafe { (*out_content).is_valid() } {
+        return error::invalid_arguments();
+    }
+
+    let path = unsafe { CStr::from_ptr(file_path).to_str().unwrap_or_default() };
+    let sdk_ref = unsafe { &*sdk };
+    let buffer = unsafe { (*out_content).as_mut_slice() };
+
+    let result = sdk_ref.runtime.block_on(ops::read_file_at(&sdk_ref.fs, path, offset, buffer));
+
+    match result {
+        Ok(size) => {
+            unsafe {
+                (*out_content).len = size;
+            }
+            0
+        }
+        Err(e) => error::fail("Failed to read file", e),
+    }
+}
+
+/// Read a whole file in one call, the buffer is taken from `alloc` once the
+/// file size is known and returned in `out_content`
+#[no_mangle]
+pub extern "C" fn read_file_alloc(
+    sdk: *mut datenlord_sdk,
+    file_path: *const c_char,
+    alloc: datenlord_alloc_fn,
+    ctx: *mut c_void,
+    out_content: *mut datenlord_bytes,
+) -> c_int {
     if sdk.is_null() || file_path.is_null() || out_content.is_null() {
-        return datenlord_error::new(1, "Invalid arguments".to_string());
+        return error::invalid_arguments();
     }
 
     let path = unsafe { CStr::from_ptr(file_path).to_str().unwrap_or_default() };
+    let sdk_ref = unsafe { &*sdk };
+    let mut data: *mut u8 = ptr::null_mut();
+
+    // The future runs on the calling thread, so does `alloc`
+    let result = sdk_ref.runtime.block_on(ops::read_whole_file(&sdk_ref.fs, path, |size| {
+        data = alloc(ctx, size);
+        if data.is_null() {
+            // An empty file may legitimately get a null buffer
+            return (size == 0).then_some(&mut []);
+        }
+        Some(unsafe { std::slice::from_raw_parts_mut(data, size) })
+    }));
+
+    match result {
+        Ok(size) => {
+            unsafe {
+                (*out_content).data = data;
+                (*out_content).len = size;
+            }
+            0
+        }
+        Err(e) => error::fail("Failed to read file", e),
+    }
+}
 
+/// Open a file, `flags` are the open(2) flags
+#[no_mangle]
+pub extern "C" fn datenlord_open(
+    sdk: *mut datenlord_sdk,
+    file_path: *const c_char,
+    flags: u32,
+    out_file: *mut *mut datenlord_file,
+) -> c_int {
+    if sdk.is_null() || file_path.is_null() || out_file.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let path = unsafe { CStr::from_ptr(file_path).to_str().unwrap_or_default() };
     let sdk_ref = unsafe { &*sdk };
 
-    let rt = Runtime::new().unwrap();
-    // TODO, use outside buffer
-    let result = rt.block_on(async {
-        let localfs = sdk_ref.localfs.lock().unwrap();
+    let result = sdk_ref.runtime.block_on(ops::open_file(&sdk_ref.fs, path, flags));
+
+    match result {
+        Ok(handle) => {
+            let file = Box::new(datenlord_file { handle });
+            unsafe {
+                *out_file = Box::into_raw(file);
+            }
+            0
+        }
+        Err(e) => error::fail("Failed to open file", e),
+    }
+}
 
-        // Convert buffer to c buffer
-        let out_content_data = unsafe { (*out_content).data as *mut u8 };
-        let out_content_len = unsafe { (*out_content).len };
-        let buffer: &mut [u8] = unsafe { std::slice::from_raw_parts_mut(out_content_data, out_content_len) };
+/// Create a regular file with `mode` and open it, `flags` are the open(2)
+/// flags. An existing file is opened instead unless `O_EXCL` is set. When
+/// `out_stat` is set it gets the attributes of the file as it was opened.
+#[no_mangle]
+pub extern "C" fn datenlord_create_open(
+    sdk: *mut datenlord_sdk,
+    file_path: *const c_char,
+    mode: u32,
+    flags: u32,
+    out_file: *mut *mut datenlord_file,
+    out_stat: *mut datenlord_file_stat,
+) -> c_int {
+    if sdk.is_null() || file_path.is_null() || out_file.is_null() {
+        return error::invalid_arguments();
+    }
 
-        localfs.read(34734588, 0, 0, buffer.len() as u32, buffer).await
-    });
+    let path = unsafe { CStr::from_ptr(file_path).to_str().unwrap_or_default() };
+    let sdk_ref = unsafe { &*sdk };
+
+    let result = sdk_ref.runtime.block_on(ops::create_open(&sdk_ref.fs, path, mode, flags));
+
+    match result {
+        Ok((handle, attr)) => {
+            if !out_stat.is_null() {
+                unsafe { (*out_stat).fill(&attr) };
+            }
+            let file = Box::new(datenlord_file { handle });
+            unsafe {
+                *out_file = Box::into_raw(file);
+            }
+            0
+        }
+        Err(e) => error::fail("Failed to create file", e),
+    }
+}
+
+/// Create or replace a file with `content`, created, written and closed in one call
+#[no_mangle]
+pub extern "C" fn datenlord_put(
+    sdk: *mut datenlord_sdk,
+    file_path: *const c_char,
+    content: datenlord_bytes,
+) -> c_int {
+    if sdk.is_null() || file_path.is_null() || !content.is_valid() {
+        return error::invalid_arguments();
+    }
+
+    let path = unsafe { CStr::from_ptr(file_path).to_str().unwrap_or_default() };
+    let data = unsafe { content.as_slice() };
+    let sdk_ref = unsafe { &*sdk };
+
+    let result = sdk_ref.runtime.block_on(ops::put(&sdk_ref.fs, path, data));
+
+    match result {
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to put file", e),
+    }
+}
+
+/// Read at offset into `out_content`, its len is set to the number of bytes read
+#[no_mangle]
+pub extern "C" fn datenlord_pread(
+    sdk: *mut datenlord_sdk,
+    file: *mut datenlord_file,
+    offset: u64,
+    out_content: *mut datenlord_bytes,
+) -> c_int {
+    if sdk.is_null() || file.is_null() || out_content.is_null() || !unsafe { (*out_content).is_valid() } {
+        return error::invalid_arguments();
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let file_ref = unsafe { &*file };
+    let buffer = unsafe { (*out_content).as_mut_slice() };
+
+    let result = sdk_ref.runtime.block_on(
+        ops::pread(&sdk_ref.fs, &file_ref.handle, offset, buffer)
+    );
 
     match result {
         Ok(size) => {
             unsafe {
                 (*out_content).len = size;
             }
-            std::ptr::null_mut()
+            0
         }
-        Err(_) => datenlord_error::new(1, "Failed to read file".to_string()),
+        Err(e) => error::fail("Failed to read file", e),
+    }
+}
+
+/// Write the whole content at offset, with write-back the write is buffered
+/// and its errors are returned by the next flush, fsync or close
+#[no_mangle]
+pub extern "C" fn datenlord_pwrite(
+    sdk: *mut datenlord_sdk,
+    file: *mut datenlord_file,
+    offset: u64,
+    content: datenlord_bytes,
+) -> c_int {
+    if sdk.is_null() || file.is_null() || !content.is_valid() {
+        return error::invalid_arguments();
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let file_ref = unsafe { &*file };
+    let data = unsafe { content.as_slice() };
+
+    let result = sdk_ref.runtime.block_on(
+        ops::pwrite(&sdk_ref.fs, &file_ref.handle, offset, data)
+    );
+
+    match result {
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to write file", e),
+    }
+}
+
+/// Read `n` segments at their offsets in one call, the `len` of each buffer
+/// is set to the number of bytes read into it. Nearby segments are merged
+/// into larger reads, which run concurrently.
+#[no_mangle]
+pub extern "C" fn datenlord_preadv(
+    sdk: *mut datenlord_sdk,
+    file: *mut datenlord_file,
+    iov: *mut datenlord_iovec,
+    n: usize,
+) -> c_int {
+    if sdk.is_null() || file.is_null() || (iov.is_null() && n > 0) {
+        return error::invalid_arguments();
     }
-}
\ No newline at end of file
+    if n == 0 {
+        return 0;
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let file_ref = unsafe { &*file };
+    let iov = unsafe { std::slice::from_raw_parts_mut(iov, n) };
+    if !iov.iter().all(|segment| segment.buf.is_valid()) {
+        return error::invalid_arguments();
+    }
+    let mut segments: Vec<(u64, &mut [u8])> = iov
+        .iter()
+        .map(|segment| (segment.offset, unsafe { segment.buf.as_mut_slice() }))
+        .collect();
+
+    let result = sdk_ref.runtime.block_on(
+        vectored::preadv(&sdk_ref.fs, &file_ref.handle, &mut segments)
+    );
+
+    match result {
+        Ok(sizes) => {
+            for (segment, size) in iov.iter_mut().zip(sizes) {
+                segment.buf.len = size;
+            }
+            0
+        }
+        Err(e) => error::fail("Failed to read file", e),
+    }
+}
+
+/// Write `n` segments at their offsets in one call, adjacent segments are
+/// merged into one write and overlapping segments are written in order
+#[no_mangle]
+pub extern "C" fn datenlord_pwritev(
+    sdk: *mut datenlord_sdk,
+    file: *mut datenlord_file,
+    iov: *const datenlord_iovec,
+    n: usize,
+) -> c_int {
+    if sdk.is_null() || file.is_null() || (iov.is_null() && n > 0) {
+        return error::invalid_arguments();
+    }
+    if n == 0 {
+        return 0;
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let file_ref = unsafe { &*file };
+    let iov = unsafe { std::slice::from_raw_parts(iov, n) };
+    if !iov.iter().all(|segment| segment.buf.is_valid()) {
+        return error::invalid_arguments();
+    }
+    let segments: Vec<(u64, &[u8])> = iov
+        .iter()
+        .map(|segment| (segment.offset, unsafe { segment.buf.as_slice() }))
+        .collect();
+
+    let result = sdk_ref.runtime.block_on(
+        vectored::pwritev(&sdk_ref.fs, &file_ref.handle, &segments)
+    );
+
+    match result {
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to write file", e),
+    }
+}
+
+/// Register `n` buffers of `buffers[i].len` bytes, `buffers[i].data` is set
+/// to each. The id of a buffer is its index. The buffers are carved out of
+/// one locked arena owned by the sdk, valid until `datenlord_unregister_buffers`.
+#[no_mangle]
+pub extern "C" fn datenlord_register_buffers(
+    sdk: *mut datenlord_sdk,
+    buffers: *mut datenlord_bytes,
+    n: usize,
+) -> c_int {
+    if sdk.is_null() || buffers.is_null() || n == 0 {
+        return error::invalid_arguments();
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let buffers = unsafe { std::slice::from_raw_parts_mut(buffers, n) };
+    let sizes: Vec<usize> = buffers.iter().map(|buffer| buffer.len).collect();
+
+    let result = sdk_ref.runtime.block_on(buffers::register(&sdk_ref.fs, &sizes));
+
+    match result {
+        Ok(registration) => {
+            for (index, buffer) in buffers.iter_mut().enumerate() {
+                buffer.data = registration.buffer_ptr(index as u32).map_or(ptr::null(), <*mut u8>::cast_const);
+            }
+            0
+        }
+        Err(e) => error::fail("Failed to register buffers", e),
+    }
+}
+
+/// Unregister the buffers, the calls still using them keep them alive until they return
+#[no_mangle]
+pub extern "C" fn datenlord_unregister_buffers(sdk: *mut datenlord_sdk) -> c_int {
+    if sdk.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+
+    match sdk_ref.runtime.block_on(buffers::unregister(&sdk_ref.fs)) {
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to unregister buffers", e),
+    }
+}
+
+/// Read at offset into `len` bytes of registered buffer `index` from
+/// `buffer_offset`, 0 reads up to the end of the buffer
+#[no_mangle]
+pub extern "C" fn datenlord_pread_fixed(
+    sdk: *mut datenlord_sdk,
+    file: *mut datenlord_file,
+    offset: u64,
+    index: u32,
+    buffer_offset: usize,
+    len: usize,
+    out_read: *mut usize,
+) -> c_int {
+    if sdk.is_null() || file.is_null() || out_read.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let file_ref = unsafe { &*file };
+
+    let result = sdk_ref.runtime.block_on(
+        buffers::pread_fixed(&sdk_ref.fs, &file_ref.handle, offset, index, buffer_offset, len)
+    );
+
+    match result {
+        Ok(size) => {
+            unsafe {
+                *out_read = size;
+            }
+            0
+        }
+        Err(e) => error::fail("Failed to read file", e),
+    }
+}
+
+/// Write `len` bytes of registered buffer `index` from `buffer_offset` at
+/// offset, 0 writes up to the end of the buffer
+#[no_mangle]
+pub extern "C" fn datenlord_pwrite_fixed(
+    sdk: *mut datenlord_sdk,
+    file: *mut datenlord_file,
+    offset: u64,
+    index: u32,
+    buffer_offset: usize,
+    len: usize,
+) -> c_int {
+    if sdk.is_null() || file.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let file_ref = unsafe { &*file };
+
+    let result = sdk_ref.runtime.block_on(
+        buffers::pwrite_fixed(&sdk_ref.fs, &file_ref.handle, offset, index, buffer_offset, len)
+    );
+
+    match result {
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to write file", e),
+    }
+}
+
+/// Read a file from offset into registered buffer `index`
+#[no_mangle]
+pub extern "C" fn datenlord_read_file_fixed(
+    sdk: *mut datenlord_sdk,
+    file_path: *const c_char,
+    offset: u64,
+    index: u32,
+    out_read: *mut usize,
+) -> c_int {
+    if sdk.is_null() || file_path.is_null() || out_read.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let path = unsafe { CStr::from_ptr(file_path).to_str().unwrap_or_default() };
+    let sdk_ref = unsafe { &*sdk };
+
+    let result = sdk_ref.runtime.block_on(buffers::read_file_fixed(&sdk_ref.fs, path, offset, index));
+
+    match result {
+        Ok(size) => {
+            unsafe {
+                *out_read = size;
+            }
+            0
+        }
+        Err(e) => error::fail("Failed to read file", e),
+    }
+}
+
+/// Write out the buffered writes of the file and flush it
+#[no_mangle]
+pub extern "C" fn datenlord_flush(
+    sdk: *mut datenlord_sdk,
+    file: *mut datenlord_file,
+) -> c_int {
+    if sdk.is_null() || file.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let file_ref = unsafe { &*file };
+
+    let result = sdk_ref.runtime.block_on(ops::flush_file(&sdk_ref.fs, &file_ref.handle));
+
+    match result {
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to flush file", e),
+    }
+}
+
+/// Write out the buffered writes of the file and sync it to storage
+#[no_mangle]
+pub extern "C" fn datenlord_fsync(
+    sdk: *mut datenlord_sdk,
+    file: *mut datenlord_file,
+) -> c_int {
+    if sdk.is_null() || file.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let file_ref = unsafe { &*file };
+
+    let result = sdk_ref.runtime.block_on(ops::fsync_file(&sdk_ref.fs, &file_ref.handle));
+
+    match result {
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to sync file", e),
+    }
+}
+
+/// Flush and close the file, the handle is freed even if the flush fails
+#[no_mangle]
+pub extern "C" fn datenlord_close(
+    sdk: *mut datenlord_sdk,
+    file: *mut datenlord_file,
+) -> c_int {
+    if sdk.is_null() || file.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let file = unsafe { Box::from_raw(file) };
+
+    let result = sdk_ref.runtime.block_on(ops::close_file(&sdk_ref.fs, &file.handle));
+
+    match result {
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to close file", e),
+    }
+}
+
+/// Open a directory for `datenlord_readdir_next`, with `plus` set every
+/// entry comes with its attributes, which also warms the metadata cache
+#[no_mangle]
+pub extern "C" fn datenlord_opendir(
+    sdk: *mut datenlord_sdk,
+    dir_path: *const c_char,
+    plus: bool,
+    out_dir: *mut *mut datenlord_dir,
+) -> c_int {
+    if sdk.is_null() || dir_path.is_null() || out_dir.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let path = unsafe { CStr::from_ptr(dir_path).to_str().unwrap_or_default() };
+    let sdk_ref = unsafe { &*sdk };
+
+    let result = sdk_ref.runtime.block_on(ops::opendir(&sdk_ref.fs, path));
+
+    match result {
+        Ok(handle) => {
+            let dir = Box::new(datenlord_dir {
+                handle,
+                plus,
+                page: Vec::new(),
+                attrs: Vec::new(),
+                next: 0,
+            });
+            unsafe {
+                *out_dir = Box::into_raw(dir);
+            }
+            0
+        }
+        Err(e) => error::fail("Failed to open directory", e),
+    }
+}
+
+/// Read up to `max` entries into `out`, `count` is set to the number of
+/// entries read, 0 at the end of the directory. Entries are read from the
+/// filesystem one page at a time, so memory does not grow with the directory.
+#[no_mangle]
+pub extern "C" fn datenlord_readdir_next(
+    sdk: *mut datenlord_sdk,
+    dir: *mut datenlord_dir,
+    out: *mut datenlord_dirent,
+    max: usize,
+    count: *mut usize,
+) -> c_int {
+    if sdk.is_null() || dir.is_null() || count.is_null() || (max > 0 && out.is_null()) {
+        return error::invalid_arguments();
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let dir = unsafe { &mut *dir };
+    let out: &mut [datenlord_dirent] = if max > 0 {
+        unsafe { std::slice::from_raw_parts_mut(out, max) }
+    } else {
+        &mut []
+    };
+
+    if dir.next == dir.page.len() && max > 0 {
+        let result = sdk_ref.runtime.block_on(async {
+            let page = ops::readdir_page(&sdk_ref.fs, &mut dir.handle).await?;
+            let attrs = if dir.plus {
+                ops::readdir_attrs(&sdk_ref.fs, &dir.handle, &page).await
+            } else {
+                Vec::new()
+            };
+            Ok::<_, DatenLordError>((page, attrs))
+        });
+        match result {
+            Ok((page, attrs)) => {
+                dir.page = page;
+                dir.attrs = attrs;
+                dir.next = 0;
+            }
+            Err(e) => return error::fail("Failed to read directory", e),
+        }
+    }
+
+    let available = dir.page.len() - dir.next;
+    let read = available.min(max);
+    for (offset, slot) in out[..read].iter_mut().enumerate() {
+        let index = dir.next + offset;
+        let entry = &dir.page[index];
+        let attr = dir.attrs.get(index).copied().flatten();
+        let mut stat = datenlord_file_stat::default();
+        if let Some(attr) = &attr {
+            stat.fill(attr);
+        }
+        *slot = datenlord_dirent {
+            ino: entry.ino(),
+            kind: entry.kind().bits() as u32,
+            name: datenlord_bytes {
+                data: entry.name().as_ptr(),
+                len: entry.name().len(),
+            },
+            has_stat: attr.is_some(),
+            stat,
+        };
+    }
+    dir.next += read;
+
+    unsafe {
+        *count = read;
+    }
+    0
+}
+
+/// Close the directory, the handle is freed even if the release fails
+#[no_mangle]
+pub extern "C" fn datenlord_closedir(
+    sdk: *mut datenlord_sdk,
+    dir: *mut datenlord_dir,
+) -> c_int {
+    if sdk.is_null() || dir.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let dir = unsafe { Box::from_raw(dir) };
+
+    let result = sdk_ref.runtime.block_on(ops::closedir(&sdk_ref.fs, &dir.handle));
+
+    match result {
+        Ok(_) => 0,
+        Err(e) => error::fail("Failed to close directory", e),
+    }
+}
+
+/// Get the counters of the block read cache
+#[no_mangle]
+pub extern "C" fn datenlord_get_cache_stats(
+    sdk: *mut datenlord_sdk,
+    out: *mut datenlord_cache_stats,
+) -> c_int {
+    if sdk.is_null() || out.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let stats = sdk_ref.fs.block_cache.stats();
+    unsafe {
+        *out = datenlord_cache_stats {
+            hits: stats.hits,
+            misses: stats.misses,
+            evictions: stats.evictions,
+            bytes: stats.bytes,
+            capacity: stats.capacity,
+        };
+    }
+    0
+}
+
+/// Write the metrics of the sdk as a json document into `buf`, its len is
+/// set to the size of the document. A null or too small buffer fails with
+/// `EINVAL` and its len set to the size needed, which grows with the counters.
+#[no_mangle]
+pub extern "C" fn datenlord_metrics_snapshot(sdk: *mut datenlord_sdk, buf: *mut datenlord_bytes) -> c_int {
+    if sdk.is_null() || buf.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let sdk_ref = unsafe { &*sdk };
+    let buf = unsafe { &mut *buf };
+    let document = metrics::snapshot(&sdk_ref.fs).to_json().to_string();
+    if document.len() > buf.len || buf.data.is_null() {
+        let error = DatenLordError::InvalidArgument {
+            context: vec![format!("metrics need a buffer of {} bytes, got {}", document.len(), buf.len)],
+        };
+        buf.len = document.len();
+        return error::fail("Failed to snapshot metrics", error);
+    }
+    unsafe {
+        ptr::copy_nonoverlapping(document.as_ptr(), buf.data.cast_mut(), document.len());
+    }
+    buf.len = document.len();
+    0
+}
+
+/// Map `len` bytes of a file from `offset` read-only, 0 maps up to the end of
+/// file. Files of a local backend are mapped and share the page cache, other
+/// backends get a copy of the range. Release it with `datenlord_munmap`.
+#[no_mangle]
+pub extern "C" fn datenlord_mmap(
+    sdk: *mut datenlord_sdk,
+    file_path: *const c_char,
+    offset: u64,
+    len: usize,
+    out: *mut datenlord_mapping,
+) -> c_int {
+    if sdk.is_null() || file_path.is_null() || out.is_null() {
+        return error::invalid_arguments();
+    }
+
+    let path = unsafe { CStr::from_ptr(file_path).to_str().unwrap_or_default() };
+    let sdk_ref = unsafe { &*sdk };
+
+    let result = sdk_ref.runtime.block_on(mmap::map_file(&sdk_ref.fs, path, offset, len));
+
+    match result {
+        Ok(mapping) => {
+            let mapping = Box::new(mapping);
+            let view = mapping.as_slice();
+            unsafe {
+                *out = datenlord_mapping {
+                    data: view.as_ptr(),
+                    len: view.len(),
+                    inner: Box::into_raw(mapping) as *mut c_void,
+                };
+            }
+            0
+        }
+        Err(e) => error::fail("Failed to map file", e),
+    }
+}
+
+/// Release a view returned by `datenlord_mmap`
+#[no_mangle]
+pub extern "C" fn datenlord_munmap(mapping: *mut datenlord_mapping) {
+    if mapping.is_null() {
+        return;
+    }
+    let mapping = unsafe { &mut *mapping };
+    if !mapping.inner.is_null() {
+        unsafe {
+            let _ = Box::from_raw(mapping.inner as *mut FileMapping);
+        }
+    }
+    *mapping = datenlord_mapping {
+        data: std::ptr::null(),
+        len: 0,
+        inner: std::ptr::null_mut(),
+    };
+}
@@ -0,0 +1,73 @@
+//! Error codes of the c sdk
+//!
+//! Every call returns 0 on success or a positive errno. The error of the last
+//! failed call is kept per thread and its message is formatted only when it
+//! is asked for. The error itself carries the context of the failed call, a
+//! formatted string, so failures still allocate; repeated lookups of a
+//! missing path are served by the negative entries of the metadata cache.
+
+use std::cell::RefCell;
+use std::ffi::CString;
+use std::os::raw::{c_char, c_int};
+use std::ptr;
+
+use crate::common::DatenLordError;
+
+/// The last failure of a thread
+#[derive(Default)]
+struct LastError {
+    /// What the call was doing
+    context: &'static str,
+    /// The cause, none for invalid arguments
+    error: Option<DatenLordError>,
+    /// The formatted message, built on demand
+    message: Option<CString>,
+}
+
+thread_local! {
+    static LAST_ERROR: RefCell<LastError> = RefCell::new(LastError::default());
+}
+
+/// Remember a failure of the calling thread, return its code
+fn record(context: &'static str, error: Option<DatenLordError>) -> c_int {
+    let code = error.as_ref().map_or(nix::libc::EINVAL, DatenLordError::errno);
+    LAST_ERROR.with(|last| {
+        *last.borrow_mut() = LastError {
+            context,
+            error,
+            message: None,
+        };
+    });
+    code
+}
+
+/// Fail a call with an error
+pub(crate) fn fail(context: &'static str, error: DatenLordError) -> c_int {
+    record(context, Some(error))
+}
+
+/// Fail a call with invalid arguments
+pub(crate) fn invalid_arguments() -> c_int {
+    record("Invalid arguments", None)
+}
+
+/// Get the message of the last failed call of the calling thread, null when
+/// no call failed. The message is valid until the next failed call of the thread.
+#[no_mangle]
+pub extern "C" fn datenlord_last_error_message() -> *const c_char {
+    LAST_ERROR.with(|last| {
+        let mut last = last.borrow_mut();
+        if last.context.is_empty() {
+            return ptr::null();
+        }
+        if last.message.is_none() {
+            let message = match &last.error {
+                Some(error) => format!("{}: {error}", last.context),
+                None => last.context.to_owned(),
+            };
+            // Error messages carry no nul, drop them in case a path does
+            last.message = Some(CString::new(message.replace('\0', "")).unwrap_or_default());
+        }
+        last.message.as_ref().map_or(ptr::null(), |message| message.as_ptr())
+    })
+}
@@ -1,2 +1,4 @@
 //! This module contains the datenlord c sdk
-pub mod datenlord;
\ No newline at end of file
+pub mod datenlord;
+pub mod async_io;
+pub mod error;
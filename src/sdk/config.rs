@@ -0,0 +1,247 @@
+//! The configuration of the datenlord sdk
+
+use std::collections::HashMap;
+use std::str::FromStr;
+
+use opendal::services::Memory;
+use opendal::{Operator, Scheme};
+use serde_derive::Deserialize;
+use tokio::runtime::{Builder, Runtime};
+use tracing::{warn, Level};
+
+use crate::common::{DatenLordError, DatenLordResult};
+use crate::sdk::block_cache::BlockCache;
+use crate::sdk::daemon::client::DaemonFs;
+use crate::sdk::daemon::RingOptions;
+use crate::sdk::ops::CopyOptions;
+use crate::storage::localfs::LocalFS;
+use crate::storage::virtualfs::VirtualFs;
+
+/// The storage backend of an sdk instance
+#[derive(Debug, Clone, Deserialize)]
+#[serde(tag = "type", rename_all = "snake_case")]
+pub enum BackendConfig {
+    /// Files under a local directory
+    Local {
+        /// The local directory
+        root: String,
+    },
+    /// Files kept in memory, dropped with the sdk instance
+    Memory,
+    /// Any opendal service, such as `s3`, configured by the options of the service
+    Opendal {
+        /// The opendal scheme of the service
+        scheme: String,
+        /// The service options, such as `bucket`, `endpoint` or `root`
+        #[serde(default)]
+        options: HashMap<String, String>,
+    },
+    /// An sdk daemon on this host, its caches and backend are shared by its clients
+    Daemon {
+        /// The unix socket the daemon listens on
+        socket: String,
+    },
+}
+
+impl Default for BackendConfig {
+    fn default() -> Self {
+        Self::Local { root: "/tmp".to_owned() }
+    }
+}
+
+impl BackendConfig {
+    /// Build the filesystem of the backend
+    pub fn build(&self) -> DatenLordResult<Box<dyn VirtualFs>> {
+        let operator_error = |e: opendal::Error| DatenLordError::InvalidArgument {
+            context: vec![format!("failed to build backend {self:?}: {e}")],
+        };
+        let fs = match self {
+            Self::Local { root } => LocalFS::new(root)?,
+            Self::Memory => {
+                let operator = Operator::new(Memory::default()).map_err(operator_error)?.finish();
+                LocalFS::from_operator(operator)
+            }
+            Self::Opendal { scheme, options } => {
+                let scheme = Scheme::from_str(scheme).map_err(operator_error)?;
+                let operator = Operator::via_map(scheme, options.clone()).map_err(operator_error)?;
+                LocalFS::from_operator(operator)
+            }
+            Self::Daemon { socket } => return Ok(Box::new(DaemonFs::connect(socket)?)),
+        };
+        Ok(Box::new(fs))
+    }
+}
+
+/// The sdk configuration, parsed from the json document passed to `init`
+#[derive(Debug, Deserialize)]
+#[serde(default)]
+pub struct SdkConfig {
+    /// The storage backend
+    pub backend: BackendConfig,
+    /// Worker threads of the shared runtime, 0 means one per cpu core
+    pub worker_threads: usize,
+    /// Max threads of the runtime for blocking local I/O, 0 means the tokio default
+    pub blocking_threads: usize,
+    /// Chunk size of streaming copies in bytes
+    pub copy_chunk_size: usize,
+    /// Chunks in flight of streaming copies, read concurrently from remote backends
+    pub copy_queue_depth: usize,
+    /// Max dentries and attributes cached, 0 disables the metadata cache
+    pub attr_cache_entries: usize,
+    /// Milliseconds a path found missing is remembered by the metadata cache, 0 remembers none
+    pub negative_ttl_ms: u64,
+    /// Max size of the files whose content is cached with their attributes, 0 disables it
+    pub inline_data_bytes: usize,
+    /// Byte budget of the block read cache, 0 disables it
+    pub block_cache_bytes: u64,
+    /// Size of the blocks of the read cache in bytes
+    pub block_size: usize,
+    /// Max bytes read ahead of sequential reads into the block cache, 0 disables readahead
+    pub readahead_max_bytes: u64,
+    /// Size writes are coalesced into before they are written out, 0 disables write-back
+    pub write_back_extent_bytes: usize,
+    /// Max bytes buffered by write-back, writes wait once it is reached
+    pub write_back_max_bytes: usize,
+    /// Share of the calls traced at debug level, between 0 and 1
+    pub trace_sample_rate: f64,
+    /// Level of the logs printed to stderr, such as `info` or `debug`, empty
+    /// installs no subscriber and leaves logging to the host
+    pub log_level: String,
+    /// Requests in flight per client when serving as a daemon
+    pub daemon_slots: u32,
+    /// Bytes of a request buffer when serving as a daemon, larger reads and writes are split
+    pub daemon_slot_bytes: u32,
+    /// Address of the Prometheus endpoint served along with the daemon, empty serves none
+    pub metrics_addr: String,
+}
+
+impl Default for SdkConfig {
+    fn default() -> Self {
+        Self {
+            backend: BackendConfig::default(),
+            worker_threads: 0,
+            blocking_threads: 0,
+            copy_chunk_size: 4 * 1024 * 1024,
+            copy_queue_depth: 8,
+            attr_cache_entries: 65536,
+            negative_ttl_ms: 1000,
+            inline_data_bytes: 0,
+            block_cache_bytes: 0,
+            block_size: 4 * 1024 * 1024,
+            readahead_max_bytes: 64 * 1024 * 1024,
+            write_back_extent_bytes: 0,
+            write_back_max_bytes: 256 * 1024 * 1024,
+            trace_sample_rate: 1.0,
+            log_level: String::new(),
+            daemon_slots: 32,
+            daemon_slot_bytes: 1024 * 1024,
+            metrics_addr: String::new(),
+        }
+    }
+}
+
+impl SdkConfig {
+    /// Parse the config string, unknown or malformed config falls back to default
+    pub fn parse(config: &str) -> Self {
+        match serde_json::from_str(config) {
+            Ok(config) => config,
+            Err(e) => {
+                warn!("failed to parse sdk config {:?}: {}, use default config", config, e);
+                Self::default()
+            }
+        }
+    }
+
+    /// Tuning of streaming copies
+    pub fn copy_options(&self) -> CopyOptions {
+        CopyOptions {
+            chunk_size: self.copy_chunk_size,
+            queue_depth: self.copy_queue_depth,
+        }
+    }
+
+    /// Build the read cache
+    pub fn block_cache(&self) -> BlockCache {
+        BlockCache::new(self.block_cache_bytes, self.block_size)
+    }
+
+    /// The rings handed out to the clients when serving as a daemon
+    pub fn ring_options(&self) -> RingOptions {
+        RingOptions {
+            slots: self.daemon_slots.max(1),
+            slot_size: self.daemon_slot_bytes.max(4096),
+        }
+    }
+
+    /// Print logs to stderr from `log_level` on, the first sdk instance of the
+    /// process with a level installs the subscriber
+    pub fn init_logging(&self) {
+        if self.log_level.is_empty() {
+            return;
+        }
+        match Level::from_str(&self.log_level) {
+            Ok(level) => {
+                // Fails when the host or an earlier instance set one already
+                let _ = tracing_subscriber::fmt()
+                    .with_max_level(level)
+                    .with_writer(std::io::stderr)
+                    .try_init();
+            }
+            Err(e) => warn!("invalid log level {:?}: {}", self.log_level, e),
+        }
+    }
+
+    /// Build the runtime shared by all calls of one sdk instance
+    pub fn build_runtime(&self) -> DatenLordResult<Runtime> {
+        let mut builder = Builder::new_multi_thread();
+        if self.worker_threads > 0 {
+            builder.worker_threads(self.worker_threads);
+        }
+        if self.blocking_threads > 0 {
+            builder.max_blocking_threads(self.blocking_threads);
+        }
+        builder
+            .thread_name("datenlord-sdk")
+            .enable_all()
+            .build()
+            .map_err(|e| DatenLordError::Internal {
+                context: vec![format!("failed to build sdk runtime: {e}")],
+            })
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn parse_backends() {
+        let config = SdkConfig::parse(r#"{"backend": {"type": "local", "root": "/data"}, "block_cache_bytes": 1024}"#);
+        assert!(matches!(config.backend, BackendConfig::Local { ref root } if root == "/data"));
+        assert_eq!(config.block_cache_bytes, 1024);
+        // Unset entries keep their default
+        assert_eq!(config.copy_queue_depth, SdkConfig::default().copy_queue_depth);
+
+        let config = SdkConfig::parse(r#"{"backend": {"type": "opendal", "scheme": "s3", "options": {"bucket": "b"}}}"#);
+        assert!(matches!(config.backend, BackendConfig::Opendal { ref scheme, ref options }
+            if scheme == "s3" && options["bucket"] == "b"));
+        assert!(matches!(SdkConfig::parse(r#"{"backend": {"type": "memory"}}"#).backend, BackendConfig::Memory));
+    }
+
+    #[test]
+    fn malformed_config_is_the_default() {
+        for config in ["", "not json", r#"{"backend": {"type": "nope"}}"#] {
+            let config = SdkConfig::parse(config);
+            assert!(matches!(config.backend, BackendConfig::Local { ref root } if root == "/tmp"));
+        }
+    }
+
+    #[test]
+    fn unknown_scheme_fails_to_build() {
+        let backend = BackendConfig::Opendal {
+            scheme: "nope".to_owned(),
+            options: HashMap::new(),
+        };
+        assert!(matches!(backend.build(), Err(DatenLordError::InvalidArgument { .. })));
+    }
+}
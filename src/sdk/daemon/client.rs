@@ -0,0 +1,598 @@
+//! The client side of the ring transport
+//!
+//! A call takes a free slot, writes its request and data there and submits
+//! the slot. The dispatcher thread waits on the completion doorbell and wakes
+//! the call of every completed slot, the call then reads its response and
+//! gives the slot back. Calls run concurrently up to the slots of the ring.
+//!
+//! Reads and writes in the registered buffers of the sdk skip the slot, the
+//! daemon maps them and moves the bytes in place.
+
+use std::ops::Range;
+use std::os::fd::{AsRawFd, OwnedFd, RawFd};
+use std::os::unix::net::UnixStream;
+use std::path::Path;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::{Arc, Mutex, RwLock};
+use std::thread::JoinHandle;
+use std::time::Duration;
+
+use async_trait::async_trait;
+use futures::future::try_join_all;
+use tokio::sync::{oneshot, Semaphore};
+use tracing::warn;
+
+use super::ring::{self, Op, Ring, WireRequest, WireResponse, SETUP_FDS};
+use super::{daemon_error, decode_setup, encode_buffers, SETUP_LEN};
+use crate::common::{DatenLordError, DatenLordResult};
+use crate::storage::fs_util::{CreateParam, FileAttr, RenameParam, SetAttrParam, StatFsParam};
+use crate::storage::virtualfs::{DirEntry, INum, VirtualFs};
+
+/// Bytes of a directory entry in a readdir response, before its name
+const ENTRY_HEADER_LEN: usize = 16;
+
+/// State shared with the dispatcher thread
+struct Shared {
+    ring: Ring,
+    /// Kept open so the daemon sees the client go away when it is closed
+    socket: UnixStream,
+    submission_event: OwnedFd,
+    completion_event: OwnedFd,
+    /// Slots not in use
+    free: Mutex<Vec<u32>>,
+    /// One permit per free slot
+    permits: Semaphore,
+    /// The call waiting on each slot
+    waiters: Mutex<Vec<Option<oneshot::Sender<()>>>>,
+    /// Serializes the submissions
+    submission_lock: Mutex<()>,
+    /// Set when the daemon went away, no waiter is registered anymore
+    dead: AtomicBool,
+    /// Set when the client is dropped
+    closed: AtomicBool,
+}
+
+impl Shared {
+    fn release(&self, index: u32) {
+        self.free.lock().unwrap().push(index);
+        self.permits.add_permits(1);
+    }
+
+    /// Wake the calls of the completed slots until the client closes or the daemon goes away
+    fn dispatch(&self) {
+        let mut fds = [
+            nix::libc::pollfd {
+                fd: self.completion_event.as_raw_fd(),
+                events: nix::libc::POLLIN,
+                revents: 0,
+            },
+            nix::libc::pollfd {
+                fd: self.socket.as_raw_fd(),
+                events: nix::libc::POLLIN,
+                revents: 0,
+            },
+        ];
+        while !self.closed.load(Ordering::Acquire) {
+            if unsafe { nix::libc::poll(fds.as_mut_ptr(), fds.len() as nix::libc::nfds_t, -1) } < 0 {
+                if std::io::Error::last_os_error().kind() == std::io::ErrorKind::Interrupted {
+                    continue;
+                }
+                break;
+            }
+            if fds[0].revents != 0 {
+                let _ = ring::drain(fds[0].fd);
+                while let Some(index) = self.ring.pop_completion() {
+                    let waiter = self.waiters.lock().unwrap().get_mut(index as usize).and_then(Option::take);
+                    match waiter {
+                        Some(waiter) => {
+                            // The call was dropped, the slot is ours to give back
+                            if waiter.send(()).is_err() {
+                                self.release(index);
+                            }
+                        }
+                        None => warn!("daemon completed slot {} with no call waiting", index),
+                    }
+                }
+            }
+            // The daemon never writes after the setup, readable is the end
+            if fds[1].revents != 0 {
+                break;
+            }
+        }
+        let mut waiters = self.waiters.lock().unwrap();
+        self.dead.store(true, Ordering::Release);
+        waiters.iter_mut().for_each(|waiter| drop(waiter.take()));
+    }
+}
+
+/// A submitted slot, given back once its response is read. A call dropped
+/// before its completion leaves the slot to the dispatcher.
+struct Pending<'a> {
+    shared: &'a Shared,
+    index: u32,
+    completion: oneshot::Receiver<()>,
+    done: bool,
+}
+
+impl Drop for Pending<'_> {
+    fn drop(&mut self) {
+        if self.done {
+            self.shared.release(self.index);
+            return;
+        }
+        self.completion.close();
+        if self.completion.try_recv().is_ok() {
+            self.shared.release(self.index);
+        }
+    }
+}
+
+/// A filesystem served by a daemon
+pub struct DaemonFs {
+    shared: Arc<Shared>,
+    dispatcher: Option<JoinHandle<()>>,
+    /// Addresses of the registered buffers shared with the daemon
+    buffers: RwLock<Option<Range<usize>>>,
+}
+
+impl std::fmt::Debug for DaemonFs {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("DaemonFs").field("slots", &self.shared.ring.slots()).finish()
+    }
+}
+
+fn io_error(e: std::io::Error, context: String) -> DatenLordError {
+    DatenLordError::Io {
+        context: vec![format!("{context}: {e}")],
+    }
+}
+
+fn disconnected() -> DatenLordError {
+    DatenLordError::Io {
+        context: vec!["daemon disconnected".to_owned()],
+    }
+}
+
+impl DaemonFs {
+    /// Connect to the daemon listening on `socket` and map its ring
+    pub fn connect(socket: &str) -> DatenLordResult<Self> {
+        let stream =
+            UnixStream::connect(socket).map_err(|e| io_error(e, format!("failed to connect to daemon {socket}")))?;
+        let mut setup = [0; SETUP_LEN];
+        let fds = ring::recv_fds(stream.as_raw_fd(), &mut setup)
+            .map_err(|e| io_error(e, format!("failed to receive the ring of daemon {socket}")))?
+            .unwrap_or_default();
+        let options = decode_setup(&setup).filter(|_| fds.len() == SETUP_FDS).ok_or_else(|| DatenLordError::Io {
+            context: vec![format!("invalid setup message from daemon {socket}")],
+        })?;
+        let mut fds = fds.into_iter();
+        let (memfd, submission_event, completion_event) =
+            (fds.next().unwrap(), fds.next().unwrap(), fds.next().unwrap());
+        let ring = Ring::open(&memfd, options.slots, options.slot_size)
+            .map_err(|e| io_error(e, format!("failed to map the ring of daemon {socket}")))?;
+
+        let shared = Arc::new(Shared {
+            ring,
+            socket: stream,
+            submission_event,
+            completion_event,
+            // Popped from the back, hand out the low slots first
+            free: Mutex::new((0..options.slots).rev().collect()),
+            permits: Semaphore::new(options.slots as usize),
+            waiters: Mutex::new((0..options.slots).map(|_| None).collect()),
+            submission_lock: Mutex::new(()),
+            dead: AtomicBool::new(false),
+            closed: AtomicBool::new(false),
+        });
+        let dispatcher = {
+            let shared = Arc::clone(&shared);
+            std::thread::Builder::new()
+                .name("datenlord-daemon-client".to_owned())
+                .spawn(move || shared.dispatch())
+                .map_err(|e| io_error(e, "failed to spawn the dispatcher".to_owned()))?
+        };
+        Ok(Self {
+            shared,
+            dispatcher: Some(dispatcher),
+            buffers: RwLock::new(None),
+        })
+    }
+
+    /// Offset of `len` bytes at `addr` in the registered buffers, if they are in there
+    fn registered(&self, addr: *const u8, len: usize) -> Option<u64> {
+        let start = addr as usize;
+        let buffers = self.buffers.read().unwrap();
+        let buffers = buffers.as_ref()?;
+        let end = start.checked_add(len)?;
+        (len > 0 && buffers.start <= start && end <= buffers.end).then(|| (start - buffers.start) as u64)
+    }
+
+    /// Run a request on the daemon. `names` and `input` are written to the
+    /// slot, `reply` reads the response and its bytes.
+    async fn call<T>(
+        &self,
+        mut request: WireRequest,
+        names: [&str; 2],
+        input: &[u8],
+        reply: impl FnOnce(&WireResponse, &[u8]) -> T,
+    ) -> DatenLordResult<T> {
+        let shared = &*self.shared;
+        let names_len = names[0].len() + names[1].len();
+        if names_len + input.len() > shared.ring.slot_size() {
+            return Err(DatenLordError::InvalidArgument {
+                context: vec![format!("request of {} bytes overflows a daemon slot", names_len + input.len())],
+            });
+        }
+        shared.permits.acquire().await.map_err(|_| disconnected())?.forget();
+        let index = shared.free.lock().unwrap().pop().unwrap_or_else(|| unreachable!("a permit without a free slot"));
+
+        let (sender, completion) = oneshot::channel();
+        let mut pending = Pending {
+            shared,
+            index,
+            completion,
+            done: false,
+        };
+        // The slot is ours until it is submitted
+        let data = unsafe { shared.ring.data(index) };
+        data[..names[0].len()].copy_from_slice(names[0].as_bytes());
+        data[names[0].len()..names_len].copy_from_slice(names[1].as_bytes());
+        data[names_len..names_len + input.len()].copy_from_slice(input);
+        request.name_len = names[0].len() as u32;
+        request.new_name_len = names[1].len() as u32;
+        if !input.is_empty() {
+            request.len = input.len() as u64;
+        }
+        unsafe { shared.ring.request(index).write(request) };
+        {
+            let mut waiters = shared.waiters.lock().unwrap();
+            if shared.dead.load(Ordering::Acquire) {
+                pending.done = true;
+                return Err(disconnected());
+            }
+            waiters[index as usize] = Some(sender);
+        }
+        {
+            let _lock = shared.submission_lock.lock().unwrap();
+            shared.ring.push_submission(index);
+        }
+        ring::ring(shared.submission_event.as_raw_fd());
+
+        let completed = (&mut pending.completion).await;
+        pending.done = true;
+        completed.map_err(|_| disconnected())?;
+        let response = unsafe { shared.ring.response(index).read() };
+        let len = usize::try_from(response.len).unwrap_or(usize::MAX).min(data.len());
+        if response.errno != 0 {
+            return Err(daemon_error(response.errno, &data[..len]));
+        }
+        Ok(reply(&response, &data[..len]))
+    }
+
+    fn entry(response: &WireResponse) -> (Duration, FileAttr, u64) {
+        (Duration::from_nanos(response.ttl), FileAttr::from(&response.attr), response.value)
+    }
+
+    /// Read one chunk, it fits a slot
+    async fn read_chunk(&self, ino: u64, fh: u64, offset: u64, buf: &mut [u8]) -> DatenLordResult<usize> {
+        let request = WireRequest {
+            op: Op::Read as u32,
+            ino,
+            fh,
+            offset,
+            len: buf.len() as u64,
+            ..WireRequest::default()
+        };
+        self.call(request, ["", ""], &[], |_, data| {
+            let read = data.len().min(buf.len());
+            buf[..read].copy_from_slice(&data[..read]);
+            read
+        })
+        .await
+    }
+
+    fn unimplemented<T>(op: &str) -> DatenLordResult<T> {
+        Err(DatenLordError::Unimplemented {
+            context: vec![format!("{op} is not served by the daemon")],
+        })
+    }
+}
+
+impl Drop for DaemonFs {
+    fn drop(&mut self) {
+        self.shared.closed.store(true, Ordering::Release);
+        ring::ring(self.shared.completion_event.as_raw_fd());
+        if let Some(dispatcher) = self.dispatcher.take() {
+            let _ = dispatcher.join();
+        }
+    }
+}
+
+fn named(op: Op, uid: u32, gid: u32, parent: INum) -> WireRequest {
+    WireRequest {
+        op: op as u32,
+        ino: parent,
+        uid,
+        gid,
+        ..WireRequest::default()
+    }
+}
+
+fn handle(op: Op, ino: u64, fh: u64) -> WireRequest {
+    WireRequest {
+        op: op as u32,
+        ino,
+        fh,
+        ..WireRequest::default()
+    }
+}
+
+#[async_trait]
+impl VirtualFs for DaemonFs {
+    async fn lookup(&self, uid: u32, gid: u32, parent: INum, name: &str) -> DatenLordResult<(Duration, FileAttr, u64)> {
+        self.call(named(Op::Lookup, uid, gid, parent), [name, ""], &[], |response, _| Self::entry(response)).await
+    }
+
+    async fn forget(&self, _ino: u64, _nlookup: u64) {}
+
+    async fn getattr(&self, ino: u64) -> DatenLordResult<(Duration, FileAttr)> {
+        let request = handle(Op::Getattr, ino, 0);
+        self.call(request, ["", ""], &[], |response, _| {
+            (Duration::from_nanos(response.ttl), FileAttr::from(&response.attr))
+        })
+        .await
+    }
+
+    async fn setattr(
+        &self,
+        _uid: u32,
+        _gid: u32,
+        _ino: u64,
+        _param: SetAttrParam,
+    ) -> DatenLordResult<(Duration, FileAttr)> {
+        Self::unimplemented("setattr")
+    }
+
+    async fn readlink(&self, _ino: u64) -> DatenLordResult<Vec<u8>> {
+        Self::unimplemented("readlink")
+    }
+
+    async fn mknod(&self, param: CreateParam) -> DatenLordResult<(Duration, FileAttr, u64)> {
+        let request = WireRequest {
+            mode: param.mode,
+            rdev: param.rdev,
+            kind: param.node_type.bits() as u32,
+            ..named(Op::Mknod, param.uid, param.gid, param.parent)
+        };
+        self.call(request, [&param.name, ""], &[], |response, _| Self::entry(response)).await
+    }
+
+    async fn mkdir(&self, param: CreateParam) -> DatenLordResult<(Duration, FileAttr, u64)> {
+        let request = WireRequest {
+            mode: param.mode,
+            rdev: param.rdev,
+            kind: param.node_type.bits() as u32,
+            ..named(Op::Mkdir, param.uid, param.gid, param.parent)
+        };
+        self.call(request, [&param.name, ""], &[], |response, _| Self::entry(response)).await
+    }
+
+    async fn unlink(&self, uid: u32, gid: u32, parent: INum, name: &str) -> DatenLordResult<()> {
+        self.call(named(Op::Unlink, uid, gid, parent), [name, ""], &[], |_, _| ()).await
+    }
+
+    async fn rmdir(&self, uid: u32, gid: u32, parent: INum, dir_name: &str) -> DatenLordResult<Option<INum>> {
+        self.call(named(Op::Rmdir, uid, gid, parent), [dir_name, ""], &[], |response, _| {
+            (response.value != 0).then_some(response.value)
+        })
+        .await
+    }
+
+    async fn symlink(
+        &self,
+        _uid: u32,
+        _gid: u32,
+        _parent: INum,
+        _name: &str,
+        _target_path: &Path,
+    ) -> DatenLordResult<(Duration, FileAttr, u64)> {
+        Self::unimplemented("symlink")
+    }
+
+    async fn rename(&self, uid: u32, gid: u32, param: RenameParam) -> DatenLordResult<()> {
+        let request = WireRequest {
+            flags: param.flags,
+            new_parent: param.new_parent,
+            ..named(Op::Rename, uid, gid, param.old_parent)
+        };
+        self.call(request, [&param.old_name, &param.new_name], &[], |_, _| ()).await
+    }
+
+    async fn copy_file(&self, uid: u32, gid: u32, param: RenameParam) -> DatenLordResult<(Duration, FileAttr)> {
+        let request = WireRequest {
+            new_parent: param.new_parent,
+            ..named(Op::CopyFile, uid, gid, param.old_parent)
+        };
+        self.call(request, [&param.old_name, &param.new_name], &[], |response, _| {
+            (Duration::from_nanos(response.ttl), FileAttr::from(&response.attr))
+        })
+        .await
+    }
+
+    async fn create(
+        &self,
+        uid: u32,
+        gid: u32,
+        parent: u64,
+        name: &str,
+        mode: u32,
+        flags: u32,
+    ) -> DatenLordResult<(Duration, FileAttr, u64)> {
+        let request = WireRequest {
+            mode,
+            flags,
+            ..named(Op::Create, uid, gid, parent)
+        };
+        self.call(request, [name, ""], &[], |response, _| Self::entry(response)).await
+    }
+
+    async fn open(&self, uid: u32, gid: u32, ino: u64, flags: u32) -> DatenLordResult<u64> {
+        let request = WireRequest {
+            flags,
+            ..named(Op::Open, uid, gid, ino)
+        };
+        self.call(request, ["", ""], &[], |response, _| response.value).await
+    }
+
+    async fn read(&self, ino: u64, fh: u64, offset: u64, size: u32, buf: &mut [u8]) -> DatenLordResult<usize> {
+        let len = buf.len().min(size as usize);
+        if let Some(buffer_offset) = self.registered(buf.as_ptr(), len) {
+            let request = WireRequest {
+                offset,
+                len: len as u64,
+                buffer: 1,
+                buffer_offset,
+                ..handle(Op::Read, ino, fh)
+            };
+            return self.call(request, ["", ""], &[], |response, _| response.len as usize).await;
+        }
+        let slot_size = self.shared.ring.slot_size();
+        // The chunks of a large read are in flight together
+        let chunks = buf[..len]
+            .chunks_mut(slot_size)
+            .enumerate()
+            .map(|(index, chunk)| self.read_chunk(ino, fh, offset + (index * slot_size) as u64, chunk));
+        let reads = try_join_all(chunks).await?;
+        // A short chunk is the end of the file, the chunks after it are empty
+        let mut total = 0;
+        for read in reads {
+            total += read;
+            if read < slot_size {
+                break;
+            }
+        }
+        Ok(total)
+    }
+
+    async fn write(&self, ino: u64, fh: u64, offset: i64, data: &[u8], _flags: u32) -> DatenLordResult<()> {
+        let slot_size = self.shared.ring.slot_size();
+        let mut offset = u64::try_from(offset).map_err(|_| DatenLordError::InvalidArgument {
+            context: vec![format!("negative write offset {offset}")],
+        })?;
+        if let Some(buffer_offset) = self.registered(data.as_ptr(), data.len()) {
+            let request = WireRequest {
+                offset,
+                len: data.len() as u64,
+                buffer: 1,
+                buffer_offset,
+                ..handle(Op::Write, ino, fh)
+            };
+            return self.call(request, ["", ""], &[], |_, _| ()).await;
+        }
+        // In order, a failed chunk leaves no later chunk written
+        for chunk in data.chunks(slot_size) {
+            let request = WireRequest {
+                offset,
+                ..handle(Op::Write, ino, fh)
+            };
+            self.call(request, ["", ""], chunk, |_, _| ()).await?;
+            offset += chunk.len() as u64;
+        }
+        Ok(())
+    }
+
+    async fn flush(&self, ino: u64, fh: u64, _lock_owner: u64) -> DatenLordResult<()> {
+        self.call(handle(Op::Flush, ino, fh), ["", ""], &[], |_, _| ()).await
+    }
+
+    async fn release(&self, ino: u64, fh: u64, flags: u32, _lock_owner: u64, _flush: bool) -> DatenLordResult<()> {
+        let request = WireRequest {
+            flags,
+            ..handle(Op::Release, ino, fh)
+        };
+        self.call(request, ["", ""], &[], |_, _| ()).await
+    }
+
+    async fn fsync(&self, ino: u64, fh: u64, datasync: bool) -> DatenLordResult<()> {
+        let request = WireRequest {
+            flags: u32::from(datasync),
+            ..handle(Op::Fsync, ino, fh)
+        };
+        self.call(request, ["", ""], &[], |_, _| ()).await
+    }
+
+    async fn opendir(&self, uid: u32, gid: u32, ino: u64, flags: u32) -> DatenLordResult<u64> {
+        let request = WireRequest {
+            flags,
+            ..named(Op::Opendir, uid, gid, ino)
+        };
+        self.call(request, ["", ""], &[], |response, _| response.value).await
+    }
+
+    async fn readdir(&self, uid: u32, gid: u32, ino: u64, fh: u64, offset: i64) -> DatenLordResult<Vec<DirEntry>> {
+        let request = WireRequest {
+            fh,
+            offset: u64::try_from(offset).unwrap_or(0),
+            ..named(Op::Readdir, uid, gid, ino)
+        };
+        self.call(request, ["", ""], &[], |response, data| {
+            let mut entries = Vec::with_capacity(response.value as usize);
+            let mut rest = data;
+            while rest.len() >= ENTRY_HEADER_LEN {
+                let field = |range: std::ops::Range<usize>| u64::from_le_bytes({
+                    let mut bytes = [0; 8];
+                    bytes[..range.len()].copy_from_slice(&rest[range]);
+                    bytes
+                });
+                let name_len = field(12..16) as usize;
+                let Some(name) = rest.get(ENTRY_HEADER_LEN..ENTRY_HEADER_LEN + name_len) else {
+                    break;
+                };
+                let kind = nix::sys::stat::SFlag::from_bits_truncate(field(8..12) as nix::libc::mode_t);
+                entries.push(DirEntry::new(field(0..8), String::from_utf8_lossy(name).into_owned(), kind));
+                rest = &rest[ENTRY_HEADER_LEN + name_len..];
+            }
+            entries
+        })
+        .await
+    }
+
+    async fn releasedir(&self, ino: u64, fh: u64, flags: u32) -> DatenLordResult<()> {
+        let request = WireRequest {
+            flags,
+            ..handle(Op::Releasedir, ino, fh)
+        };
+        self.call(request, ["", ""], &[], |_, _| ()).await
+    }
+
+    async fn register_buffers(&self, fd: RawFd, addr: usize, len: usize) -> DatenLordResult<()> {
+        // A message this small never blocks on the socket
+        ring::send_fds(self.shared.socket.as_raw_fd(), &encode_buffers(len), &[fd])
+            .map_err(|e| io_error(e, "failed to share registered buffers".to_owned()))?;
+        let request = WireRequest {
+            op: Op::RegisterBuffers as u32,
+            len: len as u64,
+            ..WireRequest::default()
+        };
+        self.call(request, ["", ""], &[], |_, _| ()).await?;
+        *self.buffers.write().unwrap() = Some(addr..addr + len);
+        Ok(())
+    }
+
+    async fn unregister_buffers(&self) -> DatenLordResult<()> {
+        self.buffers.write().unwrap().take();
+        let request = WireRequest {
+            op: Op::UnregisterBuffers as u32,
+            ..WireRequest::default()
+        };
+        self.call(request, ["", ""], &[], |_, _| ()).await
+    }
+
+    async fn fsyncdir(&self, _ino: u64, _fh: u64, _datasync: bool) -> DatenLordResult<()> {
+        Self::unimplemented("fsyncdir")
+    }
+
+    async fn statfs(&self, _uid: u32, _gid: u32, _ino: u64) -> DatenLordResult<StatFsParam> {
+        Self::unimplemented("statfs")
+    }
+}
@@ -0,0 +1,85 @@
+//! Client-daemon mode of the sdk
+//!
+//! A daemon serves one sdk instance to the processes on the host, so they
+//! share its caches, its write-back and its backend connections. A client
+//! connects to the unix socket of the daemon, which answers with a shared
+//! memory ring and two eventfd doorbells passed as file descriptors. Every
+//! filesystem operation of the client then goes through the ring: the
+//! request and its data are written to a slot of the ring, the slot index is
+//! submitted, and the daemon writes the response and the read data into the
+//! same slot. After the setup the socket only carries the arena of the
+//! registered buffers of the client, which the daemon maps to read and write
+//! them in place. The daemon drops the open files of a client once its
+//! socket is closed.
+//!
+//! On the client the daemon is a `VirtualFs` backend, so every sdk call works
+//! unchanged on top of it.
+
+pub mod client;
+mod ring;
+pub mod server;
+
+use crate::common::DatenLordError;
+
+/// Size of the setup message: magic, version, slots and slot size
+const SETUP_LEN: usize = 16;
+
+/// Size of the message sharing registered buffers: magic, reserved and length
+const BUFFERS_LEN: usize = 16;
+
+/// The sizes of the rings handed out by a daemon
+#[derive(Debug, Clone, Copy)]
+pub struct RingOptions {
+    /// Requests in flight per client
+    pub slots: u32,
+    /// Bytes of the data buffer of a slot, larger reads and writes are split
+    pub slot_size: u32,
+}
+
+fn encode_setup(options: RingOptions) -> [u8; SETUP_LEN] {
+    let mut setup = [0; SETUP_LEN];
+    for (field, value) in setup
+        .chunks_exact_mut(4)
+        .zip([ring::MAGIC, ring::VERSION, options.slots, options.slot_size])
+    {
+        field.copy_from_slice(&value.to_le_bytes());
+    }
+    setup
+}
+
+fn decode_setup(setup: &[u8; SETUP_LEN]) -> Option<RingOptions> {
+    let field = |index: usize| u32::from_le_bytes(setup[index * 4..index * 4 + 4].try_into().unwrap());
+    if field(0) != ring::MAGIC || field(1) != ring::VERSION || field(2) == 0 {
+        return None;
+    }
+    Some(RingOptions {
+        slots: field(2),
+        slot_size: field(3),
+    })
+}
+
+fn encode_buffers(len: usize) -> [u8; BUFFERS_LEN] {
+    let mut message = [0; BUFFERS_LEN];
+    message[..4].copy_from_slice(&ring::MAGIC.to_le_bytes());
+    message[8..].copy_from_slice(&(len as u64).to_le_bytes());
+    message
+}
+
+fn decode_buffers(message: &[u8; BUFFERS_LEN]) -> Option<usize> {
+    if message[..4] != ring::MAGIC.to_le_bytes() {
+        return None;
+    }
+    usize::try_from(u64::from_le_bytes(message[8..].try_into().unwrap())).ok()
+}
+
+/// Rebuild an error of the daemon from its errno and message
+fn daemon_error(errno: i32, message: &[u8]) -> DatenLordError {
+    let context = vec![format!("daemon: {}", String::from_utf8_lossy(message))];
+    match errno {
+        nix::libc::ENOENT => DatenLordError::NotFound { context },
+        nix::libc::EEXIST => DatenLordError::AlreadyExists { context },
+        nix::libc::EINVAL => DatenLordError::InvalidArgument { context },
+        nix::libc::ENOSYS => DatenLordError::Unimplemented { context },
+        _ => DatenLordError::Io { context },
+    }
+}
@@ -0,0 +1,556 @@
+//! Shared memory ring of the daemon transport
+//!
+//! The ring is a memfd mapped by the daemon and one client. It holds a
+//! submission queue and a completion queue of slot indexes and a fixed
+//! number of slots, each with room for one request, its response and a data
+//! buffer. The client owns a slot from submission to completion, so a queue
+//! never holds more indexes than there are slots.
+
+use std::io;
+use std::mem::{size_of, size_of_val};
+use std::os::fd::{AsRawFd, FromRawFd, OwnedFd, RawFd};
+use std::ptr;
+use std::sync::atomic::{AtomicU32, Ordering};
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
+
+use nix::sys::stat::SFlag;
+
+use crate::storage::fs_util::FileAttr;
+
+/// Tells a datenlord ring from any other mapping
+pub(super) const MAGIC: u32 = 0x444c_5247;
+
+/// Version of the ring layout and of the requests
+pub(super) const VERSION: u32 = 2;
+
+/// The file descriptors sent to a client: the ring, the submission doorbell
+/// and the completion doorbell
+pub(super) const SETUP_FDS: usize = 3;
+
+/// The operations of a request
+#[repr(u32)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub(super) enum Op {
+    Lookup = 1,
+    Getattr,
+    Mknod,
+    Mkdir,
+    Unlink,
+    Rmdir,
+    Rename,
+    Open,
+    Read,
+    Write,
+    Flush,
+    Release,
+    Fsync,
+    Opendir,
+    Readdir,
+    Releasedir,
+    RegisterBuffers,
+    UnregisterBuffers,
+    CopyFile,
+    Create,
+}
+
+impl Op {
+    pub(super) fn from_u32(op: u32) -> Option<Self> {
+        const OPS: [Op; 20] = [
+            Op::Lookup,
+            Op::Getattr,
+            Op::Mknod,
+            Op::Mkdir,
+            Op::Unlink,
+            Op::Rmdir,
+            Op::Rename,
+            Op::Open,
+            Op::Read,
+            Op::Write,
+            Op::Flush,
+            Op::Release,
+            Op::Fsync,
+            Op::Opendir,
+            Op::Readdir,
+            Op::Releasedir,
+            Op::RegisterBuffers,
+            Op::UnregisterBuffers,
+            Op::CopyFile,
+            Op::Create,
+        ];
+        OPS.get((op as usize).checked_sub(1)?).copied()
+    }
+}
+
+/// A request, its names and written bytes are in the data buffer of the slot
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub(super) struct WireRequest {
+    pub op: u32,
+    /// Open flags, or the datasync flag of fsync
+    pub flags: u32,
+    /// The inode, or the parent directory of named operations
+    pub ino: u64,
+    pub fh: u64,
+    pub offset: u64,
+    /// Bytes to read, or bytes written in the data buffer
+    pub len: u64,
+    /// The new parent directory of a rename
+    pub new_parent: u64,
+    pub uid: u32,
+    pub gid: u32,
+    pub mode: u32,
+    pub rdev: u32,
+    /// File type bits of a created node
+    pub kind: u32,
+    /// Length of the name at the start of the data buffer
+    pub name_len: u32,
+    /// Length of the second name, right after the first one
+    pub new_name_len: u32,
+    /// 1 when the bytes read or written are in the registered buffers of
+    /// the client at `buffer_offset` instead of the data buffer of the slot
+    pub buffer: u32,
+    pub buffer_offset: u64,
+}
+
+/// File attributes in the ring, times are nanoseconds since the epoch
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub(super) struct WireAttr {
+    pub ino: u64,
+    pub size: u64,
+    pub blocks: u64,
+    pub atime: u64,
+    pub mtime: u64,
+    pub ctime: u64,
+    pub kind: u32,
+    pub perm: u32,
+    pub nlink: u32,
+    pub uid: u32,
+    pub gid: u32,
+    pub rdev: u32,
+}
+
+fn to_nanos(time: SystemTime) -> u64 {
+    time.duration_since(UNIX_EPOCH).map_or(0, |since| since.as_nanos() as u64)
+}
+
+impl From<&FileAttr> for WireAttr {
+    fn from(attr: &FileAttr) -> Self {
+        Self {
+            ino: attr.ino,
+            size: attr.size,
+            blocks: attr.blocks,
+            atime: to_nanos(attr.atime),
+            mtime: to_nanos(attr.mtime),
+            ctime: to_nanos(attr.ctime),
+            kind: attr.kind.bits() as u32,
+            perm: u32::from(attr.perm),
+            nlink: attr.nlink,
+            uid: attr.uid,
+            gid: attr.gid,
+            rdev: attr.rdev,
+        }
+    }
+}
+
+impl From<&WireAttr> for FileAttr {
+    fn from(attr: &WireAttr) -> Self {
+        Self {
+            ino: attr.ino,
+            size: attr.size,
+            blocks: attr.blocks,
+            atime: UNIX_EPOCH + Duration::from_nanos(attr.atime),
+            mtime: UNIX_EPOCH + Duration::from_nanos(attr.mtime),
+            ctime: UNIX_EPOCH + Duration::from_nanos(attr.ctime),
+            kind: SFlag::from_bits_truncate(attr.kind as nix::libc::mode_t),
+            perm: attr.perm as u16,
+            nlink: attr.nlink,
+            uid: attr.uid,
+            gid: attr.gid,
+            rdev: attr.rdev,
+        }
+    }
+}
+
+/// The response to a request, its bytes are in the data buffer of the slot
+#[repr(C)]
+#[derive(Debug, Clone, Copy, Default)]
+pub(super) struct WireResponse {
+    /// 0 on success, the errno of the failure otherwise
+    pub errno: i32,
+    pub _reserved: u32,
+    /// Bytes in the data buffer: read data, directory entries or the error message
+    pub len: u64,
+    /// A file handle, a generation, an entry count or a removed inode
+    pub value: u64,
+    /// Ttl of the attributes in nanoseconds
+    pub ttl: u64,
+    pub attr: WireAttr,
+}
+
+/// A queue cursor on a cache line of its own, it counts positions modulo
+/// twice the number of slots so they map to the same entry across a wrap
+#[repr(C, align(64))]
+struct Cursor(AtomicU32);
+
+/// The start of the ring
+#[repr(C)]
+struct RingHeader {
+    magic: u32,
+    version: u32,
+    slots: u32,
+    slot_size: u32,
+    sq_head: Cursor,
+    sq_tail: Cursor,
+    cq_head: Cursor,
+    cq_tail: Cursor,
+}
+
+const fn align_up(value: usize, align: usize) -> usize {
+    (value + align - 1) / align * align
+}
+
+/// Offsets of the parts of a ring
+#[derive(Debug, Clone, Copy)]
+struct Layout {
+    sq: usize,
+    cq: usize,
+    slots: usize,
+    /// Offset of the data buffer in a slot
+    data: usize,
+    slot_stride: usize,
+    len: usize,
+}
+
+impl Layout {
+    fn new(slots: u32, slot_size: u32) -> Self {
+        let queue = size_of::<AtomicU32>() * slots as usize;
+        let sq = align_up(size_of::<RingHeader>(), 64);
+        let cq = align_up(sq + queue, 64);
+        let first_slot = align_up(cq + queue, 4096);
+        let data = align_up(size_of::<WireRequest>() + size_of::<WireResponse>(), 64);
+        let slot_stride = align_up(data + slot_size as usize, 4096);
+        Self {
+            sq,
+            cq,
+            slots: first_slot,
+            data,
+            slot_stride,
+            len: first_slot + slot_stride * slots as usize,
+        }
+    }
+}
+
+/// A mapped ring
+#[derive(Debug)]
+pub(super) struct Ring {
+    base: *mut u8,
+    layout: Layout,
+    slots: u32,
+    slot_size: usize,
+}
+
+// The ring is only accessed through the queue protocol, a slot belongs to
+// one side at a time
+unsafe impl Send for Ring {}
+unsafe impl Sync for Ring {}
+
+impl Ring {
+    /// Create a ring in a new memfd, return it with the memfd to send
+    pub(super) fn create(slots: u32, slot_size: u32) -> io::Result<(Self, OwnedFd)> {
+        let layout = Layout::new(slots, slot_size);
+        let fd = unsafe { nix::libc::memfd_create(b"datenlord-ring\0".as_ptr().cast(), nix::libc::MFD_CLOEXEC) };
+        if fd < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let fd = unsafe { OwnedFd::from_raw_fd(fd) };
+        if unsafe { nix::libc::ftruncate(fd.as_raw_fd(), layout.len as nix::libc::off_t) } < 0 {
+            return Err(io::Error::last_os_error());
+        }
+        let ring = Self::map_fd(&fd, layout, slots, slot_size)?;
+        let header = ring.base as *mut RingHeader;
+        unsafe {
+            (*header).magic = MAGIC;
+            (*header).version = VERSION;
+            (*header).slots = slots;
+            (*header).slot_size = slot_size;
+        }
+        Ok((ring, fd))
+    }
+
+    /// Map the ring received from the daemon
+    pub(super) fn open(fd: &OwnedFd, slots: u32, slot_size: u32) -> io::Result<Self> {
+        let ring = Self::map_fd(fd, Layout::new(slots, slot_size), slots, slot_size)?;
+        let header = ring.header();
+        let matches = header.slots == slots && header.slot_size == slot_size;
+        if header.magic != MAGIC || header.version != VERSION || !matches {
+            return Err(io::Error::new(io::ErrorKind::InvalidData, "not a datenlord ring"));
+        }
+        Ok(ring)
+    }
+
+    fn map_fd(fd: &OwnedFd, layout: Layout, slots: u32, slot_size: u32) -> io::Result<Self> {
+        let base = unsafe {
+            nix::libc::mmap(
+                ptr::null_mut(),
+                layout.len,
+                nix::libc::PROT_READ | nix::libc::PROT_WRITE,
+                nix::libc::MAP_SHARED,
+                fd.as_raw_fd(),
+                0,
+            )
+        };
+        if base == nix::libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+        Ok(Self {
+            base: base as *mut u8,
+            layout,
+            slots,
+            slot_size: slot_size as usize,
+        })
+    }
+
+    fn header(&self) -> &RingHeader {
+        unsafe { &*(self.base as *const RingHeader) }
+    }
+
+    pub(super) fn slots(&self) -> u32 {
+        self.slots
+    }
+
+    /// Bytes of the data buffer of a slot
+    pub(super) fn slot_size(&self) -> usize {
+        self.slot_size
+    }
+
+    fn entry(&self, queue: usize, position: u32) -> &AtomicU32 {
+        let index = (position % self.slots) as usize;
+        unsafe { &*(self.base.add(queue) as *const AtomicU32).add(index) }
+    }
+
+    fn slot(&self, index: u32) -> *mut u8 {
+        assert!(index < self.slots, "slot {index} out of the ring");
+        unsafe { self.base.add(self.layout.slots + self.layout.slot_stride * index as usize) }
+    }
+
+    pub(super) fn request(&self, index: u32) -> *mut WireRequest {
+        self.slot(index) as *mut WireRequest
+    }
+
+    pub(super) fn response(&self, index: u32) -> *mut WireResponse {
+        unsafe { self.slot(index).add(size_of::<WireRequest>()) as *mut WireResponse }
+    }
+
+    /// The data buffer of a slot, only the side owning the slot may use it
+    #[allow(clippy::mut_from_ref)]
+    pub(super) unsafe fn data(&self, index: u32) -> &mut [u8] {
+        std::slice::from_raw_parts_mut(self.slot(index).add(self.layout.data), self.slot_size)
+    }
+
+    /// The position after `position`, a wrap of the u32 itself would skip
+    /// or repeat an entry when the number of slots is not a power of two
+    fn next(&self, position: u32) -> u32 {
+        ((u64::from(position) + 1) % (2 * u64::from(self.slots))) as u32
+    }
+
+    fn push(&self, queue: usize, tail: &Cursor, index: u32) {
+        let position = tail.0.load(Ordering::Relaxed);
+        self.entry(queue, position).store(index, Ordering::Relaxed);
+        tail.0.store(self.next(position), Ordering::Release);
+    }
+
+    fn pop(&self, queue: usize, head: &Cursor, tail: &Cursor) -> Option<u32> {
+        let position = head.0.load(Ordering::Relaxed);
+        if position == tail.0.load(Ordering::Acquire) {
+            return None;
+        }
+        let index = self.entry(queue, position).load(Ordering::Relaxed);
+        head.0.store(self.next(position), Ordering::Release);
+        Some(index)
+    }
+
+    /// Submit a slot, the client serializes the submissions
+    pub(super) fn push_submission(&self, index: u32) {
+        let header = self.header();
+        self.push(self.layout.sq, &header.sq_tail, index);
+    }
+
+    pub(super) fn pop_submission(&self) -> Option<u32> {
+        let header = self.header();
+        self.pop(self.layout.sq, &header.sq_head, &header.sq_tail)
+    }
+
+    /// Complete a slot, the daemon serializes the completions
+    pub(super) fn push_completion(&self, index: u32) {
+        let header = self.header();
+        self.push(self.layout.cq, &header.cq_tail, index);
+    }
+
+    pub(super) fn pop_completion(&self) -> Option<u32> {
+        let header = self.header();
+        self.pop(self.layout.cq, &header.cq_head, &header.cq_tail)
+    }
+}
+
+impl Drop for Ring {
+    fn drop(&mut self) {
+        unsafe {
+            nix::libc::munmap(self.base as *mut nix::libc::c_void, self.layout.len);
+        }
+    }
+}
+
+/// Create an eventfd doorbell
+pub(super) fn eventfd(nonblocking: bool) -> io::Result<OwnedFd> {
+    let mut flags = nix::libc::EFD_CLOEXEC;
+    if nonblocking {
+        flags |= nix::libc::EFD_NONBLOCK;
+    }
+    let fd = unsafe { nix::libc::eventfd(0, flags) };
+    if fd < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(unsafe { OwnedFd::from_raw_fd(fd) })
+}
+
+/// Ring a doorbell
+pub(super) fn ring(fd: RawFd) {
+    let one: u64 = 1;
+    unsafe {
+        nix::libc::write(fd, (&one as *const u64).cast(), size_of::<u64>());
+    }
+}
+
+/// Reset a doorbell
+pub(super) fn drain(fd: RawFd) -> io::Result<()> {
+    let mut count: u64 = 0;
+    if unsafe { nix::libc::read(fd, (&mut count as *mut u64).cast(), size_of::<u64>()) } < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(())
+}
+
+/// Send `data` with file descriptors over a unix socket
+pub(super) fn send_fds(socket: RawFd, data: &[u8], fds: &[RawFd]) -> io::Result<()> {
+    let fds_len = size_of_val(fds);
+    let mut control = vec![0u8; unsafe { nix::libc::CMSG_SPACE(fds_len as u32) } as usize];
+    let mut iov = nix::libc::iovec {
+        iov_base: data.as_ptr() as *mut nix::libc::c_void,
+        iov_len: data.len(),
+    };
+    let mut msg: nix::libc::msghdr = unsafe { std::mem::zeroed() };
+    msg.msg_iov = &mut iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.as_mut_ptr().cast();
+    msg.msg_controllen = control.len() as _;
+    unsafe {
+        let cmsg = nix::libc::CMSG_FIRSTHDR(&msg);
+        (*cmsg).cmsg_level = nix::libc::SOL_SOCKET;
+        (*cmsg).cmsg_type = nix::libc::SCM_RIGHTS;
+        (*cmsg).cmsg_len = nix::libc::CMSG_LEN(fds_len as u32) as _;
+        ptr::copy_nonoverlapping(fds.as_ptr(), nix::libc::CMSG_DATA(cmsg) as *mut RawFd, fds.len());
+    }
+    let sent = unsafe { nix::libc::sendmsg(socket, &msg, nix::libc::MSG_NOSIGNAL) };
+    if sent < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    if sent as usize != data.len() {
+        return Err(io::Error::new(io::ErrorKind::WriteZero, "short message"));
+    }
+    Ok(())
+}
+
+/// Receive `data` with the file descriptors sent along, none when the peer
+/// closed the socket
+pub(super) fn recv_fds(socket: RawFd, data: &mut [u8]) -> io::Result<Option<Vec<OwnedFd>>> {
+    let fds_len = size_of::<[RawFd; SETUP_FDS]>();
+    let mut control = vec![0u8; unsafe { nix::libc::CMSG_SPACE(fds_len as u32) } as usize];
+    let mut iov = nix::libc::iovec {
+        iov_base: data.as_mut_ptr().cast(),
+        iov_len: data.len(),
+    };
+    let mut msg: nix::libc::msghdr = unsafe { std::mem::zeroed() };
+    msg.msg_iov = &mut iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.as_mut_ptr().cast();
+    msg.msg_controllen = control.len() as _;
+    let received = unsafe { nix::libc::recvmsg(socket, &mut msg, nix::libc::MSG_CMSG_CLOEXEC) };
+    if received < 0 {
+        return Err(io::Error::last_os_error());
+    }
+    if received == 0 {
+        return Ok(None);
+    }
+
+    let mut fds = Vec::new();
+    unsafe {
+        let mut cmsg = nix::libc::CMSG_FIRSTHDR(&msg);
+        while !cmsg.is_null() {
+            if (*cmsg).cmsg_level == nix::libc::SOL_SOCKET && (*cmsg).cmsg_type == nix::libc::SCM_RIGHTS {
+                let payload = (*cmsg).cmsg_len as usize - nix::libc::CMSG_LEN(0) as usize;
+                let first = nix::libc::CMSG_DATA(cmsg) as *const RawFd;
+                for index in 0..payload / size_of::<RawFd>() {
+                    fds.push(OwnedFd::from_raw_fd(ptr::read_unaligned(first.add(index))));
+                }
+            }
+            cmsg = nix::libc::CMSG_NXTHDR(&msg, cmsg);
+        }
+    }
+    if received as usize != data.len() {
+        return Err(io::Error::new(io::ErrorKind::UnexpectedEof, "short message"));
+    }
+    Ok(Some(fds))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn queues_wrap_around() {
+        // Not a power of two, so the entries only line up when the cursors wrap at a multiple of it
+        let (ring, _fd) = Ring::create(3, 4096).unwrap();
+        let mut next = 0;
+        for round in 0..20 {
+            let count = round % 3 + 1;
+            let submitted: Vec<u32> = (next..next + count).map(|index| index % 3).collect();
+            next += count;
+            for &index in &submitted {
+                ring.push_submission(index);
+            }
+            let popped: Vec<u32> = std::iter::from_fn(|| ring.pop_submission()).collect();
+            assert_eq!(popped, submitted);
+            for &index in &submitted {
+                ring.push_completion(index);
+            }
+            let completed: Vec<u32> = std::iter::from_fn(|| ring.pop_completion()).collect();
+            assert_eq!(completed, submitted);
+        }
+        let header = ring.header();
+        assert!(header.sq_head.0.load(Ordering::Relaxed) < 6);
+    }
+
+    #[test]
+    fn a_full_queue_keeps_every_slot() {
+        let (ring, _fd) = Ring::create(4, 4096).unwrap();
+        for round in 0..10 {
+            for index in 0..4 {
+                ring.push_submission((index + round) % 4);
+            }
+            for index in 0..4 {
+                assert_eq!(ring.pop_submission(), Some((index + round) % 4));
+            }
+            assert_eq!(ring.pop_submission(), None);
+        }
+    }
+
+    #[test]
+    fn open_checks_the_layout() {
+        let (ring, fd) = Ring::create(2, 4096).unwrap();
+        unsafe { ring.data(1)[..5].copy_from_slice(b"hello") };
+        let peer = Ring::open(&fd, 2, 4096).unwrap();
+        assert_eq!(unsafe { &peer.data(1)[..5] }, b"hello");
+        assert!(Ring::open(&fd, 4, 4096).is_err());
+    }
+}
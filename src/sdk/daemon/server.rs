@@ -0,0 +1,421 @@
+//! The daemon side of the ring transport
+//!
+//! Every client gets a ring of its own. Its submissions are run concurrently
+//! on the runtime of the daemon, reads and writes go through the sdk layer so
+//! they share the block cache, readahead and write-back of the daemon.
+
+use std::collections::HashMap;
+use std::os::fd::{AsRawFd, OwnedFd};
+use std::sync::{Arc, Mutex};
+use std::time::Duration;
+
+use nix::sys::stat::SFlag;
+use tokio::io::unix::AsyncFd;
+use tokio::io::Interest;
+use tokio::net::{UnixListener, UnixStream};
+use tokio::sync::Notify;
+use tokio::time::Instant;
+use tracing::{debug, warn};
+
+use super::ring::{self, Op, Ring, WireAttr, WireRequest, WireResponse};
+use super::{decode_buffers, encode_setup, RingOptions, BUFFERS_LEN};
+use crate::common::{DatenLordError, DatenLordResult};
+use crate::sdk::buffers::Arena;
+use crate::sdk::ops::{self, FileHandle, SdkFs};
+use crate::storage::fs_util::{CreateParam, FileAttr, RenameParam};
+use crate::storage::virtualfs::INum;
+
+/// Bind the socket of the daemon, replacing a stale socket file
+pub fn bind(path: &str) -> DatenLordResult<UnixListener> {
+    let _ = std::fs::remove_file(path);
+    UnixListener::bind(path).map_err(|e| DatenLordError::Io {
+        context: vec![format!("failed to bind daemon socket {path}: {e}")],
+    })
+}
+
+/// Serve the clients connecting to the socket until the runtime shuts down
+pub async fn serve(fs: Arc<SdkFs>, listener: UnixListener, options: RingOptions) {
+    loop {
+        match listener.accept().await {
+            Ok((stream, _)) => {
+                let fs = Arc::clone(&fs);
+                tokio::spawn(async move {
+                    if let Err(e) = serve_client(fs, stream, options).await {
+                        warn!("daemon client failed: {}", e);
+                    }
+                });
+            }
+            Err(e) => {
+                warn!("failed to accept daemon client: {}", e);
+                // The fd table may be full, back off before retrying
+                tokio::time::sleep(Duration::from_millis(100)).await;
+            }
+        }
+    }
+}
+
+/// How long the registration of buffers waits for their arena on the socket
+const SHARE_TIMEOUT: Duration = Duration::from_secs(5);
+
+/// A connected client
+struct Connection {
+    fs: Arc<SdkFs>,
+    ring: Ring,
+    /// Rung after every completion
+    completion_event: OwnedFd,
+    /// Serializes the completions of the concurrent requests
+    completion_lock: Mutex<()>,
+    /// Files opened by the client, released when it goes away
+    files: Mutex<HashMap<u64, FileHandle>>,
+    /// Directories opened by the client
+    dirs: Mutex<HashMap<u64, INum>>,
+    /// The registered buffers of the client, mapped in the daemon
+    buffers: Mutex<Option<Arc<Arena>>>,
+    /// Notified when the client shares its buffers
+    buffers_shared: Notify,
+}
+
+fn io_error(e: std::io::Error, context: &str) -> DatenLordError {
+    DatenLordError::Io {
+        context: vec![format!("{context}: {e}")],
+    }
+}
+
+async fn serve_client(fs: Arc<SdkFs>, stream: UnixStream, options: RingOptions) -> DatenLordResult<()> {
+    let (ring, memfd) =
+        Ring::create(options.slots, options.slot_size).map_err(|e| io_error(e, "failed to create ring"))?;
+    let submission_event = ring::eventfd(true).map_err(|e| io_error(e, "failed to create eventfd"))?;
+    let completion_event = ring::eventfd(false).map_err(|e| io_error(e, "failed to create eventfd"))?;
+
+    let setup = encode_setup(options);
+    let fds = [memfd.as_raw_fd(), submission_event.as_raw_fd(), completion_event.as_raw_fd()];
+    loop {
+        stream.writable().await.map_err(|e| io_error(e, "daemon socket failed"))?;
+        match stream.try_io(Interest::WRITABLE, || ring::send_fds(stream.as_raw_fd(), &setup, &fds)) {
+            Ok(()) => break,
+            Err(e) if e.kind() == std::io::ErrorKind::WouldBlock => continue,
+            Err(e) => return Err(io_error(e, "failed to send ring")),
+        }
+    }
+    // The client holds its own copy of the fds, the mapping outlives the memfd
+    drop(memfd);
+    debug!("daemon client connected, {} slots of {} bytes", options.slots, options.slot_size);
+
+    let connection = Arc::new(Connection {
+        fs,
+        ring,
+        completion_event,
+        completion_lock: Mutex::new(()),
+        files: Mutex::new(HashMap::new()),
+        dirs: Mutex::new(HashMap::new()),
+        buffers: Mutex::new(None),
+        buffers_shared: Notify::new(),
+    });
+    let submissions = AsyncFd::new(submission_event).map_err(|e| io_error(e, "failed to poll eventfd"))?;
+    let result = poll_client(&connection, &stream, &submissions).await;
+    debug!("daemon client disconnected");
+    connection.release_all().await;
+    result
+}
+
+/// Run the submissions of a client until it goes away
+async fn poll_client(
+    connection: &Arc<Connection>,
+    stream: &UnixStream,
+    submissions: &AsyncFd<OwnedFd>,
+) -> DatenLordResult<()> {
+    let mut message = [0; BUFFERS_LEN];
+    loop {
+        tokio::select! {
+            ready = submissions.readable() => {
+                let mut guard = ready.map_err(|e| io_error(e, "failed to poll eventfd"))?;
+                if guard.try_io(|event| ring::drain(event.get_ref().as_raw_fd())).is_err() {
+                    continue;
+                }
+                while let Some(index) = connection.ring.pop_submission() {
+                    if index >= connection.ring.slots() {
+                        warn!("daemon client submitted slot {} out of its ring", index);
+                        continue;
+                    }
+                    tokio::spawn(Arc::clone(connection).complete(index));
+                }
+            }
+            ready = stream.readable() => {
+                ready.map_err(|e| io_error(e, "daemon socket failed"))?;
+                let received = stream.try_io(Interest::READABLE, || ring::recv_fds(stream.as_raw_fd(), &mut message));
+                match received {
+                    Ok(Some(fds)) => connection.share_buffers(&message, fds),
+                    Ok(None) => return Ok(()),
+                    Err(e) if e.kind() == std::io::ErrorKind::WouldBlock => continue,
+                    Err(e) => return Err(io_error(e, "failed to read daemon socket")),
+                }
+            }
+        }
+    }
+}
+
+impl Connection {
+    /// Map the arena of registered buffers sent by the client
+    fn share_buffers(&self, message: &[u8; BUFFERS_LEN], fds: Vec<OwnedFd>) {
+        let (Some(len), Ok::<[OwnedFd; 1], _>([fd])) = (decode_buffers(message), fds.try_into()) else {
+            warn!("daemon client sent an invalid message");
+            return;
+        };
+        match Arena::from_fd(fd, len) {
+            Ok(arena) => {
+                *self.buffers.lock().unwrap() = Some(Arc::new(arena));
+                self.buffers_shared.notify_waiters();
+            }
+            Err(e) => warn!("failed to map the buffers of a daemon client: {}", e),
+        }
+    }
+
+    /// The registered buffers a request reads into or writes from, none for the slot
+    fn request_buffers(&self, request: &WireRequest) -> DatenLordResult<Option<Arc<Arena>>> {
+        if request.buffer == 0 {
+            return Ok(None);
+        }
+        let buffers = self.buffers.lock().unwrap().clone();
+        buffers.map(Some).ok_or_else(|| DatenLordError::InvalidArgument {
+            context: vec!["no registered buffers shared".to_owned()],
+        })
+    }
+
+    /// The bytes a read or write request moves
+    fn io_buffer<'a>(
+        request: &WireRequest,
+        buffers: Option<&'a Arena>,
+        data: &'a mut [u8],
+    ) -> DatenLordResult<&'a mut [u8]> {
+        let len = usize::try_from(request.len).unwrap_or(usize::MAX);
+        let Some(buffers) = buffers else {
+            return data.get_mut(..len).ok_or_else(|| DatenLordError::InvalidArgument {
+                context: vec![format!("request of {len} bytes overflows its slot")],
+            });
+        };
+        let start = usize::try_from(request.buffer_offset).unwrap_or(usize::MAX);
+        match start.checked_add(len) {
+            // The client owns the range until the request completes
+            Some(end) if end <= buffers.len() => Ok(unsafe { buffers.slice(start..end) }),
+            _ => Err(DatenLordError::InvalidArgument {
+                context: vec![format!("range {start}+{len} out of the registered buffers")],
+            }),
+        }
+    }
+
+    /// Wait for the arena of `len` bytes sent over the socket
+    async fn wait_buffers(&self, len: usize) -> DatenLordResult<()> {
+        let deadline = Instant::now() + SHARE_TIMEOUT;
+        loop {
+            let shared = self.buffers_shared.notified();
+            if self.buffers.lock().unwrap().as_ref().is_some_and(|buffers| buffers.len() == len) {
+                return Ok(());
+            }
+            if tokio::time::timeout_at(deadline, shared).await.is_err() {
+                return Err(DatenLordError::InvalidArgument {
+                    context: vec!["registered buffers were not shared".to_owned()],
+                });
+            }
+        }
+    }
+
+    /// Run the request of a slot and post its response
+    async fn complete(self: Arc<Self>, index: u32) {
+        let request = unsafe { self.ring.request(index).read() };
+        let data = unsafe { self.ring.data(index) };
+        let mut response = WireResponse::default();
+        if let Err(e) = self.execute(&request, data, &mut response).await {
+            let message = e.to_string();
+            let len = message.len().min(data.len());
+            data[..len].copy_from_slice(&message.as_bytes()[..len]);
+            response = WireResponse {
+                errno: e.errno(),
+                len: len as u64,
+                ..WireResponse::default()
+            };
+        }
+        unsafe { self.ring.response(index).write(response) };
+        {
+            let _lock = self.completion_lock.lock().unwrap();
+            self.ring.push_completion(index);
+        }
+        ring::ring(self.completion_event.as_raw_fd());
+    }
+
+    fn file(&self, fh: u64) -> DatenLordResult<FileHandle> {
+        self.files.lock().unwrap().get(&fh).copied().ok_or_else(|| DatenLordError::InvalidArgument {
+            context: vec![format!("invalid file handle {fh}")],
+        })
+    }
+
+    async fn execute(
+        &self,
+        request: &WireRequest,
+        data: &mut [u8],
+        response: &mut WireResponse,
+    ) -> DatenLordResult<()> {
+        let op = Op::from_u32(request.op).ok_or_else(|| DatenLordError::Unimplemented {
+            context: vec![format!("unknown daemon op {}", request.op)],
+        })?;
+        let names_len = request.name_len as usize + request.new_name_len as usize;
+        if names_len > data.len() {
+            return Err(DatenLordError::InvalidArgument {
+                context: vec![format!("names of {op:?} overflow its slot")],
+            });
+        }
+        let text = |range: std::ops::Range<usize>| {
+            std::str::from_utf8(&data[range]).map(str::to_owned).map_err(|_| DatenLordError::InvalidArgument {
+                context: vec!["file name is not utf-8".to_owned()],
+            })
+        };
+        let name = text(0..request.name_len as usize)?;
+        let new_name = text(request.name_len as usize..names_len)?;
+        let fs = &self.fs;
+        let backend = &fs.backend;
+        let set_attr = |response: &mut WireResponse, ttl: Duration, attr: &FileAttr| {
+            response.ttl = ttl.as_nanos() as u64;
+            response.attr = WireAttr::from(attr);
+        };
+
+        match op {
+            Op::Lookup => {
+                let (ttl, attr, generation) = backend.lookup(request.uid, request.gid, request.ino, &name).await?;
+                set_attr(response, ttl, &attr);
+                response.value = generation;
+            }
+            Op::Getattr => {
+                let (ttl, attr) = backend.getattr(request.ino).await?;
+                set_attr(response, ttl, &attr);
+            }
+            Op::Mknod | Op::Mkdir => {
+                let param = CreateParam {
+                    parent: request.ino,
+                    name,
+                    mode: request.mode,
+                    rdev: request.rdev,
+                    uid: request.uid,
+                    gid: request.gid,
+                    node_type: SFlag::from_bits_truncate(request.kind as nix::libc::mode_t),
+                    link: None,
+                };
+                let (ttl, attr, generation) = if op == Op::Mknod {
+                    backend.mknod(param).await?
+                } else {
+                    backend.mkdir(param).await?
+                };
+                set_attr(response, ttl, &attr);
+                response.value = generation;
+            }
+            Op::Unlink => backend.unlink(request.uid, request.gid, request.ino, &name).await?,
+            Op::Rmdir => {
+                let removed = backend.rmdir(request.uid, request.gid, request.ino, &name).await?;
+                // Inode 0 is never handed out, it stands for none
+                response.value = removed.unwrap_or(0);
+            }
+            Op::Rename => {
+                let param = RenameParam {
+                    old_parent: request.ino,
+                    old_name: name,
+                    new_parent: request.new_parent,
+                    new_name,
+                    flags: request.flags,
+                };
+                backend.rename(request.uid, request.gid, param).await?;
+            }
+            Op::CopyFile => {
+                let param = RenameParam {
+                    old_parent: request.ino,
+                    old_name: name,
+                    new_parent: request.new_parent,
+                    new_name,
+                    flags: 0,
+                };
+                let (ttl, attr) = backend.copy_file(request.uid, request.gid, param).await?;
+                set_attr(response, ttl, &attr);
+            }
+            Op::Create => {
+                let (handle, attr) =
+                    ops::create_inode(fs, request.ino, &name, request.mode, request.flags).await?;
+                self.files.lock().unwrap().insert(handle.fh, handle);
+                // The ttl the backends give their entries
+                set_attr(response, Duration::from_secs(1), &attr);
+                response.value = handle.fh;
+            }
+            Op::Open => {
+                let (_, attr) = backend.getattr(request.ino).await?;
+                let handle = ops::open_inode(fs, &attr, request.flags).await?;
+                self.files.lock().unwrap().insert(handle.fh, handle);
+                response.value = handle.fh;
+            }
+            Op::Read => {
+                let handle = self.file(request.fh)?;
+                let buffers = self.request_buffers(request)?;
+                let buffer = Self::io_buffer(request, buffers.as_deref(), data)?;
+                let read = ops::pread(fs, &handle, request.offset, buffer).await?;
+                response.len = read as u64;
+            }
+            Op::Write => {
+                let handle = self.file(request.fh)?;
+                let buffers = self.request_buffers(request)?;
+                let buffer = Self::io_buffer(request, buffers.as_deref(), data)?;
+                ops::pwrite(fs, &handle, request.offset, buffer).await?;
+            }
+            Op::Flush => ops::flush_file(fs, &self.file(request.fh)?).await?,
+            Op::Fsync => ops::fsync_file(fs, &self.file(request.fh)?).await?,
+            Op::Release => {
+                let handle = self.file(request.fh)?;
+                self.files.lock().unwrap().remove(&request.fh);
+                ops::close_file(fs, &handle).await?;
+            }
+            Op::Opendir => {
+                let fh = backend.opendir(request.uid, request.gid, request.ino, request.flags).await?;
+                self.dirs.lock().unwrap().insert(fh, request.ino);
+                response.value = fh;
+            }
+            Op::Readdir => {
+                let offset = i64::try_from(request.offset).unwrap_or(i64::MAX);
+                let entries = backend.readdir(request.uid, request.gid, request.ino, request.fh, offset).await?;
+                // As many entries as fit, the client asks again for the rest
+                let mut written = 0;
+                let mut count = 0;
+                for entry in &entries {
+                    let name = entry.name().as_bytes();
+                    let end = written + 16 + name.len();
+                    if end > data.len() {
+                        break;
+                    }
+                    data[written..written + 8].copy_from_slice(&entry.ino().to_le_bytes());
+                    data[written + 8..written + 12].copy_from_slice(&(entry.kind().bits() as u32).to_le_bytes());
+                    data[written + 12..written + 16].copy_from_slice(&(name.len() as u32).to_le_bytes());
+                    data[written + 16..end].copy_from_slice(name);
+                    written = end;
+                    count += 1;
+                }
+                response.len = written as u64;
+                response.value = count;
+            }
+            Op::Releasedir => {
+                self.dirs.lock().unwrap().remove(&request.fh);
+                backend.releasedir(request.ino, request.fh, request.flags).await?;
+            }
+            // The arena is sent over the socket, it may be read after this request
+            Op::RegisterBuffers => self.wait_buffers(usize::try_from(request.len).unwrap_or(usize::MAX)).await?,
+            Op::UnregisterBuffers => drop(self.buffers.lock().unwrap().take()),
+        }
+        Ok(())
+    }
+
+    /// Release what a gone client left open
+    async fn release_all(&self) {
+        let files: Vec<FileHandle> = self.files.lock().unwrap().drain().map(|(_, handle)| handle).collect();
+        for handle in files {
+            if let Err(e) = ops::close_file(&self.fs, &handle).await {
+                warn!("failed to release file {} of a gone daemon client: {}", handle.ino, e);
+            }
+        }
+        let dirs: Vec<(u64, INum)> = self.dirs.lock().unwrap().drain().collect();
+        for (fh, ino) in dirs {
+            let _ = self.fs.backend.releasedir(ino, fh, 0).await;
+        }
+    }
+}
@@ -0,0 +1,561 @@
+//! Metrics of the sdk calls
+//!
+//! Every sdk call records its latency in a log-linear histogram of its op,
+//! with the bytes it moves, whether it failed and the calls of the op in
+//! flight. The histograms have 8 buckets per power of two, so percentiles are
+//! within 12.5% of the recorded latencies, from a nanosecond up to a minute.
+//! Recording is a few relaxed atomic adds on the shard of the calling thread,
+//! threads do not share cache lines and never lock; a snapshot sums the shards.
+//!
+//! Snapshots are rendered as json for the C ABI and the bindings, and in the
+//! Prometheus text format for the scrape endpoint of a daemon.
+
+use std::fmt::Write;
+use std::future::Future;
+use std::sync::atomic::{AtomicI64, AtomicU64, AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::time::Instant;
+
+use serde_json::{json, Value};
+use tokio::io::{AsyncReadExt, AsyncWriteExt};
+use tokio::net::TcpListener;
+use tracing::warn;
+
+use crate::common::{DatenLordError, DatenLordResult};
+use crate::sdk::block_cache::BlockCacheStats;
+use crate::sdk::ops::SdkFs;
+
+/// The operations with metrics
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Op {
+    /// Lookups of a name that missed the metadata cache
+    Lookup,
+    /// Attribute reads that missed the metadata cache
+    Getattr,
+    Open,
+    Pread,
+    Pwrite,
+    Flush,
+    Fsync,
+    Close,
+    Opendir,
+    Readdir,
+    CreateFile,
+    Stat,
+    Mkdir,
+    Deldir,
+    Rename,
+    WriteFile,
+    ReadFileAt,
+    ReadWholeFile,
+    CopyFromLocalFile,
+    CopyToLocalFile,
+    RemoveTree,
+    CopyTree,
+    Copy,
+    Create,
+    Put,
+}
+
+const OPS: usize = 25;
+
+impl Op {
+    pub const ALL: [Op; OPS] = [
+        Op::Lookup,
+        Op::Getattr,
+        Op::Open,
+        Op::Pread,
+        Op::Pwrite,
+        Op::Flush,
+        Op::Fsync,
+        Op::Close,
+        Op::Opendir,
+        Op::Readdir,
+        Op::CreateFile,
+        Op::Stat,
+        Op::Mkdir,
+        Op::Deldir,
+        Op::Rename,
+        Op::WriteFile,
+        Op::ReadFileAt,
+        Op::ReadWholeFile,
+        Op::CopyFromLocalFile,
+        Op::CopyToLocalFile,
+        Op::RemoveTree,
+        Op::CopyTree,
+        Op::Copy,
+        Op::Create,
+        Op::Put,
+    ];
+
+    pub fn name(self) -> &'static str {
+        match self {
+            Op::Lookup => "lookup",
+            Op::Getattr => "getattr",
+            Op::Open => "open",
+            Op::Pread => "pread",
+            Op::Pwrite => "pwrite",
+            Op::Flush => "flush",
+            Op::Fsync => "fsync",
+            Op::Close => "close",
+            Op::Opendir => "opendir",
+            Op::Readdir => "readdir",
+            Op::CreateFile => "create_file",
+            Op::Stat => "stat",
+            Op::Mkdir => "mkdir",
+            Op::Deldir => "deldir",
+            Op::Rename => "rename",
+            Op::WriteFile => "write_file",
+            Op::ReadFileAt => "read_file_at",
+            Op::ReadWholeFile => "read_whole_file",
+            Op::CopyFromLocalFile => "copy_from_local_file",
+            Op::CopyToLocalFile => "copy_to_local_file",
+            Op::RemoveTree => "remove_tree",
+            Op::CopyTree => "copy_tree",
+            Op::Copy => "copy",
+            Op::Create => "create",
+            Op::Put => "put",
+        }
+    }
+}
+
+/// Buckets per power of two are `1 << SUB_BITS`
+const SUB_BITS: u32 = 3;
+const SUB_BUCKETS: usize = 1 << SUB_BITS;
+/// Latencies from `1 << MAX_POWER` ns on, about a minute, share the last bucket
+const MAX_POWER: u32 = 36;
+const BUCKETS: usize = (MAX_POWER as usize - SUB_BITS as usize + 2) * SUB_BUCKETS;
+/// Shards of the counters, the threads of a process are spread over them
+const SHARDS: usize = 8;
+
+/// Bucket of a latency in nanoseconds
+fn bucket(ns: u64) -> usize {
+    if ns < SUB_BUCKETS as u64 {
+        return ns as usize;
+    }
+    let power = 63 - ns.leading_zeros();
+    if power > MAX_POWER {
+        return BUCKETS - 1;
+    }
+    let sub = (ns >> (power - SUB_BITS)) as usize & (SUB_BUCKETS - 1);
+    (power - SUB_BITS + 1) as usize * SUB_BUCKETS + sub
+}
+
+/// Smallest latency in nanoseconds of a bucket
+fn bucket_start(index: usize) -> u64 {
+    if index < SUB_BUCKETS {
+        return index as u64;
+    }
+    let power = (index / SUB_BUCKETS) as u32 + SUB_BITS - 1;
+    ((SUB_BUCKETS + index % SUB_BUCKETS) as u64) << (power - SUB_BITS)
+}
+
+/// Counters of one op in one shard
+#[repr(align(64))]
+struct OpCounters {
+    calls: AtomicU64,
+    errors: AtomicU64,
+    bytes: AtomicU64,
+    latency_ns: AtomicU64,
+    /// Started minus finished calls, the sum over the shards is the calls in flight
+    in_flight: AtomicI64,
+    buckets: [AtomicU64; BUCKETS],
+}
+
+impl Default for OpCounters {
+    fn default() -> Self {
+        Self {
+            calls: AtomicU64::new(0),
+            errors: AtomicU64::new(0),
+            bytes: AtomicU64::new(0),
+            latency_ns: AtomicU64::new(0),
+            in_flight: AtomicI64::new(0),
+            buckets: std::array::from_fn(|_| AtomicU64::new(0)),
+        }
+    }
+}
+
+/// The counters recorded by a group of threads
+struct Shard {
+    ops: [OpCounters; OPS],
+    attr_cache_hits: AtomicU64,
+    attr_cache_misses: AtomicU64,
+}
+
+impl Default for Shard {
+    fn default() -> Self {
+        Self {
+            ops: std::array::from_fn(|_| OpCounters::default()),
+            attr_cache_hits: AtomicU64::new(0),
+            attr_cache_misses: AtomicU64::new(0),
+        }
+    }
+}
+
+static NEXT_SHARD: AtomicUsize = AtomicUsize::new(0);
+
+thread_local! {
+    /// The shard the calling thread records to, picked round-robin
+    static SHARD: usize = NEXT_SHARD.fetch_add(1, Ordering::Relaxed) % SHARDS;
+}
+
+/// The metrics of an sdk instance
+pub struct Metrics {
+    shards: Box<[Shard]>,
+    started: Instant,
+}
+
+impl std::fmt::Debug for Metrics {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("Metrics").field("started", &self.started).finish_non_exhaustive()
+    }
+}
+
+impl Default for Metrics {
+    fn default() -> Self {
+        Self {
+            shards: (0..SHARDS).map(|_| Shard::default()).collect(),
+            started: Instant::now(),
+        }
+    }
+}
+
+/// Ends a call when the future running it completes or is dropped
+struct InFlight<'a> {
+    metrics: &'a Metrics,
+    op: Op,
+}
+
+impl Drop for InFlight<'_> {
+    fn drop(&mut self) {
+        self.metrics.shard().ops[self.op as usize].in_flight.fetch_sub(1, Ordering::Relaxed);
+    }
+}
+
+impl Metrics {
+    fn shard(&self) -> &Shard {
+        &self.shards[SHARD.with(|shard| *shard)]
+    }
+
+    /// Run a call of `op` moving `bytes`, record its latency and outcome
+    pub async fn record<T, F>(&self, op: Op, bytes: usize, call: F) -> DatenLordResult<T>
+    where
+        F: Future<Output = DatenLordResult<T>>,
+    {
+        self.shard().ops[op as usize].in_flight.fetch_add(1, Ordering::Relaxed);
+        let _in_flight = InFlight { metrics: self, op };
+        let start = Instant::now();
+        let result = call.await;
+        let ns = u64::try_from(start.elapsed().as_nanos()).unwrap_or(u64::MAX);
+
+        // The call may have moved to another worker thread meanwhile
+        let counters = &self.shard().ops[op as usize];
+        counters.calls.fetch_add(1, Ordering::Relaxed);
+        counters.latency_ns.fetch_add(ns, Ordering::Relaxed);
+        counters.buckets[bucket(ns)].fetch_add(1, Ordering::Relaxed);
+        if result.is_ok() {
+            counters.bytes.fetch_add(bytes as u64, Ordering::Relaxed);
+        } else {
+            counters.errors.fetch_add(1, Ordering::Relaxed);
+        }
+        result
+    }
+
+    /// Count a lookup of the metadata cache
+    pub fn attr_cache_lookup(&self, hit: bool) {
+        let shard = self.shard();
+        let counter = if hit { &shard.attr_cache_hits } else { &shard.attr_cache_misses };
+        counter.fetch_add(1, Ordering::Relaxed);
+    }
+}
+
+/// The metrics of one op summed over the shards
+#[derive(Debug, Clone)]
+pub struct OpSnapshot {
+    pub op: Op,
+    pub calls: u64,
+    pub errors: u64,
+    /// Bytes of the successful calls
+    pub bytes: u64,
+    pub in_flight: i64,
+    /// Sum of the latencies in nanoseconds
+    pub latency_ns: u64,
+    buckets: Vec<u64>,
+}
+
+impl OpSnapshot {
+    /// Latency in nanoseconds under which a `quantile` of the calls finished
+    pub fn percentile(&self, quantile: f64) -> u64 {
+        let total: u64 = self.buckets.iter().sum();
+        if total == 0 {
+            return 0;
+        }
+        let rank = ((total as f64 * quantile).ceil() as u64).clamp(1, total);
+        let mut seen = 0;
+        for (index, count) in self.buckets.iter().enumerate() {
+            seen += count;
+            if seen >= rank {
+                // The start of the next bucket bounds the latencies of this one
+                return bucket_start(index + 1).saturating_sub(1).max(bucket_start(index));
+            }
+        }
+        bucket_start(BUCKETS)
+    }
+
+    /// Calls finished in at most `ns` nanoseconds, rounded down to a bucket
+    fn calls_within(&self, ns: u64) -> u64 {
+        self.buckets
+            .iter()
+            .enumerate()
+            .take_while(|(index, _)| bucket_start(index + 1) <= ns + 1)
+            .map(|(_, count)| count)
+            .sum()
+    }
+}
+
+/// The metrics of an sdk instance at one point
+#[derive(Debug, Clone)]
+pub struct MetricsSnapshot {
+    pub ops: Vec<OpSnapshot>,
+    pub attr_cache_hits: u64,
+    pub attr_cache_misses: u64,
+    pub block_cache: BlockCacheStats,
+    pub uptime_secs: f64,
+}
+
+/// Sum the counters of the sdk instance
+pub fn snapshot(fs: &SdkFs) -> MetricsSnapshot {
+    let metrics = &fs.metrics;
+    let ops = Op::ALL
+        .iter()
+        .map(|&op| {
+            let mut snapshot = OpSnapshot {
+                op,
+                calls: 0,
+                errors: 0,
+                bytes: 0,
+                in_flight: 0,
+                latency_ns: 0,
+                buckets: vec![0; BUCKETS],
+            };
+            for shard in metrics.shards.iter() {
+                let counters = &shard.ops[op as usize];
+                snapshot.calls += counters.calls.load(Ordering::Relaxed);
+                snapshot.errors += counters.errors.load(Ordering::Relaxed);
+                snapshot.bytes += counters.bytes.load(Ordering::Relaxed);
+                snapshot.latency_ns += counters.latency_ns.load(Ordering::Relaxed);
+                snapshot.in_flight += counters.in_flight.load(Ordering::Relaxed);
+                for (sum, bucket) in snapshot.buckets.iter_mut().zip(counters.buckets.iter()) {
+                    *sum += bucket.load(Ordering::Relaxed);
+                }
+            }
+            snapshot
+        })
+        .collect();
+    let sum = |counter: fn(&Shard) -> &AtomicU64| {
+        metrics.shards.iter().map(|shard| counter(shard).load(Ordering::Relaxed)).sum()
+    };
+    MetricsSnapshot {
+        ops,
+        attr_cache_hits: sum(|shard| &shard.attr_cache_hits),
+        attr_cache_misses: sum(|shard| &shard.attr_cache_misses),
+        block_cache: fs.block_cache.stats(),
+        uptime_secs: metrics.started.elapsed().as_secs_f64(),
+    }
+}
+
+fn hit_rate(hits: u64, misses: u64) -> f64 {
+    if hits + misses == 0 {
+        0.0
+    } else {
+        hits as f64 / (hits + misses) as f64
+    }
+}
+
+/// Bounds in nanoseconds of the Prometheus histogram buckets, from 1 us to a minute
+const PROMETHEUS_BOUNDS: [u64; 12] = [
+    1_000,
+    5_000,
+    10_000,
+    50_000,
+    100_000,
+    500_000,
+    1_000_000,
+    5_000_000,
+    10_000_000,
+    100_000_000,
+    1_000_000_000,
+    60_000_000_000,
+];
+
+impl MetricsSnapshot {
+    /// The snapshot as a json document, latencies in microseconds
+    pub fn to_json(&self) -> Value {
+        let us = |ns: u64| ns as f64 / 1e3;
+        let ops: serde_json::Map<String, Value> = self
+            .ops
+            .iter()
+            .map(|op| {
+                let mean = if op.calls == 0 { 0 } else { op.latency_ns / op.calls };
+                let value = json!({
+                    "calls": op.calls,
+                    "errors": op.errors,
+                    "bytes": op.bytes,
+                    "in_flight": op.in_flight,
+                    "latency_us": {
+                        "mean": us(mean),
+                        "p50": us(op.percentile(0.5)),
+                        "p90": us(op.percentile(0.9)),
+                        "p99": us(op.percentile(0.99)),
+                        "p999": us(op.percentile(0.999)),
+                        "max": us(op.percentile(1.0)),
+                    },
+                });
+                (op.op.name().to_owned(), value)
+            })
+            .collect();
+        let block_cache = &self.block_cache;
+        json!({
+            "uptime_secs": self.uptime_secs,
+            "ops": ops,
+            "attr_cache": {
+                "hits": self.attr_cache_hits,
+                "misses": self.attr_cache_misses,
+                "hit_rate": hit_rate(self.attr_cache_hits, self.attr_cache_misses),
+            },
+            "block_cache": {
+                "hits": block_cache.hits,
+                "misses": block_cache.misses,
+                "evictions": block_cache.evictions,
+                "bytes": block_cache.bytes,
+                "capacity": block_cache.capacity,
+                "hit_rate": hit_rate(block_cache.hits, block_cache.misses),
+            },
+        })
+    }
+
+    /// The snapshot in the Prometheus text exposition format
+    pub fn to_prometheus(&self) -> String {
+        let mut out = String::new();
+        let _ = writeln!(out, "# TYPE datenlord_sdk_op_duration_seconds histogram");
+        for op in &self.ops {
+            let name = op.op.name();
+            for bound in PROMETHEUS_BOUNDS {
+                let le = bound as f64 / 1e9;
+                let count = op.calls_within(bound);
+                let _ = writeln!(out, "datenlord_sdk_op_duration_seconds_bucket{{op=\"{name}\",le=\"{le}\"}} {count}");
+            }
+            let _ = writeln!(out, "datenlord_sdk_op_duration_seconds_bucket{{op=\"{name}\",le=\"+Inf\"}} {}", op.calls);
+            let seconds = op.latency_ns as f64 / 1e9;
+            let _ = writeln!(out, "datenlord_sdk_op_duration_seconds_sum{{op=\"{name}\"}} {seconds}");
+            let _ = writeln!(out, "datenlord_sdk_op_duration_seconds_count{{op=\"{name}\"}} {}", op.calls);
+        }
+        let mut family = |name: &str, kind: &str, value: fn(&OpSnapshot) -> i64| {
+            let _ = writeln!(out, "# TYPE {name} {kind}");
+            for op in &self.ops {
+                let _ = writeln!(out, "{name}{{op=\"{}\"}} {}", op.op.name(), value(op));
+            }
+        };
+        family("datenlord_sdk_op_errors_total", "counter", |op| op.errors as i64);
+        family("datenlord_sdk_op_bytes_total", "counter", |op| op.bytes as i64);
+        family("datenlord_sdk_op_in_flight", "gauge", |op| op.in_flight);
+
+        let block_cache = &self.block_cache;
+        for (name, kind, value) in [
+            ("datenlord_sdk_attr_cache_hits_total", "counter", self.attr_cache_hits),
+            ("datenlord_sdk_attr_cache_misses_total", "counter", self.attr_cache_misses),
+            ("datenlord_sdk_block_cache_hits_total", "counter", block_cache.hits),
+            ("datenlord_sdk_block_cache_misses_total", "counter", block_cache.misses),
+            ("datenlord_sdk_block_cache_evictions_total", "counter", block_cache.evictions),
+            ("datenlord_sdk_block_cache_bytes", "gauge", block_cache.bytes),
+            ("datenlord_sdk_block_cache_capacity_bytes", "gauge", block_cache.capacity),
+        ] {
+            let _ = writeln!(out, "# TYPE {name} {kind}\n{name} {value}");
+        }
+        out
+    }
+}
+
+/// Bind the Prometheus endpoint, within the runtime of the sdk
+pub fn bind_prometheus(addr: &str) -> DatenLordResult<TcpListener> {
+    let listener = std::net::TcpListener::bind(addr)
+        .and_then(|listener| {
+            listener.set_nonblocking(true)?;
+            TcpListener::from_std(listener)
+        })
+        .map_err(|e| DatenLordError::Io {
+            context: vec![format!("failed to bind metrics endpoint {addr}: {e}")],
+        })?;
+    Ok(listener)
+}
+
+/// Answer every http request on the listener with the metrics of the sdk,
+/// until the runtime shuts down
+pub async fn serve_prometheus(fs: Arc<SdkFs>, listener: TcpListener) {
+    loop {
+        let mut stream = match listener.accept().await {
+            Ok((stream, _)) => stream,
+            Err(e) => {
+                warn!("failed to accept metrics scrape: {}", e);
+                tokio::time::sleep(std::time::Duration::from_millis(100)).await;
+                continue;
+            }
+        };
+        let fs = Arc::clone(&fs);
+        tokio::spawn(async move {
+            // Any request gets the metrics, read its head so the client sees no reset
+            let mut request = [0; 4096];
+            let _ = stream.read(&mut request).await;
+            let body = snapshot(&fs).to_prometheus();
+            let response = format!(
+                "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: {}\r\n\
+                 Connection: close\r\n\r\n{body}",
+                body.len()
+            );
+            if let Err(e) = stream.write_all(response.as_bytes()).await {
+                warn!("failed to answer metrics scrape: {}", e);
+            }
+        });
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn buckets_cover_the_latencies_in_order() {
+        for index in 0..BUCKETS - 1 {
+            assert!(bucket_start(index) < bucket_start(index + 1));
+            assert_eq!(bucket(bucket_start(index)), index);
+            assert_eq!(bucket(bucket_start(index + 1) - 1), index);
+        }
+        assert_eq!(bucket(u64::MAX), BUCKETS - 1);
+        // Within an eighth of the latency
+        let ns = 1_234_567;
+        assert!(ns - bucket_start(bucket(ns)) <= ns / SUB_BUCKETS as u64);
+    }
+
+    #[test]
+    fn percentiles() {
+        let mut buckets = vec![0; BUCKETS];
+        buckets[bucket(1000)] = 90;
+        buckets[bucket(1_000_000)] = 10;
+        let snapshot = OpSnapshot {
+            op: Op::Pread,
+            calls: 100,
+            errors: 0,
+            bytes: 0,
+            in_flight: 0,
+            latency_ns: 0,
+            buckets,
+        };
+        let p50 = snapshot.percentile(0.5);
+        assert!((1000..1000 + 1000 / SUB_BUCKETS as u64).contains(&p50), "{p50}");
+        assert!(snapshot.percentile(0.9) < 2000);
+        assert!(snapshot.percentile(0.99) >= 1_000_000);
+        assert_eq!(snapshot.calls_within(500), 0);
+        assert_eq!(snapshot.calls_within(10_000), 90);
+        assert_eq!(snapshot.calls_within(u64::MAX - 1), 100);
+    }
+}
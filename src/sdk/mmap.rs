@@ -0,0 +1,121 @@
+//! Read-only views of files
+//!
+//! Files of a backend with local paths are mapped with `mmap(2)`, so every
+//! process mapping a file shares its page cache. Other backends read the
+//! range into a buffer, through the block cache.
+
+use std::fs::File;
+use std::os::fd::AsRawFd;
+use std::os::raw::c_void;
+use std::sync::Arc;
+
+use crate::common::{DatenLordError, DatenLordResult};
+use crate::sdk::ops::{self, SdkFs};
+use crate::sdk::resolver;
+
+/// A read-only view of a range of a file
+#[derive(Debug)]
+pub enum FileMapping {
+    /// A shared mapping of a local file
+    Mapped {
+        /// Start of the mapping, at a page boundary
+        addr: *mut c_void,
+        /// Length of the mapping
+        map_len: usize,
+        /// Offset of the range in the mapping
+        delta: usize,
+        /// Length of the range
+        len: usize,
+    },
+    /// A copy of the range
+    Buffer(Vec<u8>),
+}
+
+// The mapping is read-only and owned by the view
+unsafe impl Send for FileMapping {}
+unsafe impl Sync for FileMapping {}
+
+impl FileMapping {
+    pub fn as_slice(&self) -> &[u8] {
+        match self {
+            Self::Mapped { addr, delta, len, .. } => unsafe {
+                std::slice::from_raw_parts((*addr as *const u8).add(*delta), *len)
+            },
+            Self::Buffer(buffer) => buffer,
+        }
+    }
+}
+
+impl Drop for FileMapping {
+    fn drop(&mut self) {
+        if let Self::Mapped { addr, map_len, .. } = *self {
+            unsafe {
+                nix::libc::munmap(addr, map_len);
+            }
+        }
+    }
+}
+
+/// Clip a range of `len` bytes from `offset` to a file of `size` bytes, 0 is up to the end of file
+fn clip(path: &str, size: u64, offset: u64, len: usize) -> DatenLordResult<usize> {
+    let available = size.saturating_sub(offset);
+    let len = if len == 0 { available } else { available.min(len as u64) };
+    usize::try_from(len).map_err(|_| DatenLordError::InvalidArgument {
+        context: vec![format!("{path}: {len} bytes do not fit in memory")],
+    })
+}
+
+/// Map `len` bytes of a file from `offset`, 0 maps up to the end of file.
+/// The range is clipped to the file size, the one of the mapped file
+/// rather than the cached one so that a file shrunk since is not mapped
+/// past its end.
+pub async fn map_file(fs: &Arc<SdkFs>, path: &str, offset: u64, len: usize) -> DatenLordResult<FileMapping> {
+    let attr = resolver::resolve(fs, path).await?;
+
+    let Some(local_path) = fs.backend.local_path(attr.ino) else {
+        let len = clip(path, attr.size, offset, len)?;
+        if len == 0 {
+            return Ok(FileMapping::Buffer(Vec::new()));
+        }
+        let mut buffer = vec![0; len];
+        let read = ops::read_file_at(fs, path, offset, &mut buffer).await?;
+        buffer.truncate(read);
+        return Ok(FileMapping::Buffer(buffer));
+    };
+
+    let path = path.to_owned();
+    tokio::task::spawn_blocking(move || {
+        let map_error = |e: std::io::Error| DatenLordError::Io {
+            context: vec![format!("failed to map {}: {e}", local_path.display())],
+        };
+        let file = File::open(&local_path).map_err(map_error)?;
+        let size = file.metadata().map_err(map_error)?.len();
+        let len = clip(&path, size, offset, len)?;
+        if len == 0 {
+            return Ok(FileMapping::Buffer(Vec::new()));
+        }
+        let page_size = unsafe { nix::libc::sysconf(nix::libc::_SC_PAGESIZE) } as u64;
+        let map_offset = offset - offset % page_size;
+        let delta = (offset - map_offset) as usize;
+        let map_len = delta + len;
+        let addr = unsafe {
+            nix::libc::mmap(
+                std::ptr::null_mut(),
+                map_len,
+                nix::libc::PROT_READ,
+                nix::libc::MAP_SHARED,
+                file.as_raw_fd(),
+                map_offset as nix::libc::off_t,
+            )
+        };
+        if addr == nix::libc::MAP_FAILED {
+            return Err(map_error(std::io::Error::last_os_error()));
+        }
+        // The mapping outlives the file descriptor
+        Ok(FileMapping::Mapped { addr, map_len, delta, len })
+    })
+    .await
+    .map_err(|e| DatenLordError::Internal {
+        context: vec![format!("blocking task failed: {e}")],
+    })?
+}
@@ -1,3 +1,17 @@
+pub mod attr_cache;
+pub mod block_cache;
+pub mod buffers;
 pub mod c;
+pub mod config;
+pub mod daemon;
+pub mod metrics;
+pub mod mmap;
+pub mod ops;
 pub mod py;
-pub mod pybind11;
\ No newline at end of file
+pub mod pybind11;
+pub mod readahead;
+pub mod resolver;
+pub mod trace;
+pub mod tree;
+pub mod vectored;
+pub mod write_back;
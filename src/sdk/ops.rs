@@ -0,0 +1,1017 @@
+//! Filesystem operations shared by the c and python sdks
+
+use std::fs::File;
+use std::future::Future;
+use std::ops::Range;
+use std::os::unix::fs::FileExt;
+use std::path::PathBuf;
+use std::sync::Arc;
+use std::time::Duration;
+
+use bytes::Bytes;
+use futures::{StreamExt, TryStreamExt};
+use nix::fcntl::OFlag;
+use nix::sys::stat::SFlag;
+use tokio::task::JoinSet;
+
+use crate::common::{DatenLordError, DatenLordResult};
+use crate::sdk::attr_cache::AttrCache;
+use crate::sdk::block_cache::{BlockCache, FileVersion};
+use crate::sdk::buffers::BufferPool;
+use crate::sdk::config::SdkConfig;
+use crate::sdk::metrics::{Metrics, Op};
+use crate::sdk::readahead::Readahead;
+use crate::sdk::write_back::WriteBack;
+use crate::sdk::resolver;
+use crate::sdk::trace::{self, Sampler};
+use crate::storage::fs_util::{CreateParam, FileAttr, RenameParam};
+use crate::storage::virtualfs::{DirEntry, INum, VirtualFs};
+
+/// The filesystem of an sdk instance with its metadata cache
+pub struct SdkFs {
+    /// The storage backend selected by the sdk config
+    pub backend: Box<dyn VirtualFs>,
+    /// Lookup results, kept for the ttl returned by the filesystem
+    pub attr_cache: AttrCache,
+    /// File blocks read through the sdk
+    pub block_cache: BlockCache,
+    /// Sequential reads, prefetched into the block cache
+    pub readahead: Readahead,
+    /// Buffered writes of the open files
+    pub write_back: WriteBack,
+    /// The calls to trace
+    pub sampler: Sampler,
+    /// Buffers registered by the caller
+    pub buffers: BufferPool,
+    /// Latencies and counters of the calls
+    pub metrics: Metrics,
+}
+
+impl SdkFs {
+    /// Wrap a filesystem with the caches sized by the config
+    pub fn new(backend: Box<dyn VirtualFs>, config: &SdkConfig) -> Self {
+        let block_cache = config.block_cache();
+        // Prefetched blocks are kept in the block cache, no readahead without it
+        let max_window = if block_cache.enabled() { config.readahead_max_bytes } else { 0 };
+        Self {
+            backend,
+            attr_cache: AttrCache::new(
+                config.attr_cache_entries,
+                config.inline_data_bytes,
+                Duration::from_millis(config.negative_ttl_ms),
+            ),
+            readahead: Readahead::new(block_cache.block_size() as u64, max_window),
+            write_back: WriteBack::new(config.write_back_extent_bytes, config.write_back_max_bytes),
+            sampler: Sampler::new(config.trace_sample_rate),
+            buffers: BufferPool::default(),
+            metrics: Metrics::default(),
+            block_cache,
+        }
+    }
+}
+
+/// An open file of the filesystem
+#[derive(Debug, Clone, Copy)]
+pub struct FileHandle {
+    /// Inode number of the file
+    pub ino: INum,
+    /// File handle returned by `VirtualFs::open`
+    pub fh: u64,
+    /// The open flags
+    pub flags: u32,
+    /// The version of the file when it was opened, blocks cached for another
+    /// version are not read through this handle
+    pub version: FileVersion,
+}
+
+impl FileHandle {
+    fn writable(&self) -> bool {
+        OFlag::from_bits_truncate(self.flags as i32) & OFlag::O_ACCMODE != OFlag::O_RDONLY
+    }
+}
+
+/// Open a file by path
+pub async fn open_file(fs: &SdkFs, path: &str, flags: u32) -> DatenLordResult<FileHandle> {
+    trace::traced(fs, Op::Open, path, 0, async {
+        let attr = resolver::resolve(fs, path).await?;
+        open_inode(fs, &attr, flags).await
+    })
+    .await
+}
+
+/// Open a file by its attributes
+pub(crate) async fn open_inode(fs: &SdkFs, attr: &FileAttr, flags: u32) -> DatenLordResult<FileHandle> {
+    let fh = fs.backend.open(1000, 1000, attr.ino, flags).await?;
+    Ok(FileHandle {
+        ino: attr.ino,
+        fh,
+        flags,
+        version: FileVersion::of(attr),
+    })
+}
+
+/// Read from an open file at offset, return the number of bytes read
+pub async fn pread(
+    fs: &Arc<SdkFs>,
+    handle: &FileHandle,
+    offset: u64,
+    buffer: &mut [u8],
+) -> DatenLordResult<usize> {
+    trace::traced(fs, Op::Pread, handle.ino, buffer.len(), async {
+        // Reads see the buffered writes of the handle
+        if fs.write_back.enabled() {
+            fs.write_back.barrier(fs, handle).await?;
+        }
+
+        if !fs.block_cache.enabled() {
+            let size = u32::try_from(buffer.len()).unwrap_or(u32::MAX);
+            return fs.backend.read(handle.ino, handle.fh, offset, size, buffer).await;
+        }
+
+        let block_size = fs.block_cache.block_size() as u64;
+        let mut read = 0;
+        while read < buffer.len() {
+            let position = offset + read as u64;
+            let index = position / block_size;
+            let block = match fs.block_cache.get(handle.ino, index, handle.version) {
+                Some(block) => block,
+                None => {
+                    let epoch = fs.block_cache.epoch(handle.ino);
+                    let block =
+                        read_block(fs, handle.ino, handle.fh, index * block_size, block_size as usize).await?;
+                    fs.block_cache.insert(handle.ino, index, handle.version, epoch, block.clone(), false);
+                    block
+                }
+            };
+            let start = (position - index * block_size) as usize;
+            if start >= block.len() {
+                break;
+            }
+            let len = (block.len() - start).min(buffer.len() - read);
+            buffer[read..read + len].copy_from_slice(&block[start..start + len]);
+            read += len;
+            // A short block is the end of file
+            if block.len() < block_size as usize {
+                break;
+            }
+        }
+
+        if let Some(range) = fs.readahead.on_read(handle.ino, offset, read as u64, handle.version.size) {
+            tokio::spawn(prefetch(Arc::clone(fs), handle.ino, handle.version, range));
+        }
+        Ok(read)
+    })
+    .await
+}
+
+/// Read the blocks of a range into the block cache, with a handle of its own
+/// as the one of the caller may be closed meanwhile
+async fn prefetch(fs: Arc<SdkFs>, ino: INum, version: FileVersion, range: Range<u64>) {
+    let block_size = fs.block_cache.block_size() as u64;
+    // Taken before the blocks are read, a write meanwhile drops them
+    let epoch = fs.block_cache.epoch(ino);
+    let indexes: Vec<u64> = (range.start / block_size..range.end.div_ceil(block_size))
+        .filter(|&index| !fs.block_cache.contains(ino, index, version))
+        .collect();
+    if indexes.is_empty() {
+        return;
+    }
+    let Ok(fh) = fs.backend.open(1000, 1000, ino, OFlag::O_RDONLY.bits() as u32).await else {
+        return;
+    };
+    let blocks = indexes.iter().map(|&index| {
+        let fs = &fs;
+        async move {
+            let block = read_block(fs, ino, fh, index * block_size, block_size as usize).await?;
+            fs.block_cache.insert(ino, index, version, epoch, block, true);
+            DatenLordResult::Ok(())
+        }
+    });
+    // A failed prefetch is retried by the read of the caller
+    let _ = futures::future::join_all(blocks).await;
+    let _ = fs.backend.release(ino, fh, OFlag::O_RDONLY.bits() as u32, 0, false).await;
+}
+
+/// Read a whole block from the filesystem, shorter only at the end of file
+async fn read_block(fs: &SdkFs, ino: INum, fh: u64, offset: u64, size: usize) -> DatenLordResult<Bytes> {
+    let mut block = vec![0; size];
+    let mut filled = 0;
+    while filled < size {
+        let remaining = u32::try_from(size - filled).unwrap_or(u32::MAX);
+        let read = fs
+            .backend
+            .read(ino, fh, offset + filled as u64, remaining, &mut block[filled..])
+            .await?;
+        if read == 0 {
+            break;
+        }
+        filled += read;
+    }
+    block.truncate(filled);
+    Ok(Bytes::from(block))
+}
+
+/// Write to an open file at offset, with write-back the write is buffered
+/// and its errors are returned by the next flush, fsync or close
+pub async fn pwrite(
+    fs: &Arc<SdkFs>,
+    handle: &FileHandle,
+    offset: u64,
+    data: &[u8],
+) -> DatenLordResult<()> {
+    trace::traced(fs, Op::Pwrite, handle.ino, data.len(), async {
+        let written = if fs.write_back.enabled() {
+            fs.write_back.write(fs, handle, offset, data).await
+        } else {
+            let offset = i64::try_from(offset).map_err(|_| DatenLordError::InvalidArgument {
+                context: vec![format!("offset {offset} overflow")],
+            })?;
+            fs.backend.write(handle.ino, handle.fh, offset, data, handle.flags).await
+        };
+        // The size and mtime changed, even a failed write may have been partial
+        invalidate_written(fs, handle.ino);
+        written
+    })
+    .await
+}
+
+/// Drop the cached attributes and content of a written file, once when the
+/// write is issued and, with write-back, again once it lands
+pub(crate) fn invalidate_written(fs: &SdkFs, ino: INum) {
+    fs.attr_cache.invalidate_attr(ino);
+    fs.block_cache.invalidate(ino);
+    fs.readahead.invalidate(ino);
+}
+
+/// Write out the buffered writes of an open file and flush it
+pub async fn flush_file(fs: &Arc<SdkFs>, handle: &FileHandle) -> DatenLordResult<()> {
+    trace::traced(fs, Op::Flush, handle.ino, 0, async {
+        let written = fs.write_back.barrier(fs, handle).await;
+        let flushed = fs.backend.flush(handle.ino, handle.fh, 0).await;
+        written.and(flushed)
+    })
+    .await
+}
+
+/// Write out the buffered writes of an open file and sync it to storage
+pub async fn fsync_file(fs: &Arc<SdkFs>, handle: &FileHandle) -> DatenLordResult<()> {
+    trace::traced(fs, Op::Fsync, handle.ino, 0, async {
+        let written = fs.write_back.barrier(fs, handle).await;
+        let synced = fs.backend.fsync(handle.ino, handle.fh, false).await;
+        written.and(synced)
+    })
+    .await
+}
+
+/// Flush and release an open file
+pub async fn close_file(fs: &Arc<SdkFs>, handle: &FileHandle) -> DatenLordResult<()> {
+    trace::traced(fs, Op::Close, handle.ino, 0, async {
+        let written = fs.write_back.close(fs, handle).await;
+        let flushed = written.and(fs.backend.flush(handle.ino, handle.fh, 0).await);
+        // Always release the handle, even if the flush failed
+        let released = fs.backend.release(handle.ino, handle.fh, handle.flags, 0, true).await;
+        if handle.writable() {
+            // Blocks read while the writes were not visible yet
+            fs.block_cache.invalidate(handle.ino);
+        }
+        released?;
+        flushed
+    })
+    .await
+}
+
+/// An open directory of the filesystem
+#[derive(Debug)]
+pub struct DirHandle {
+    /// Inode number of the directory
+    pub ino: INum,
+    /// Directory handle returned by `VirtualFs::opendir`
+    pub fh: u64,
+    /// Index of the next entry to read
+    offset: i64,
+}
+
+/// Open a directory by path
+pub async fn opendir(fs: &SdkFs, path: &str) -> DatenLordResult<DirHandle> {
+    trace::traced(fs, Op::Opendir, path, 0, async {
+        let attr = resolver::resolve(fs, path).await?;
+        opendir_inode(fs, attr.ino).await
+    })
+    .await
+}
+
+/// Open a directory by its inode number
+pub(crate) async fn opendir_inode(fs: &SdkFs, ino: INum) -> DatenLordResult<DirHandle> {
+    let fh = fs.backend.opendir(1000, 1000, ino, 0).await?;
+    Ok(DirHandle { ino, fh, offset: 0 })
+}
+
+/// Read the next page of entries, an empty page is the end of the directory
+pub async fn readdir_page(fs: &SdkFs, dir: &mut DirHandle) -> DatenLordResult<Vec<DirEntry>> {
+    let page = fs.metrics.record(Op::Readdir, 0, fs.backend.readdir(1000, 1000, dir.ino, dir.fh, dir.offset)).await?;
+    dir.offset += page.len() as i64;
+    Ok(page)
+}
+
+/// Lookups in flight of a page of a readdirplus
+const READDIR_ATTRS_CONCURRENCY: usize = 64;
+
+/// Get the attributes of the entries of a page, `None` for the entries
+/// removed since the page was read. The attributes listed along with the
+/// entries fill the attribute cache, the other entries are looked up
+/// concurrently.
+pub async fn readdir_attrs(fs: &SdkFs, dir: &DirHandle, page: &[DirEntry]) -> Vec<Option<FileAttr>> {
+    futures::stream::iter(page)
+        .map(|entry| async move {
+            if let Some((ttl, attr)) = entry.attr() {
+                fs.attr_cache.insert_entry(dir.ino, entry.name(), attr, ttl);
+                return Some(attr);
+            }
+            resolver::lookup_child(fs, dir.ino, entry.name()).await.ok()
+        })
+        .buffered(READDIR_ATTRS_CONCURRENCY)
+        .collect()
+        .await
+}
+
+/// Release an open directory
+pub async fn closedir(fs: &SdkFs, dir: &DirHandle) -> DatenLordResult<()> {
+    fs.backend.releasedir(dir.ino, dir.fh, 0).await
+}
+
+/// Tuning of streaming copies
+#[derive(Debug, Clone, Copy)]
+pub struct CopyOptions {
+    /// Bytes moved per read and write
+    pub chunk_size: usize,
+    /// Chunks in flight, read concurrently, the copy holds about this many buffers
+    pub queue_depth: usize,
+}
+
+/// Build an I/O error of a local file
+fn local_io_error(e: std::io::Error, context: String) -> DatenLordError {
+    let context = vec![format!("{context}: {e}")];
+    match e.kind() {
+        std::io::ErrorKind::NotFound => DatenLordError::NotFound { context },
+        std::io::ErrorKind::AlreadyExists => DatenLordError::AlreadyExists { context },
+        _ => DatenLordError::Io { context },
+    }
+}
+
+/// Run a blocking local file operation on the blocking thread pool
+async fn blocking<T, F>(f: F) -> DatenLordResult<T>
+where
+    F: FnOnce() -> DatenLordResult<T> + Send + 'static,
+    T: Send + 'static,
+{
+    tokio::task::spawn_blocking(f)
+        .await
+        .map_err(|e| DatenLordError::Internal {
+            context: vec![format!("blocking task failed: {e}")],
+        })?
+}
+
+/// Buffers of the chunks of a copy, reused once their chunk is written
+#[derive(Default)]
+struct ChunkPool {
+    free: std::sync::Mutex<Vec<Vec<u8>>>,
+}
+
+impl ChunkPool {
+    /// A buffer of `len` bytes
+    fn take(&self, len: usize) -> Vec<u8> {
+        let mut buf = self.free.lock().unwrap().pop().unwrap_or_default();
+        buf.resize(len, 0);
+        buf
+    }
+
+    fn put(&self, buf: Vec<u8>) {
+        self.free.lock().unwrap().push(buf);
+    }
+}
+
+/// Copy the `size` bytes of a source in chunks, `queue_depth` of them in flight.
+///
+/// `read(offset, buf)` fills `buf` and returns it with the number of bytes
+/// read, less only at the end of the source. `write(offset, buf, len)` writes
+/// the first `len` bytes and hands the buffer back for reuse. The chunks are
+/// read concurrently, so a remote source is read with as many range requests
+/// in flight. With `ordered` they are written one after the other in file
+/// order for a destination that is streamed, otherwise each chunk is written
+/// at its offset as soon as it is read. A source that grew since its size was
+/// taken is read on to its end one chunk at a time. Return the bytes copied.
+async fn copy_chunks<R, RFut, W, WFut>(
+    options: CopyOptions,
+    size: u64,
+    ordered: bool,
+    read: R,
+    write: W,
+) -> DatenLordResult<u64>
+where
+    R: Fn(u64, Vec<u8>) -> RFut,
+    RFut: Future<Output = DatenLordResult<(Vec<u8>, usize)>>,
+    W: Fn(u64, Vec<u8>, usize) -> WFut,
+    WFut: Future<Output = DatenLordResult<Vec<u8>>>,
+{
+    let chunk_size = options.chunk_size.max(1) as u64;
+    let depth = options.queue_depth.max(1);
+    let pool = ChunkPool::default();
+    let chunks = futures::stream::iter((0..size).step_by(chunk_size as usize)).map(|offset| {
+        let len = chunk_size.min(size - offset) as usize;
+        let buf = pool.take(len);
+        let read = read(offset, buf);
+        async move {
+            let (buf, read) = read.await?;
+            DatenLordResult::Ok((offset, buf, read, read == len))
+        }
+    });
+    let write_chunk = |(offset, buf, len, full): (u64, Vec<u8>, usize, bool)| {
+        let write = write(offset, buf, len);
+        let pool = &pool;
+        async move {
+            pool.put(write.await?);
+            DatenLordResult::Ok((len as u64, full))
+        }
+    };
+    let sum = |(copied, complete): (u64, bool), (len, full): (u64, bool)| async move {
+        DatenLordResult::Ok((copied + len, complete && full))
+    };
+    let (mut copied, complete) = if ordered {
+        chunks.buffered(depth).and_then(write_chunk).try_fold((0, true), sum).await?
+    } else {
+        let write_chunk = &write_chunk;
+        chunks
+            .map(|chunk| async move { write_chunk(chunk.await?).await })
+            .buffer_unordered(depth)
+            .try_fold((0, true), sum)
+            .await?
+    };
+
+    if complete {
+        loop {
+            let (buf, len) = read(copied, pool.take(chunk_size as usize)).await?;
+            if len == 0 {
+                break;
+            }
+            pool.put(write(copied, buf, len).await?);
+            copied += len as u64;
+        }
+    }
+    Ok(copied)
+}
+
+/// Read into the whole buffer unless the file ends first, return the bytes read
+fn read_full_at(file: &File, buf: &mut [u8], offset: u64) -> std::io::Result<usize> {
+    let mut filled = 0;
+    while filled < buf.len() {
+        match file.read_at(&mut buf[filled..], offset + filled as u64) {
+            Ok(0) => break,
+            Ok(len) => filled += len,
+            Err(e) if e.kind() == std::io::ErrorKind::Interrupted => {}
+            Err(e) => return Err(e),
+        }
+    }
+    Ok(filled)
+}
+
+/// Copy between two local paths in the kernel, `copy_file_range` on linux
+async fn copy_local_path(from: PathBuf, to: PathBuf) -> DatenLordResult<u64> {
+    blocking(move || {
+        std::fs::copy(&from, &to).map_err(|e| {
+            local_io_error(e, format!("failed to copy {} to {}", from.display(), to.display()))
+        })
+    })
+    .await
+}
+
+/// Copy a local file into the filesystem
+pub async fn copy_from_local_file(
+    fs: &Arc<SdkFs>,
+    options: CopyOptions,
+    overwrite: bool,
+    local: &str,
+    dest: &str,
+) -> DatenLordResult<()> {
+    trace::traced(fs, Op::CopyFromLocalFile, dest, 0, async {
+        let attr = match resolver::resolve(fs, dest).await {
+            Ok(_) if !overwrite => {
+                return Err(DatenLordError::AlreadyExists {
+                    context: vec![format!("{dest} already exists")],
+                });
+            }
+            Ok(attr) => attr,
+            Err(DatenLordError::NotFound { .. }) => create_file(fs, dest).await?,
+            Err(e) => return Err(e),
+        };
+
+        if let Some(dest_path) = fs.backend.local_path(attr.ino) {
+            let copied = copy_local_path(PathBuf::from(local), dest_path).await;
+            fs.attr_cache.invalidate_attr(attr.ino);
+            fs.block_cache.invalidate(attr.ino);
+            copied?;
+            return Ok(());
+        }
+
+        let local_path = local.to_owned();
+        let (source, size) = blocking(move || {
+            let source = File::open(&local_path)
+                .map_err(|e| local_io_error(e, format!("failed to open local file {local_path}")))?;
+            let metadata = source
+                .metadata()
+                .map_err(|e| local_io_error(e, format!("failed to stat local file {local_path}")))?;
+            Ok((Arc::new(source), metadata.len()))
+        })
+        .await?;
+
+        // The truncating open streams the chunks, in order, to the backend
+        let flags = (OFlag::O_WRONLY | OFlag::O_TRUNC).bits() as u32;
+        let handle = open_inode(fs, &attr, flags).await?;
+        let copied = copy_chunks(
+            options,
+            size,
+            true,
+            |offset, mut buf| {
+                let source = Arc::clone(&source);
+                blocking(move || {
+                    let len = read_full_at(&source, &mut buf, offset)
+                        .map_err(|e| local_io_error(e, "failed to read local file".to_owned()))?;
+                    Ok((buf, len))
+                })
+            },
+            |offset, buf, len| async move {
+                pwrite(fs, &handle, offset, &buf[..len]).await?;
+                Ok(buf)
+            },
+        )
+        .await;
+        let closed = close_file(fs, &handle).await;
+        copied?;
+        closed
+    })
+    .await
+}
+
+/// Copy a file of the filesystem to a local file
+pub async fn copy_to_local_file(
+    fs: &Arc<SdkFs>,
+    options: CopyOptions,
+    src: &str,
+    local: &str,
+) -> DatenLordResult<()> {
+    trace::traced(fs, Op::CopyToLocalFile, src, 0, async {
+        let attr = resolver::resolve(fs, src).await?;
+
+        if let Some(src_path) = fs.backend.local_path(attr.ino) {
+            copy_local_path(src_path, PathBuf::from(local)).await?;
+            return Ok(());
+        }
+
+        let local_path = local.to_owned();
+        let target = blocking(move || {
+            File::create(&local_path)
+                .map_err(|e| local_io_error(e, format!("failed to create local file {local_path}")))
+        })
+        .await
+        .map(Arc::new)?;
+
+        // Chunks are read with concurrent range reads and written where they belong
+        let handle = open_inode(fs, &attr, OFlag::O_RDONLY.bits() as u32).await?;
+        let copied = copy_chunks(
+            options,
+            attr.size,
+            false,
+            |offset, mut buf| async move {
+                let mut filled = 0;
+                while filled < buf.len() {
+                    let len = pread(fs, &handle, offset + filled as u64, &mut buf[filled..]).await?;
+                    if len == 0 {
+                        break;
+                    }
+                    filled += len;
+                }
+                Ok((buf, filled))
+            },
+            |offset, buf, len| {
+                let target = Arc::clone(&target);
+                blocking(move || {
+                    target
+                        .write_all_at(&buf[..len], offset)
+                        .map_err(|e| local_io_error(e, "failed to write local file".to_owned()))?;
+                    Ok(buf)
+                })
+            },
+        )
+        .await;
+        let closed = close_file(fs, &handle).await;
+        copied?;
+        closed
+    })
+    .await
+}
+
+/// Copy the content of a file of the filesystem into another one
+async fn copy_inode(
+    fs: &Arc<SdkFs>,
+    options: CopyOptions,
+    src: &FileAttr,
+    dest: &FileAttr,
+) -> DatenLordResult<()> {
+    if let (Some(src_path), Some(dest_path)) = (fs.backend.local_path(src.ino), fs.backend.local_path(dest.ino)) {
+        let copied = copy_local_path(src_path, dest_path).await;
+        fs.attr_cache.invalidate_attr(dest.ino);
+        fs.block_cache.invalidate(dest.ino);
+        return copied.map(|_| ());
+    }
+
+    let source = open_inode(fs, src, OFlag::O_RDONLY.bits() as u32).await?;
+    let flags = (OFlag::O_WRONLY | OFlag::O_TRUNC).bits() as u32;
+    let target = match open_inode(fs, dest, flags).await {
+        Ok(target) => target,
+        Err(e) => {
+            let _ = close_file(fs, &source).await;
+            return Err(e);
+        }
+    };
+    let copied = copy_chunks(
+        options,
+        src.size,
+        true,
+        |offset, mut buf| async move {
+            let len = pread(fs, &source, offset, &mut buf).await?;
+            Ok((buf, len))
+        },
+        |offset, buf, len| async move {
+            pwrite(fs, &target, offset, &buf[..len]).await?;
+            Ok(buf)
+        },
+    )
+    .await;
+    let _ = close_file(fs, &source).await;
+    let closed = close_file(fs, &target).await;
+    copied?;
+    closed
+}
+
+/// Copy a regular file to `dest`, replacing it. The copy is made within the
+/// backend when it can, such as a server-side copy of an object store or a
+/// reflink of a local filesystem, else the data is streamed through the sdk.
+pub async fn copy(fs: &Arc<SdkFs>, options: CopyOptions, src: &str, dest: &str) -> DatenLordResult<()> {
+    trace::traced(fs, Op::Copy, src, 0, async {
+        let (old_parent, old_name) = resolver::resolve_parent(fs, src).await?;
+        let attr = resolver::lookup_child(fs, old_parent, &old_name).await?;
+        if attr.kind != SFlag::S_IFREG {
+            return Err(DatenLordError::InvalidArgument {
+                context: vec![format!("{src} is not a regular file")],
+            });
+        }
+        let (new_parent, new_name) = resolver::resolve_parent(fs, dest).await?;
+        let param = RenameParam {
+            old_parent,
+            old_name,
+            new_parent,
+            new_name,
+            flags: 0,
+        };
+        copy_child(fs, options, &attr, param).await.map(|_| ())
+    })
+    .await
+}
+
+/// Copy the regular file `src` named by `param` into `param.new_parent`,
+/// within the backend when it can, return the attributes of the copy
+pub(crate) async fn copy_child(
+    fs: &Arc<SdkFs>,
+    options: CopyOptions,
+    src: &FileAttr,
+    param: RenameParam,
+) -> DatenLordResult<FileAttr> {
+    let (new_parent, new_name) = (param.new_parent, param.new_name.clone());
+    match fs.backend.copy_file(1000, 1000, param).await {
+        Ok((ttl, attr)) => {
+            fs.attr_cache.insert_entry(new_parent, &new_name, attr, ttl);
+            fs.block_cache.invalidate(attr.ino);
+            return Ok(attr);
+        }
+        Err(DatenLordError::Unimplemented { .. }) => {}
+        Err(e) => return Err(e),
+    }
+
+    let dest = match resolver::lookup_child(fs, new_parent, &new_name).await {
+        Ok(dest) => dest,
+        Err(DatenLordError::NotFound { .. }) => {
+            let param = CreateParam {
+                parent: new_parent,
+                name: new_name.clone(),
+                mode: 0o644,
+                rdev: 0,
+                uid: 1000,
+                gid: 1000,
+                node_type: SFlag::S_IFREG,
+                link: None,
+            };
+            let (ttl, attr, _) = fs.backend.mknod(param).await?;
+            fs.attr_cache.insert_entry(new_parent, &new_name, attr, ttl);
+            attr
+        }
+        Err(e) => return Err(e),
+    };
+    copy_inode(fs, options, src, &dest).await?;
+    Ok(dest)
+}
+
+/// Create a regular file and open it, `flags` are the open(2) flags. An
+/// existing file is opened instead unless `O_EXCL` is set. Return the handle
+/// with the attributes of the file once opened, empty after `O_TRUNC`.
+pub async fn create_open(
+    fs: &Arc<SdkFs>,
+    path: &str,
+    mode: u32,
+    flags: u32,
+) -> DatenLordResult<(FileHandle, FileAttr)> {
+    trace::traced(fs, Op::Create, path, 0, async {
+        let (parent, name) = resolver::resolve_parent(fs, path).await?;
+        match create_inode(fs, parent, &name, mode, flags).await {
+            Err(DatenLordError::AlreadyExists { .. }) if flags & OFlag::O_EXCL.bits() as u32 == 0 => {
+                let mut attr = resolver::lookup_child(fs, parent, &name).await?;
+                let handle = open_inode(fs, &attr, flags).await?;
+                // The attributes were looked up before the open emptied the file
+                let oflags = OFlag::from_bits_truncate(flags as i32);
+                if oflags.contains(OFlag::O_TRUNC) && oflags & OFlag::O_ACCMODE != OFlag::O_RDONLY {
+                    attr.size = 0;
+                    attr.blocks = 0;
+                    invalidate_written(fs, attr.ino);
+                }
+                Ok((handle, attr))
+            }
+            created => created,
+        }
+    })
+    .await
+}
+
+/// Create a regular file in a directory and open it, with `mknod` and `open`
+/// when the backend cannot do both in one call
+pub(crate) async fn create_inode(
+    fs: &SdkFs,
+    parent: INum,
+    name: &str,
+    mode: u32,
+    flags: u32,
+) -> DatenLordResult<(FileHandle, FileAttr)> {
+    let (ttl, attr, fh) = match fs.backend.create(1000, 1000, parent, name, mode, flags).await {
+        Err(DatenLordError::Unimplemented { .. }) => {
+            let param = CreateParam {
+                parent,
+                name: name.to_owned(),
+                mode,
+                rdev: 0,
+                uid: 1000,
+                gid: 1000,
+                node_type: SFlag::S_IFREG,
+                link: None,
+            };
+            let (ttl, attr, _) = fs.backend.mknod(param).await?;
+            fs.attr_cache.insert_entry(parent, name, attr, ttl);
+            let handle = open_inode(fs, &attr, flags).await?;
+            return Ok((handle, attr));
+        }
+        created => created?,
+    };
+    fs.attr_cache.insert_entry(parent, name, attr, ttl);
+    let handle = FileHandle {
+        ino: attr.ino,
+        fh,
+        flags,
+        version: FileVersion::of(&attr),
+    };
+    Ok((handle, attr))
+}
+
+/// Create or replace a file with its whole content, the file is created,
+/// written and closed in one call
+pub async fn put(fs: &Arc<SdkFs>, path: &str, data: &[u8]) -> DatenLordResult<()> {
+    trace::traced(fs, Op::Put, path, data.len(), async {
+        let flags = (OFlag::O_WRONLY | OFlag::O_CREAT | OFlag::O_TRUNC).bits() as u32;
+        let (handle, _) = create_open(fs, path, 0o644, flags).await?;
+        let written = pwrite(fs, &handle, 0, data).await;
+        let closed = close_file(fs, &handle).await;
+        written?;
+        closed?;
+        cache_written(fs, handle.ino, data).await;
+        Ok(())
+    })
+    .await
+}
+
+/// Keep the content of a small file written whole with its attributes, so
+/// that later stats and reads take no call to the backend
+async fn cache_written(fs: &SdkFs, ino: INum, data: &[u8]) {
+    if fs.attr_cache.inlines(data.len() as u64) {
+        if let Ok((ttl, attr)) = fs.metrics.record(Op::Getattr, 0, fs.backend.getattr(ino)).await {
+            fs.attr_cache.insert_attr(attr, ttl);
+            fs.attr_cache.insert_data(&attr, Bytes::copy_from_slice(data));
+        }
+    }
+}
+
+/// Create an empty regular file
+pub async fn create_file(fs: &SdkFs, path: &str) -> DatenLordResult<FileAttr> {
+    trace::traced(fs, Op::CreateFile, path, 0, async {
+        let (parent, name) = resolver::resolve_parent(fs, path).await?;
+        let param = CreateParam {
+            parent,
+            name: name.clone(),
+            mode: 0o644,
+            rdev: 0,
+            uid: 1000,
+            gid: 1000,
+            node_type: SFlag::S_IFREG,
+            link: None,
+        };
+        let (ttl, attr, _) = fs.backend.mknod(param).await?;
+        fs.attr_cache.insert_entry(parent, &name, attr, ttl);
+        Ok(attr)
+    })
+    .await
+}
+
+/// Get the attributes of a file
+pub async fn stat(fs: &SdkFs, path: &str) -> DatenLordResult<FileAttr> {
+    trace::traced(fs, Op::Stat, path, 0, resolver::resolve(fs, path)).await
+}
+
+/// Lookups in flight of a batched stat
+const STAT_BATCH_CONCURRENCY: usize = 256;
+
+/// Get the attributes of many files concurrently on the runtime workers,
+/// results are in the order of `paths`
+pub async fn stat_batch(fs: &Arc<SdkFs>, paths: Vec<String>) -> Vec<DatenLordResult<FileAttr>> {
+    let mut results: Vec<Option<DatenLordResult<FileAttr>>> = (0..paths.len()).map(|_| None).collect();
+    let mut tasks = JoinSet::new();
+    for (index, path) in paths.into_iter().enumerate() {
+        if tasks.len() >= STAT_BATCH_CONCURRENCY {
+            if let Some(Ok((index, result))) = tasks.join_next().await {
+                results[index] = Some(result);
+            }
+        }
+        let fs = Arc::clone(fs);
+        tasks.spawn(async move { (index, resolver::resolve(&fs, &path).await) });
+    }
+    while let Some(joined) = tasks.join_next().await {
+        if let Ok((index, result)) = joined {
+            results[index] = Some(result);
+        }
+    }
+    // A missing result is a lookup task that panicked
+    results
+        .into_iter()
+        .map(|result| {
+            result.unwrap_or_else(|| {
+                Err(DatenLordError::Internal {
+                    context: vec!["stat task failed".to_owned()],
+                })
+            })
+        })
+        .collect()
+}
+
+/// Check whether a path exists
+pub async fn exists(fs: &SdkFs, path: &str) -> bool {
+    resolver::resolve(fs, path).await.is_ok()
+}
+
+/// Create a directory
+pub async fn mkdir(fs: &SdkFs, path: &str) -> DatenLordResult<FileAttr> {
+    trace::traced(fs, Op::Mkdir, path, 0, async {
+        let (parent, name) = resolver::resolve_parent(fs, path).await?;
+        let param = CreateParam {
+            parent,
+            name: name.clone(),
+            mode: 0o777,
+            rdev: 0,
+            uid: 1000,
+            gid: 1000,
+            node_type: SFlag::S_IFDIR,
+            link: None,
+        };
+        let (ttl, attr, _) = fs.backend.mkdir(param).await?;
+        fs.attr_cache.insert_entry(parent, &name, attr, ttl);
+        Ok(attr)
+    })
+    .await
+}
+
+/// Remove a directory
+pub async fn deldir(fs: &SdkFs, path: &str) -> DatenLordResult<()> {
+    trace::traced(fs, Op::Deldir, path, 0, async {
+        let (parent, name) = resolver::resolve_parent(fs, path).await?;
+        let removed = fs.backend.rmdir(1000, 1000, parent, &name).await;
+        fs.attr_cache.invalidate_entry(parent, &name);
+        if let Ok(Some(ino)) = removed {
+            fs.attr_cache.invalidate_attr(ino);
+        }
+        removed.map(|_| ())
+    })
+    .await
+}
+
+/// Rename a path, replacing the destination
+pub async fn rename(fs: &SdkFs, src: &str, dest: &str) -> DatenLordResult<()> {
+    trace::traced(fs, Op::Rename, src, 0, async {
+        let (old_parent, old_name) = resolver::resolve_parent(fs, src).await?;
+        let (new_parent, new_name) = resolver::resolve_parent(fs, dest).await?;
+        let param = RenameParam {
+            old_parent,
+            old_name: old_name.clone(),
+            new_parent,
+            new_name: new_name.clone(),
+            flags: 0,
+        };
+        let renamed = fs.backend.rename(1000, 1000, param).await;
+        // Entries below a renamed directory are keyed by its inode and stay valid
+        fs.attr_cache.invalidate_entry(old_parent, &old_name);
+        fs.attr_cache.invalidate_entry(new_parent, &new_name);
+        renamed
+    })
+    .await
+}
+
+/// Replace the whole content of a file
+pub async fn write_file(fs: &Arc<SdkFs>, path: &str, data: &[u8]) -> DatenLordResult<()> {
+    trace::traced(fs, Op::WriteFile, path, data.len(), async {
+        let flags = (OFlag::O_WRONLY | OFlag::O_TRUNC).bits() as u32;
+        let handle = open_file(fs, path, flags).await?;
+        let written = pwrite(fs, &handle, 0, data).await;
+        let closed = close_file(fs, &handle).await;
+        written?;
+        closed?;
+        cache_written(fs, handle.ino, data).await;
+        Ok(())
+    })
+    .await
+}
+
+/// Read a file into the buffer, return the number of bytes read
+pub async fn read_file(fs: &Arc<SdkFs>, path: &str, buffer: &mut [u8]) -> DatenLordResult<usize> {
+    read_file_at(fs, path, 0, buffer).await
+}
+
+/// Copy the inline content of a small file from offset, return the number of bytes copied
+fn read_inline(data: &[u8], offset: u64, buffer: &mut [u8]) -> usize {
+    let start = usize::try_from(offset).unwrap_or(usize::MAX).min(data.len());
+    let len = buffer.len().min(data.len() - start);
+    buffer[..len].copy_from_slice(&data[start..start + len]);
+    len
+}
+
+/// Read a file at offset into the buffer, return the number of bytes read
+pub async fn read_file_at(
+    fs: &Arc<SdkFs>,
+    path: &str,
+    offset: u64,
+    buffer: &mut [u8],
+) -> DatenLordResult<usize> {
+    trace::traced(fs, Op::ReadFileAt, path, buffer.len(), async {
+        let attr = resolver::resolve(fs, path).await?;
+        if let Some(data) = fs.attr_cache.inline_data(attr.ino) {
+            return Ok(read_inline(&data, offset, buffer));
+        }
+        let handle = open_inode(fs, &attr, OFlag::O_RDONLY.bits() as u32).await?;
+        let read = pread(fs, &handle, offset, buffer).await;
+        let closed = close_file(fs, &handle).await;
+        let size = read?;
+        closed?;
+        if offset == 0 && size as u64 == attr.size && fs.attr_cache.inlines(attr.size) {
+            fs.attr_cache.insert_data(&attr, Bytes::copy_from_slice(&buffer[..size]));
+        }
+        Ok(size)
+    })
+    .await
+}
+
+/// Read a whole file into the buffer returned by `alloc`, which is called
+/// once with the file size, return the number of bytes read
+pub async fn read_whole_file<'a, F>(fs: &Arc<SdkFs>, path: &str, alloc: F) -> DatenLordResult<usize>
+where
+    F: FnOnce(usize) -> Option<&'a mut [u8]>,
+{
+    trace::traced(fs, Op::ReadWholeFile, path, 0, async {
+        let attr = resolver::resolve(fs, path).await?;
+        let buffer = alloc(attr.size as usize).ok_or_else(|| DatenLordError::Internal {
+            context: vec![format!("failed to allocate {} bytes for {path}", attr.size)],
+        })?;
+        if let Some(data) = fs.attr_cache.inline_data(attr.ino) {
+            return Ok(read_inline(&data, 0, buffer));
+        }
+        let handle = open_inode(fs, &attr, OFlag::O_RDONLY.bits() as u32).await?;
+        let read = pread(fs, &handle, 0, buffer).await;
+        let closed = close_file(fs, &handle).await;
+        let size = read?;
+        closed?;
+        if size as u64 == attr.size && fs.attr_cache.inlines(attr.size) {
+            fs.attr_cache.insert_data(&attr, Bytes::copy_from_slice(&buffer[..size]));
+        }
+        Ok(size)
+    })
+    .await
+}
@@ -1,56 +1,68 @@
 use pyo3::prelude::*;
 use pyo3::wrap_pyfunction;
-use std::sync::{Arc, Mutex};
+use std::sync::Arc;
 use tokio::runtime::Runtime;
-use bytes::BytesMut;
-use std::fs;
-use crate::storage::localfs::LocalFS;
-use crate::storage::fs_util::{CreateParam, RenameParam};
-use crate::storage::virtualfs::{INum, VirtualFs};
-use nix::sys::stat::SFlag;
+use crate::sdk::config::SdkConfig;
+use crate::sdk::daemon;
+use crate::sdk::metrics;
+use crate::sdk::ops::{self, SdkFs};
+use crate::sdk::tree;
 
 #[pyclass]
 struct DatenlordSDK {
-    localfs: Arc<Mutex<LocalFS>>,
+    fs: Arc<SdkFs>,
+    /// Runtime shared by all methods of this sdk instance
+    runtime: Runtime,
+    config: SdkConfig,
 }
 
 #[pymethods]
 impl DatenlordSDK {
     #[new]
-    fn new() -> PyResult<Self> {
-        let localfs = LocalFS::new().unwrap();
+    #[args(config = "\"{}\"")]
+    fn new(config: &str) -> PyResult<Self> {
+        let config = SdkConfig::parse(config);
+        config.init_logging();
+        let runtime = config
+            .build_runtime()
+            .map_err(|e| pyo3::exceptions::PyOSError::new_err(e.to_string()))?;
+        let backend = config
+            .backend
+            .build()
+            .map_err(|e| pyo3::exceptions::PyOSError::new_err(e.to_string()))?;
         Ok(DatenlordSDK {
-            localfs: Arc::new(Mutex::new(localfs)),
+            fs: Arc::new(SdkFs::new(backend, &config)),
+            runtime,
+            config,
         })
     }
 
-    fn exists(&self, dir_path: &str) -> PyResult<bool> {
-        let sdk_ref = &self.localfs;
-        let rt = Runtime::new().unwrap();
-        let result = rt.block_on(async {
-            let localfs = sdk_ref.lock().unwrap();
-            localfs.lookup(1000, 1000, 1, dir_path).await
-        });
-        Ok(result.is_ok())
-    }
-
-    fn mkdir(&self, dir_path: &str) -> PyResult<()> {
-        let sdk_ref = &self.localfs;
-        let rt = Runtime::new().unwrap();
-        let result = rt.block_on(async {
-            let param = CreateParam {
-                parent: 34735213, // 示例 inode
-                name: dir_path.to_string(),
-                mode: 0o777,
-                rdev: 0,
-                uid: 1000,
-                gid: 1000,
-                node_type: SFlag::S_IFDIR,
-                link: None,
-            };
-            let localfs = sdk_ref.lock().unwrap();
-            localfs.mkdir(param).await
-        });
+    /// Serve this sdk to the clients on the host through a unix socket
+    fn serve(&self, socket_path: &str) -> PyResult<()> {
+        let _runtime = self.runtime.enter();
+        let listener = daemon::server::bind(socket_path)
+            .map_err(|e| pyo3::exceptions::PyOSError::new_err(e.to_string()))?;
+        let scrape = if self.config.metrics_addr.is_empty() {
+            None
+        } else {
+            let scrape = metrics::bind_prometheus(&self.config.metrics_addr)
+                .map_err(|e| pyo3::exceptions::PyOSError::new_err(e.to_string()))?;
+            Some(scrape)
+        };
+        let serve = daemon::server::serve(Arc::clone(&self.fs), listener, self.config.ring_options());
+        self.runtime.spawn(serve);
+        if let Some(scrape) = scrape {
+            self.runtime.spawn(metrics::serve_prometheus(Arc::clone(&self.fs), scrape));
+        }
+        Ok(())
+    }
+
+    fn exists(&self, py: Python, dir_path: &str) -> PyResult<bool> {
+        Ok(py.allow_threads(|| self.runtime.block_on(ops::exists(&self.fs, dir_path))))
+    }
+
+    fn mkdir(&self, py: Python, dir_path: &str) -> PyResult<()> {
+        let result = py.allow_threads(|| self.runtime.block_on(ops::mkdir(&self.fs, dir_path)));
 
         if result.is_ok() {
             Ok(())
@@ -59,13 +71,12 @@ impl DatenlordSDK {
         }
     }
 
-    fn deldir(&self, dir_path: &str, recursive: bool) -> PyResult<()> {
-        let sdk_ref = &self.localfs;
-        let rt = Runtime::new().unwrap();
-        let result = rt.block_on(async {
-            let localfs = sdk_ref.lock().unwrap();
-            localfs.rmdir(1000, 1000, 1, dir_path).await // 示例 inode
-        });
+    fn deldir(&self, py: Python, dir_path: &str, recursive: bool) -> PyResult<()> {
+        let result = if recursive {
+            py.allow_threads(|| self.runtime.block_on(tree::remove_tree(&self.fs, dir_path)))
+        } else {
+            py.allow_threads(|| self.runtime.block_on(ops::deldir(&self.fs, dir_path)))
+        };
 
         if result.is_ok() {
             Ok(())
@@ -74,20 +85,8 @@ impl DatenlordSDK {
         }
     }
 
-    fn rename_path(&self, src_path: &str, dest_path: &str) -> PyResult<()> {
-        let sdk_ref = &self.localfs;
-        let rt = Runtime::new().unwrap();
-        let result = rt.block_on(async {
-            let param = RenameParam {
-                old_parent: 1,
-                old_name: src_path.to_string(),
-                new_parent: 1,
-                new_name: dest_path.to_string(),
-                flags: 0,
-            };
-            let localfs = sdk_ref.lock().unwrap();
-            localfs.rename(1000, 1000, param).await
-        });
+    fn rename_path(&self, py: Python, src_path: &str, dest_path: &str) -> PyResult<()> {
+        let result = py.allow_threads(|| self.runtime.block_on(ops::rename(&self.fs, src_path, dest_path)));
 
         if result.is_ok() {
             Ok(())
@@ -96,20 +95,34 @@ impl DatenlordSDK {
         }
     }
 
-    fn copy_from_local_file(&self, local_file_path: &str, dest_file_path: &str, overwrite: bool) -> PyResult<()> {
-        let sdk_ref = &self.localfs;
-        let rt = Runtime::new().unwrap();
-        let result = rt.block_on(async {
-            let localfs = sdk_ref.lock().unwrap();
-            if !overwrite && localfs.lookup(1000, 1000, 1, dest_file_path).await.is_ok() {
-                return Err(());
-            }
+    fn copy_from_local_file(&self, py: Python, local_file_path: &str, dest_file_path: &str, overwrite: bool) -> PyResult<()> {
+        let result = py.allow_threads(|| self.runtime.block_on(
+            ops::copy_from_local_file(&self.fs, self.config.copy_options(), overwrite, local_file_path, dest_file_path)
+        ));
 
-            match fs::read(local_file_path) {
-                Ok(content) => localfs.write(1, 0, 0, &content, 0).await.map_err(|_| ()),
-                Err(_) => Err(()),
-            }
-        });
+        if result.is_ok() {
+            Ok(())
+        } else {
+            Err(pyo3::exceptions::PyOSError::new_err("Failed to copy file"))
+        }
+    }
+
+    fn copy_to_local_file(&self, py: Python, src_file_path: &str, local_file_path: &str) -> PyResult<()> {
+        let result = py.allow_threads(|| self.runtime.block_on(
+            ops::copy_to_local_file(&self.fs, self.config.copy_options(), src_file_path, local_file_path)
+        ));
+
+        if result.is_ok() {
+            Ok(())
+        } else {
+            Err(pyo3::exceptions::PyOSError::new_err("Failed to copy file to local"))
+        }
+    }
+
+    fn copy(&self, py: Python, src_path: &str, dest_path: &str) -> PyResult<()> {
+        let result = py.allow_threads(|| self.runtime.block_on(
+            ops::copy(&self.fs, self.config.copy_options(), src_path, dest_path)
+        ));
 
         if result.is_ok() {
             Ok(())
@@ -118,41 +131,20 @@ impl DatenlordSDK {
         }
     }
 
-    fn copy_to_local_file(&self, src_file_path: &str, local_file_path: &str) -> PyResult<()> {
-        let sdk_ref = &self.localfs;
-        let rt = Runtime::new().unwrap();
-        let result = rt.block_on(async {
-            let mut buf = BytesMut::new();
-            let localfs = sdk_ref.lock().unwrap();
-            localfs.read(1, 0, 0, 1024, &mut buf).await.map_err(|_| ()) // 示例 inode 和最大读取字节数
-        });
+    fn copy_tree(&self, py: Python, src_path: &str, dest_path: &str) -> PyResult<()> {
+        let result = py.allow_threads(|| self.runtime.block_on(
+            tree::copy_tree(&self.fs, self.config.copy_options(), src_path, dest_path)
+        ));
 
-        match result {
-            Ok(size) => {
-                Ok(())
-            }
-            Err(_) => Err(pyo3::exceptions::PyOSError::new_err("Failed to copy file to local")),
+        if result.is_ok() {
+            Ok(())
+        } else {
+            Err(pyo3::exceptions::PyOSError::new_err("Failed to copy directory tree"))
         }
     }
 
-    fn create_file(&self, file_path: &str) -> PyResult<()> {
-        let sdk_ref = &self.localfs;
-        let rt = Runtime::new().unwrap();
-        let result = rt.block_on(async {
-            let param = CreateParam {
-                parent: 1,
-                name: file_path.to_string(),
-                mode: 0o644,
-                rdev: 0,
-                uid: 1000,
-                gid: 1000,
-                node_type: SFlag::S_IFREG,
-                link: None,
-            };
-
-            let localfs = sdk_ref.lock().unwrap();
-            localfs.mknod(param).await
-        });
+    fn create_file(&self, py: Python, file_path: &str) -> PyResult<()> {
+        let result = py.allow_threads(|| self.runtime.block_on(ops::create_file(&self.fs, file_path)));
 
         if result.is_ok() {
             Ok(())
@@ -161,22 +153,17 @@ impl DatenlordSDK {
         }
     }
 
-    fn stat(&self, file_path: &str) -> PyResult<(u64, u32, u32, u32, u32)> {
-        let sdk_ref = &self.localfs;
-        let rt = Runtime::new().unwrap();
-        let result = rt.block_on(async {
-            let localfs = sdk_ref.lock().unwrap();
-            localfs.getattr(1).await // 示例 inode
-        });
+    fn stat(&self, py: Python, file_path: &str) -> PyResult<(u64, u32, u32, u32, u32)> {
+        let result = py.allow_threads(|| self.runtime.block_on(ops::stat(&self.fs, file_path)));
 
         match result {
             Ok(attr) => {
                 let file_stat = (
-                    attr.1.size,  // 文件大小
-                    attr.1.uid,   // 用户ID
-                    attr.1.gid,   // 组ID
-                    attr.1.nlink, // 硬链接数量
-                    attr.1.rdev,  // 设备ID
+                    attr.size,  // 文件大小
+                    attr.uid,   // 用户ID
+                    attr.gid,   // 组ID
+                    attr.nlink, // 硬链接数量
+                    attr.rdev,  // 设备ID
                 );
                 Ok(file_stat)
             }
@@ -184,13 +171,29 @@ impl DatenlordSDK {
         }
     }
 
-    fn write_file(&self, file_path: &str, content: Vec<u8>) -> PyResult<()> {
-        let sdk_ref = &self.localfs;
-        let rt = Runtime::new().unwrap();
-        let result = rt.block_on(async {
-            let localfs = sdk_ref.lock().unwrap();
-            localfs.write(34734588, 0, 0, &content, 0).await // 示例 inode
-        });
+    /// Stat many paths concurrently, None for the paths that failed
+    fn stat_batch(&self, py: Python, file_paths: Vec<String>) -> PyResult<Vec<Option<(u64, u32, u32, u32, u32)>>> {
+        let results = py.allow_threads(|| self.runtime.block_on(ops::stat_batch(&self.fs, file_paths)));
+        Ok(results
+            .into_iter()
+            .map(|result| result.ok().map(|attr| (attr.size, attr.uid, attr.gid, attr.nlink, attr.rdev)))
+            .collect())
+    }
+
+    /// Get the block cache counters as (hits, misses, evictions, bytes, capacity)
+    fn cache_stats(&self) -> PyResult<(u64, u64, u64, u64, u64)> {
+        let stats = self.fs.block_cache.stats();
+        Ok((stats.hits, stats.misses, stats.evictions, stats.bytes, stats.capacity))
+    }
+
+    /// Get the latencies and counters of the sdk calls as a dict
+    fn metrics(&self, py: Python) -> PyResult<PyObject> {
+        let document = metrics::snapshot(&self.fs).to_json().to_string();
+        Ok(py.import("json")?.call_method1("loads", (document,))?.into())
+    }
+
+    fn write_file(&self, py: Python, file_path: &str, content: Vec<u8>) -> PyResult<()> {
+        let result = py.allow_threads(|| self.runtime.block_on(ops::write_file(&self.fs, file_path, &content)));
 
         if result.is_ok() {
             Ok(())
@@ -199,28 +202,36 @@ impl DatenlordSDK {
         }
     }
 
-    fn read_file(&self, file_path: &str) -> PyResult<Vec<u8>> {
-        let sdk_ref = &self.localfs;
-        let rt = Runtime::new().unwrap();
-        let mut buf = BytesMut::new();
-        let result = rt.block_on(async {
-            buf.reserve(1024);
-            let localfs = sdk_ref.lock().unwrap();
-            localfs.read(1, 0, 0, 1024, &mut buf).await.map_err(|_| ()) // 示例 inode
-        });
+    fn put(&self, py: Python, file_path: &str, content: Vec<u8>) -> PyResult<()> {
+        let result = py.allow_threads(|| self.runtime.block_on(ops::put(&self.fs, file_path, &content)));
+
+        if result.is_ok() {
+            Ok(())
+        } else {
+            Err(pyo3::exceptions::PyOSError::new_err("Failed to put file"))
+        }
+    }
+
+    fn read_file(&self, py: Python, file_path: &str) -> PyResult<Vec<u8>> {
+        let mut buf = Vec::new();
+        let result = py.allow_threads(|| self.runtime.block_on(ops::read_whole_file(&self.fs, file_path, |size| {
+            buf.resize(size, 0);
+            Some(&mut buf[..])
+        })));
 
         match result {
-            Ok(size) =>  {
-                Ok(Vec::from(&buf[..size]))
+            Ok(size) => {
+                buf.truncate(size);
+                Ok(buf)
             }
             Err(_) => Err(pyo3::exceptions::PyOSError::new_err("Failed to read file")),
         }
     }
 }
 
-#[pyfunction]
-fn init_sdk() -> PyResult<DatenlordSDK> {
-    DatenlordSDK::new()
+#[pyfunction(config = "\"{}\"")]
+fn init_sdk(config: &str) -> PyResult<DatenlordSDK> {
+    DatenlordSDK::new(config)
 }
 
 #[pymodule]
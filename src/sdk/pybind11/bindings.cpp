@@ -1,77 +1,228 @@
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/numpy.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <cstring>
 #include "datenlord.h"
 
 namespace py = pybind11;
 using namespace datenlord;
 using namespace pybind11::literals;
 
-std::string handle_error(datenlord_error *err) {
-    if (err == nullptr) {
+// The message of a failed call is kept by the sdk per thread, read it on the calling thread
+std::string handle_error(int err) {
+    if (err == 0) {
         return "Success";
     }
-    std::string message((const char *)err->message.data, err->message.len);
-    free(err);
-    return message;
+    const char *message = datenlord_last_error_message();
+    return message != nullptr ? message : std::strerror(err);
 }
 
+// Contiguous view of any buffer protocol object, released on scope exit
+struct buffer_view {
+    Py_buffer view;
+
+    buffer_view(const py::buffer &buffer, bool writable) {
+        int flags = PyBUF_ANY_CONTIGUOUS | (writable ? PyBUF_WRITABLE : PyBUF_SIMPLE);
+        if (PyObject_GetBuffer(buffer.ptr(), &view, flags) != 0) {
+            throw py::error_already_set();
+        }
+    }
+    ~buffer_view() {
+        PyBuffer_Release(&view);
+    }
+    buffer_view(const buffer_view &) = delete;
+    buffer_view &operator=(const buffer_view &) = delete;
+
+    datenlord_bytes bytes() const {
+        return { static_cast<const uint8_t *>(view.buf), static_cast<uintptr_t>(view.len) };
+    }
+};
+
+// Allocator for `read_file_alloc`, `ctx` points to the array to fill,
+// errors are reported as a null buffer since they must not unwind into rust.
+// It runs inside the sdk call, which is made with the GIL released.
+uint8_t *alloc_array(void *ctx, uintptr_t size) {
+    try {
+        py::gil_scoped_acquire acquire;
+        auto *array = static_cast<py::array_t<uint8_t> *>(ctx);
+        *array = py::array_t<uint8_t>(size);
+        return array->mutable_data();
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+// Alignment of the arrays allocated by `read_array`, a cache line, enough for any simd load
+#define ARRAY_ALIGNMENT 64
+
+// An uninitialized C-contiguous array of `dtype` and `shape` whose data is
+// aligned to ARRAY_ALIGNMENT, freed with the last array or view on it
+py::array aligned_array(const py::dtype &dtype, const std::vector<py::ssize_t> &shape) {
+    size_t size = dtype.itemsize();
+    for (py::ssize_t dim : shape) {
+        if (dim < 0) {
+            throw py::value_error("negative dimension in shape");
+        }
+        size *= dim;
+    }
+    void *data = nullptr;
+    size_t rounded = (std::max<size_t>(size, 1) + ARRAY_ALIGNMENT - 1) / ARRAY_ALIGNMENT * ARRAY_ALIGNMENT;
+    if (posix_memalign(&data, ARRAY_ALIGNMENT, rounded) != 0) {
+        throw std::bad_alloc();
+    }
+    py::capsule owner(data, [](void *data) { free(data); });
+    return py::array(dtype, shape, data, owner);
+}
+
+// A shape given as an int or a sequence of ints
+std::vector<py::ssize_t> shape_of(const py::object &shape) {
+    if (py::isinstance<py::int_>(shape)) {
+        return { shape.cast<py::ssize_t>() };
+    }
+    return shape.cast<std::vector<py::ssize_t>>();
+}
+
+// The writable C-contiguous array an array is read into
+py::array checked_out(const py::array &out) {
+    if (!(out.flags() & py::array::c_style) || !out.writeable()) {
+        throw py::value_error("out must be a writable C-contiguous array");
+    }
+    return out;
+}
+
+// Fill the whole array from `read(offset, bytes)`, which reads once at
+// offset and sets the len of `bytes` to the bytes read. An array longer than
+// the file is an error rather than a partly filled array.
+template <typename Read>
+void fill_array(py::array &array, uint64_t offset, Read read) {
+    uint8_t *data = static_cast<uint8_t *>(array.mutable_data());
+    size_t size = array.nbytes();
+    size_t filled = 0;
+    int err = 0;
+    {
+        py::gil_scoped_release release;
+        while (filled < size) {
+            datenlord_bytes out = { data + filled, size - filled };
+            err = read(offset + filled, &out);
+            if (err != 0 || out.len == 0) {
+                break;
+            }
+            filled += out.len;
+        }
+    }
+    if (err != 0) {
+        throw std::runtime_error(handle_error(err));
+    }
+    if (filled < size) {
+        throw std::runtime_error("the file ends before the array is filled");
+    }
+}
+
+// A `datenlord_mmap` view exposed through the buffer protocol, unmapped
+// once the last memoryview or array on it is released
+struct mapping_view {
+    datenlord_mapping mapping{};
+
+    mapping_view() = default;
+    ~mapping_view() {
+        datenlord::datenlord_munmap(&mapping);
+    }
+    mapping_view(const mapping_view &) = delete;
+    mapping_view &operator=(const mapping_view &) = delete;
+};
+
 PYBIND11_MODULE(datenlord, m) {
     m.doc() = "Python bindings for datenlord SDK";
 
+    PYBIND11_NUMPY_DTYPE(datenlord_file_stat, ino, size, blocks, perm, nlink, uid, gid, rdev);
+
     m.attr("ROOT_ID") = ROOT_ID;
     m.attr("NEED_CHECK_PERM") = NEED_CHECK_PERM;
 
     py::class_<datenlord_sdk>(m, "DatenlordSDK")
         .def(py::init<>());
 
+    py::class_<datenlord_file>(m, "DatenlordFile");
+
+    py::class_<datenlord_dir>(m, "DatenlordDir");
+
+    py::class_<mapping_view>(m, "DatenlordMapping", py::buffer_protocol())
+        .def_buffer([](mapping_view &view) -> py::buffer_info {
+            return py::buffer_info(
+                const_cast<uint8_t *>(view.mapping.data), 1, py::format_descriptor<uint8_t>::format(),
+                1, {static_cast<py::ssize_t>(view.mapping.len)}, {1}, true);
+        })
+        .def("__len__", [](const mapping_view &view) { return view.mapping.len; });
+
     m.def("init", [](const std::string &config) -> datenlord_sdk* {
         datenlord_sdk *sdk = datenlord::init(config.c_str());
         return sdk;
-    }, py::return_value_policy::reference);
+    }, py::return_value_policy::reference, py::call_guard<py::gil_scoped_release>());
 
     m.def("free_sdk", [](datenlord_sdk *sdk) {
         free_sdk(sdk);
-    });
+    }, py::call_guard<py::gil_scoped_release>());
+
+    m.def("serve", [](datenlord_sdk *sdk, const std::string &socket_path) -> std::string {
+        int err = datenlord_serve(sdk, socket_path.c_str());
+        return handle_error(err);
+    }, py::call_guard<py::gil_scoped_release>());
 
     m.def("exists", [](datenlord_sdk *sdk, const std::string &dir_path) -> bool {
         return exists(sdk, dir_path.c_str());
-    });
+    }, py::call_guard<py::gil_scoped_release>());
 
     m.def("mkdir", [](datenlord_sdk *sdk, const std::string &dir_path) -> std::string {
-        datenlord_error *err = datenlord::mkdir(sdk, dir_path.c_str());
+        int err = datenlord::datenlord_mkdir(sdk, dir_path.c_str());
         return handle_error(err);
-    });
+    }, py::call_guard<py::gil_scoped_release>());
 
     m.def("deldir", [](datenlord_sdk *sdk, const std::string &dir_path, bool recursive) -> std::string {
-        datenlord_error *err = datenlord::deldir(sdk, dir_path.c_str(), recursive);
+        int err = datenlord::deldir(sdk, dir_path.c_str(), recursive);
         return handle_error(err);
-    });
+    }, py::call_guard<py::gil_scoped_release>());
 
     m.def("rename_path", [](datenlord_sdk *sdk, const std::string &src_path, const std::string &dest_path) -> std::string {
-        datenlord_error *err = datenlord::rename_path(sdk, src_path.c_str(), dest_path.c_str());
+        int err = datenlord::rename_path(sdk, src_path.c_str(), dest_path.c_str());
         return handle_error(err);
-    });
+    }, py::call_guard<py::gil_scoped_release>());
 
     m.def("copy_from_local_file", [](datenlord_sdk *sdk, bool overwrite, const std::string &local_file_path, const std::string &dest_file_path) -> std::string {
-        datenlord_error *err = datenlord::copy_from_local_file(sdk, overwrite, local_file_path.c_str(), dest_file_path.c_str());
+        int err = datenlord::copy_from_local_file(sdk, overwrite, local_file_path.c_str(), dest_file_path.c_str());
         return handle_error(err);
-    });
+    }, py::call_guard<py::gil_scoped_release>());
 
     m.def("copy_to_local_file", [](datenlord_sdk *sdk, const std::string &src_file_path, const std::string &local_file_path) -> std::string {
-        datenlord_error *err = datenlord::copy_to_local_file(sdk, src_file_path.c_str(), local_file_path.c_str());
+        int err = datenlord::copy_to_local_file(sdk, src_file_path.c_str(), local_file_path.c_str());
         return handle_error(err);
-    });
+    }, py::call_guard<py::gil_scoped_release>());
+
+    m.def("copy", [](datenlord_sdk *sdk, const std::string &src_path, const std::string &dest_path) -> std::string {
+        int err = datenlord::datenlord_copy(sdk, src_path.c_str(), dest_path.c_str());
+        return handle_error(err);
+    }, py::call_guard<py::gil_scoped_release>());
+
+    m.def("copy_tree", [](datenlord_sdk *sdk, const std::string &src_path, const std::string &dest_path) -> std::string {
+        int err = datenlord::datenlord_copy_tree(sdk, src_path.c_str(), dest_path.c_str());
+        return handle_error(err);
+    }, py::call_guard<py::gil_scoped_release>());
 
     m.def("create_file", [](datenlord_sdk *sdk, const std::string &file_path) -> std::string {
-        datenlord_error *err = datenlord::create_file(sdk, file_path.c_str());
+        int err = datenlord::create_file(sdk, file_path.c_str());
         return handle_error(err);
-    });
+    }, py::call_guard<py::gil_scoped_release>());
 
     m.def("stat", [](datenlord_sdk *sdk, const std::string &file_path) -> py::dict {
         datenlord_file_stat stat;
-        datenlord_error *err = datenlord::stat(sdk, file_path.c_str(), &stat);
-        if (err != nullptr) {
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_stat(sdk, file_path.c_str(), &stat);
+        }
+        if (err != 0) {
             throw std::runtime_error(handle_error(err));
         }
         return py::dict(
@@ -86,31 +237,476 @@ PYBIND11_MODULE(datenlord, m) {
         );
     });
 
-    m.def("write_file", [](datenlord_sdk *sdk, const std::string &file_path, const std::string &content) -> std::string {
-        datenlord_bytes bytes = { reinterpret_cast<const uint8_t *>(content.c_str()), content.size() };
-        datenlord_error *err = datenlord::write_file(sdk, file_path.c_str(), bytes);
+    // Return a structured array of stats and the list of errors, None for the paths that succeeded
+    m.def("stat_batch", [](datenlord_sdk *sdk, const std::vector<std::string> &paths) -> py::tuple {
+        std::vector<const char *> c_paths;
+        c_paths.reserve(paths.size());
+        for (const auto &path : paths) {
+            c_paths.push_back(path.c_str());
+        }
+        py::array_t<datenlord_file_stat> stats(paths.size());
+        std::vector<int> errs(paths.size(), 0);
+        datenlord_file_stat *out = stats.mutable_data();
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_stat_batch(sdk, c_paths.data(), c_paths.size(), out, errs.data());
+        }
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+
+        py::list errors;
+        for (int path_err : errs) {
+            if (path_err == 0) {
+                errors.append(py::none());
+            } else {
+                errors.append(std::strerror(path_err));
+            }
+        }
+        return py::make_tuple(stats, errors);
+    });
+
+    m.def("exists_batch", [](datenlord_sdk *sdk, const std::vector<std::string> &paths) -> py::array_t<bool> {
+        std::vector<const char *> c_paths;
+        c_paths.reserve(paths.size());
+        for (const auto &path : paths) {
+            c_paths.push_back(path.c_str());
+        }
+        py::array_t<bool> found(paths.size());
+        bool *out = found.mutable_data();
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_exists_batch(sdk, c_paths.data(), c_paths.size(), out);
+        }
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+        return found;
+    });
+
+    m.def("write_file", [](datenlord_sdk *sdk, const std::string &file_path, const py::buffer &content) -> std::string {
+        // Pass the exported buffer straight to the sdk, it stays valid while the view is held
+        buffer_view view(content, false);
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::write_file(sdk, file_path.c_str(), view.bytes());
+        }
+        return handle_error(err);
+    });
+
+    m.def("put", [](datenlord_sdk *sdk, const std::string &file_path, const py::buffer &content) -> std::string {
+        buffer_view view(content, false);
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_put(sdk, file_path.c_str(), view.bytes());
+        }
         return handle_error(err);
     });
 
     m.def("read_file", [](datenlord_sdk *sdk, const std::string &file_path) -> py::memoryview {
+        // Size and fill the array in a single call
+        py::array_t<uint8_t> out_content;
+        datenlord_bytes out_content_struct = { nullptr, 0 };
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::read_file_alloc(sdk, file_path.c_str(), alloc_array, &out_content, &out_content_struct);
+        }
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+
+        if (static_cast<py::ssize_t>(out_content_struct.len) != out_content.size()) {
+            out_content.resize({static_cast<py::ssize_t>(out_content_struct.len)});
+        }
+        return py::memoryview(out_content);
+    });
+
+    m.def("read_into", [](datenlord_sdk *sdk, const std::string &file_path, const py::buffer &buffer, uint64_t offset) -> size_t {
+        buffer_view view(buffer, true);
+        datenlord_bytes out_content = view.bytes();
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::read_file_at(sdk, file_path.c_str(), offset, &out_content);
+        }
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+        return out_content.len;
+    }, "sdk"_a, "file_path"_a, "buffer"_a, "offset"_a = 0);
+
+    m.def("read_into", [](datenlord_sdk *sdk, datenlord_file *file, const py::buffer &buffer, uint64_t offset) -> size_t {
+        buffer_view view(buffer, true);
+        datenlord_bytes out_content = view.bytes();
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_pread(sdk, file, offset, &out_content);
+        }
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+        return out_content.len;
+    }, "sdk"_a, "file"_a, "buffer"_a, "offset"_a = 0);
+
+    // Read a file into a new aligned array, or into `out` such as the numpy
+    // view of a pinned torch tensor. Without a shape the array is flat and
+    // covers the file from offset. The arrays export DLPack through numpy,
+    // so torch.from_dlpack takes them without a copy.
+    m.def("read_array", [](datenlord_sdk *sdk, const std::string &file_path, const py::object &dtype,
+                           const py::object &shape, uint64_t offset, const py::object &out) -> py::array {
+        py::array array;
+        if (!out.is_none()) {
+            array = checked_out(out.cast<py::array>());
+        } else {
+            py::dtype type = py::dtype::from_args(dtype);
+            std::vector<py::ssize_t> dims;
+            if (shape.is_none()) {
+                datenlord_file_stat stat;
+                int err;
+                {
+                    py::gil_scoped_release release;
+                    err = datenlord::datenlord_stat(sdk, file_path.c_str(), &stat);
+                }
+                if (err != 0) {
+                    throw std::runtime_error(handle_error(err));
+                }
+                uint64_t size = stat.size > offset ? stat.size - offset : 0;
+                uint64_t itemsize = type.itemsize();
+                if (size % itemsize != 0) {
+                    throw py::value_error("the file size is not a multiple of the dtype size");
+                }
+                dims.push_back(size / itemsize);
+            } else {
+                dims = shape_of(shape);
+            }
+            array = aligned_array(type, dims);
+        }
+        fill_array(array, offset, [&](uint64_t at, datenlord_bytes *bytes) {
+            return datenlord::read_file_at(sdk, file_path.c_str(), at, bytes);
+        });
+        return array;
+    }, "sdk"_a, "file_path"_a, "dtype"_a = "float32", "shape"_a = py::none(), "offset"_a = 0, "out"_a = py::none());
+
+    // The size of an open file is not known, it is read into the given shape
+    m.def("read_array", [](datenlord_sdk *sdk, datenlord_file *file, const py::object &dtype,
+                           const py::object &shape, uint64_t offset, const py::object &out) -> py::array {
+        py::array array;
+        if (!out.is_none()) {
+            array = checked_out(out.cast<py::array>());
+        } else if (shape.is_none()) {
+            throw py::value_error("a shape or out is needed to read an open file");
+        } else {
+            array = aligned_array(py::dtype::from_args(dtype), shape_of(shape));
+        }
+        fill_array(array, offset, [&](uint64_t at, datenlord_bytes *bytes) {
+            return datenlord::datenlord_pread(sdk, file, at, bytes);
+        });
+        return array;
+    }, "sdk"_a, "file"_a, "dtype"_a = "float32", "shape"_a = py::none(), "offset"_a = 0, "out"_a = py::none());
+
+    // Write the raw data of an array as the whole content of a file, a
+    // contiguous array is passed to the sdk without a copy
+    m.def("write_array", [](datenlord_sdk *sdk, const std::string &file_path, const py::array &array) -> std::string {
+        py::array contiguous = py::array::ensure(array, py::array::c_style);
+        if (!contiguous) {
+            throw py::error_already_set();
+        }
+        datenlord_bytes content = { static_cast<const uint8_t *>(contiguous.data()),
+                                    static_cast<uintptr_t>(contiguous.nbytes()) };
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_put(sdk, file_path.c_str(), content);
+        }
+        return handle_error(err);
+    }, "sdk"_a, "file_path"_a, "array"_a);
+
+    m.def("open", [](datenlord_sdk *sdk, const std::string &file_path, uint32_t flags) -> datenlord_file* {
+        datenlord_file *file = nullptr;
+        int err = datenlord::datenlord_open(sdk, file_path.c_str(), flags, &file);
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+        return file;
+    }, py::return_value_policy::reference, py::call_guard<py::gil_scoped_release>());
+
+    // Return the open file with the stat of the file as it was opened
+    m.def("create_open", [](datenlord_sdk *sdk, const std::string &file_path, uint32_t mode, uint32_t flags) -> py::tuple {
+        datenlord_file *file = nullptr;
         datenlord_file_stat stat;
-        datenlord_error *err = datenlord::stat(sdk, file_path.c_str(), &stat);
-        if (err != nullptr) {
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_create_open(sdk, file_path.c_str(), mode, flags, &file, &stat);
+        }
+        if (err != 0) {
             throw std::runtime_error(handle_error(err));
         }
+        py::dict attr(
+            "ino"_a = stat.ino,
+            "size"_a = stat.size,
+            "blocks"_a = stat.blocks,
+            "perm"_a = stat.perm,
+            "nlink"_a = stat.nlink,
+            "uid"_a = stat.uid,
+            "gid"_a = stat.gid,
+            "rdev"_a = stat.rdev
+        );
+        return py::make_tuple(py::cast(file, py::return_value_policy::reference), attr);
+    }, "sdk"_a, "path"_a, "mode"_a = 0644, "flags"_a = O_WRONLY | O_CREAT | O_TRUNC);
 
-        py::array_t<uint8_t> out_content(stat.size);
-        uint8_t* buf = out_content.mutable_data();
+    m.def("pread", [](datenlord_sdk *sdk, datenlord_file *file, uint64_t offset, size_t size) -> py::memoryview {
+        py::array_t<uint8_t> out_content(size);
         datenlord_bytes out_content_struct = {
-            buf,
-            stat.size
+            out_content.mutable_data(),
+            size
         };
 
-        err = datenlord::read_file(sdk, file_path.c_str(), &out_content_struct);
-        if (err != nullptr) {
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_pread(sdk, file, offset, &out_content_struct);
+        }
+        if (err != 0) {
             throw std::runtime_error(handle_error(err));
         }
 
+        out_content.resize({static_cast<py::ssize_t>(out_content_struct.len)});
         return py::memoryview(out_content);
     });
+
+    m.def("pwrite", [](datenlord_sdk *sdk, datenlord_file *file, uint64_t offset, const py::buffer &content) -> std::string {
+        buffer_view view(content, false);
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_pwrite(sdk, file, offset, view.bytes());
+        }
+        return handle_error(err);
+    });
+
+    m.def("preadv", [](datenlord_sdk *sdk, datenlord_file *file, const std::vector<std::pair<uint64_t, py::buffer>> &segments) -> std::vector<size_t> {
+        std::vector<std::unique_ptr<buffer_view>> views;
+        std::vector<datenlord_iovec> iov;
+        for (const auto &segment : segments) {
+            views.push_back(std::make_unique<buffer_view>(segment.second, true));
+            datenlord_bytes buf = views.back()->bytes();
+            iov.push_back({segment.first, buf});
+        }
+
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_preadv(sdk, file, iov.data(), iov.size());
+        }
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+
+        std::vector<size_t> sizes;
+        for (const auto &segment : iov) {
+            sizes.push_back(segment.buf.len);
+        }
+        return sizes;
+    }, "sdk"_a, "file"_a, "segments"_a);
+
+    m.def("pwritev", [](datenlord_sdk *sdk, datenlord_file *file, const std::vector<std::pair<uint64_t, py::buffer>> &segments) -> std::string {
+        std::vector<std::unique_ptr<buffer_view>> views;
+        std::vector<datenlord_iovec> iov;
+        for (const auto &segment : segments) {
+            views.push_back(std::make_unique<buffer_view>(segment.second, false));
+            iov.push_back({segment.first, views.back()->bytes()});
+        }
+
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_pwritev(sdk, file, iov.data(), iov.size());
+        }
+        return handle_error(err);
+    }, "sdk"_a, "file"_a, "segments"_a);
+
+    m.def("flush", [](datenlord_sdk *sdk, datenlord_file *file) -> std::string {
+        int err = datenlord::datenlord_flush(sdk, file);
+        return handle_error(err);
+    }, py::call_guard<py::gil_scoped_release>());
+
+    m.def("fsync", [](datenlord_sdk *sdk, datenlord_file *file) -> std::string {
+        int err = datenlord::datenlord_fsync(sdk, file);
+        return handle_error(err);
+    }, py::call_guard<py::gil_scoped_release>());
+
+    m.def("close", [](datenlord_sdk *sdk, datenlord_file *file) -> std::string {
+        int err = datenlord::datenlord_close(sdk, file);
+        return handle_error(err);
+    }, py::call_guard<py::gil_scoped_release>());
+
+    m.def("opendir", [](datenlord_sdk *sdk, const std::string &dir_path, bool plus) -> datenlord_dir* {
+        datenlord_dir *dir = nullptr;
+        int err = datenlord::datenlord_opendir(sdk, dir_path.c_str(), plus, &dir);
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+        return dir;
+    }, py::return_value_policy::reference, py::call_guard<py::gil_scoped_release>(),
+       "sdk"_a, "dir_path"_a, "plus"_a = false);
+
+    // Return the next entries as (name, ino, kind) tuples, with a stat dict
+    // appended for directories opened with plus, an empty list at the end
+    m.def("readdir_next", [](datenlord_sdk *sdk, datenlord_dir *dir, size_t max) -> py::list {
+        std::vector<datenlord_dirent> entries(max);
+        size_t count = 0;
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_readdir_next(sdk, dir, entries.data(), max, &count);
+        }
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+
+        py::list result;
+        for (size_t i = 0; i < count; i++) {
+            const datenlord_dirent &entry = entries[i];
+            py::str name((const char *)entry.name.data, entry.name.len);
+            if (!entry.has_stat) {
+                result.append(py::make_tuple(name, entry.ino, entry.kind));
+                continue;
+            }
+            py::dict stat(
+                "ino"_a = entry.stat.ino,
+                "size"_a = entry.stat.size,
+                "blocks"_a = entry.stat.blocks,
+                "perm"_a = entry.stat.perm,
+                "nlink"_a = entry.stat.nlink,
+                "uid"_a = entry.stat.uid,
+                "gid"_a = entry.stat.gid,
+                "rdev"_a = entry.stat.rdev
+            );
+            result.append(py::make_tuple(name, entry.ino, entry.kind, stat));
+        }
+        return result;
+    }, "sdk"_a, "dir"_a, "max"_a = 1024);
+
+    m.def("closedir", [](datenlord_sdk *sdk, datenlord_dir *dir) -> std::string {
+        int err = datenlord::datenlord_closedir(sdk, dir);
+        return handle_error(err);
+    }, py::call_guard<py::gil_scoped_release>());
+
+    m.def("cache_stats", [](datenlord_sdk *sdk) -> py::dict {
+        datenlord_cache_stats stats;
+        int err = datenlord::datenlord_get_cache_stats(sdk, &stats);
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+        return py::dict(
+            "hits"_a = stats.hits,
+            "misses"_a = stats.misses,
+            "evictions"_a = stats.evictions,
+            "bytes"_a = stats.bytes,
+            "capacity"_a = stats.capacity
+        );
+    }, "sdk"_a);
+
+    // Parse the json snapshot into nested dicts, retrying while the document outgrows the buffer
+    m.def("metrics", [](datenlord_sdk *sdk) -> py::object {
+        std::string document(64 * 1024, '\0');
+        int err;
+        while (true) {
+            datenlord_bytes buf = { reinterpret_cast<const uint8_t *>(document.data()), document.size() };
+            {
+                py::gil_scoped_release release;
+                err = datenlord::datenlord_metrics_snapshot(sdk, &buf);
+            }
+            if (err == 0) {
+                document.resize(buf.len);
+                break;
+            }
+            if (buf.len <= document.size()) {
+                throw std::runtime_error(handle_error(err));
+            }
+            document.resize(buf.len + 4096);
+        }
+        return py::module_::import("json").attr("loads")(document);
+    }, "sdk"_a);
+
+    // The views point into the arena of the sdk, they must not be used after unregister_buffers
+    m.def("register_buffers", [](datenlord_sdk *sdk, const std::vector<size_t> &sizes) -> std::vector<py::memoryview> {
+        std::vector<datenlord_bytes> buffers;
+        for (size_t size : sizes) {
+            buffers.push_back({nullptr, size});
+        }
+
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_register_buffers(sdk, buffers.data(), buffers.size());
+        }
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+
+        std::vector<py::memoryview> views;
+        for (const auto &buffer : buffers) {
+            views.push_back(py::memoryview::from_memory(
+                const_cast<uint8_t *>(buffer.data), static_cast<py::ssize_t>(buffer.len)));
+        }
+        return views;
+    }, "sdk"_a, "sizes"_a);
+
+    m.def("unregister_buffers", [](datenlord_sdk *sdk) -> std::string {
+        int err = datenlord::datenlord_unregister_buffers(sdk);
+        return handle_error(err);
+    }, py::call_guard<py::gil_scoped_release>());
+
+    m.def("pread_fixed", [](datenlord_sdk *sdk, datenlord_file *file, uint64_t offset, uint32_t index, size_t buffer_offset, size_t len) -> size_t {
+        size_t read = 0;
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_pread_fixed(sdk, file, offset, index, buffer_offset, len, &read);
+        }
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+        return read;
+    }, "sdk"_a, "file"_a, "offset"_a, "index"_a, "buffer_offset"_a = 0, "len"_a = 0);
+
+    m.def("pwrite_fixed", [](datenlord_sdk *sdk, datenlord_file *file, uint64_t offset, uint32_t index, size_t buffer_offset, size_t len) -> std::string {
+        int err = datenlord::datenlord_pwrite_fixed(sdk, file, offset, index, buffer_offset, len);
+        return handle_error(err);
+    }, "sdk"_a, "file"_a, "offset"_a, "index"_a, "buffer_offset"_a = 0, "len"_a = 0, py::call_guard<py::gil_scoped_release>());
+
+    m.def("read_file_fixed", [](datenlord_sdk *sdk, const std::string &file_path, uint32_t index, uint64_t offset) -> size_t {
+        size_t read = 0;
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_read_file_fixed(sdk, file_path.c_str(), offset, index, &read);
+        }
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+        return read;
+    }, "sdk"_a, "file_path"_a, "index"_a, "offset"_a = 0);
+
+    m.def("mmap", [](datenlord_sdk *sdk, const std::string &file_path, uint64_t offset, size_t len) -> py::memoryview {
+        auto view = std::make_unique<mapping_view>();
+        int err;
+        {
+            py::gil_scoped_release release;
+            err = datenlord::datenlord_mmap(sdk, file_path.c_str(), offset, len, &view->mapping);
+        }
+        if (err != 0) {
+            throw std::runtime_error(handle_error(err));
+        }
+        // The memoryview keeps the mapping alive, numpy.frombuffer on it does not copy
+        return py::memoryview(py::cast(std::move(view)));
+    }, "sdk"_a, "file_path"_a, "offset"_a = 0, "len"_a = 0);
 }
@@ -0,0 +1,127 @@
+//! Sequential read detection of the sdk
+//!
+//! Reads are tracked per inode rather than per handle, so a file streamed
+//! with `read_file_at` calls that each open it is detected as well. Once a
+//! read starts where the previous one ended, the blocks after it are read
+//! into the block cache in the background, the window doubles on every
+//! sequential read up to the configured max and a random read resets it.
+
+use std::collections::hash_map::DefaultHasher;
+use std::collections::HashMap;
+use std::hash::{Hash, Hasher};
+use std::ops::Range;
+use std::sync::Mutex;
+
+use crate::storage::virtualfs::INum;
+
+/// Number of shards of the stream map
+const SHARDS: usize = 16;
+
+/// Max streams tracked per shard, a full shard forgets all its streams
+const SHARD_STREAMS: usize = 256;
+
+/// A file being read
+#[derive(Debug, Clone, Copy)]
+struct Stream {
+    /// Where the next sequential read starts
+    next: u64,
+    /// Bytes to read ahead of the reader
+    window: u64,
+    /// End of the range read ahead so far
+    prefetched: u64,
+}
+
+/// Read patterns of the files read through an sdk instance
+#[derive(Debug)]
+pub struct Readahead {
+    shards: Vec<Mutex<HashMap<INum, Stream>>>,
+    /// First window, one block
+    min_window: u64,
+    /// Max window in bytes, 0 disables readahead
+    max_window: u64,
+}
+
+impl Readahead {
+    /// Create a tracker whose window grows from `min_window` up to `max_window` bytes
+    pub fn new(min_window: u64, max_window: u64) -> Self {
+        Self {
+            shards: (0..SHARDS).map(|_| Mutex::new(HashMap::new())).collect(),
+            min_window: min_window.max(1),
+            max_window,
+        }
+    }
+
+    /// Whether reads are tracked
+    pub fn enabled(&self) -> bool {
+        self.max_window > 0
+    }
+
+    fn shard(&self, ino: INum) -> &Mutex<HashMap<INum, Stream>> {
+        let mut hasher = DefaultHasher::new();
+        ino.hash(&mut hasher);
+        &self.shards[hasher.finish() as usize & (SHARDS - 1)]
+    }
+
+    /// Record a read of `len` bytes at `offset` of a file of `size` bytes,
+    /// return the range to read ahead, if any
+    pub fn on_read(&self, ino: INum, offset: u64, len: u64, size: u64) -> Option<Range<u64>> {
+        if !self.enabled() {
+            return None;
+        }
+        let end = offset + len;
+        let mut shard = self.shard(ino).lock().unwrap();
+        if !shard.contains_key(&ino) {
+            if shard.len() >= SHARD_STREAMS {
+                shard.clear();
+            }
+            // Like the kernel, a read from the start of a file is taken as sequential
+            let next = if offset == 0 { 0 } else { end };
+            shard.insert(ino, Stream { next, window: 0, prefetched: 0 });
+            if offset != 0 {
+                return None;
+            }
+        }
+        let stream = shard.get_mut(&ino)?;
+        if stream.next != offset {
+            // A random read, start over
+            *stream = Stream {
+                next: end,
+                window: 0,
+                prefetched: 0,
+            };
+            return None;
+        }
+        stream.window = (stream.window * 2).clamp(self.min_window, self.max_window);
+        stream.next = end;
+
+        let start = stream.prefetched.max(end);
+        let target = (end + stream.window).min(size);
+        if start >= target {
+            return None;
+        }
+        stream.prefetched = target;
+        Some(start..target)
+    }
+
+    /// Forget the stream of a file, after it was written
+    pub fn invalidate(&self, ino: INum) {
+        self.shard(ino).lock().unwrap().remove(&ino);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn windows_grow_on_sequential_reads() {
+        let readahead = Readahead::new(10, 80);
+        assert_eq!(readahead.on_read(1, 0, 5, 1000), Some(5..15));
+        assert_eq!(readahead.on_read(1, 5, 5, 1000), Some(15..30));
+        assert_eq!(readahead.on_read(1, 10, 5, 1000), Some(30..55));
+        // A seek starts over from the min window
+        assert_eq!(readahead.on_read(1, 500, 5, 1000), None);
+        assert_eq!(readahead.on_read(1, 505, 5, 1000), Some(510..520));
+        assert_eq!(readahead.on_read(2, 100, 5, 1000), None);
+    }
+}
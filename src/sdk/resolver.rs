@@ -0,0 +1,102 @@
+//! Resolution of sdk paths to inodes
+//!
+//! A path such as `/a/b/c` is split into components which are looked up one
+//! by one from the root inode with `VirtualFs::lookup(parent, component)`.
+//! Every step goes through the attribute cache, so the dentries of hot
+//! directories form a cached tree and, once warm, a deep path resolves with
+//! one hash lookup per component whatever the number of siblings.
+
+use nix::sys::stat::SFlag;
+
+use crate::common::{DatenLordError, DatenLordResult};
+use crate::sdk::metrics::Op;
+use crate::sdk::ops::SdkFs;
+use crate::storage::fs_util::{FileAttr, ROOT_ID};
+use crate::storage::virtualfs::INum;
+
+/// Split a path into its components, relative to the root.
+///
+/// Empty and `.` components are skipped and `..` drops the previous one,
+/// it never goes above the root.
+pub fn components(path: &str) -> Vec<&str> {
+    let mut components = Vec::new();
+    for component in path.split('/') {
+        match component {
+            "" | "." => {}
+            ".." => {
+                components.pop();
+            }
+            name => components.push(name),
+        }
+    }
+    components
+}
+
+/// Get the attributes of the root directory
+async fn root_attr(fs: &SdkFs) -> DatenLordResult<FileAttr> {
+    let cached = fs.attr_cache.getattr(ROOT_ID);
+    fs.metrics.attr_cache_lookup(cached.is_some());
+    if let Some(attr) = cached {
+        return Ok(attr);
+    }
+    let (ttl, attr) = fs.metrics.record(Op::Getattr, 0, fs.backend.getattr(ROOT_ID)).await?;
+    fs.attr_cache.insert_attr(attr, ttl);
+    Ok(attr)
+}
+
+/// Look up `name` in the directory `parent`, served from the cache while fresh
+pub async fn lookup_child(fs: &SdkFs, parent: INum, name: &str) -> DatenLordResult<FileAttr> {
+    let cached = fs.attr_cache.lookup(parent, name);
+    fs.metrics.attr_cache_lookup(cached.is_some());
+    if let Some(attr) = cached {
+        return Ok(attr);
+    }
+    if fs.attr_cache.missing(parent, name) {
+        return Err(DatenLordError::NotFound {
+            context: vec![format!("{name} not found, cached as missing")],
+        });
+    }
+    let looked_up = fs.metrics.record(Op::Lookup, 0, fs.backend.lookup(1000, 1000, parent, name)).await;
+    let (ttl, attr, _) = looked_up.inspect_err(|e| {
+        if matches!(e, DatenLordError::NotFound { .. }) {
+            fs.attr_cache.insert_missing(parent, name);
+        }
+    })?;
+    fs.attr_cache.insert_entry(parent, name, attr, ttl);
+    Ok(attr)
+}
+
+/// Walk the components from the root, every one but the last must be a directory
+async fn walk(fs: &SdkFs, path: &str, components: &[&str]) -> DatenLordResult<FileAttr> {
+    let mut attr = root_attr(fs).await?;
+    for name in components {
+        if attr.kind != SFlag::S_IFDIR {
+            return Err(DatenLordError::InvalidArgument {
+                context: vec![format!("{path}: a parent of {name} is not a directory")],
+            });
+        }
+        attr = lookup_child(fs, attr.ino, name).await?;
+    }
+    Ok(attr)
+}
+
+/// Get the attributes of the file at `path`
+pub async fn resolve(fs: &SdkFs, path: &str) -> DatenLordResult<FileAttr> {
+    walk(fs, path, &components(path)).await
+}
+
+/// Get the parent directory inode and the file name of `path`, the file
+/// itself does not need to exist
+pub async fn resolve_parent(fs: &SdkFs, path: &str) -> DatenLordResult<(INum, String)> {
+    let mut components = components(path);
+    let name = components.pop().ok_or_else(|| DatenLordError::InvalidArgument {
+        context: vec![format!("{path} has no file name")],
+    })?;
+    let parent = walk(fs, path, &components).await?;
+    if parent.kind != SFlag::S_IFDIR {
+        return Err(DatenLordError::InvalidArgument {
+            context: vec![format!("{path}: the parent of {name} is not a directory")],
+        });
+    }
+    Ok((parent.ino, name.to_owned()))
+}
@@ -0,0 +1,91 @@
+//! Tracing of the sdk calls
+//!
+//! A traced call runs in a `sdk_call` span with its op, file and bytes, and
+//! ends with an event carrying its latency and error. Both are at debug
+//! level, so nothing is formatted unless the subscriber enables debug, and
+//! the `max_level_*` features of tracing compile them out. Only every n-th
+//! call is traced when the sample rate is below 1, the calls an sdk call
+//! makes to other sdk calls are part of its span and are not traced apart.
+
+use std::fmt::Display;
+use std::future::Future;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::Instant;
+
+use tracing::{debug, debug_span, Instrument, Level};
+
+use crate::common::DatenLordResult;
+use crate::sdk::metrics::Op;
+use crate::sdk::ops::SdkFs;
+
+tokio::task_local! {
+    /// Set while an sdk call runs, the sdk calls it makes are not sampled again
+    static IN_CALL: ();
+}
+
+/// Picks the calls to trace
+#[derive(Debug)]
+pub struct Sampler {
+    /// Trace one call out of `interval`, 0 traces none
+    interval: u64,
+    calls: AtomicU64,
+}
+
+impl Sampler {
+    /// Trace a `rate` share of the calls, between 0 and 1
+    pub fn new(rate: f64) -> Self {
+        let interval = if rate > 0.0 { (1.0 / rate.min(1.0)).round() as u64 } else { 0 };
+        Self {
+            interval,
+            calls: AtomicU64::new(0),
+        }
+    }
+
+    fn sample(&self) -> bool {
+        self.interval > 0 && self.calls.fetch_add(1, Ordering::Relaxed) % self.interval == 0
+    }
+}
+
+/// Run an sdk call and record its metrics, in a span when it is sampled.
+/// `file` is the path or the inode the call works on and `bytes` the bytes it moves.
+pub async fn traced<T, F>(fs: &SdkFs, op: Op, file: impl Display, bytes: usize, call: F) -> DatenLordResult<T>
+where
+    F: Future<Output = DatenLordResult<T>>,
+{
+    let call = fs.metrics.record(op, bytes, call);
+    if !tracing::enabled!(Level::DEBUG) || IN_CALL.try_with(|_| ()).is_ok() {
+        return call.await;
+    }
+    if !fs.sampler.sample() {
+        return IN_CALL.scope((), call).await;
+    }
+    let span = debug_span!("sdk_call", op = op.name(), file = %file, bytes);
+    let start = Instant::now();
+    let result = IN_CALL.scope((), call).instrument(span.clone()).await;
+    let latency_us = start.elapsed().as_micros() as u64;
+    let _entered = span.enter();
+    match &result {
+        Ok(_) => debug!(latency_us, "done"),
+        Err(e) => debug!(latency_us, error = %e, "failed"),
+    }
+    result
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sampled(sampler: &Sampler, calls: usize) -> usize {
+        (0..calls).filter(|_| sampler.sample()).count()
+    }
+
+    #[test]
+    fn sample_rates() {
+        assert_eq!(sampled(&Sampler::new(1.0), 10), 10);
+        assert_eq!(sampled(&Sampler::new(2.0), 10), 10);
+        assert_eq!(sampled(&Sampler::new(0.5), 10), 5);
+        assert_eq!(sampled(&Sampler::new(0.01), 1000), 10);
+        assert_eq!(sampled(&Sampler::new(0.0), 10), 0);
+        assert_eq!(sampled(&Sampler::new(-1.0), 10), 0);
+    }
+}
@@ -0,0 +1,271 @@
+//! Recursive removal and copy of directory trees
+//!
+//! A tree is walked with a task per entry on the sdk runtime, whose
+//! work-stealing scheduler spreads the tasks of a wide or deep tree over its
+//! workers. A directory is listed a page at a time so that a large one is
+//! never held in memory whole, and the backend calls in flight across the
+//! whole walk are bounded by a semaphore. The permits are only held around
+//! single backend calls, never while waiting on the children of a
+//! directory, so a deep tree cannot starve the walk.
+
+use std::sync::Arc;
+
+use futures::future::BoxFuture;
+use nix::sys::stat::SFlag;
+use tokio::sync::{Semaphore, SemaphorePermit};
+use tokio::task::JoinSet;
+
+use crate::common::{DatenLordError, DatenLordResult};
+use crate::sdk::metrics::Op;
+use crate::sdk::ops::{self, CopyOptions, SdkFs};
+use crate::sdk::resolver;
+use crate::sdk::trace;
+use crate::storage::fs_util::{CreateParam, FileAttr, RenameParam};
+use crate::storage::virtualfs::{DirEntry, INum};
+
+/// Backend calls in flight of a walk
+const TREE_CONCURRENCY: usize = 64;
+
+/// Files copied at once by a tree copy, each holds the buffers of its chunks
+/// when the backend cannot copy it by itself
+const TREE_COPY_CONCURRENCY: usize = 8;
+
+/// The state shared by the tasks of a walk
+struct Walk {
+    fs: Arc<SdkFs>,
+    calls: Semaphore,
+    copies: Semaphore,
+}
+
+impl Walk {
+    fn new(fs: &Arc<SdkFs>) -> Arc<Self> {
+        Arc::new(Self {
+            fs: Arc::clone(fs),
+            calls: Semaphore::new(TREE_CONCURRENCY),
+            copies: Semaphore::new(TREE_COPY_CONCURRENCY),
+        })
+    }
+
+    async fn call(&self) -> SemaphorePermit<'_> {
+        // The semaphores are never closed
+        self.calls.acquire().await.unwrap()
+    }
+}
+
+/// Wait for a task of a walk, the first error ends the walk
+async fn join_next(tasks: &mut JoinSet<DatenLordResult<()>>) -> DatenLordResult<()> {
+    match tasks.join_next().await {
+        Some(Ok(result)) => result,
+        Some(Err(e)) => Err(DatenLordError::Internal {
+            context: vec![format!("tree task failed: {e}")],
+        }),
+        None => Ok(()),
+    }
+}
+
+/// Wait for every task of a walk, aborting the others on the first error
+async fn join_all(tasks: &mut JoinSet<DatenLordResult<()>>) -> DatenLordResult<()> {
+    while !tasks.is_empty() {
+        if let Err(e) = join_next(tasks).await {
+            tasks.abort_all();
+            return Err(e);
+        }
+    }
+    Ok(())
+}
+
+/// Read the first page of a directory
+async fn first_page(walk: &Walk, ino: INum) -> DatenLordResult<Vec<DirEntry>> {
+    let _permit = walk.call().await;
+    let mut dir = ops::opendir_inode(&walk.fs, ino).await?;
+    let page = ops::readdir_page(&walk.fs, &mut dir).await;
+    let _ = ops::closedir(&walk.fs, &dir).await;
+    page
+}
+
+fn not_a_directory(path: &str) -> DatenLordError {
+    DatenLordError::InvalidArgument {
+        context: vec![format!("{path} is not a directory")],
+    }
+}
+
+/// Remove a directory with everything below it
+pub async fn remove_tree(fs: &Arc<SdkFs>, path: &str) -> DatenLordResult<()> {
+    trace::traced(fs, Op::RemoveTree, path, 0, async {
+        let (parent, name) = resolver::resolve_parent(fs, path).await?;
+        let attr = resolver::lookup_child(fs, parent, &name).await?;
+        if attr.kind != SFlag::S_IFDIR {
+            return Err(not_a_directory(path));
+        }
+        let walk = Walk::new(fs);
+        remove_children(Arc::clone(&walk), attr.ino).await?;
+        remove_entry(&walk, parent, &name, attr.ino, true).await
+    })
+    .await
+}
+
+/// Empty a directory. The entries of a page are removed concurrently, then
+/// the directory is listed again from its start, so that the offsets of a
+/// listing never shift under the removals.
+fn remove_children(walk: Arc<Walk>, dir: INum) -> BoxFuture<'static, DatenLordResult<()>> {
+    Box::pin(async move {
+        loop {
+            let page = first_page(&walk, dir).await?;
+            if page.is_empty() {
+                return Ok(());
+            }
+            let mut tasks = JoinSet::new();
+            for entry in page {
+                let walk = Arc::clone(&walk);
+                tasks.spawn(async move {
+                    let is_dir = entry.kind() == SFlag::S_IFDIR;
+                    if is_dir {
+                        let ino = lookup_dir(&walk, dir, &entry).await?;
+                        remove_children(Arc::clone(&walk), ino).await?;
+                    }
+                    remove_entry(&walk, dir, entry.name(), entry.ino(), is_dir).await
+                });
+            }
+            join_all(&mut tasks).await?;
+        }
+    })
+}
+
+/// Look up a directory listed in `parent`. The inode numbers of a listing
+/// are only known to the backend once looked up, a directory that was never
+/// looked up has to be before it is opened.
+async fn lookup_dir(walk: &Walk, parent: INum, entry: &DirEntry) -> DatenLordResult<INum> {
+    let _permit = walk.call().await;
+    Ok(resolver::lookup_child(&walk.fs, parent, entry.name()).await?.ino)
+}
+
+/// Remove an entry of a directory and drop what the caches hold of it
+async fn remove_entry(walk: &Walk, parent: INum, name: &str, ino: INum, is_dir: bool) -> DatenLordResult<()> {
+    let fs = &walk.fs;
+    let removed = {
+        let _permit = walk.call().await;
+        if is_dir {
+            fs.backend.rmdir(1000, 1000, parent, name).await.map(|_| ())
+        } else {
+            fs.backend.unlink(1000, 1000, parent, name).await
+        }
+    };
+    fs.attr_cache.invalidate_entry(parent, name);
+    fs.attr_cache.invalidate_attr(ino);
+    if !is_dir {
+        fs.block_cache.invalidate(ino);
+    }
+    removed
+}
+
+/// Copy a directory with everything below it to `dest`, which must not
+/// exist. Regular files and directories are copied, other kinds of entries
+/// are skipped.
+pub async fn copy_tree(fs: &Arc<SdkFs>, options: CopyOptions, src: &str, dest: &str) -> DatenLordResult<()> {
+    trace::traced(fs, Op::CopyTree, src, 0, async {
+        let attr = resolver::resolve(fs, src).await?;
+        if attr.kind != SFlag::S_IFDIR {
+            return Err(not_a_directory(src));
+        }
+        if resolver::components(dest).starts_with(&resolver::components(src)) {
+            return Err(DatenLordError::InvalidArgument {
+                context: vec![format!("cannot copy {src} into itself at {dest}")],
+            });
+        }
+        let (parent, name) = resolver::resolve_parent(fs, dest).await?;
+        let walk = Walk::new(fs);
+        let dest_attr = create_dir(&walk, parent, &name).await?;
+        copy_children(walk, options, attr.ino, dest_attr.ino).await
+    })
+    .await
+}
+
+/// Create a directory of the copy
+async fn create_dir(walk: &Walk, parent: INum, name: &str) -> DatenLordResult<FileAttr> {
+    let param = CreateParam {
+        parent,
+        name: name.to_owned(),
+        mode: 0o777,
+        rdev: 0,
+        uid: 1000,
+        gid: 1000,
+        node_type: SFlag::S_IFDIR,
+        link: None,
+    };
+    let _permit = walk.call().await;
+    let (ttl, attr, _) = walk.fs.backend.mkdir(param).await?;
+    walk.fs.attr_cache.insert_entry(parent, name, attr, ttl);
+    Ok(attr)
+}
+
+/// Copy the entries of a directory into another one, listed page by page
+fn copy_children(
+    walk: Arc<Walk>,
+    options: CopyOptions,
+    src: INum,
+    dest: INum,
+) -> BoxFuture<'static, DatenLordResult<()>> {
+    Box::pin(async move {
+        let mut dir = {
+            let _permit = walk.call().await;
+            ops::opendir_inode(&walk.fs, src).await?
+        };
+        let mut tasks = JoinSet::new();
+        let copied = async {
+            loop {
+                let page = {
+                    let _permit = walk.call().await;
+                    ops::readdir_page(&walk.fs, &mut dir).await?
+                };
+                if page.is_empty() {
+                    break;
+                }
+                for entry in page {
+                    if tasks.len() >= TREE_CONCURRENCY {
+                        join_next(&mut tasks).await?;
+                    }
+                    let walk = Arc::clone(&walk);
+                    tasks.spawn(async move { copy_entry(walk, options, src, dest, entry).await });
+                }
+            }
+            join_all(&mut tasks).await
+        }
+        .await;
+        tasks.abort_all();
+        let _ = ops::closedir(&walk.fs, &dir).await;
+        copied
+    })
+}
+
+/// Copy an entry of a directory into another one
+async fn copy_entry(
+    walk: Arc<Walk>,
+    options: CopyOptions,
+    src: INum,
+    dest: INum,
+    entry: DirEntry,
+) -> DatenLordResult<()> {
+    match entry.kind() {
+        SFlag::S_IFDIR => {
+            let ino = lookup_dir(&walk, src, &entry).await?;
+            let attr = create_dir(&walk, dest, entry.name()).await?;
+            copy_children(walk, options, ino, attr.ino).await
+        }
+        SFlag::S_IFREG => {
+            let src_attr = {
+                let _permit = walk.call().await;
+                resolver::lookup_child(&walk.fs, src, entry.name()).await?
+            };
+            let param = RenameParam {
+                old_parent: src,
+                old_name: entry.name().to_owned(),
+                new_parent: dest,
+                new_name: entry.name().to_owned(),
+                flags: 0,
+            };
+            let _copy = walk.copies.acquire().await.unwrap();
+            ops::copy_child(&walk.fs, options, &src_attr, param).await.map(|_| ())
+        }
+        _ => Ok(()),
+    }
+}
@@ -0,0 +1,122 @@
+//! Vectored reads and writes of the sdk
+//!
+//! A vectored call takes many `(offset, buffer)` segments of one file.
+//! Reads sort the segments and merge the ones close to each other into
+//! fewer, larger ranges, which are read concurrently and scattered back
+//! into the segments. Writes merge the segments that are adjacent in the
+//! file and write them in file order, so sequential writers stay sequential.
+
+use std::sync::Arc;
+
+use futures::{StreamExt, TryStreamExt};
+
+use crate::common::DatenLordResult;
+use crate::sdk::ops::{self, FileHandle, SdkFs};
+
+/// Max gap between two segments read with one range
+const MERGE_GAP: u64 = 64 * 1024;
+
+/// Max length of a merged range
+const MAX_RANGE: u64 = 8 * 1024 * 1024;
+
+/// Ranges read concurrently
+const RANGE_CONCURRENCY: usize = 16;
+
+/// A range of the file covering one or more segments
+#[derive(Debug)]
+struct MergedRange {
+    offset: u64,
+    len: u64,
+    /// Indexes of the segments in the range
+    segments: Vec<usize>,
+}
+
+/// Group the segments, sorted by offset, into ranges
+fn merge(spans: &[(u64, u64)], max_gap: u64, allow: impl Fn(u64) -> bool) -> Vec<MergedRange> {
+    let mut order: Vec<usize> = (0..spans.len()).collect();
+    order.sort_by_key(|&index| spans[index].0);
+
+    let mut ranges: Vec<MergedRange> = Vec::new();
+    for index in order {
+        let (offset, len) = spans[index];
+        if let Some(range) = ranges.last_mut() {
+            let end = range.offset + range.len;
+            let new_end = end.max(offset + len);
+            if offset <= end + max_gap && allow(new_end - range.offset) {
+                range.len = new_end - range.offset;
+                range.segments.push(index);
+                continue;
+            }
+        }
+        ranges.push(MergedRange {
+            offset,
+            len,
+            segments: vec![index],
+        });
+    }
+    ranges
+}
+
+/// Read every segment at its offset, return the number of bytes read into each
+pub async fn preadv(
+    fs: &Arc<SdkFs>,
+    handle: &FileHandle,
+    segments: &mut [(u64, &mut [u8])],
+) -> DatenLordResult<Vec<usize>> {
+    let spans: Vec<(u64, u64)> = segments.iter().map(|(offset, buf)| (*offset, buf.len() as u64)).collect();
+    let ranges = merge(&spans, MERGE_GAP, |len| len <= MAX_RANGE);
+
+    let reads: Vec<Vec<u8>> = futures::stream::iter(ranges.iter())
+        .map(|range| async move {
+            let mut buffer = vec![0; range.len as usize];
+            let read = ops::pread(fs, handle, range.offset, &mut buffer).await?;
+            buffer.truncate(read);
+            DatenLordResult::Ok(buffer)
+        })
+        .buffered(RANGE_CONCURRENCY)
+        .try_collect()
+        .await?;
+
+    let mut sizes = vec![0; segments.len()];
+    for (range, data) in ranges.iter().zip(reads) {
+        for &index in &range.segments {
+            let (offset, buf) = &mut segments[index];
+            let start = (*offset - range.offset) as usize;
+            if start < data.len() {
+                let len = buf.len().min(data.len() - start);
+                buf[..len].copy_from_slice(&data[start..start + len]);
+                sizes[index] = len;
+            }
+        }
+    }
+    Ok(sizes)
+}
+
+/// Write every segment at its offset. Overlapping segments are written in
+/// the given order, so the later ones win.
+pub async fn pwritev(fs: &Arc<SdkFs>, handle: &FileHandle, segments: &[(u64, &[u8])]) -> DatenLordResult<()> {
+    let spans: Vec<(u64, u64)> = segments.iter().map(|(offset, data)| (*offset, data.len() as u64)).collect();
+    let mut sorted = spans.clone();
+    sorted.sort_unstable();
+    let overlapping = sorted.windows(2).any(|pair| pair[0].0 + pair[0].1 > pair[1].0);
+    if overlapping {
+        for (offset, data) in segments {
+            ops::pwrite(fs, handle, *offset, data).await?;
+        }
+        return Ok(());
+    }
+
+    // Only adjacent segments are merged, a gap has no data to write
+    for range in merge(&spans, 0, |len| len <= MAX_RANGE) {
+        if let [index] = range.segments[..] {
+            ops::pwrite(fs, handle, range.offset, segments[index].1).await?;
+            continue;
+        }
+        let mut data = Vec::with_capacity(range.len as usize);
+        for &index in &range.segments {
+            data.extend_from_slice(segments[index].1);
+        }
+        ops::pwrite(fs, handle, range.offset, &data).await?;
+    }
+    Ok(())
+}
@@ -0,0 +1,190 @@
+//! Write-back buffering of the sdk
+//!
+//! With write-back enabled, writes to a handle are appended to a buffered
+//! extent while they are contiguous, and an extent is written to the
+//! filesystem in the background once it reaches the extent size or a write
+//! lands elsewhere. The writes of one handle reach the filesystem in order.
+//!
+//! Flush, fsync and close wait for every write of the handle and return the
+//! first error of the background writes. The buffered bytes of all handles
+//! are bounded by a byte budget, a write waits for budget once it is spent.
+
+use std::collections::HashMap;
+use std::sync::{Arc, Mutex};
+
+use tokio::sync::{Mutex as AsyncMutex, Semaphore};
+use tokio::task::JoinHandle;
+
+use crate::common::{DatenLordError, DatenLordResult};
+use crate::sdk::ops::{self, FileHandle, SdkFs};
+
+/// Pending writes of one handle
+#[derive(Debug)]
+struct HandleBuffer {
+    handle: FileHandle,
+    /// Offset of the buffered extent
+    offset: u64,
+    /// The buffered extent, not written yet
+    data: Vec<u8>,
+    /// Budget held by the buffered extent
+    permits: u32,
+    /// The last background write, which waits for the previous ones
+    in_flight: Option<JoinHandle<DatenLordResult<()>>>,
+}
+
+/// Write-back buffers of all handles of an sdk instance
+#[derive(Debug)]
+pub struct WriteBack {
+    /// Size an extent is written at, 0 disables write-back
+    extent_size: usize,
+    /// Byte budget of all buffered and in flight writes
+    budget: Arc<Semaphore>,
+    /// The full budget, a single write takes at most all of it
+    max_bytes: u32,
+    /// Buffers by file handle
+    buffers: Mutex<HashMap<u64, Arc<AsyncMutex<HandleBuffer>>>>,
+}
+
+impl WriteBack {
+    /// Create the buffers, `max_bytes` is capped at 4 GiB
+    pub fn new(extent_size: usize, max_bytes: usize) -> Self {
+        let max_bytes = u32::try_from(max_bytes).unwrap_or(u32::MAX).max(1);
+        Self {
+            extent_size,
+            budget: Arc::new(Semaphore::new(max_bytes as usize)),
+            max_bytes,
+            buffers: Mutex::new(HashMap::new()),
+        }
+    }
+
+    /// Whether writes are buffered
+    pub fn enabled(&self) -> bool {
+        self.extent_size > 0
+    }
+
+    fn buffer(&self, handle: &FileHandle) -> Arc<AsyncMutex<HandleBuffer>> {
+        let mut buffers = self.buffers.lock().unwrap();
+        let buffer = buffers.entry(handle.fh).or_insert_with(|| {
+            Arc::new(AsyncMutex::new(HandleBuffer {
+                handle: *handle,
+                offset: 0,
+                data: Vec::new(),
+                permits: 0,
+                in_flight: None,
+            }))
+        });
+        Arc::clone(buffer)
+    }
+
+    /// Buffer a write, it reaches the filesystem later
+    pub async fn write(&self, fs: &Arc<SdkFs>, handle: &FileHandle, offset: u64, data: &[u8]) -> DatenLordResult<()> {
+        let permits = self.acquire(fs, data.len()).await?;
+        let buffer = self.buffer(handle);
+        let mut buffer = buffer.lock().await;
+
+        if !buffer.data.is_empty() && buffer.offset + buffer.data.len() as u64 != offset {
+            // Not contiguous, the buffered extent goes first
+            issue(fs, &mut buffer);
+        }
+        if buffer.data.is_empty() {
+            buffer.offset = offset;
+        }
+        buffer.data.extend_from_slice(data);
+        buffer.permits += permits;
+        if buffer.data.len() >= self.extent_size {
+            issue(fs, &mut buffer);
+        }
+        Ok(())
+    }
+
+    /// Take budget for `len` bytes, when it is spent the buffered extents
+    /// are written out so it comes back
+    async fn acquire(&self, fs: &Arc<SdkFs>, len: usize) -> DatenLordResult<u32> {
+        let permits = u32::try_from(len).unwrap_or(u32::MAX).min(self.max_bytes);
+        if let Ok(acquired) = self.budget.try_acquire_many(permits) {
+            acquired.forget();
+            return Ok(permits);
+        }
+
+        // No buffer lock is held while waiting for budget, so the busy buffers
+        // are being written to and get issued by their own writers
+        let buffers: Vec<_> = self.buffers.lock().unwrap().values().cloned().collect();
+        for buffer in buffers {
+            if let Ok(mut buffer) = buffer.try_lock() {
+                issue(fs, &mut buffer);
+            }
+        }
+        self.budget
+            .acquire_many(permits)
+            .await
+            .map_err(|e| DatenLordError::Internal {
+                context: vec![format!("write-back budget closed: {e}")],
+            })?
+            .forget();
+        Ok(permits)
+    }
+
+    /// Wait for every write of a handle, return the first error
+    pub async fn barrier(&self, fs: &Arc<SdkFs>, handle: &FileHandle) -> DatenLordResult<()> {
+        let buffer = self.buffers.lock().unwrap().get(&handle.fh).cloned();
+        let Some(buffer) = buffer else {
+            return Ok(());
+        };
+        let mut buffer = buffer.lock().await;
+        issue(fs, &mut buffer);
+        match buffer.in_flight.take() {
+            Some(in_flight) => join(in_flight).await,
+            None => Ok(()),
+        }
+    }
+
+    /// Wait for every write of a handle and forget it, before it is released
+    pub async fn close(&self, fs: &Arc<SdkFs>, handle: &FileHandle) -> DatenLordResult<()> {
+        let done = self.barrier(fs, handle).await;
+        self.buffers.lock().unwrap().remove(&handle.fh);
+        done
+    }
+
+    fn release(&self, permits: u32) {
+        self.budget.add_permits(permits as usize);
+    }
+}
+
+/// Write the buffered extent in the background, after the previous writes of the handle
+fn issue(fs: &Arc<SdkFs>, buffer: &mut HandleBuffer) {
+    if buffer.data.is_empty() {
+        return;
+    }
+    let data = std::mem::take(&mut buffer.data);
+    let permits = std::mem::take(&mut buffer.permits);
+    let (handle, offset) = (buffer.handle, buffer.offset);
+    let previous = buffer.in_flight.take();
+    let fs = Arc::clone(fs);
+
+    buffer.in_flight = Some(tokio::spawn(async move {
+        let previous = match previous {
+            Some(previous) => join(previous).await,
+            None => Ok(()),
+        };
+        let written = match i64::try_from(offset) {
+            Ok(offset) => fs.backend.write(handle.ino, handle.fh, offset, &data, handle.flags).await,
+            Err(_) => Err(DatenLordError::InvalidArgument {
+                context: vec![format!("offset {offset} overflow")],
+            }),
+        };
+        drop(data);
+        // Reads in the meantime may have cached the content from before the write
+        ops::invalidate_written(&fs, handle.ino);
+        fs.write_back.release(permits);
+        // Keep the first error
+        previous.and(written)
+    }));
+}
+
+async fn join(in_flight: JoinHandle<DatenLordResult<()>>) -> DatenLordResult<()> {
+    in_flight.await.unwrap_or_else(|e| {
+        Err(DatenLordError::Internal {
+            context: vec![format!("write-back task failed: {e}")],
+        })
+    })
+}
@@ -144,7 +144,7 @@ pub struct FileLockParam {
 }
 
 /// File attributes
-#[derive(Copy, Clone, Debug)]
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
 pub struct FileAttr {
     /// Inode number
     pub ino: INum,
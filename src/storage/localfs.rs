@@ -1,29 +1,575 @@
 use async_trait::async_trait;
 use bytes::BytesMut;
+use futures::TryStreamExt;
 use opendal::services::Fs;
-use opendal::Operator;
-use std::fs;
-use std::os::unix::fs::MetadataExt;
-use std::time::{Duration, SystemTime};
-use std::path::Path;
-
-use crate::common::DatenLordResult;
-use super::fs_util::{CreateParam, FileAttr, RenameParam, SetAttrParam, StatFsParam};
+use opendal::{ErrorKind as OpendalErrorKind, Lister, Metadata, Metakey, Operator, Writer};
+use std::collections::hash_map::DefaultHasher;
+use std::collections::HashMap;
+use std::fs::{File, OpenOptions};
+use std::hash::{Hash, Hasher};
+use std::os::unix::fs::FileExt;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, RwLock};
+use std::time::{Duration, Instant, SystemTime};
+use std::path::{Path, PathBuf};
+use tokio::sync::Mutex;
+
+use crate::common::{DatenLordError, DatenLordResult};
+use super::fs_util::{CreateParam, FileAttr, RenameParam, SetAttrParam, StatFsParam, parse_oflag, ROOT_ID};
 use super::virtualfs::{DirEntry, INum, VirtualFs};
+
+/// Operator path of the root directory
+const ROOT_PATH: &str = "/";
+
+/// Max entries returned by one readdir
+const READDIR_PAGE: usize = 1024;
+
+/// Locks serializing the rewrites of objects, striped by inode number
+const REWRITE_LOCKS: usize = 64;
+
+/// Inodes remembered past which idle ones are evicted
+const INODE_TABLE_CAPACITY: usize = 1 << 16;
+
+/// Idle time after which an inode can be evicted, well past the TTL of the
+/// attributes returned so callers have looked it up again by then
+const INODE_LEASE: Duration = Duration::from_secs(600);
+
+/// A remembered inode
+#[derive(Debug)]
+struct Inode {
+    /// Operator path
+    path: String,
+    /// Lookups not forgotten yet
+    lookups: AtomicU64,
+    /// Open files and directories, an open inode is never evicted
+    opens: AtomicU64,
+    /// Last use, in seconds since the table was created
+    used: AtomicU64,
+}
+
+/// Operator paths and inode numbers of the inodes returned so far.
+/// Directory paths end with `/`, as opendal expects.
+///
+/// An inode is removed once all its lookups are forgotten. As callers such
+/// as the sdk never forget, once the table grows past its capacity the
+/// inodes idle for longer than `INODE_LEASE`, and not open, are evicted too.
+#[derive(Debug)]
+struct InodeTable {
+    /// Inode by inode number
+    paths: HashMap<INum, Inode>,
+    /// Inode number by operator path
+    inodes: HashMap<String, INum>,
+    /// Time the uses are counted from
+    created: Instant,
+    /// Idle time after which an inode can be evicted
+    lease: Duration,
+    /// Size of the table past which the next eviction runs
+    evict_at: usize,
+}
+
+impl InodeTable {
+    /// Create a table with only the root directory
+    fn new() -> Self {
+        let mut table = Self {
+            paths: HashMap::new(),
+            inodes: HashMap::new(),
+            created: Instant::now(),
+            lease: INODE_LEASE,
+            evict_at: INODE_TABLE_CAPACITY,
+        };
+        table.insert(ROOT_ID, ROOT_PATH.to_owned());
+        table
+    }
+
+    /// Current time in seconds since the table was created
+    fn now(&self) -> u64 {
+        self.created.elapsed().as_secs()
+    }
+
+    fn insert(&mut self, ino: INum, path: String) {
+        let inode = Inode {
+            path: path.clone(),
+            lookups: AtomicU64::new(1),
+            opens: AtomicU64::new(0),
+            used: AtomicU64::new(self.now()),
+        };
+        self.paths.insert(ino, inode);
+        self.inodes.insert(path, ino);
+    }
+
+    /// Get the inode number of a path, the recorded one or else a hash of it
+    fn ino_of(&self, path: &str) -> INum {
+        if let Some(&ino) = self.inodes.get(path) {
+            return ino;
+        }
+        let mut hasher = DefaultHasher::new();
+        path.trim_end_matches('/').hash(&mut hasher);
+        let mut ino = hasher.finish();
+        // Skip the reserved numbers and the ones taken by other paths
+        while ino <= ROOT_ID || self.paths.contains_key(&ino) {
+            ino = ino.wrapping_add(1);
+        }
+        ino
+    }
+
+    /// Get the operator path of an inode
+    fn path(&self, ino: INum) -> Option<String> {
+        let inode = self.paths.get(&ino)?;
+        inode.used.store(self.now(), Ordering::Relaxed);
+        Some(inode.path.clone())
+    }
+
+    /// Count one more lookup of a path if it is remembered, return its inode number
+    fn lookup(&self, path: &str) -> Option<INum> {
+        let ino = *self.inodes.get(path)?;
+        let inode = &self.paths[&ino];
+        inode.lookups.fetch_add(1, Ordering::Relaxed);
+        inode.used.store(self.now(), Ordering::Relaxed);
+        Some(ino)
+    }
+
+    /// Remember a path, or count one more lookup of it, return its inode number
+    fn record(&mut self, path: String) -> INum {
+        if let Some(ino) = self.lookup(&path) {
+            return ino;
+        }
+        let ino = self.ino_of(&path);
+        self.insert(ino, path);
+        if self.paths.len() > self.evict_at {
+            self.evict();
+        }
+        ino
+    }
+
+    /// Evict the idle inodes that are not open, the next eviction runs once
+    /// the table doubles so the scans are amortized over the insertions
+    fn evict(&mut self) {
+        let now = self.now();
+        let lease = self.lease.as_secs();
+        self.paths.retain(|&ino, inode| {
+            let idle = now.saturating_sub(inode.used.load(Ordering::Relaxed));
+            ino == ROOT_ID || inode.opens.load(Ordering::Relaxed) > 0 || idle < lease
+        });
+        let paths = &self.paths;
+        self.inodes.retain(|_, ino| paths.contains_key(ino));
+        self.evict_at = INODE_TABLE_CAPACITY.max(self.paths.len() * 2);
+    }
+
+    /// Forget `nlookup` lookups of an inode, it is removed once none are left and it is not open
+    fn forget(&mut self, ino: INum, nlookup: u64) {
+        let Some(inode) = self.paths.get(&ino) else {
+            return;
+        };
+        let lookups = inode.lookups.load(Ordering::Relaxed).saturating_sub(nlookup);
+        inode.lookups.store(lookups, Ordering::Relaxed);
+        if ino != ROOT_ID && lookups == 0 && inode.opens.load(Ordering::Relaxed) == 0 {
+            let path = inode.path.clone();
+            self.remove(&path);
+        }
+    }
+
+    /// Count an open file or directory of an inode
+    fn open(&self, ino: INum) {
+        if let Some(inode) = self.paths.get(&ino) {
+            inode.opens.fetch_add(1, Ordering::Relaxed);
+        }
+    }
+
+    /// Count a released file or directory of an inode
+    fn release(&self, ino: INum) {
+        if let Some(inode) = self.paths.get(&ino) {
+            let _ = inode.opens.fetch_update(Ordering::Relaxed, Ordering::Relaxed, |opens| opens.checked_sub(1));
+        }
+    }
+
+    /// Forget a path
+    fn remove(&mut self, path: &str) {
+        if let Some(ino) = self.inodes.remove(path) {
+            self.paths.remove(&ino);
+        }
+    }
+
+    /// Move `from`, and everything below it for a directory, to `to`,
+    /// the inode numbers are kept
+    fn rename(&mut self, from: &str, to: &str) {
+        let moved: Vec<(String, INum)> = self
+            .inodes
+            .iter()
+            .filter(|(path, _)| *path == from || (from.ends_with('/') && path.starts_with(from)))
+            .map(|(path, &ino)| (path.clone(), ino))
+            .collect();
+        for (path, ino) in moved {
+            self.inodes.remove(&path);
+            let new_path = format!("{to}{}", &path[from.len()..]);
+            if let Some(inode) = self.paths.get_mut(&ino) {
+                inode.path = new_path.clone();
+            }
+            self.inodes.insert(new_path, ino);
+        }
+    }
+}
+
+/// Sequential writes streamed to the operator, the file is replaced once the writer is closed
+struct SequentialWriter {
+    writer: Writer,
+    /// Offset the next sequential write starts at
+    offset: u64,
+}
+
+/// An open file
+struct OpenFile {
+    /// Inode number of the file
+    ino: INum,
+    /// Operator path of the file
+    path: String,
+    /// Pending sequential writes, started by an open with `O_TRUNC`
+    writer: Mutex<Option<SequentialWriter>>,
+    /// Local file for positional writes, opened on the first one
+    local: std::sync::Mutex<Option<Arc<File>>>,
+}
+
+impl std::fmt::Debug for OpenFile {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("OpenFile").field("path", &self.path).finish()
+    }
+}
+
+/// An open directory, listed sequentially
+struct OpenDir {
+    /// Inode number of the directory
+    ino: INum,
+    /// Operator path of the directory
+    path: String,
+    /// The directory listing
+    lister: Lister,
+    /// Index of the next entry of the listing
+    position: i64,
+}
+
+impl std::fmt::Debug for OpenDir {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.debug_struct("OpenDir")
+            .field("path", &self.path)
+            .field("position", &self.position)
+            .finish()
+    }
+}
+
+/// A filesystem on an opendal `Operator`, all data and metadata goes
+/// through the operator, except what needs a local directory: positional
+/// writes and the local path of files, which are only used when the
+/// operator is rooted at a local directory
 #[derive(Debug)]
 pub struct LocalFS {
     operator: Operator,
+    /// Local directory the operator is rooted at
+    local_root: Option<PathBuf>,
+    /// The inodes returned by lookup, create, mknod and mkdir
+    inodes: RwLock<InodeTable>,
+    /// Open files by file handle
+    handles: RwLock<HashMap<u64, Arc<OpenFile>>>,
+    /// Open directories by file handle
+    dirs: RwLock<HashMap<u64, Arc<Mutex<OpenDir>>>>,
+    /// The next file or directory handle to hand out, 0 is never used
+    next_fh: AtomicU64,
+    /// Held across the read and the write back of a rewritten object, so
+    /// that concurrent positional writes to it are not lost
+    rewrites: Vec<Mutex<()>>,
+}
+
+/// Build an I/O error with context
+fn io_error(e: std::io::Error, context: String) -> DatenLordError {
+    let context = vec![format!("{context}: {e}")];
+    match e.kind() {
+        std::io::ErrorKind::NotFound => DatenLordError::NotFound { context },
+        std::io::ErrorKind::AlreadyExists => DatenLordError::AlreadyExists { context },
+        _ => DatenLordError::Io { context },
+    }
+}
+
+/// Build an error of an operator call with context
+fn opendal_error(e: opendal::Error, context: String) -> DatenLordError {
+    let context = vec![format!("{context}: {e}")];
+    match e.kind() {
+        OpendalErrorKind::NotFound => DatenLordError::NotFound { context },
+        OpendalErrorKind::AlreadyExists => DatenLordError::AlreadyExists { context },
+        _ => DatenLordError::Io { context },
+    }
+}
+
+/// Run a blocking local file operation on the blocking thread pool
+async fn blocking<T, F>(f: F) -> DatenLordResult<T>
+where
+    F: FnOnce() -> DatenLordResult<T> + Send + 'static,
+    T: Send + 'static,
+{
+    tokio::task::spawn_blocking(f)
+        .await
+        .map_err(|e| DatenLordError::Internal {
+            context: vec![format!("blocking task failed: {e}")],
+        })?
 }
 
 impl LocalFS {
-    pub fn new() -> DatenLordResult<Self> {
+    /// Create a filesystem on the local directory `root`
+    pub fn new(root: &str) -> DatenLordResult<Self> {
         let mut builder = Fs::default();
-        builder.root("/tmp");
-        let op = Operator::new(builder).unwrap().finish();
-        Ok(Self { operator: op })
+        builder.root(root);
+        let operator = Operator::new(builder)
+            .map_err(|e| opendal_error(e, format!("failed to open local root {root}")))?
+            .finish();
+        Ok(Self::with_local_root(operator, Some(PathBuf::from(root))))
+    }
+
+    /// Create a filesystem on an operator without a local directory, such as an object store
+    pub fn from_operator(operator: Operator) -> Self {
+        Self::with_local_root(operator, None)
+    }
+
+    fn with_local_root(operator: Operator, local_root: Option<PathBuf>) -> Self {
+        Self {
+            operator,
+            local_root,
+            inodes: RwLock::new(InodeTable::new()),
+            handles: RwLock::new(HashMap::new()),
+            dirs: RwLock::new(HashMap::new()),
+            next_fh: AtomicU64::new(1),
+            rewrites: (0..REWRITE_LOCKS).map(|_| Mutex::new(())).collect(),
+        }
+    }
+
+    /// Get the operator path of an inode
+    fn inode_path(&self, ino: INum) -> DatenLordResult<String> {
+        self.inodes
+            .read()
+            .unwrap()
+            .path(ino)
+            .ok_or_else(|| DatenLordError::InvalidArgument {
+                context: vec![format!("unknown inode {ino}")],
+            })
+    }
+
+    /// Get the operator path of `name` in the directory `parent`, without
+    /// the trailing `/` of a directory
+    fn child_path(&self, parent: INum, name: &str) -> DatenLordResult<String> {
+        if name.is_empty() || name == "." || name == ".." || name.contains('/') {
+            return Err(DatenLordError::InvalidArgument {
+                context: vec![format!("invalid file name {name:?}")],
+            });
+        }
+        let parent = self.inode_path(parent)?;
+        if parent == ROOT_PATH {
+            Ok(name.to_owned())
+        } else {
+            Ok(format!("{parent}{name}"))
+        }
+    }
+
+    /// Get the local path of an operator path
+    fn local_file_path(&self, path: &str) -> Option<PathBuf> {
+        self.local_root.as_ref().map(|root| root.join(path))
+    }
+
+    /// Stat `name` in the directory `parent`, return its operator path
+    async fn stat_child(&self, parent: INum, name: &str) -> DatenLordResult<(String, Metadata)> {
+        let path = self.child_path(parent, name)?;
+        match self.operator.stat(&path).await {
+            Ok(metadata) if metadata.is_dir() => Ok((format!("{path}/"), metadata)),
+            Ok(metadata) => Ok((path, metadata)),
+            // Object stores only know directories by their trailing `/`
+            Err(e) if e.kind() == OpendalErrorKind::NotFound => {
+                let dir_path = format!("{path}/");
+                let metadata = self
+                    .operator
+                    .stat(&dir_path)
+                    .await
+                    .map_err(|e| opendal_error(e, format!("failed to lookup {path}")))?;
+                Ok((dir_path, metadata))
+            }
+            Err(e) => Err(opendal_error(e, format!("failed to lookup {path}"))),
+        }
+    }
+
+    /// Check that `name` does not exist in the directory `parent` yet
+    async fn check_absent(&self, parent: INum, name: &str) -> DatenLordResult<String> {
+        let path = self.child_path(parent, name)?;
+        if self.stat_child(parent, name).await.is_ok() {
+            return Err(DatenLordError::AlreadyExists {
+                context: vec![format!("{path} already exists")],
+            });
+        }
+        Ok(path)
+    }
+
+    /// Create an empty file `name` in the directory `parent`, failing if it
+    /// exists. Local files are created exclusively, object stores have no
+    /// conditional writes so a file created by another client between the
+    /// check and the write is replaced.
+    async fn create_empty(&self, parent: INum, name: &str) -> DatenLordResult<String> {
+        let path = self.child_path(parent, name)?;
+        if let Some(local_path) = self.local_file_path(&path) {
+            blocking(move || {
+                OpenOptions::new()
+                    .write(true)
+                    .create_new(true)
+                    .open(&local_path)
+                    .map(drop)
+                    .map_err(|e| io_error(e, format!("failed to create {}", local_path.display())))
+            })
+            .await?;
+            return Ok(path);
+        }
+        let path = self.check_absent(parent, name).await?;
+        self.operator
+            .write(&path, Vec::new())
+            .await
+            .map_err(|e| opendal_error(e, format!("failed to create {path}")))?;
+        Ok(path)
+    }
+
+    /// Remember a path, the table is only locked for writing the first time
+    fn record(&self, path: String) -> INum {
+        if let Some(ino) = self.inodes.read().unwrap().lookup(&path) {
+            return ino;
+        }
+        self.inodes.write().unwrap().record(path)
+    }
+
+    /// List a directory along with the metadata of its entries
+    async fn list(&self, path: &str) -> opendal::Result<Lister> {
+        self.operator
+            .lister_with(path)
+            .metakey(Metakey::Mode | Metakey::ContentLength | Metakey::LastModified)
+            .await
+    }
+
+    /// Stat a new operator path and remember it
+    async fn record_path(&self, path: String) -> DatenLordResult<FileAttr> {
+        let metadata = self
+            .operator
+            .stat(&path)
+            .await
+            .map_err(|e| opendal_error(e, format!("failed to stat {path}")))?;
+        let ino = self.record(path);
+        Ok(Self::fileattr_from_metadata(metadata, ino))
+    }
+
+    /// Get an open file by its handle
+    fn handle(&self, fh: u64) -> DatenLordResult<Arc<OpenFile>> {
+        self.handles
+            .read()
+            .unwrap()
+            .get(&fh)
+            .cloned()
+            .ok_or_else(|| DatenLordError::InvalidArgument {
+                context: vec![format!("invalid file handle {fh}")],
+            })
     }
 
-    fn fileattr_from_metadata(metadata: opendal::Metadata, ino: u64) -> FileAttr {
+    /// Get an open directory by its handle
+    fn dir(&self, fh: u64) -> DatenLordResult<Arc<Mutex<OpenDir>>> {
+        self.dirs
+            .read()
+            .unwrap()
+            .get(&fh)
+            .cloned()
+            .ok_or_else(|| DatenLordError::InvalidArgument {
+                context: vec![format!("invalid directory handle {fh}")],
+            })
+    }
+
+    /// Close the pending sequential writer of a file, which makes its writes visible
+    async fn commit(&self, file: &OpenFile) -> DatenLordResult<()> {
+        if let Some(mut pending) = file.writer.lock().await.take() {
+            pending
+                .writer
+                .close()
+                .await
+                .map_err(|e| opendal_error(e, format!("failed to write {}", file.path)))?;
+        }
+        Ok(())
+    }
+
+    /// Write at any offset. Local files are written in place, object stores
+    /// have no positional writes so the whole object is rewritten, one
+    /// rewrite of an inode at a time.
+    async fn write_at(&self, file: &OpenFile, offset: u64, data: &[u8]) -> DatenLordResult<()> {
+        let Some(local_path) = self.local_file_path(&file.path) else {
+            let _rewrite = self.rewrites[file.ino as usize % REWRITE_LOCKS].lock().await;
+            let mut content = self
+                .operator
+                .read(&file.path)
+                .await
+                .map_err(|e| opendal_error(e, format!("failed to read {}", file.path)))?;
+            let start = offset as usize;
+            let end = start + data.len();
+            if content.len() < end {
+                content.resize(end, 0);
+            }
+            content[start..end].copy_from_slice(data);
+            return self
+                .operator
+                .write(&file.path, content)
+                .await
+                .map_err(|e| opendal_error(e, format!("failed to write {}", file.path)));
+        };
+
+        let cached = file.local.lock().unwrap().clone();
+        let local = match cached {
+            Some(local) => local,
+            None => {
+                let local = blocking(move || {
+                    OpenOptions::new()
+                        .write(true)
+                        .open(&local_path)
+                        .map_err(|e| io_error(e, format!("failed to open {}", local_path.display())))
+                })
+                .await
+                .map(Arc::new)?;
+                file.local.lock().unwrap().get_or_insert(local).clone()
+            }
+        };
+        let data = data.to_vec();
+        let path = file.path.clone();
+        blocking(move || {
+            local
+                .write_all_at(&data, offset)
+                .map_err(|e| io_error(e, format!("failed to write {path}")))
+        })
+        .await
+    }
+
+    /// Start the writer of a truncating open, which streams its writes and
+    /// replaces the file on close
+    async fn sequential_writer(&self, path: &str, flags: u32) -> DatenLordResult<Option<SequentialWriter>> {
+        let oflags = parse_oflag(flags);
+        let writable = oflags & nix::fcntl::OFlag::O_ACCMODE != nix::fcntl::OFlag::O_RDONLY;
+        if !writable || !oflags.contains(nix::fcntl::OFlag::O_TRUNC) {
+            return Ok(None);
+        }
+        let writer = self
+            .operator
+            .writer(path)
+            .await
+            .map_err(|e| opendal_error(e, format!("failed to open {path}")))?;
+        Ok(Some(SequentialWriter { writer, offset: 0 }))
+    }
+
+    /// Hand out a file handle
+    fn insert_handle(&self, ino: INum, path: String, writer: Option<SequentialWriter>) -> u64 {
+        self.inodes.read().unwrap().open(ino);
+        let file = OpenFile {
+            ino,
+            path,
+            writer: Mutex::new(writer),
+            local: std::sync::Mutex::new(None),
+        };
+        let fh = self.next_fh.fetch_add(1, Ordering::Relaxed);
+        self.handles.write().unwrap().insert(fh, Arc::new(file));
+        fh
+    }
+
+    fn fileattr_from_metadata(metadata: Metadata, ino: u64) -> FileAttr {
         let kind = if metadata.is_file() {
             nix::sys::stat::SFlag::S_IFREG
         } else if metadata.is_dir() {
@@ -50,33 +596,6 @@ impl LocalFS {
             rdev: 0,
         }
     }
-
-    fn fileattr_from_local_metadata(metadata: fs::Metadata, ino: u64) -> FileAttr {
-        let kind = if metadata.is_file() {
-            nix::sys::stat::SFlag::S_IFREG
-        } else if metadata.is_dir() {
-            nix::sys::stat::SFlag::S_IFDIR
-        } else {
-            nix::sys::stat::SFlag::S_IFLNK
-        };
-        let size = metadata.len();
-        let atime = metadata.modified().unwrap_or(SystemTime::now().into()).into();
-
-        return FileAttr {
-            ino: ino as INum,
-            size,
-            blocks: size / 512,
-            atime,
-            mtime: atime,
-            ctime: atime,
-            kind,
-            perm: 0o775,
-            nlink: 1,
-            uid: 1000,
-            gid: 1000,
-            rdev: 0,
-        };
-    }
 }
 
 #[async_trait]
@@ -85,18 +604,22 @@ impl VirtualFs for LocalFS {
         &self,
         _uid: u32,
         _gid: u32,
-        _parent: INum,
+        parent: INum,
         name: &str,
     ) -> DatenLordResult<(Duration, FileAttr, u64)> {
-        let path = format!("/tmp/{}", name);
-        let local_metadata = fs::metadata(path).unwrap();
-        let ino = local_metadata.ino();
-        let metadata = Self::fileattr_from_local_metadata(local_metadata, ino);
-        Ok((Duration::from_secs(1), metadata, 0))
+        let (path, metadata) = self.stat_child(parent, name).await?;
+        let ino = self.record(path);
+        Ok((Duration::from_secs(1), Self::fileattr_from_metadata(metadata, ino), 0))
     }
 
     async fn getattr(&self, ino: u64) -> DatenLordResult<(Duration, FileAttr)> {
-        Ok((Duration::from_secs(1), FileAttr::default()))
+        let path = self.inode_path(ino)?;
+        let metadata = self
+            .operator
+            .stat(&path)
+            .await
+            .map_err(|e| opendal_error(e, format!("failed to stat {path}")))?;
+        Ok((Duration::from_secs(1), Self::fileattr_from_metadata(metadata, ino)))
     }
 
     async fn setattr(
@@ -113,86 +636,216 @@ impl VirtualFs for LocalFS {
         Ok(Vec::new())
     }
 
-    async fn open(&self, _uid: u32, _gid: u32, ino: u64, _flags: u32) -> DatenLordResult<u64> {
-        Ok(0)
+    async fn open(&self, _uid: u32, _gid: u32, ino: u64, flags: u32) -> DatenLordResult<u64> {
+        let path = self.inode_path(ino)?;
+        let writer = self.sequential_writer(&path, flags).await?;
+        Ok(self.insert_handle(ino, path, writer))
+    }
+
+    async fn create(
+        &self,
+        _uid: u32,
+        _gid: u32,
+        parent: u64,
+        name: &str,
+        _mode: u32,
+        flags: u32,
+    ) -> DatenLordResult<(Duration, FileAttr, u64)> {
+        // Created up front, so that the file is seen before the writer of a
+        // truncating open replaces it on close
+        let path = self.create_empty(parent, name).await?;
+        let writer = self.sequential_writer(&path, flags).await?;
+        let attr = self.record_path(path.clone()).await?;
+        Ok((Duration::from_secs(1), attr, self.insert_handle(attr.ino, path, writer)))
     }
 
     async fn read(
         &self,
-        ino: u64,
+        _ino: u64,
         fh: u64,
         offset: u64,
         size: u32,
         buf: &mut [u8],
     ) -> DatenLordResult<usize> {
-        // fill buf with size bytes from data
-        let data = vec![0; size as usize];
-        buf.copy_from_slice(&data);
-        Ok(data.len())
+        let file = self.handle(fh)?;
+        // Reads see the writes of the same handle
+        self.commit(&file).await?;
+
+        let size = (size as usize).min(buf.len());
+        if size == 0 {
+            return Ok(0);
+        }
+        let data = match self
+            .operator
+            .read_with(&file.path)
+            .range(offset..offset + size as u64)
+            .await
+        {
+            Ok(data) => data,
+            // Past the end of file
+            Err(e) if e.kind() == OpendalErrorKind::RangeNotSatisfied => return Ok(0),
+            Err(e) => return Err(opendal_error(e, format!("failed to read {}", file.path))),
+        };
+        let read = data.len().min(size);
+        buf[..read].copy_from_slice(&data[..read]);
+        Ok(read)
     }
 
     async fn write(
         &self,
-        ino: u64,
+        _ino: u64,
         fh: u64,
         offset: i64,
         data: &[u8],
         _flags: u32,
     ) -> DatenLordResult<()> {
-        Ok(())
+        let file = self.handle(fh)?;
+        let offset = offset as u64;
+
+        let mut pending = file.writer.lock().await;
+        if let Some(sequential) = pending.as_mut().filter(|sequential| sequential.offset == offset) {
+            sequential
+                .writer
+                .write(data.to_vec())
+                .await
+                .map_err(|e| opendal_error(e, format!("failed to write {}", file.path)))?;
+            sequential.offset += data.len() as u64;
+            return Ok(());
+        }
+        // Not a sequential write, finish the streamed part and write in place
+        if let Some(mut sequential) = pending.take() {
+            sequential
+                .writer
+                .close()
+                .await
+                .map_err(|e| opendal_error(e, format!("failed to write {}", file.path)))?;
+        }
+        drop(pending);
+        self.write_at(&file, offset, data).await
     }
 
-    async fn unlink(&self, _uid: u32, _gid: u32, _parent: INum, name: &str) -> DatenLordResult<()> {
+    async fn unlink(&self, _uid: u32, _gid: u32, parent: INum, name: &str) -> DatenLordResult<()> {
+        let (path, _) = self.stat_child(parent, name).await?;
+        self.operator
+            .delete(&path)
+            .await
+            .map_err(|e| opendal_error(e, format!("failed to remove {path}")))?;
+        self.inodes.write().unwrap().remove(&path);
         Ok(())
     }
 
     async fn mkdir(&self, param: CreateParam) -> DatenLordResult<(Duration, FileAttr, u64)> {
-        let path = format!("/tmp/{}", param.name);
-        // self.operator.create_dir(&path).await.unwrap();
-
-        let attr = FileAttr {
-            ino: param.parent,
-            size: 0,
-            blocks: 0,
-            atime: SystemTime::now(),
-            mtime: SystemTime::now(),
-            ctime: SystemTime::now(),
-            kind: param.node_type,
-            perm: param.mode as u16,
-            nlink: 2,
-            uid: param.uid,
-            gid: param.gid,
-            rdev: 0,
-        };
-
-        Ok((Duration::from_secs(1), attr, param.parent))
+        let path = self.check_absent(param.parent, &param.name).await?;
+        self.operator
+            .create_dir(&format!("{path}/"))
+            .await
+            .map_err(|e| opendal_error(e, format!("failed to create directory {path}")))?;
+        let attr = self.record_path(format!("{path}/")).await?;
+        Ok((Duration::from_secs(1), attr, 0))
     }
 
     async fn rename(&self, _uid: u32, _gid: u32, param: RenameParam) -> DatenLordResult<()> {
+        let (from, _) = self.stat_child(param.old_parent, &param.old_name).await?;
+        let to = self.child_path(param.new_parent, &param.new_name)?;
+        let to = if from.ends_with('/') { format!("{to}/") } else { to };
+        match self.operator.rename(from.trim_end_matches('/'), to.trim_end_matches('/')).await {
+            Ok(()) => {}
+            // Object stores have no rename, a file is copied within the store then removed
+            Err(e) if e.kind() == OpendalErrorKind::Unsupported && !from.ends_with('/') => {
+                self.operator
+                    .copy(&from, &to)
+                    .await
+                    .map_err(|e| opendal_error(e, format!("failed to copy {from} to {to}")))?;
+                self.operator
+                    .delete(&from)
+                    .await
+                    .map_err(|e| opendal_error(e, format!("failed to remove {from}")))?;
+            }
+            Err(e) => return Err(opendal_error(e, format!("failed to rename {from} to {to}"))),
+        }
+
+        let mut inodes = self.inodes.write().unwrap();
+        if from != to {
+            // The replaced destination is gone
+            inodes.remove(&to);
+        }
+        inodes.rename(&from, &to);
         Ok(())
     }
 
+    async fn copy_file(&self, _uid: u32, _gid: u32, param: RenameParam) -> DatenLordResult<(Duration, FileAttr)> {
+        let (from, _) = self.stat_child(param.old_parent, &param.old_name).await?;
+        if from.ends_with('/') {
+            return Err(DatenLordError::InvalidArgument {
+                context: vec![format!("{from} is a directory")],
+            });
+        }
+        let to = self.child_path(param.new_parent, &param.new_name)?;
+        match (self.local_file_path(&from), self.local_file_path(&to)) {
+            // copy_file_range, which shares the extents on filesystems with reflinks
+            (Some(src), Some(dest)) => {
+                blocking(move || {
+                    std::fs::copy(&src, &dest)
+                        .map_err(|e| io_error(e, format!("failed to copy {} to {}", src.display(), dest.display())))
+                })
+                .await?;
+            }
+            _ => self.operator.copy(&from, &to).await.map_err(|e| {
+                if e.kind() == OpendalErrorKind::Unsupported {
+                    DatenLordError::Unimplemented {
+                        context: vec![format!("the backend cannot copy {from}: {e}")],
+                    }
+                } else {
+                    opendal_error(e, format!("failed to copy {from} to {to}"))
+                }
+            })?,
+        }
+        let attr = self.record_path(to).await?;
+        Ok((Duration::from_secs(1), attr))
+    }
+
     async fn release(
         &self,
-        ino: u64,
+        _ino: u64,
         fh: u64,
         _flags: u32,
         _lock_owner: u64,
         _flush: bool,
     ) -> DatenLordResult<()> {
-        Ok(())
+        let file = self.handles.write().unwrap().remove(&fh);
+        match file {
+            Some(file) => {
+                self.inodes.read().unwrap().release(file.ino);
+                self.commit(&file).await
+            }
+            None => Err(DatenLordError::InvalidArgument {
+                context: vec![format!("invalid file handle {fh}")],
+            }),
+        }
     }
 
     async fn statfs(&self, _uid: u32, _gid: u32, ino: u64) -> DatenLordResult<StatFsParam> {
         Ok(StatFsParam::default())
     }
 
-    async fn fsync(&self, _ino: u64, _fh: u64, _datasync: bool) -> DatenLordResult<()> {
-        Ok(())
+    async fn fsync(&self, _ino: u64, fh: u64, datasync: bool) -> DatenLordResult<()> {
+        let file = self.handle(fh)?;
+        self.commit(&file).await?;
+        let local = file.local.lock().unwrap().clone();
+        let Some(local) = local else {
+            return Ok(());
+        };
+        let path = file.path.clone();
+        blocking(move || {
+            let result = if datasync { local.sync_data() } else { local.sync_all() };
+            result.map_err(|e| io_error(e, format!("failed to fsync {path}")))
+        })
+        .await
     }
 
-    async fn flush(&self, _ino: u64, _fh: u64, _lock_owner: u64) -> DatenLordResult<()> {
-        Ok(())
+    async fn flush(&self, _ino: u64, fh: u64, _lock_owner: u64) -> DatenLordResult<()> {
+        let file = self.handle(fh)?;
+        self.commit(&file).await
     }
 
     async fn symlink(
@@ -208,45 +861,192 @@ impl VirtualFs for LocalFS {
 
     async fn readdir(
         &self,
-        uid: u32,
-        gid: u32,
-        ino: u64,
+        _uid: u32,
+        _gid: u32,
+        _ino: u64,
         fh: u64,
         offset: i64,
     ) -> DatenLordResult<Vec<DirEntry>> {
-        Ok(Vec::new())
+        let dir = self.dir(fh)?;
+        let mut dir = dir.lock().await;
+        let path = dir.path.clone();
+        let list_error = |e| opendal_error(e, format!("failed to read directory {path}"));
+
+        // Sequential reads continue the listing, a seek restarts it
+        if offset != dir.position {
+            dir.lister = self.list(&path).await.map_err(list_error)?;
+            dir.position = 0;
+        }
+
+        let mut listed = Vec::new();
+        while listed.len() < READDIR_PAGE {
+            let Some(entry) = dir.lister.try_next().await.map_err(list_error)? else {
+                break;
+            };
+            // Some services list the directory itself
+            if entry.path() == path {
+                continue;
+            }
+            dir.position += 1;
+            if dir.position <= offset {
+                continue;
+            }
+            listed.push(entry);
+        }
+
+        // The listing has the attributes, the entries are remembered as if
+        // they were looked up so that readdirplus takes no stat per entry
+        let mut inodes = self.inodes.write().unwrap();
+        let page = listed
+            .into_iter()
+            .map(|entry| {
+                let name = entry.name().trim_end_matches('/').to_owned();
+                let (path, metadata) = entry.into_parts();
+                let ino = inodes.record(path);
+                DirEntry::with_attr(name, Duration::from_secs(1), Self::fileattr_from_metadata(metadata, ino))
+            })
+            .collect();
+        Ok(page)
     }
 
     async fn rmdir(
         &self,
-        uid: u32,
-        gid: u32,
+        _uid: u32,
+        _gid: u32,
         parent: INum,
         dir_name: &str,
     ) -> DatenLordResult<Option<INum>> {
-        Ok(None)
+        let (path, metadata) = self.stat_child(parent, dir_name).await?;
+        if !metadata.is_dir() {
+            return Err(DatenLordError::InvalidArgument {
+                context: vec![format!("{path} is not a directory")],
+            });
+        }
+        let mut lister = self
+            .operator
+            .lister(&path)
+            .await
+            .map_err(|e| opendal_error(e, format!("failed to read directory {path}")))?;
+        while let Some(entry) = lister
+            .try_next()
+            .await
+            .map_err(|e| opendal_error(e, format!("failed to read directory {path}")))?
+        {
+            if entry.path() != path {
+                return Err(DatenLordError::InvalidArgument {
+                    context: vec![format!("directory {path} is not empty")],
+                });
+            }
+        }
+
+        self.operator
+            .delete(&path)
+            .await
+            .map_err(|e| opendal_error(e, format!("failed to remove directory {path}")))?;
+        let mut inodes = self.inodes.write().unwrap();
+        let ino = inodes.inodes.get(&path).copied();
+        inodes.remove(&path);
+        Ok(ino)
     }
 
     async fn link(&self, _newparent: u64, _newname: &str) -> DatenLordResult<()> {
         Ok(())
     }
 
-    async fn forget(&self, _ino: u64, _nlookup: u64) {
+    async fn forget(&self, ino: u64, nlookup: u64) {
+        self.inodes.write().unwrap().forget(ino, nlookup);
     }
 
-    async fn mknod(&self, _param: CreateParam) -> DatenLordResult<(Duration, FileAttr, u64)> {
-        Ok((Duration::from_secs(1), FileAttr::default(), 0))
+    async fn mknod(&self, param: CreateParam) -> DatenLordResult<(Duration, FileAttr, u64)> {
+        let path = self.create_empty(param.parent, &param.name).await?;
+        let attr = self.record_path(path).await?;
+        Ok((Duration::from_secs(1), attr, 0))
+    }
+
+    fn local_path(&self, ino: u64) -> Option<PathBuf> {
+        let path = self.inode_path(ino).ok()?;
+        if path.ends_with('/') {
+            return None;
+        }
+        self.local_file_path(&path)
     }
 
     async fn opendir(&self, _uid: u32, _gid: u32, ino: u64, _flags: u32) -> DatenLordResult<u64> {
-        Ok(0)
+        let path = self.inode_path(ino)?;
+        if !path.ends_with('/') {
+            return Err(DatenLordError::InvalidArgument {
+                context: vec![format!("{path} is not a directory")],
+            });
+        }
+        let lister = self
+            .list(&path)
+            .await
+            .map_err(|e| opendal_error(e, format!("failed to open directory {path}")))?;
+
+        let fh = self.next_fh.fetch_add(1, Ordering::Relaxed);
+        self.inodes.read().unwrap().open(ino);
+        let dir = OpenDir { ino, path, lister, position: 0 };
+        self.dirs.write().unwrap().insert(fh, Arc::new(Mutex::new(dir)));
+        Ok(fh)
     }
 
-    async fn releasedir(&self, _ino: u64, _fh: u64, _flags: u32) -> DatenLordResult<()> {
-        Ok(())
+    async fn releasedir(&self, _ino: u64, fh: u64, _flags: u32) -> DatenLordResult<()> {
+        let dir = self.dirs.write().unwrap().remove(&fh);
+        match dir {
+            Some(dir) => {
+                let ino = dir.lock().await.ino;
+                self.inodes.read().unwrap().release(ino);
+                Ok(())
+            }
+            None => Err(DatenLordError::InvalidArgument {
+                context: vec![format!("invalid directory handle {fh}")],
+            }),
+        }
     }
 
     async fn fsyncdir(&self, _ino: u64, _fh: u64, _datasync: bool) -> DatenLordResult<()> {
         Ok(())
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn lookups_are_counted_until_forgotten() {
+        let mut table = InodeTable::new();
+        let ino = table.record("a".to_owned());
+        assert_eq!(table.record("a".to_owned()), ino);
+        table.forget(ino, 1);
+        assert_eq!(table.path(ino).as_deref(), Some("a"));
+        table.forget(ino, 1);
+        assert_eq!(table.path(ino), None);
+        table.forget(ROOT_ID, 1);
+        assert_eq!(table.path(ROOT_ID).as_deref(), Some(ROOT_PATH));
+    }
+
+    #[test]
+    fn idle_inodes_are_evicted_past_the_capacity() {
+        let mut table = InodeTable::new();
+        let open = table.record("open".to_owned());
+        table.open(open);
+        let idle = table.record("idle".to_owned());
+        // Nothing is evicted within the lease
+        table.evict();
+        assert_eq!(table.paths.len(), 3);
+
+        table.lease = Duration::ZERO;
+        table.evict_at = table.paths.len();
+        table.record("new".to_owned());
+        assert_eq!(table.path(idle), None);
+        assert_eq!(table.inodes.get("idle"), None);
+        assert_eq!(table.path(open).as_deref(), Some("open"));
+        assert_eq!(table.path(ROOT_ID).as_deref(), Some(ROOT_PATH));
+        assert_eq!(table.evict_at, INODE_TABLE_CAPACITY);
+
+        table.release(open);
+        table.evict();
+        assert_eq!(table.paths.len(), 1);
+    }
+}
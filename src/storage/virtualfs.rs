@@ -1,8 +1,9 @@
 //! The `FileSystem` trait
-use std::{path::Path, time::Duration};
+use std::{os::fd::RawFd, path::Path, time::Duration};
 
 use async_trait::async_trait;
 use bytes::BytesMut;
+use nix::sys::stat::SFlag;
 use serde_derive::{Serialize, Deserialize};
 use tracing::warn;
 
@@ -20,6 +21,54 @@ pub struct DirEntry {
     ino: INum,
     /// The name of the child
     name: String,
+    /// The file type of the child, the `S_IFMT` bits of its mode
+    kind: u32,
+    /// The attributes of the child and their TTL, when the listing has them
+    #[serde(skip)]
+    attr: Option<(Duration, FileAttr)>,
+}
+
+impl DirEntry {
+    /// Create a directory entry
+    pub fn new(ino: INum, name: String, kind: SFlag) -> Self {
+        Self {
+            ino,
+            name,
+            kind: kind.bits() as u32,
+            attr: None,
+        }
+    }
+
+    /// Create a directory entry along with the attributes of the child, as
+    /// if it was looked up
+    pub fn with_attr(name: String, ttl: Duration, attr: FileAttr) -> Self {
+        Self {
+            ino: attr.ino,
+            name,
+            kind: attr.kind.bits() as u32,
+            attr: Some((ttl, attr)),
+        }
+    }
+
+    /// The inode number of the child
+    pub fn ino(&self) -> INum {
+        self.ino
+    }
+
+    /// The name of the child
+    pub fn name(&self) -> &str {
+        &self.name
+    }
+
+    /// The file type of the child
+    pub fn kind(&self) -> SFlag {
+        SFlag::from_bits_truncate(self.kind as nix::libc::mode_t)
+    }
+
+    /// The attributes of the child and their TTL, if listed with it
+    pub fn attr(&self) -> Option<(Duration, FileAttr)> {
+        self.attr
+    }
 }
 
 /// Virtual filesystem trait
@@ -106,6 +155,16 @@ pub trait VirtualFs: Sync + Send {
     /// Rename a file
     async fn rename(&self, uid: u32, gid: u32, param: RenameParam) -> DatenLordResult<()>;
 
+    /// Copy the regular file `old_name` of `old_parent` to `new_name` of
+    /// `new_parent` within the backend, replacing the destination, without
+    /// moving the data through the caller. Return the attributes of the copy.
+    #[allow(unused_variables)]
+    async fn copy_file(&self, uid: u32, gid: u32, param: RenameParam) -> DatenLordResult<(Duration, FileAttr)> {
+        Err(DatenLordError::Unimplemented {
+            context: vec!["copy_file unimplemented".to_owned()],
+        })
+    }
+
     /// Create a hard link
     #[allow(unused_variables)]
     async fn link(&self, newparent: u64, newname: &str) -> DatenLordResult<()> {
@@ -157,7 +216,8 @@ pub trait VirtualFs: Sync + Send {
     /// Open a directory
     async fn opendir(&self, uid: u32, gid: u32, ino: u64, flags: u32) -> DatenLordResult<u64>;
 
-    /// Read directory
+    /// Read directory, return the entries from index `offset` on, an empty
+    /// result is the end of the directory
     async fn readdir(
         &self,
         uid: u32,
@@ -240,23 +300,42 @@ pub trait VirtualFs: Sync + Send {
     /// change the way the file is opened. See `fuse_file_info` structure in
     /// `fuse_common.h` for more details. If self method is not implemented
     /// or under Linux kernel versions earlier than 2.6.15, the mknod()
-    /// and open() methods will be called instead.
+    /// and open() methods will be called instead. Return the attributes of
+    /// the new file with its handle.
     #[allow(unused_variables)]
     async fn create(
         &self,
         uid: u32,
         gid: u32,
-        ino: u64,
         parent: u64,
         name: &str,
         mode: u32,
         flags: u32,
-    ) -> DatenLordResult<()> {
+    ) -> DatenLordResult<(Duration, FileAttr, u64)> {
         Err(DatenLordError::Unimplemented {
             context: vec!["create unimplemented".to_owned()],
         })
     }
 
+    /// Local path backing an inode, for backends stored on the local
+    /// filesystem, so that copies can stay in the kernel
+    #[allow(unused_variables)]
+    fn local_path(&self, ino: u64) -> Option<std::path::PathBuf> {
+        None
+    }
+
+    /// Share the registered buffers of the sdk, the memfd `fd` mapped at
+    /// `addr` for `len` bytes, so that reads and writes in them skip a copy
+    #[allow(unused_variables)]
+    async fn register_buffers(&self, fd: RawFd, addr: usize, len: usize) -> DatenLordResult<()> {
+        Ok(())
+    }
+
+    /// Stop using the registered buffers
+    async fn unregister_buffers(&self) -> DatenLordResult<()> {
+        Ok(())
+    }
+
     /// Test for a POSIX file lock
     #[allow(unused_variables)]
     async fn getlk(
@@ -0,0 +1,44 @@
+//! The metadata cache seen through the c sdk
+
+mod common;
+
+use common::{bytes, c, Sdk};
+use datenlord::sdk::c::datenlord::*;
+
+#[test]
+fn stat_after_write() {
+    let sdk = Sdk::local("attr-cache", "{}");
+    let mut stat = datenlord_file_stat::default();
+    assert_eq!(create_file(sdk.ptr, c("f.txt").as_ptr()), 0);
+    assert_eq!(datenlord_stat(sdk.ptr, c("f.txt").as_ptr(), &mut stat), 0);
+    assert_eq!(stat.size, 0);
+    // A write drops the cached attributes of the file
+    assert_eq!(write_file(sdk.ptr, c("f.txt").as_ptr(), bytes(b"abc")), 0);
+    assert_eq!(datenlord_stat(sdk.ptr, c("f.txt").as_ptr(), &mut stat), 0);
+    assert_eq!(stat.size, 3);
+    // And a removal its dentry
+    assert_eq!(datenlord_mkdir(sdk.ptr, c("d").as_ptr()), 0);
+    assert!(exists(sdk.ptr, c("d").as_ptr()));
+    assert_eq!(deldir(sdk.ptr, c("d").as_ptr(), false), 0);
+    assert!(!exists(sdk.ptr, c("d").as_ptr()));
+}
+
+#[test]
+fn missing_paths_are_cached() {
+    let sdk = Sdk::local("attr-cache-missing", "{}");
+    assert!(!exists(sdk.ptr, c("f.txt").as_ptr()));
+    // Created behind the sdk, still missing until the negative ttl expires
+    std::fs::write(sdk.root.join("f.txt"), b"abc").unwrap();
+    assert!(!exists(sdk.ptr, c("f.txt").as_ptr()));
+    std::thread::sleep(std::time::Duration::from_millis(1100));
+    assert!(exists(sdk.ptr, c("f.txt").as_ptr()));
+    // Creates of the sdk replace the negative entry
+    assert!(!exists(sdk.ptr, c("g.txt").as_ptr()));
+    assert_eq!(create_file(sdk.ptr, c("g.txt").as_ptr()), 0);
+    assert!(exists(sdk.ptr, c("g.txt").as_ptr()));
+
+    let sdk = Sdk::local("attr-cache-no-missing", r#"{"negative_ttl_ms": 0}"#);
+    assert!(!exists(sdk.ptr, c("f.txt").as_ptr()));
+    std::fs::write(sdk.root.join("f.txt"), b"abc").unwrap();
+    assert!(exists(sdk.ptr, c("f.txt").as_ptr()));
+}
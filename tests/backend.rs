@@ -0,0 +1,63 @@
+//! Backends selected by the init config
+
+mod common;
+
+use common::{bytes, c, out, Sdk, TempDir};
+use datenlord::sdk::c::datenlord::*;
+
+#[test]
+fn local_backend() {
+    let sdk = Sdk::local("backend-local", r#"{"blocking_threads": 4}"#);
+    assert!(exists(sdk.ptr, c("/").as_ptr()));
+    assert_eq!(create_file(sdk.ptr, c("a.txt").as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, c("a.txt").as_ptr(), bytes(b"local")), 0);
+    assert_eq!(std::fs::read(sdk.root.join("a.txt")).unwrap(), b"local");
+}
+
+#[test]
+fn memory_backend() {
+    let backend = serde_json::json!({ "type": "memory" });
+    let sdk = Sdk::with_backend(TempDir::new("backend-memory"), backend, "{}");
+    assert!(!exists(sdk.ptr, c("a.txt").as_ptr()));
+    assert_eq!(create_file(sdk.ptr, c("a.txt").as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, c("a.txt").as_ptr(), bytes(b"memory")), 0);
+    let mut buffer = [0; 16];
+    let mut content = out(&mut buffer);
+    assert_eq!(read_file(sdk.ptr, c("a.txt").as_ptr(), &mut content), 0);
+    assert_eq!(&buffer[..content.len], b"memory");
+}
+
+#[test]
+fn concurrent_rewrites() {
+    let backend = serde_json::json!({ "type": "memory" });
+    let sdk = Sdk::with_backend(TempDir::new("backend-rewrites"), backend, r#"{"worker_threads": 4}"#);
+    assert_eq!(create_file(sdk.ptr, c("f.bin").as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, c("f.bin").as_ptr(), bytes(&[0; 64])), 0);
+
+    // Positional writes rewrite the whole object, none of them is lost to another
+    let ptr = sdk.ptr as usize;
+    std::thread::scope(|scope| {
+        for i in 0..8u8 {
+            scope.spawn(move || {
+                let sdk = ptr as *mut datenlord_sdk;
+                let mut file: *mut datenlord_file = std::ptr::null_mut();
+                assert_eq!(datenlord_open(sdk, c("f.bin").as_ptr(), nix::libc::O_RDWR as u32, &mut file), 0);
+                for _ in 0..10 {
+                    assert_eq!(datenlord_pwrite(sdk, file, i as u64 * 8, bytes(&[i + 1; 8])), 0);
+                }
+                assert_eq!(datenlord_close(sdk, file), 0);
+            });
+        }
+    });
+    let mut buffer = [0; 64];
+    let mut content = out(&mut buffer);
+    assert_eq!(read_file(sdk.ptr, c("f.bin").as_ptr(), &mut content), 0);
+    let expected: Vec<u8> = (0..64).map(|i| i as u8 / 8 + 1).collect();
+    assert_eq!(&buffer[..content.len], &expected[..]);
+}
+
+#[test]
+fn unknown_backend() {
+    let sdk = init(c(r#"{"backend": {"type": "opendal", "scheme": "nope"}}"#).as_ptr());
+    assert!(sdk.is_null());
+}
@@ -0,0 +1,48 @@
+//! Batched stat and exists calls
+
+mod common;
+
+use common::{c, Sdk};
+use datenlord::sdk::c::datenlord::*;
+
+#[test]
+fn stat_many() {
+    let sdk = Sdk::local("batch", "{}");
+    std::fs::write(sdk.root.join("one.txt"), b"1").unwrap();
+    std::fs::write(sdk.root.join("two.txt"), b"22").unwrap();
+    let names = [c("one.txt"), c("missing.txt"), c("two.txt")];
+    let paths: Vec<_> = names.iter().map(|name| name.as_ptr()).collect();
+
+    let mut stats: Vec<datenlord_file_stat> = (0..3).map(|_| Default::default()).collect();
+    let mut errs = vec![0; 3];
+    assert_eq!(datenlord_stat_batch(sdk.ptr, paths.as_ptr(), 3, stats.as_mut_ptr(), errs.as_mut_ptr()), 0);
+    assert_eq!((stats[0].size, stats[1].size, stats[2].size), (1, 0, 2));
+    assert_eq!(errs, [0, nix::libc::ENOENT, 0]);
+    // Without errs any failure fails the call
+    let err = datenlord_stat_batch(sdk.ptr, paths.as_ptr(), 3, stats.as_mut_ptr(), std::ptr::null_mut());
+    assert_eq!(err, nix::libc::ENOENT);
+
+    let mut exist = vec![false; 3];
+    assert_eq!(datenlord_exists_batch(sdk.ptr, paths.as_ptr(), 3, exist.as_mut_ptr()), 0);
+    assert_eq!(exist, [true, false, true]);
+}
+
+#[test]
+fn stat_more_paths_than_in_flight() {
+    let sdk = Sdk::local("batch-large", "{}");
+    let names: Vec<_> = (0..1000).map(|i| c(&format!("f{i}"))).collect();
+    for i in (0..1000).step_by(2) {
+        std::fs::write(sdk.root.join(&format!("f{i}")), vec![0; i]).unwrap();
+    }
+    let paths: Vec<_> = names.iter().map(|name| name.as_ptr()).collect();
+    let mut stats: Vec<datenlord_file_stat> = (0..1000).map(|_| Default::default()).collect();
+    let mut errs = vec![0; 1000];
+    assert_eq!(datenlord_stat_batch(sdk.ptr, paths.as_ptr(), 1000, stats.as_mut_ptr(), errs.as_mut_ptr()), 0);
+    for i in 0..1000 {
+        if i % 2 == 0 {
+            assert_eq!((errs[i], stats[i].size), (0, i as u64));
+        } else {
+            assert_eq!(errs[i], nix::libc::ENOENT);
+        }
+    }
+}
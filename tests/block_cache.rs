@@ -0,0 +1,31 @@
+//! Reads through the block cache
+
+mod common;
+
+use common::{bytes, c, out, pattern, Sdk};
+use datenlord::sdk::c::datenlord::*;
+
+#[test]
+fn cached_reads() {
+    let sdk = Sdk::local("block-cache", r#"{"block_cache_bytes": 65536, "block_size": 4096}"#);
+    let path = c("f");
+    let data = pattern(10000);
+    assert_eq!(create_file(sdk.ptr, path.as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, path.as_ptr(), bytes(&data)), 0);
+    let mut buffer = vec![0; 20000];
+    for _ in 0..3 {
+        let mut content = out(&mut buffer);
+        assert_eq!(read_file(sdk.ptr, path.as_ptr(), &mut content), 0);
+        assert_eq!(&buffer[..content.len], &data[..]);
+    }
+    let mut stats = datenlord_cache_stats::default();
+    assert_eq!(datenlord_get_cache_stats(sdk.ptr, &mut stats), 0);
+    assert!(stats.hits >= 6, "{} hits, {} misses", stats.hits, stats.misses);
+
+    // A write drops the cached blocks
+    let data = vec![7; 5000];
+    assert_eq!(write_file(sdk.ptr, path.as_ptr(), bytes(&data)), 0);
+    let mut content = out(&mut buffer);
+    assert_eq!(read_file(sdk.ptr, path.as_ptr(), &mut content), 0);
+    assert_eq!(&buffer[..content.len], &data[..]);
+}
@@ -0,0 +1,79 @@
+//! Reads and writes through registered buffers
+
+mod common;
+
+use common::{bytes, c, out, pattern, Sdk, TempDir};
+use datenlord::sdk::c::datenlord::*;
+use nix::libc;
+
+fn exercise(sdk: &Sdk, name: &str) {
+    let path = c(name);
+    let data = pattern(3_000_000);
+    assert_eq!(create_file(sdk.ptr, path.as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, path.as_ptr(), bytes(&data)), 0);
+    let mut buffers = [
+        datenlord_bytes {
+            data: std::ptr::null(),
+            len: 4096,
+        },
+        datenlord_bytes {
+            data: std::ptr::null(),
+            len: 3 * 1024 * 1024,
+        },
+    ];
+    assert_eq!(datenlord_register_buffers(sdk.ptr, buffers.as_mut_ptr(), 2), 0);
+    assert!(!buffers[0].data.is_null());
+    // Large buffers are aligned to huge pages
+    assert_eq!(buffers[1].data as usize % (2 * 1024 * 1024), 0);
+    let mut again = [datenlord_bytes {
+        data: std::ptr::null(),
+        len: 10,
+    }];
+    assert_eq!(datenlord_register_buffers(sdk.ptr, again.as_mut_ptr(), 1), libc::EEXIST);
+
+    let mut read = 0;
+    assert_eq!(datenlord_read_file_fixed(sdk.ptr, path.as_ptr(), 0, 1, &mut read), 0);
+    assert_eq!(read, data.len());
+    assert_eq!(unsafe { std::slice::from_raw_parts(buffers[1].data, read) }, &data[..]);
+
+    let mut file = std::ptr::null_mut();
+    assert_eq!(datenlord_open(sdk.ptr, path.as_ptr(), libc::O_RDWR as u32, &mut file), 0);
+    assert_eq!(datenlord_pread_fixed(sdk.ptr, file, 1000, 0, 96, 100, &mut read), 0);
+    assert_eq!(read, 100);
+    let small = unsafe { std::slice::from_raw_parts_mut(buffers[0].data.cast_mut(), 4096) };
+    assert_eq!(&small[96..196], &data[1000..1100]);
+    // Out of the buffer, or of the registered ones
+    assert_eq!(datenlord_pread_fixed(sdk.ptr, file, 0, 0, 4000, 200, &mut read), libc::EINVAL);
+    assert_eq!(datenlord_pread_fixed(sdk.ptr, file, 0, 5, 0, 0, &mut read), libc::EINVAL);
+    small[..16].fill(b'Z');
+    assert_eq!(datenlord_pwrite_fixed(sdk.ptr, file, 10, 0, 0, 16), 0);
+    assert_eq!(datenlord_close(sdk.ptr, file), 0);
+
+    let mut buffer = [0; 40];
+    let mut content = out(&mut buffer);
+    assert_eq!(read_file(sdk.ptr, path.as_ptr(), &mut content), 0);
+    assert_eq!(&buffer[..10], &data[..10]);
+    assert_eq!(&buffer[10..26], &[b'Z'; 16]);
+
+    assert_eq!(datenlord_unregister_buffers(sdk.ptr), 0);
+    assert_eq!(datenlord_read_file_fixed(sdk.ptr, path.as_ptr(), 0, 1, &mut read), libc::EINVAL);
+    assert_eq!(datenlord_unregister_buffers(sdk.ptr), libc::EINVAL);
+}
+
+#[test]
+fn local_buffers() {
+    exercise(&Sdk::local("buffers", "{}"), "f");
+}
+
+#[test]
+fn daemon_buffers() {
+    let server = Sdk::local("buffers-daemon", r#"{"daemon_slot_bytes": 8192}"#);
+    let socket = server.root.join("daemon.sock").display().to_string();
+    assert_eq!(datenlord_serve(server.ptr, c(&socket).as_ptr()), 0);
+    let backend = serde_json::json!({ "type": "daemon", "socket": socket });
+    let client = Sdk::with_backend(TempDir::new("buffers-client"), backend, "{}");
+    exercise(&client, "f");
+    // The buffers registered again are shared with the daemon again
+    exercise(&client, "g");
+    assert_eq!(std::fs::read(server.root.join("g")).unwrap().len(), 3_000_000);
+}
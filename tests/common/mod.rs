@@ -0,0 +1,101 @@
+//! Helpers shared by the integration tests
+
+#![allow(dead_code)]
+
+use std::ffi::CString;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use datenlord::sdk::c::datenlord::{datenlord_bytes, datenlord_sdk, free_sdk, init};
+
+/// A C string of a path or config
+pub fn c(s: &str) -> CString {
+    CString::new(s).unwrap()
+}
+
+/// The bytes of a slice, to pass to the sdk
+pub fn bytes(data: &[u8]) -> datenlord_bytes {
+    datenlord_bytes {
+        data: data.as_ptr(),
+        len: data.len(),
+    }
+}
+
+/// A buffer for the sdk to read into
+pub fn out(buffer: &mut [u8]) -> datenlord_bytes {
+    datenlord_bytes {
+        data: buffer.as_mut_ptr(),
+        len: buffer.len(),
+    }
+}
+
+/// Content whose period divides no block size, so misplaced blocks show
+pub fn pattern(len: usize) -> Vec<u8> {
+    (0..len).map(|i| (i % 251) as u8).collect()
+}
+
+/// A new local directory, removed with everything below it on drop
+pub struct TempDir(PathBuf);
+
+impl TempDir {
+    pub fn new(name: &str) -> Self {
+        static NEXT: AtomicUsize = AtomicUsize::new(0);
+        let dir = std::env::temp_dir().join(format!(
+            "datenlord-test-{name}-{}-{}",
+            std::process::id(),
+            NEXT.fetch_add(1, Ordering::Relaxed)
+        ));
+        std::fs::create_dir_all(&dir).unwrap();
+        Self(dir)
+    }
+
+    pub fn path(&self) -> &Path {
+        &self.0
+    }
+
+    pub fn join(&self, path: &str) -> PathBuf {
+        self.0.join(path)
+    }
+
+    pub fn display(&self) -> String {
+        self.0.display().to_string()
+    }
+}
+
+impl Drop for TempDir {
+    fn drop(&mut self) {
+        let _ = std::fs::remove_dir_all(&self.0);
+    }
+}
+
+/// An sdk instance, freed on drop
+pub struct Sdk {
+    pub ptr: *mut datenlord_sdk,
+    /// The local directory of a local backend
+    pub root: TempDir,
+}
+
+impl Sdk {
+    /// An sdk on a local directory of its own, `config` is a json object with
+    /// the other entries of the sdk config
+    pub fn local(name: &str, config: &str) -> Self {
+        let root = TempDir::new(name);
+        let backend = serde_json::json!({ "type": "local", "root": root.display() });
+        Self::with_backend(root, backend, config)
+    }
+
+    /// An sdk on `backend`, `root` is only removed on drop
+    pub fn with_backend(root: TempDir, backend: serde_json::Value, config: &str) -> Self {
+        let mut config: serde_json::Value = serde_json::from_str(config).unwrap();
+        config["backend"] = backend;
+        let ptr = init(c(&config.to_string()).as_ptr());
+        assert!(!ptr.is_null(), "failed to init the sdk with {config}");
+        Self { ptr, root }
+    }
+}
+
+impl Drop for Sdk {
+    fn drop(&mut self) {
+        free_sdk(self.ptr);
+    }
+}
@@ -0,0 +1,45 @@
+//! Streaming copies between local files and the sdk
+
+mod common;
+
+use common::{c, pattern, Sdk, TempDir};
+use datenlord::sdk::c::datenlord::*;
+
+#[test]
+fn copy_roundtrip() {
+    let sdk = Sdk::local("copy", r#"{"copy_chunk_size": 65536, "copy_queue_depth": 3}"#);
+    let local = TempDir::new("copy-local");
+    let data = pattern(3 * 1024 * 1024 + 17);
+    let src = local.join("src.bin");
+    let back = local.join("back.bin");
+    std::fs::write(&src, &data).unwrap();
+
+    let src = c(src.to_str().unwrap());
+    assert_eq!(copy_from_local_file(sdk.ptr, false, src.as_ptr(), c("dest.bin").as_ptr()), 0);
+    assert_eq!(copy_from_local_file(sdk.ptr, false, src.as_ptr(), c("dest.bin").as_ptr()), nix::libc::EEXIST);
+    assert_eq!(copy_from_local_file(sdk.ptr, true, src.as_ptr(), c("dest.bin").as_ptr()), 0);
+    assert_eq!(copy_from_local_file(sdk.ptr, true, src.as_ptr(), c("missing/dest.bin").as_ptr()), nix::libc::ENOENT);
+    assert_eq!(copy_to_local_file(sdk.ptr, c("dest.bin").as_ptr(), c(back.to_str().unwrap()).as_ptr()), 0);
+    assert_eq!(std::fs::read(&back).unwrap(), data);
+}
+
+#[test]
+fn copy_in_chunks_to_a_remote_backend() {
+    let sdk = Sdk::with_backend(
+        TempDir::new("copy-memory"),
+        serde_json::json!({ "type": "memory" }),
+        r#"{"copy_chunk_size": 65536, "copy_queue_depth": 8}"#,
+    );
+    let local = TempDir::new("copy-memory-local");
+    let src = local.join("src.bin");
+    let back = local.join("back.bin");
+    let (src_path, back_path) = (c(src.to_str().unwrap()), c(back.to_str().unwrap()));
+
+    // Many chunks with a short last one, an empty file and one below a chunk
+    for data in [pattern(5 * 1024 * 1024 + 4093), Vec::new(), b"hello".to_vec()] {
+        std::fs::write(&src, &data).unwrap();
+        assert_eq!(copy_from_local_file(sdk.ptr, true, src_path.as_ptr(), c("dest.bin").as_ptr()), 0);
+        assert_eq!(copy_to_local_file(sdk.ptr, c("dest.bin").as_ptr(), back_path.as_ptr()), 0);
+        assert_eq!(std::fs::read(&back).unwrap(), data);
+    }
+}
@@ -0,0 +1,96 @@
+//! Files created, opened and written in one call
+
+mod common;
+
+use common::{bytes, c, out, Sdk, TempDir};
+use datenlord::sdk::c::datenlord::*;
+use nix::libc::{EEXIST, O_CREAT, O_EXCL, O_RDWR, O_TRUNC, O_WRONLY};
+
+/// Read a whole file through the sdk
+fn read(sdk: &Sdk, path: &str) -> Vec<u8> {
+    let mut buffer = vec![0; 100];
+    let mut content = out(&mut buffer);
+    assert_eq!(read_file(sdk.ptr, c(path).as_ptr(), &mut content), 0);
+    buffer.truncate(content.len);
+    buffer
+}
+
+fn check(sdk: &Sdk) {
+    let data = b"some content here";
+    assert_eq!(datenlord_put(sdk.ptr, c("a").as_ptr(), bytes(data)), 0);
+    assert_eq!(read(sdk, "a"), data);
+    // A put replaces the whole file
+    assert_eq!(datenlord_put(sdk.ptr, c("a").as_ptr(), bytes(&data[..4])), 0);
+    assert_eq!(read(sdk, "a"), b"some");
+    let mut stat = datenlord_file_stat::default();
+    assert_eq!(datenlord_stat(sdk.ptr, c("a").as_ptr(), &mut stat), 0);
+    assert_eq!(stat.size, 4);
+    assert_eq!(datenlord_put(sdk.ptr, c("empty").as_ptr(), bytes(&[])), 0);
+    assert_eq!(read(sdk, "empty"), b"");
+
+    let flags = |flags: i32| flags as u32;
+    let mut file = std::ptr::null_mut();
+    let exclusive = flags(O_WRONLY | O_CREAT | O_EXCL);
+    assert_eq!(datenlord_create_open(sdk.ptr, c("a").as_ptr(), 0o644, exclusive, &mut file, &mut stat), EEXIST);
+    // A new file streamed
+    let mut stat = datenlord_file_stat::default();
+    let streamed = flags(O_WRONLY | O_CREAT | O_EXCL | O_TRUNC);
+    assert_eq!(datenlord_create_open(sdk.ptr, c("b").as_ptr(), 0o644, streamed, &mut file, &mut stat), 0);
+    assert_eq!(stat.size, 0);
+    assert_ne!(stat.ino, 0);
+    assert_eq!(datenlord_pwrite(sdk.ptr, file, 0, bytes(data)), 0);
+    assert_eq!(datenlord_close(sdk.ptr, file), 0);
+    assert_eq!(read(sdk, "b"), data);
+    // Positional writes into a new file
+    let positional = flags(O_RDWR | O_CREAT);
+    assert_eq!(datenlord_create_open(sdk.ptr, c("c").as_ptr(), 0o644, positional, &mut file, std::ptr::null_mut()), 0);
+    assert_eq!(datenlord_pwrite(sdk.ptr, file, 3, bytes(&data[..4])), 0);
+    assert_eq!(datenlord_close(sdk.ptr, file), 0);
+    assert_eq!(read(sdk, "c"), b"\0\0\0some");
+    // An existing file is opened without O_EXCL
+    let open = flags(O_WRONLY | O_CREAT);
+    assert_eq!(datenlord_create_open(sdk.ptr, c("b").as_ptr(), 0o644, open, &mut file, &mut stat), 0);
+    assert_eq!(stat.size, data.len() as u64);
+    assert_eq!(datenlord_close(sdk.ptr, file), 0);
+    // And emptied by O_TRUNC
+    let truncate = flags(O_WRONLY | O_CREAT | O_TRUNC);
+    assert_eq!(datenlord_create_open(sdk.ptr, c("b").as_ptr(), 0o644, truncate, &mut file, &mut stat), 0);
+    assert_eq!(stat.size, 0);
+    assert_eq!(datenlord_close(sdk.ptr, file), 0);
+    assert_eq!(read(sdk, "b"), b"");
+}
+
+#[test]
+fn create_and_put_local_files() {
+    let sdk = Sdk::local("create", "{}");
+    check(&sdk);
+    assert_eq!(std::fs::read(sdk.root.join("b")).unwrap(), b"");
+    assert_eq!(std::fs::read(sdk.root.join("c")).unwrap(), b"\0\0\0some");
+
+    // A streamed file is there before its writer is closed
+    let flags = (O_WRONLY | O_CREAT | O_EXCL | O_TRUNC) as u32;
+    let mut file = std::ptr::null_mut();
+    assert_eq!(datenlord_create_open(sdk.ptr, c("d").as_ptr(), 0o644, flags, &mut file, std::ptr::null_mut()), 0);
+    assert_eq!(std::fs::read(sdk.root.join("d")).unwrap(), b"");
+    assert_eq!(datenlord_pwrite(sdk.ptr, file, 0, bytes(b"streamed")), 0);
+    assert_eq!(datenlord_close(sdk.ptr, file), 0);
+    assert_eq!(std::fs::read(sdk.root.join("d")).unwrap(), b"streamed");
+    // Created exclusively, even when the sdk still has it cached as missing
+    assert!(!exists(sdk.ptr, c("e").as_ptr()));
+    std::fs::write(sdk.root.join("e"), b"behind the sdk").unwrap();
+    assert_eq!(datenlord_create_open(sdk.ptr, c("e").as_ptr(), 0o644, flags, &mut file, std::ptr::null_mut()), EEXIST);
+    assert_eq!(std::fs::read(sdk.root.join("e")).unwrap(), b"behind the sdk");
+}
+
+#[test]
+fn create_and_put_remote_files() {
+    let backend = serde_json::json!({ "type": "memory" });
+    check(&Sdk::with_backend(TempDir::new("create-memory"), backend, "{}"));
+}
+
+#[test]
+fn create_and_put_inline_files() {
+    let sdk = Sdk::local("create-inline", r#"{"inline_data_bytes": 4096}"#);
+    check(&sdk);
+    assert_eq!(std::fs::read(sdk.root.join("a")).unwrap(), b"some");
+}
@@ -0,0 +1,99 @@
+//! Clients of an sdk daemon over the shared memory ring
+
+mod common;
+
+use common::{bytes, c, out, pattern, Sdk, TempDir};
+use datenlord::sdk::c::datenlord::*;
+use datenlord::sdk::c::error::datenlord_last_error_message;
+use nix::libc;
+
+/// A daemon on a local directory with small slots, so large calls are split
+fn serve(name: &str) -> (Sdk, serde_json::Value) {
+    let server = Sdk::local(name, r#"{"daemon_slots": 3, "daemon_slot_bytes": 4096}"#);
+    let socket = server.root.join("daemon.sock");
+    assert_eq!(datenlord_serve(server.ptr, c(&socket.display().to_string()).as_ptr()), 0);
+    let backend = serde_json::json!({ "type": "daemon", "socket": socket.display().to_string() });
+    (server, backend)
+}
+
+fn client(name: &str, backend: &serde_json::Value) -> Sdk {
+    Sdk::with_backend(TempDir::new(name), backend.clone(), r#"{"attr_cache_entries": 0}"#)
+}
+
+#[test]
+fn daemon_roundtrip() {
+    let (server, backend) = serve("daemon");
+    let client = client("daemon-client", &backend);
+    let data = pattern(50000);
+    assert_eq!(datenlord_mkdir(client.ptr, c("d").as_ptr()), 0);
+    assert_eq!(create_file(client.ptr, c("d/f").as_ptr()), 0);
+    assert_eq!(write_file(client.ptr, c("d/f").as_ptr(), bytes(&data)), 0);
+    assert_eq!(std::fs::read(server.root.join("d/f")).unwrap(), data);
+    let mut buffer = vec![0; 60000];
+    let mut content = out(&mut buffer);
+    assert_eq!(read_file(client.ptr, c("d/f").as_ptr(), &mut content), 0);
+    assert_eq!(&buffer[..content.len], &data[..]);
+
+    let mut stat = datenlord_file_stat::default();
+    assert_eq!(datenlord_stat(client.ptr, c("d/f").as_ptr(), &mut stat), 0);
+    assert_eq!(stat.size, 50000);
+    // The errors of the daemon come back with their message
+    assert_eq!(datenlord_stat(client.ptr, c("d/missing").as_ptr(), &mut stat), libc::ENOENT);
+    let message = unsafe { std::ffi::CStr::from_ptr(datenlord_last_error_message()) };
+    assert!(message.to_string_lossy().contains("daemon"), "{message:?}");
+
+    for i in 0..40 {
+        std::fs::write(server.root.join(&format!("d/e{i:03}")), b"x").unwrap();
+    }
+    let mut dir = std::ptr::null_mut();
+    assert_eq!(datenlord_opendir(client.ptr, c("d").as_ptr(), false, &mut dir), 0);
+    let mut page: Vec<datenlord_dirent> = (0..8).map(|_| unsafe { std::mem::zeroed() }).collect();
+    let mut total = 0;
+    loop {
+        let mut n = 0;
+        assert_eq!(datenlord_readdir_next(client.ptr, dir, page.as_mut_ptr(), 8, &mut n), 0);
+        if n == 0 {
+            break;
+        }
+        total += n;
+    }
+    assert_eq!(total, 41);
+    assert_eq!(datenlord_closedir(client.ptr, dir), 0);
+    assert_eq!(rename_path(client.ptr, c("d/f").as_ptr(), c("d/g").as_ptr()), 0);
+    assert!(exists(client.ptr, c("d/g").as_ptr()));
+}
+
+#[test]
+fn concurrent_calls_and_clients() {
+    let (server, backend) = serve("daemon-concurrent");
+    let data = pattern(50000);
+    std::fs::write(server.root.join("f"), &data).unwrap();
+    let first = client("daemon-concurrent-first", &backend);
+    // More threads than slots
+    let sdk = first.ptr as usize;
+    let threads: Vec<_> = (0..8)
+        .map(|thread: u64| {
+            let data = data.clone();
+            std::thread::spawn(move || {
+                for k in 0..20 {
+                    let offset = ((thread * 997 + k * 131) % 45000) as usize;
+                    let mut buffer = vec![0; 5000];
+                    let mut read = out(&mut buffer);
+                    assert_eq!(read_file_at(sdk as *mut datenlord_sdk, c("f").as_ptr(), offset as u64, &mut read), 0);
+                    assert_eq!(&buffer[..read.len], &data[offset..offset + 5000]);
+                }
+            })
+        })
+        .collect();
+    for thread in threads {
+        thread.join().unwrap();
+    }
+
+    let other = client("daemon-concurrent-other", &backend);
+    assert!(exists(other.ptr, c("f").as_ptr()));
+    drop(other);
+    drop(first);
+    // The daemon keeps serving new clients after others left
+    let last = client("daemon-concurrent-last", &backend);
+    assert!(exists(last.ptr, c("f").as_ptr()));
+}
@@ -0,0 +1,57 @@
+//! Listing directories in pages, with and without the attributes
+
+mod common;
+
+use common::{c, out, Sdk};
+use datenlord::sdk::c::datenlord::*;
+
+#[test]
+fn list_dir() {
+    let sdk = Sdk::local("dir", "{}");
+    std::fs::create_dir(sdk.root.join("list")).unwrap();
+    for i in 0..2500 {
+        std::fs::write(sdk.root.join(&format!("list/f{i}")), b"x").unwrap();
+    }
+    assert_eq!(datenlord_mkdir(sdk.ptr, c("list/sub").as_ptr()), 0);
+
+    for plus in [false, true] {
+        let mut dir: *mut datenlord_dir = std::ptr::null_mut();
+        assert_eq!(datenlord_opendir(sdk.ptr, c("list").as_ptr(), plus, &mut dir), 0);
+        let mut page: Vec<datenlord_dirent> = (0..300).map(|_| unsafe { std::mem::zeroed() }).collect();
+        // No room for entries reads none, without a buffer
+        let mut n = 1;
+        assert_eq!(datenlord_readdir_next(sdk.ptr, dir, std::ptr::null_mut(), 0, &mut n), 0);
+        assert_eq!(n, 0);
+        let (mut total, mut dirs, mut stats) = (0, 0, 0);
+        loop {
+            let mut n = 0;
+            assert_eq!(datenlord_readdir_next(sdk.ptr, dir, page.as_mut_ptr(), 300, &mut n), 0);
+            if n == 0 {
+                break;
+            }
+            for entry in &page[..n] {
+                if entry.kind == 0o040000 {
+                    dirs += 1;
+                }
+                if entry.has_stat {
+                    stats += 1;
+                    assert!(entry.kind != 0o100000 || entry.stat.size == 1);
+                }
+            }
+            total += n;
+        }
+        assert_eq!((total, dirs), (2501, 1));
+        assert_eq!(stats, if plus { 2501 } else { 0 });
+        assert_eq!(datenlord_closedir(sdk.ptr, dir), 0);
+    }
+
+    // The attributes came with the listing, the entries were not looked up
+    let mut stat = datenlord_file_stat::default();
+    assert_eq!(datenlord_stat(sdk.ptr, c("list/f7").as_ptr(), &mut stat), 0);
+    assert_eq!(stat.size, 1);
+    let mut storage = vec![0; 1 << 16];
+    let mut buffer = out(&mut storage);
+    assert_eq!(datenlord_metrics_snapshot(sdk.ptr, &mut buffer), 0);
+    let snapshot: serde_json::Value = serde_json::from_slice(&storage[..buffer.len]).unwrap();
+    assert!(snapshot["ops"]["lookup"]["calls"].as_u64().unwrap_or(0) < 10, "{}", snapshot["ops"]["lookup"]);
+}
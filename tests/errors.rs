@@ -0,0 +1,44 @@
+//! Error codes and the message of the last failed call
+
+mod common;
+
+use std::ffi::CStr;
+
+use common::{c, Sdk};
+use datenlord::sdk::c::datenlord::*;
+use datenlord::sdk::c::error::datenlord_last_error_message;
+use nix::libc;
+
+/// The message of the last failed call of this thread
+fn last_error() -> Option<String> {
+    let message = datenlord_last_error_message();
+    (!message.is_null()).then(|| unsafe { CStr::from_ptr(message) }.to_string_lossy().into_owned())
+}
+
+#[test]
+fn messages_of_failed_calls() {
+    let sdk = Sdk::local("errors", "{}");
+    let mut stat = datenlord_file_stat::default();
+    assert_eq!(datenlord_stat(sdk.ptr, c("missing.txt").as_ptr(), &mut stat), libc::ENOENT);
+    let message = last_error().unwrap();
+    assert!(message.contains("missing.txt"), "{message}");
+    // Again from the negative entry of the metadata cache
+    assert_eq!(datenlord_stat(sdk.ptr, c("missing.txt").as_ptr(), &mut stat), libc::ENOENT);
+    let message = last_error().unwrap();
+    assert!(message.contains("missing.txt"), "{message}");
+
+    assert_eq!(datenlord_stat(sdk.ptr, std::ptr::null(), &mut stat), libc::EINVAL);
+    assert_eq!(last_error().as_deref(), Some("Invalid arguments"));
+    // A successful call keeps the message
+    assert_eq!(datenlord_mkdir(sdk.ptr, c("dir").as_ptr()), 0);
+    assert_eq!(last_error().as_deref(), Some("Invalid arguments"));
+    assert_eq!(datenlord_mkdir(sdk.ptr, c("dir").as_ptr()), libc::EEXIST);
+}
+
+#[test]
+fn messages_are_per_thread() {
+    let sdk = Sdk::local("errors-thread", "{}");
+    assert_eq!(datenlord_stat(sdk.ptr, std::ptr::null(), std::ptr::null_mut()), libc::EINVAL);
+    assert!(std::thread::spawn(last_error).join().unwrap().is_none());
+    assert!(last_error().is_some());
+}
@@ -0,0 +1,90 @@
+//! Open files and positional I/O through the c sdk
+
+mod common;
+
+use common::{bytes, c, out, Sdk};
+use datenlord::sdk::c::datenlord::*;
+
+#[test]
+fn pread_pwrite() {
+    let sdk = Sdk::local("handles", r#"{"worker_threads": 2}"#);
+    assert_eq!(create_file(sdk.ptr, c("f.txt").as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, c("f.txt").as_ptr(), bytes(b"hello world")), 0);
+
+    let mut file: *mut datenlord_file = std::ptr::null_mut();
+    assert_eq!(datenlord_open(sdk.ptr, c("f.txt").as_ptr(), nix::libc::O_RDWR as u32, &mut file), 0);
+    assert_eq!(datenlord_pwrite(sdk.ptr, file, 6, bytes(b"WORLD")), 0);
+    let mut buffer = [0; 16];
+    let mut content = out(&mut buffer[..5]);
+    assert_eq!(datenlord_pread(sdk.ptr, file, 6, &mut content), 0);
+    assert_eq!(&buffer[..content.len], b"WORLD");
+    // Past the end of file
+    let mut content = out(&mut buffer);
+    assert_eq!(datenlord_pread(sdk.ptr, file, 100, &mut content), 0);
+    assert_eq!(content.len, 0);
+    assert_eq!(datenlord_close(sdk.ptr, file), 0);
+
+    assert_eq!(std::fs::read(sdk.root.join("f.txt")).unwrap(), b"hello WORLD");
+    assert!(exists(sdk.ptr, c("f.txt").as_ptr()));
+    assert!(!exists(sdk.ptr, c("missing.txt").as_ptr()));
+    assert_eq!(datenlord_open(sdk.ptr, c("missing.txt").as_ptr(), 0, &mut file), nix::libc::ENOENT);
+}
+
+#[test]
+fn empty_buffers() {
+    let sdk = Sdk::local("empty-buffers", "{}");
+    let empty = datenlord_bytes {
+        data: std::ptr::null(),
+        len: 0,
+    };
+    assert_eq!(create_file(sdk.ptr, c("f.txt").as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, c("f.txt").as_ptr(), empty), 0);
+    assert_eq!(std::fs::read(sdk.root.join("f.txt")).unwrap(), b"");
+
+    let mut file: *mut datenlord_file = std::ptr::null_mut();
+    assert_eq!(datenlord_open(sdk.ptr, c("f.txt").as_ptr(), nix::libc::O_RDWR as u32, &mut file), 0);
+    let empty = datenlord_bytes {
+        data: std::ptr::null(),
+        len: 0,
+    };
+    assert_eq!(datenlord_pwrite(sdk.ptr, file, 0, empty), 0);
+    let mut read = datenlord_bytes {
+        data: std::ptr::null(),
+        len: 0,
+    };
+    assert_eq!(datenlord_pread(sdk.ptr, file, 0, &mut read), 0);
+    assert_eq!(read.len, 0);
+    // A null buffer with a length is rejected
+    let dangling = datenlord_bytes {
+        data: std::ptr::null(),
+        len: 4,
+    };
+    assert_eq!(datenlord_pwrite(sdk.ptr, file, 0, dangling), nix::libc::EINVAL);
+    assert_eq!(datenlord_close(sdk.ptr, file), 0);
+}
+
+extern "C" fn alloc_vec(ctx: *mut std::ffi::c_void, size: usize) -> *mut u8 {
+    let vec = unsafe { &mut *(ctx as *mut Vec<u8>) };
+    vec.resize(size, 0);
+    vec.as_mut_ptr()
+}
+
+#[test]
+fn read_into_caller_buffers() {
+    let sdk = Sdk::local("read-alloc", "{}");
+    std::fs::write(sdk.root.join("f.txt"), b"0123456789").unwrap();
+    let mut vec: Vec<u8> = Vec::new();
+    let mut content = datenlord_bytes {
+        data: std::ptr::null(),
+        len: 0,
+    };
+    let ctx = &mut vec as *mut Vec<u8> as *mut std::ffi::c_void;
+    assert_eq!(read_file_alloc(sdk.ptr, c("f.txt").as_ptr(), alloc_vec, ctx, &mut content), 0);
+    assert_eq!(content.len, 10);
+    assert_eq!(vec, b"0123456789");
+
+    let mut buffer = [0; 4];
+    let mut content = out(&mut buffer);
+    assert_eq!(read_file_at(sdk.ptr, c("f.txt").as_ptr(), 8, &mut content), 0);
+    assert_eq!(&buffer[..content.len], b"89");
+}
@@ -0,0 +1,41 @@
+//! Small files served from the content cached with their attributes
+
+mod common;
+
+use common::{bytes, c, out, Sdk};
+use datenlord::sdk::c::datenlord::*;
+
+fn read(sdk: &Sdk, path: &str, offset: u64) -> Vec<u8> {
+    let mut buffer = vec![0; 100];
+    let mut content = out(&mut buffer);
+    assert_eq!(read_file_at(sdk.ptr, c(path).as_ptr(), offset, &mut content), 0);
+    buffer.truncate(content.len);
+    buffer
+}
+
+#[test]
+fn inline_small_files() {
+    let sdk = Sdk::local("inline", r#"{"inline_data_bytes": 64}"#);
+    assert_eq!(create_file(sdk.ptr, c("small").as_ptr()), 0);
+    assert_eq!(create_file(sdk.ptr, c("big").as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, c("small").as_ptr(), bytes(b"hello world")), 0);
+    assert_eq!(write_file(sdk.ptr, c("big").as_ptr(), bytes(&[7; 80])), 0);
+    // Changed behind the sdk, the inline content is served until its ttl expires
+    std::fs::write(sdk.root.join("small"), b"HELLO WORLD").unwrap();
+    std::fs::write(sdk.root.join("big"), [8; 80]).unwrap();
+    assert_eq!(read(&sdk, "small", 0), b"hello world");
+    assert_eq!(read(&sdk, "small", 6), b"world");
+    assert_eq!(read(&sdk, "small", 50), b"");
+    assert_eq!(read(&sdk, "big", 0), [8; 80]);
+    // A write through the sdk replaces it
+    assert_eq!(write_file(sdk.ptr, c("small").as_ptr(), bytes(b"bye")), 0);
+    assert_eq!(read(&sdk, "small", 0), b"bye");
+
+    // Filled by a whole read
+    std::fs::write(sdk.root.join("read"), b"first").unwrap();
+    assert_eq!(read(&sdk, "read", 0), b"first");
+    std::fs::write(sdk.root.join("read"), b"again").unwrap();
+    assert_eq!(read(&sdk, "read", 0), b"first");
+    std::thread::sleep(std::time::Duration::from_millis(1100));
+    assert_eq!(read(&sdk, "read", 0), b"again");
+}
@@ -0,0 +1,69 @@
+//! Metrics snapshots and the Prometheus endpoint
+
+mod common;
+
+use std::io::{Read, Write};
+
+use common::{bytes, c, out, Sdk, TempDir};
+use datenlord::sdk::c::datenlord::*;
+
+#[test]
+fn metrics_snapshot() {
+    // A free port, released for the sdk to bind
+    let port = std::net::TcpListener::bind("127.0.0.1:0").unwrap().local_addr().unwrap().port();
+    let config = serde_json::json!({ "metrics_addr": format!("127.0.0.1:{port}") }).to_string();
+    let sdk = Sdk::with_backend(TempDir::new("metrics"), serde_json::json!({ "type": "memory" }), &config);
+    let path = c("f.txt");
+    assert_eq!(create_file(sdk.ptr, path.as_ptr()), 0);
+    for _ in 0..100 {
+        assert_eq!(write_file(sdk.ptr, path.as_ptr(), bytes(b"abcd")), 0);
+    }
+    let mut stat = datenlord_file_stat::default();
+    assert_eq!(datenlord_stat(sdk.ptr, path.as_ptr(), &mut stat), 0);
+    assert_eq!(datenlord_stat(sdk.ptr, c("missing").as_ptr(), &mut stat), nix::libc::ENOENT);
+
+    // Too small a buffer returns the size needed
+    let mut buffer = datenlord_bytes {
+        data: std::ptr::null(),
+        len: 0,
+    };
+    assert_eq!(datenlord_metrics_snapshot(sdk.ptr, &mut buffer), nix::libc::EINVAL);
+    assert!(buffer.len > 0);
+    let mut storage = vec![0; buffer.len + 4096];
+    let mut buffer = out(&mut storage);
+    assert_eq!(datenlord_metrics_snapshot(sdk.ptr, &mut buffer), 0);
+    let snapshot: serde_json::Value = serde_json::from_slice(&storage[..buffer.len]).unwrap();
+    let write_file_op = &snapshot["ops"]["write_file"];
+    assert_eq!(write_file_op["calls"], 100);
+    assert_eq!(write_file_op["bytes"], 400);
+    assert_eq!(write_file_op["in_flight"], 0);
+    assert_eq!(snapshot["ops"]["pwrite"]["calls"], 100);
+    assert_eq!(snapshot["ops"]["stat"]["calls"], 2);
+    assert_eq!(snapshot["ops"]["stat"]["errors"], 1);
+    let latency = |quantile: &str| write_file_op["latency_us"][quantile].as_f64().unwrap();
+    assert!(latency("p50") > 0.0 && latency("p50") <= latency("p99") && latency("p99") <= latency("max"));
+    assert!(snapshot["attr_cache"]["hits"].as_u64().unwrap() > 0);
+
+    // The endpoint is served along with the daemon
+    let socket = sdk.root.join("daemon.sock").display().to_string();
+    assert_eq!(datenlord_serve(sdk.ptr, c(&socket).as_ptr()), 0);
+    let mut stream = (0..50)
+        .find_map(|_| {
+            std::net::TcpStream::connect(("127.0.0.1", port))
+                .map_err(|_| std::thread::sleep(std::time::Duration::from_millis(10)))
+                .ok()
+        })
+        .unwrap();
+    stream.write_all(b"GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n").unwrap();
+    let mut response = String::new();
+    stream.read_to_string(&mut response).unwrap();
+    assert!(response.starts_with("HTTP/1.1 200 OK"));
+    assert!(response.contains("datenlord_sdk_op_duration_seconds_count{op=\"write_file\"} 100"), "{response}");
+    assert!(response.contains("datenlord_sdk_op_duration_seconds_bucket{op=\"write_file\",le=\"+Inf\"} 100"));
+    assert!(response.contains("datenlord_sdk_op_errors_total{op=\"stat\"} 1"));
+    let minute = response
+        .lines()
+        .find(|line| line.starts_with("datenlord_sdk_op_duration_seconds_bucket{op=\"write_file\",le=\"60\"}"))
+        .unwrap();
+    assert!(minute.ends_with(" 100"), "{minute}");
+}
@@ -0,0 +1,57 @@
+//! Read-only file mappings
+
+mod common;
+
+use common::{bytes, c, pattern, Sdk, TempDir};
+use datenlord::sdk::c::datenlord::*;
+
+/// Map a range of a file and copy it out
+fn map(sdk: &Sdk, path: &str, offset: u64, len: usize) -> Result<Vec<u8>, i32> {
+    let mut mapping = datenlord_mapping {
+        data: std::ptr::null(),
+        len: 0,
+        inner: std::ptr::null_mut(),
+    };
+    match datenlord_mmap(sdk.ptr, c(path).as_ptr(), offset, len, &mut mapping) {
+        0 => {
+            let content = unsafe { std::slice::from_raw_parts(mapping.data, mapping.len) }.to_vec();
+            datenlord_munmap(&mut mapping);
+            Ok(content)
+        }
+        err => Err(err),
+    }
+}
+
+fn check_ranges(sdk: &Sdk) {
+    let data = pattern(20000);
+    assert_eq!(create_file(sdk.ptr, c("f").as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, c("f").as_ptr(), bytes(&data)), 0);
+    assert_eq!(map(sdk, "f", 5000, 0).unwrap(), &data[5000..]);
+    // Not aligned to a page
+    assert_eq!(map(sdk, "f", 4097, 10).unwrap(), &data[4097..4107]);
+    assert_eq!(map(sdk, "missing", 0, 0), Err(nix::libc::ENOENT));
+}
+
+#[test]
+fn map_local_files() {
+    check_ranges(&Sdk::local("mmap", "{}"));
+}
+
+#[test]
+fn map_copies_of_remote_files() {
+    let backend = serde_json::json!({ "type": "memory" });
+    check_ranges(&Sdk::with_backend(TempDir::new("mmap-memory"), backend, "{}"));
+}
+
+#[test]
+fn map_files_shrunk_behind_the_cache() {
+    let sdk = Sdk::local("mmap-shrunk", "{}");
+    let data = pattern(20000);
+    assert_eq!(create_file(sdk.ptr, c("f").as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, c("f").as_ptr(), bytes(&data)), 0);
+    assert_eq!(map(&sdk, "f", 0, 0).unwrap(), data);
+    // The cached size is stale, the mapping follows the file
+    std::fs::OpenOptions::new().write(true).open(sdk.root.join("f")).unwrap().set_len(100).unwrap();
+    assert_eq!(map(&sdk, "f", 0, 0).unwrap(), &data[..100]);
+    assert_eq!(map(&sdk, "f", 8192, 10).unwrap(), b"");
+}
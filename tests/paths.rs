@@ -0,0 +1,43 @@
+//! Path resolution through the dentry cache
+
+mod common;
+
+use common::{bytes, c, out, Sdk};
+use datenlord::sdk::c::datenlord::*;
+
+#[test]
+fn deep_paths() {
+    let sdk = Sdk::local("paths", "{}");
+    assert_eq!(datenlord_mkdir(sdk.ptr, c("/tree").as_ptr()), 0);
+    assert_eq!(datenlord_mkdir(sdk.ptr, c("/tree/a").as_ptr()), 0);
+    assert_eq!(datenlord_mkdir(sdk.ptr, c("/tree/a/b").as_ptr()), 0);
+    assert_eq!(create_file(sdk.ptr, c("/tree/a/b/f.txt").as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, c("/tree/a/b/f.txt").as_ptr(), bytes(b"deep")), 0);
+    assert!(exists(sdk.ptr, c("/tree/a/b/f.txt").as_ptr()));
+    assert!(exists(sdk.ptr, c("tree/./a/../a/b/f.txt").as_ptr()));
+    assert!(!exists(sdk.ptr, c("/tree/a/b/f.txt/x").as_ptr()));
+
+    // The cached dentries below a renamed directory stay valid
+    assert_eq!(rename_path(sdk.ptr, c("/tree").as_ptr(), c("/moved").as_ptr()), 0);
+    assert!(!exists(sdk.ptr, c("/tree/a/b/f.txt").as_ptr()));
+    let mut buffer = [0; 8];
+    let mut content = out(&mut buffer);
+    assert_eq!(read_file(sdk.ptr, c("/moved/a/b/f.txt").as_ptr(), &mut content), 0);
+    assert_eq!(&buffer[..content.len], b"deep");
+    assert!(sdk.root.join("moved/a/b/f.txt").is_file());
+
+    std::fs::remove_file(sdk.root.join("moved/a/b/f.txt")).unwrap();
+    assert_eq!(deldir(sdk.ptr, c("/moved/a/b").as_ptr(), false), 0);
+    assert!(!exists(sdk.ptr, c("/moved/a/b").as_ptr()));
+}
+
+#[test]
+fn libc_mkdir_is_not_shadowed() {
+    let sdk = Sdk::local("libc-mkdir", "{}");
+    // Calls the libc mkdir, which an sdk export of the same name used to replace
+    std::fs::create_dir_all(sdk.root.join("a/b")).unwrap();
+    let mut stat = datenlord_file_stat::default();
+    assert_eq!(datenlord_stat(sdk.ptr, c("a/b").as_ptr(), &mut stat), 0);
+    assert_eq!(datenlord_mkdir(sdk.ptr, c("a/b/c").as_ptr()), 0);
+    assert!(sdk.root.join("a/b/c").is_dir());
+}
@@ -0,0 +1,49 @@
+//! Sequential reads served by the blocks read ahead
+
+mod common;
+
+use common::{bytes, c, out, pattern, Sdk};
+use datenlord::sdk::c::datenlord::*;
+
+const CONFIG: &str = r#"{"block_cache_bytes": 1048576, "block_size": 4096, "readahead_max_bytes": 65536}"#;
+
+/// Read a file sequentially in small reads
+fn read_sequentially(sdk: &Sdk, path: &str, len: usize) -> Vec<u8> {
+    let path = c(path);
+    let mut content = Vec::new();
+    let mut buffer = vec![0; 3000];
+    while content.len() < len {
+        let mut read = out(&mut buffer);
+        assert_eq!(read_file_at(sdk.ptr, path.as_ptr(), content.len() as u64, &mut read), 0);
+        assert!(read.len > 0);
+        content.extend_from_slice(&buffer[..read.len]);
+        std::thread::sleep(std::time::Duration::from_millis(1));
+    }
+    content
+}
+
+#[test]
+fn prefetched_reads() {
+    let sdk = Sdk::local("readahead", CONFIG);
+    let data = pattern(200000);
+    assert_eq!(create_file(sdk.ptr, c("f").as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, c("f").as_ptr(), bytes(&data)), 0);
+    assert_eq!(read_sequentially(&sdk, "f", data.len()), data);
+    let mut stats = datenlord_cache_stats::default();
+    assert_eq!(datenlord_get_cache_stats(sdk.ptr, &mut stats), 0);
+    assert!(stats.misses < 10, "{} hits, {} misses", stats.hits, stats.misses);
+}
+
+#[test]
+fn writes_drop_the_blocks_read_ahead() {
+    let sdk = Sdk::local("readahead-write", CONFIG);
+    let data = pattern(100000);
+    assert_eq!(create_file(sdk.ptr, c("f").as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, c("f").as_ptr(), bytes(&data)), 0);
+    for round in 0..5 {
+        // Overwrite while the blocks of the last round are still read ahead
+        let data = vec![round; data.len()];
+        assert_eq!(write_file(sdk.ptr, c("f").as_ptr(), bytes(&data)), 0);
+        assert_eq!(read_sequentially(&sdk, "f", data.len()), data);
+    }
+}
@@ -0,0 +1,58 @@
+//! Copies within the backend and renames over existing files
+
+mod common;
+
+use common::{bytes, c, out, pattern, Sdk, TempDir};
+use datenlord::sdk::c::datenlord::*;
+
+/// Read a whole file through the sdk
+fn read(sdk: &Sdk, path: &str) -> Vec<u8> {
+    let mut buffer = vec![0; 400000];
+    let mut content = out(&mut buffer);
+    assert_eq!(read_file(sdk.ptr, c(path).as_ptr(), &mut content), 0);
+    buffer.truncate(content.len);
+    buffer
+}
+
+fn put(sdk: &Sdk, path: &str, data: &[u8]) {
+    assert_eq!(create_file(sdk.ptr, c(path).as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, c(path).as_ptr(), bytes(data)), 0);
+}
+
+fn check(sdk: &Sdk) {
+    let data = pattern(300000);
+    assert_eq!(datenlord_mkdir(sdk.ptr, c("sub").as_ptr()), 0);
+    put(sdk, "src", &data);
+    put(sdk, "sub/old", b"old content");
+    // Warm the caches of the replaced file
+    assert_eq!(read(sdk, "sub/old"), b"old content");
+
+    assert_eq!(datenlord_copy(sdk.ptr, c("src").as_ptr(), c("sub/new").as_ptr()), 0);
+    assert_eq!(datenlord_copy(sdk.ptr, c("src").as_ptr(), c("sub/old").as_ptr()), 0);
+    assert_ne!(datenlord_copy(sdk.ptr, c("sub").as_ptr(), c("x").as_ptr()), 0);
+    assert_eq!(datenlord_copy(sdk.ptr, c("missing").as_ptr(), c("x").as_ptr()), nix::libc::ENOENT);
+    assert_eq!(read(sdk, "sub/new"), data);
+    assert_eq!(read(sdk, "sub/old"), data);
+    let mut stat = datenlord_file_stat::default();
+    assert_eq!(datenlord_stat(sdk.ptr, c("sub/old").as_ptr(), &mut stat), 0);
+    assert_eq!(stat.size, data.len() as u64);
+
+    // Publish through a temporary file
+    put(sdk, "tmp", b"published");
+    assert_eq!(rename_path(sdk.ptr, c("tmp").as_ptr(), c("sub/new").as_ptr()), 0);
+    assert_eq!(read(sdk, "sub/new"), b"published");
+    assert!(!exists(sdk.ptr, c("tmp").as_ptr()));
+}
+
+#[test]
+fn copy_local_files() {
+    let sdk = Sdk::local("server-copy", "{}");
+    check(&sdk);
+    assert_eq!(std::fs::read(sdk.root.join("sub/old")).unwrap(), pattern(300000));
+}
+
+#[test]
+fn copy_remote_files() {
+    let backend = serde_json::json!({ "type": "memory" });
+    check(&Sdk::with_backend(TempDir::new("server-copy-memory"), backend, r#"{"copy_chunk_size": 65536}"#));
+}
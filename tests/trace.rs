@@ -0,0 +1,21 @@
+//! Calls traced at debug level
+
+mod common;
+
+use common::{bytes, c, Sdk};
+use datenlord::sdk::c::datenlord::*;
+
+#[test]
+fn traced_calls() {
+    let sdk = Sdk::local("trace", r#"{"log_level": "debug", "trace_sample_rate": 0.5}"#);
+    let path = c("f.txt");
+    assert_eq!(create_file(sdk.ptr, path.as_ptr()), 0);
+    for _ in 0..4 {
+        assert_eq!(write_file(sdk.ptr, path.as_ptr(), bytes(b"abc")), 0);
+    }
+    let mut stat = datenlord_file_stat::default();
+    assert_eq!(datenlord_stat(sdk.ptr, path.as_ptr(), &mut stat), 0);
+    assert_eq!(stat.size, 3);
+    // Failed calls are traced too
+    assert_eq!(datenlord_stat(sdk.ptr, c("missing").as_ptr(), &mut stat), nix::libc::ENOENT);
+}
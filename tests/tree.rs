@@ -0,0 +1,64 @@
+//! Recursive copies and removals of directory trees
+
+mod common;
+
+use common::{c, Sdk};
+use datenlord::sdk::c::datenlord::*;
+
+/// Write a tree behind the sdk, so none of its inodes were looked up
+fn write_tree(sdk: &Sdk, root: &str) {
+    std::fs::create_dir_all(sdk.root.join(&format!("{root}/a/b"))).unwrap();
+    std::fs::create_dir(sdk.root.join(&format!("{root}/empty"))).unwrap();
+    for i in 0..2500 {
+        std::fs::write(sdk.root.join(&format!("{root}/f{i}")), format!("file {i}")).unwrap();
+    }
+    for i in 0..50 {
+        std::fs::write(sdk.root.join(&format!("{root}/a/b/g{i}")), vec![i as u8; 100000 + i]).unwrap();
+    }
+}
+
+fn check_tree(sdk: &Sdk, root: &str) {
+    for i in 0..2500 {
+        let content = std::fs::read(sdk.root.join(&format!("{root}/f{i}"))).unwrap();
+        assert_eq!(content, format!("file {i}").into_bytes());
+    }
+    for i in 0..50 {
+        let content = std::fs::read(sdk.root.join(&format!("{root}/a/b/g{i}"))).unwrap();
+        assert_eq!(content, vec![i as u8; 100000 + i]);
+    }
+    assert!(sdk.root.join(&format!("{root}/empty")).is_dir());
+}
+
+#[test]
+fn copy_and_remove_tree() {
+    let sdk = Sdk::local("tree", "{}");
+    assert_eq!(datenlord_mkdir(sdk.ptr, c("tree").as_ptr()), 0);
+    assert_eq!(datenlord_mkdir(sdk.ptr, c("tree/a").as_ptr()), 0);
+    write_tree(&sdk, "tree");
+
+    // Not a directory, a copy into itself, an existing destination
+    assert_ne!(datenlord_copy_tree(sdk.ptr, c("tree/f0").as_ptr(), c("x").as_ptr()), 0);
+    assert_ne!(datenlord_copy_tree(sdk.ptr, c("tree").as_ptr(), c("tree/a/copy").as_ptr()), 0);
+    assert_ne!(datenlord_copy_tree(sdk.ptr, c("tree/a").as_ptr(), c("tree/empty").as_ptr()), 0);
+    assert_eq!(datenlord_copy_tree(sdk.ptr, c("tree").as_ptr(), c("copy").as_ptr()), 0);
+    check_tree(&sdk, "copy");
+
+    assert_ne!(deldir(sdk.ptr, c("tree").as_ptr(), false), 0);
+    assert_ne!(deldir(sdk.ptr, c("tree/f1").as_ptr(), true), 0);
+    assert_eq!(deldir(sdk.ptr, c("tree").as_ptr(), true), 0);
+    assert_eq!(deldir(sdk.ptr, c("copy").as_ptr(), true), 0);
+    assert!(!sdk.root.join("tree").exists());
+    assert!(!sdk.root.join("copy").exists());
+    let mut stat = datenlord_file_stat::default();
+    assert_eq!(datenlord_stat(sdk.ptr, c("tree").as_ptr(), &mut stat), nix::libc::ENOENT);
+}
+
+#[test]
+fn trees_written_behind_the_sdk() {
+    let sdk = Sdk::local("tree-outside", "{}");
+    write_tree(&sdk, "outside");
+    assert_eq!(datenlord_copy_tree(sdk.ptr, c("outside").as_ptr(), c("copy").as_ptr()), 0);
+    check_tree(&sdk, "copy");
+    assert_eq!(deldir(sdk.ptr, c("outside").as_ptr(), true), 0);
+    assert!(!sdk.root.join("outside").exists());
+}
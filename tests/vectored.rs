@@ -0,0 +1,75 @@
+//! Vectored reads and writes
+
+mod common;
+
+use common::{c, Sdk};
+use datenlord::sdk::c::datenlord::*;
+use nix::libc;
+
+#[test]
+fn segments() {
+    let sdk = Sdk::local("vectored", "{}");
+    let path = c("f");
+    assert_eq!(create_file(sdk.ptr, path.as_ptr()), 0);
+    let mut file = std::ptr::null_mut();
+    assert_eq!(datenlord_open(sdk.ptr, path.as_ptr(), (libc::O_WRONLY | libc::O_TRUNC) as u32, &mut file), 0);
+    let parts: Vec<Vec<u8>> = (0..10).map(|i| vec![i; 1000]).collect();
+    // Adjacent segments out of order are merged
+    let order = [3, 0, 1, 9, 2, 4, 8, 5, 7, 6];
+    let iov: Vec<datenlord_iovec> = order
+        .iter()
+        .map(|&i| datenlord_iovec {
+            offset: i as u64 * 1000,
+            buf: datenlord_bytes {
+                data: parts[i].as_ptr(),
+                len: 1000,
+            },
+        })
+        .collect();
+    assert_eq!(datenlord_pwritev(sdk.ptr, file, iov.as_ptr(), iov.len()), 0);
+    assert_eq!(datenlord_close(sdk.ptr, file), 0);
+    assert_eq!(std::fs::read(sdk.root.join("f")).unwrap(), parts.concat());
+
+    assert_eq!(datenlord_open(sdk.ptr, path.as_ptr(), libc::O_RDONLY as u32, &mut file), 0);
+    let mut buffers = vec![vec![0; 10]; 4];
+    let offsets = [9995, 0, 5000, 20000];
+    let mut iov: Vec<datenlord_iovec> = buffers
+        .iter_mut()
+        .zip(offsets)
+        .map(|(buffer, offset)| datenlord_iovec {
+            offset,
+            buf: datenlord_bytes {
+                data: buffer.as_mut_ptr(),
+                len: 10,
+            },
+        })
+        .collect();
+    assert_eq!(datenlord_preadv(sdk.ptr, file, iov.as_mut_ptr(), iov.len()), 0);
+    let sizes: Vec<usize> = iov.iter().map(|segment| segment.buf.len).collect();
+    assert_eq!(sizes, [5, 10, 10, 0]);
+    assert_eq!(&buffers[0][..5], &[9; 5]);
+    assert_eq!(&buffers[1][..], &[0; 10]);
+    assert_eq!(&buffers[2][..], &[5; 10]);
+    assert_eq!(datenlord_close(sdk.ptr, file), 0);
+}
+
+#[test]
+fn empty_segments() {
+    let sdk = Sdk::local("vectored-empty", "{}");
+    assert_eq!(create_file(sdk.ptr, c("f").as_ptr()), 0);
+    let mut file = std::ptr::null_mut();
+    assert_eq!(datenlord_open(sdk.ptr, c("f").as_ptr(), libc::O_RDWR as u32, &mut file), 0);
+    let iov = [datenlord_iovec {
+        offset: 0,
+        buf: datenlord_bytes {
+            data: std::ptr::null(),
+            len: 0,
+        },
+    }];
+    assert_eq!(datenlord_pwritev(sdk.ptr, file, iov.as_ptr(), 1), 0);
+    assert_eq!(datenlord_pwritev(sdk.ptr, file, std::ptr::null(), 0), 0);
+    let mut iov = iov;
+    iov[0].buf.len = 1;
+    assert_eq!(datenlord_pwritev(sdk.ptr, file, iov.as_ptr(), 1), libc::EINVAL);
+    assert_eq!(datenlord_close(sdk.ptr, file), 0);
+}
@@ -0,0 +1,93 @@
+//! Writes buffered by write-back
+
+mod common;
+
+use common::{bytes, c, out, Sdk};
+use datenlord::sdk::c::datenlord::*;
+use nix::libc;
+
+const CONFIG: &str = r#"{"write_back_extent_bytes": 65536, "write_back_max_bytes": 100000}"#;
+
+#[test]
+fn coalesced_appends() {
+    let sdk = Sdk::local("write-back", CONFIG);
+    let path = c("f");
+    assert_eq!(create_file(sdk.ptr, path.as_ptr()), 0);
+    let mut file = std::ptr::null_mut();
+    assert_eq!(datenlord_open(sdk.ptr, path.as_ptr(), (libc::O_WRONLY | libc::O_TRUNC) as u32, &mut file), 0);
+    // Five times the budget in small appends
+    let mut expected = Vec::new();
+    for i in 0..2500 {
+        let record = vec![(i % 256) as u8; 200];
+        assert_eq!(datenlord_pwrite(sdk.ptr, file, expected.len() as u64, bytes(&record)), 0);
+        expected.extend_from_slice(&record);
+    }
+    assert_eq!(datenlord_fsync(sdk.ptr, file), 0);
+    assert_eq!(std::fs::read(sdk.root.join("f")).unwrap(), expected);
+
+    assert_eq!(datenlord_pwrite(sdk.ptr, file, 10, bytes(b"xyz")), 0);
+    expected[10..13].copy_from_slice(b"xyz");
+    assert_eq!(datenlord_close(sdk.ptr, file), 0);
+    let mut buffer = vec![0; expected.len() + 10];
+    let mut content = out(&mut buffer);
+    assert_eq!(read_file(sdk.ptr, path.as_ptr(), &mut content), 0);
+    assert_eq!(&buffer[..content.len], &expected[..]);
+}
+
+#[test]
+fn reads_see_the_buffered_writes() {
+    let sdk = Sdk::local("write-back-read", CONFIG);
+    assert_eq!(create_file(sdk.ptr, c("f").as_ptr()), 0);
+    let mut file = std::ptr::null_mut();
+    assert_eq!(datenlord_open(sdk.ptr, c("f").as_ptr(), libc::O_RDWR as u32, &mut file), 0);
+    assert_eq!(datenlord_pwrite(sdk.ptr, file, 0, bytes(b"buffered")), 0);
+    let mut buffer = [0; 16];
+    let mut read = out(&mut buffer);
+    assert_eq!(datenlord_pread(sdk.ptr, file, 0, &mut read), 0);
+    assert_eq!(&buffer[..read.len], b"buffered");
+    assert_eq!(datenlord_close(sdk.ptr, file), 0);
+}
+
+#[test]
+fn other_handles_see_the_landed_writes() {
+    let config = r#"{"write_back_extent_bytes": 65536, "write_back_max_bytes": 100000, "block_cache_bytes": 65536, "block_size": 4096}"#;
+    let sdk = Sdk::local("write-back-handles", config);
+    let path = c("f");
+    assert_eq!(create_file(sdk.ptr, path.as_ptr()), 0);
+    assert_eq!(write_file(sdk.ptr, path.as_ptr(), bytes(b"old data")), 0);
+    let (mut writer, mut reader) = (std::ptr::null_mut(), std::ptr::null_mut());
+    assert_eq!(datenlord_open(sdk.ptr, path.as_ptr(), libc::O_WRONLY as u32, &mut writer), 0);
+    assert_eq!(datenlord_open(sdk.ptr, path.as_ptr(), libc::O_RDONLY as u32, &mut reader), 0);
+
+    // Read, and cached, by the other handle while the write is buffered
+    assert_eq!(datenlord_pwrite(sdk.ptr, writer, 0, bytes(b"new")), 0);
+    let mut buffer = [0; 16];
+    let mut read = out(&mut buffer);
+    assert_eq!(datenlord_pread(sdk.ptr, reader, 0, &mut read), 0);
+    assert_eq!(datenlord_fsync(sdk.ptr, writer), 0);
+
+    // Once the write lands the stale block is gone
+    let mut read = out(&mut buffer);
+    assert_eq!(datenlord_pread(sdk.ptr, reader, 0, &mut read), 0);
+    assert_eq!(&buffer[..read.len], b"new data");
+    let mut read = out(&mut buffer);
+    assert_eq!(read_file(sdk.ptr, path.as_ptr(), &mut read), 0);
+    assert_eq!(&buffer[..read.len], b"new data");
+    assert_eq!(datenlord_close(sdk.ptr, reader), 0);
+    assert_eq!(datenlord_close(sdk.ptr, writer), 0);
+}
+
+#[test]
+fn errors_are_returned_by_the_barrier() {
+    let sdk = Sdk::local("write-back-error", CONFIG);
+    assert_eq!(create_file(sdk.ptr, c("f").as_ptr()), 0);
+    let mut file = std::ptr::null_mut();
+    assert_eq!(datenlord_open(sdk.ptr, c("f").as_ptr(), libc::O_WRONLY as u32, &mut file), 0);
+    // Removed behind the sdk, the background write fails to open it
+    std::fs::remove_file(sdk.root.join("f")).unwrap();
+    assert_eq!(datenlord_pwrite(sdk.ptr, file, 0, bytes(b"lost")), 0);
+    assert_eq!(datenlord_fsync(sdk.ptr, file), libc::ENOENT);
+    // The error is returned once
+    assert_eq!(datenlord_fsync(sdk.ptr, file), 0);
+    datenlord_close(sdk.ptr, file);
+}